@@ -0,0 +1,620 @@
+/**
+ * EC800K DFOTA 测试工具 - 基准测试
+ *
+ * 无需真实模组：每个模拟模组是一对伪终端，后台线程在主端按可配置延时应答
+ * AT、AT+QGMR、AT+CSQ、AT+CREG?等命令，收到AT+QFOTADL后按固定间隔回放
+ * README中的+QIND: "FOTA",...上报序列。被测代码直接包含ec800k_dfota_test.c，
+ * 与正式工具走同一套串口/AT/批量升级实现。
+ *
+ * 输出:
+ *   1. 单模组AT事务吞吐（事务/秒）与延迟p50/p99，逐条与拼接批处理两种方式
+ *   2. 批量升级扩展曲线：1..N个模组完成整个FOTA流程的用时与加速比
+ *   3. 回放解析：按EC800K R07A04/R07A09会话合成的收发记录经replay引擎回放，
+ *      核对解析结果并报告行/秒与每行耗时
+ *
+ * 编译运行: make bench
+ *           ./ec800k_bench [事务数] [最大模组数] [URC间隔ms]
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE     // posix_openpt/ptsname
+#endif
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1     // 去掉逐条收发跟踪，避免日志本身成为瓶颈
+#endif
+#define EC800K_NO_MAIN
+#include "ec800k_dfota_test.c"
+
+#ifdef _WIN32
+#error "基准测试依赖POSIX伪终端，仅支持Linux/macOS"
+#endif
+
+#define BENCH_DEFAULT_TRANSACTIONS 2000
+#define BENCH_DEFAULT_FLEET_MAX 16
+#define BENCH_DEFAULT_URC_STEP_MS 20
+#define BENCH_LOG_FILE "ec800k_bench.log"
+#define BENCH_TRACE_FILE "ec800k_bench.trace"
+#define BENCH_REPLAY_ROUNDS 20000
+
+// ================== 模拟模组 ==================
+
+// README中的升级流程URC，相邻两条间隔urc_step_ms
+const char* FAKE_FOTA_URCS[] = {
+    "+QIND: \"FOTA\",\"HTTPSTART\"",
+    "+QIND: \"FOTA\",\"HTTPEND\",0",
+    "+QIND: \"FOTA\",\"START\"",
+    "+QIND: \"FOTA\",\"UPDATING\",7",
+    "+QIND: \"FOTA\",\"UPDATING\",47",
+    "+QIND: \"FOTA\",\"UPDATING\",60",
+    "+QIND: \"FOTA\",\"UPDATING\",96",
+    "+QIND: \"FOTA\",\"END\",0",
+};
+#define FAKE_FOTA_URC_COUNT ((int)(sizeof(FAKE_FOTA_URCS) / sizeof(FAKE_FOTA_URCS[0])))
+
+typedef struct {
+    int master;
+    int slave;              // 自身保持从端打开，工具关闭串口时主端不会收到挂断
+    char path[64];
+    int index;
+    volatile int delay_us;  // 每条命令的应答延时
+    int urc_step_ms;
+    volatile bool stop;
+    thread_t thread;
+    
+    int urc_next;           // 下一条待回放的URC，-1表示无
+    uint64_t urc_at_ms;
+    char line[512];
+    size_t line_len;
+} FakeModem;
+
+void fake_write(FakeModem* fm, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fm->master, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = { fm->master, POLLOUT, 0 };
+                poll(&pfd, 1, 10);
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// 单条命令的信息行（不含结果码），返回是否为升级指令
+bool fake_answer(FakeModem* fm, const char* cmd, char* out, size_t size, size_t* len) {
+    const char* info = NULL;
+    char imei[32];
+    
+    if (strcmp(cmd, "AT+QGMR") == 0) {
+        info = "EC800KCNLCR07A04M04V02";
+    } else if (strcmp(cmd, "AT+GSN") == 0) {
+        snprintf(imei, sizeof(imei), "8612345678%05d", fm->index);
+        info = imei;
+    } else if (strcmp(cmd, "AT+CSQ") == 0) {
+        info = "+CSQ: 24,99";
+    } else if (strcmp(cmd, "AT+CREG?") == 0) {
+        info = "+CREG: 2,1";
+    } else if (strcmp(cmd, "AT+CEREG?") == 0) {
+        info = "+CEREG: 2,1";
+    } else if (strcmp(cmd, "AT+CPIN?") == 0) {
+        info = "+CPIN: READY";
+    } else if (strcmp(cmd, "AT+CGATT?") == 0) {
+        info = "+CGATT: 1";
+    } else if (strcmp(cmd, "AT+QIACT?") == 0) {
+        info = "+QIACT: 1,1,1,\"10.0.0.2\"";
+    }
+    if (info != NULL) {
+        *len += (size_t)snprintf(out + *len, size - *len, "\r\n%s\r\n", info);
+    }
+    return strncmp(cmd, "AT+QFOTADL=", 11) == 0;
+}
+
+// 应答一行命令（支持分号拼接），其余命令一律OK
+void fake_handle_line(FakeModem* fm, char* line) {
+    char out[1024];
+    size_t len = 0;
+    bool fota = false;
+    char cmd[512];
+    
+    if (strncmp(line, "AT", 2) != 0 && strncmp(line, "at", 2) != 0) return;
+    
+    int delay = fm->delay_us;
+    if (delay > 0) {
+        struct timespec ts = { delay / 1000000, (long)(delay % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+    
+    // 回显（ATE1）
+    len += (size_t)snprintf(out, sizeof(out), "%s\r", line);
+    
+    char* p = line;
+    bool first = true;
+    while (*p != '\0') {
+        size_t n = strcspn(p, ";");
+        // 拼接中的后续命令省略了"AT"前缀
+        snprintf(cmd, sizeof(cmd), "%s%.*s", first ? "" : "AT", (int)n, p);
+        fota |= fake_answer(fm, cmd, out, sizeof(out), &len);
+        p += n;
+        if (*p == ';') p++;
+        first = false;
+    }
+    len += (size_t)snprintf(out + len, sizeof(out) - len, "\r\nOK\r\n");
+    fake_write(fm, out, len);
+    
+    if (fota) {
+        fm->urc_next = 0;
+        fm->urc_at_ms = monotonic_ms() + (uint64_t)fm->urc_step_ms;
+    }
+}
+
+THREAD_RETURN fake_modem_thread(void* arg) {
+    FakeModem* fm = (FakeModem*)arg;
+    char buf[4096];
+    
+    while (!fm->stop) {
+        int wait = 50;
+        if (fm->urc_next >= 0) {
+            wait = remaining_ms(fm->urc_at_ms);
+            if (wait == 0) {
+                char urc[128];
+                int n = snprintf(urc, sizeof(urc), "\r\n%s\r\n", FAKE_FOTA_URCS[fm->urc_next]);
+                fake_write(fm, urc, (size_t)n);
+                fm->urc_next = fm->urc_next + 1 < FAKE_FOTA_URC_COUNT ? fm->urc_next + 1 : -1;
+                fm->urc_at_ms += (uint64_t)fm->urc_step_ms;
+                continue;
+            }
+            if (wait > 50) wait = 50;
+        }
+    
+        struct pollfd pfd = { fm->master, POLLIN, 0 };
+        if (poll(&pfd, 1, wait) <= 0 || !(pfd.revents & POLLIN)) continue;
+        ssize_t n = read(fm->master, buf, sizeof(buf));
+        if (n <= 0) continue;
+    
+        for (ssize_t i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c == '\r' || c == '\n') {
+                if (fm->line_len > 0) {
+                    fm->line[fm->line_len] = '\0';
+                    fake_handle_line(fm, fm->line);
+                    fm->line_len = 0;
+                }
+            } else if (fm->line_len < sizeof(fm->line) - 1) {
+                fm->line[fm->line_len++] = c;
+            }
+        }
+    }
+    return THREAD_RESULT;
+}
+
+bool fake_modem_start(FakeModem* fm, int index, int delay_us, int urc_step_ms) {
+    memset(fm, 0, sizeof(*fm));
+    fm->index = index;
+    fm->delay_us = delay_us;
+    fm->urc_step_ms = urc_step_ms;
+    fm->urc_next = -1;
+    
+    fm->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fm->master < 0 || grantpt(fm->master) != 0 || unlockpt(fm->master) != 0 ||
+        ptsname(fm->master) == NULL) {
+        if (fm->master >= 0) close(fm->master);
+        return false;
+    }
+    snprintf(fm->path, sizeof(fm->path), "%s", ptsname(fm->master));
+    fcntl(fm->master, F_SETFL, fcntl(fm->master, F_GETFL) | O_NONBLOCK);
+    
+    fm->slave = open(fm->path, O_RDWR | O_NOCTTY);
+    if (fm->slave >= 0) {
+        struct termios tio;
+        tcgetattr(fm->slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(fm->slave, TCSANOW, &tio);
+    }
+    
+    if (!thread_create(&fm->thread, fake_modem_thread, fm)) {
+        close(fm->master);
+        if (fm->slave >= 0) close(fm->slave);
+        return false;
+    }
+    return true;
+}
+
+void fake_modem_stop(FakeModem* fm) {
+    fm->stop = true;
+    thread_join(fm->thread);
+    close(fm->master);
+    if (fm->slave >= 0) close(fm->slave);
+}
+
+// ================== 统计 ==================
+
+int bench_compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// 排序后的样本第q分位（最近秩）
+uint64_t bench_percentile(const uint64_t* sorted, int count, double q) {
+    int rank = (int)(q * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+// ================== 测试项 ==================
+
+const char* BENCH_COMMANDS[] = { "AT", "AT+QGMR", "AT+CSQ", "AT+CREG?" };
+#define BENCH_COMMAND_COUNT ((int)(sizeof(BENCH_COMMANDS) / sizeof(BENCH_COMMANDS[0])))
+#define BENCH_WARMUP (BENCH_COMMAND_COUNT * 4)     // 每种延时下预热的事务数
+
+typedef struct {
+    double per_second;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+    int errors;
+} BenchResult;
+
+// 逐条事务：轮流发送四条查询命令
+BenchResult bench_transactions(EC800KModem* modem, int count, uint64_t* samples) {
+    BenchResult r;
+    AtResponse resp;
+    memset(&r, 0, sizeof(r));
+    
+    uint64_t start = monotonic_us();
+    for (int i = 0; i < count; i++) {
+        uint64_t t0 = monotonic_us();
+        if (!modem_at_transact(modem, BENCH_COMMANDS[i % BENCH_COMMAND_COUNT], &resp, AT_TIMEOUT_POLICY)) {
+            r.errors++;
+        }
+        samples[i] = monotonic_us() - t0;
+    }
+    uint64_t total = monotonic_us() - start;
+    
+    qsort(samples, (size_t)count, sizeof(samples[0]), bench_compare_u64);
+    r.per_second = total > 0 ? (double)count * 1e6 / (double)total : 0;
+    r.p50_us = bench_percentile(samples, count, 0.50);
+    r.p99_us = bench_percentile(samples, count, 0.99);
+    r.max_us = samples[count - 1];
+    return r;
+}
+
+// 批处理：四条命令一次拼接下发，按命令数折算事务/秒
+BenchResult bench_batches(EC800KModem* modem, int count, uint64_t* samples) {
+    BenchResult r;
+    memset(&r, 0, sizeof(r));
+    int batches = count / BENCH_COMMAND_COUNT > 0 ? count / BENCH_COMMAND_COUNT : 1;
+    
+    uint64_t start = monotonic_us();
+    for (int i = 0; i < batches; i++) {
+        AtBatch batch;
+        at_batch_init(&batch);
+        for (int c = 0; c < BENCH_COMMAND_COUNT; c++) {
+            at_batch_add(&batch, BENCH_COMMANDS[c], NULL);
+        }
+        uint64_t t0 = monotonic_us();
+        if (!modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY)) r.errors++;
+        samples[i] = monotonic_us() - t0;
+    }
+    uint64_t total = monotonic_us() - start;
+    
+    qsort(samples, (size_t)batches, sizeof(samples[0]), bench_compare_u64);
+    r.per_second = total > 0 ? (double)batches * BENCH_COMMAND_COUNT * 1e6 / (double)total : 0;
+    r.p50_us = bench_percentile(samples, batches, 0.50);
+    r.p99_us = bench_percentile(samples, batches, 0.99);
+    r.max_us = samples[batches - 1];
+    return r;
+}
+
+// 批量升级：n个模拟模组完成整个FOTA流程的墙钟时间（毫秒），失败返回0
+uint64_t bench_fleet(int n, int urc_step_ms, int* failures) {
+    FakeModem* fakes = (FakeModem*)calloc((size_t)n, sizeof(FakeModem));
+    size_t ports_size = (size_t)n * 64;
+    char* ports = (char*)malloc(ports_size);
+    ToolOptions opts;
+    FotaPackageSet packages;
+    int started = 0;
+    uint64_t elapsed = 0;
+    
+    if (fakes == NULL || ports == NULL) goto out;
+    ports[0] = '\0';
+    for (; started < n; started++) {
+        if (!fake_modem_start(&fakes[started], started, 0, urc_step_ms)) goto out;
+        size_t len = strlen(ports);
+        snprintf(ports + len, ports_size - len, "%s%s", started > 0 ? "," : "", fakes[started].path);
+    }
+    
+    tool_options_init(&opts);
+    opts.max_downloads = 0;     // 测量编排本身的开销，不限同时下载数
+    packages.count = 0;
+    fota_package_set_add(&packages, "http://bench.local/fota.bin");
+    uint64_t start = monotonic_ms();
+    *failures = run_fleet(ports, &packages, 0, 50, n, &opts);
+    elapsed = monotonic_ms() - start;
+    
+out:
+    for (int i = 0; i < started; i++) {
+        fake_modem_stop(&fakes[i]);
+    }
+    free(ports);
+    free(fakes);
+    return elapsed;
+}
+
+// ================== 回放会话 ==================
+
+// 合成的收发记录：'T'为一次写入，'R'为一次读取，分块方式即固件实际的输出方式
+typedef struct {
+    char dir;
+    const char* data;
+} BenchTraceStep;
+
+// R07A04：回显打开，回显行以\r\r\n结束；信息行与URC被拆到两次读取中，
+// +QIND紧随OK同批到达，首次下载遇到+CME ERROR: 703后重试，升级结束后重启
+const BenchTraceStep BENCH_SESSION_R07A04[] = {
+    { 'T', "AT\r\n" },
+    { 'R', "AT\r\r\nOK\r\n" },
+    { 'T', "AT+QGMR;+GSN;+QCCID\r\n" },
+    { 'R', "AT+QGMR;+GSN;+QCCID\r\r\nEC800KCNLCR07A04M04V02\r\n\r\n861234567890123\r\n\r\n+QCC" },
+    { 'R', "ID: 89860012345678901234\r\n\r\nOK\r\n" },
+    { 'T', "AT+CSQ\r\n" },
+    { 'R', "AT+CSQ\r\r\n+CS" },
+    { 'R', "Q: 24,99\r\n\r\nOK\r\n" },
+    { 'T', "AT+CREG?\r\n" },
+    { 'R', "AT+CREG?\r\r\n+CREG: 2,1,\"5A1F\",\"0C3D2E01\",7\r\n\r\nOK\r\n" },
+    { 'T', "AT+QFOTADL=\"http://fota.local/EC800KCNLCR07A04M04V02-EC800KCNLCR07A09M04V02.bin\",1,50\r\n" },
+    { 'R', "AT+QFOTADL=\"http://fota.local/EC800KCNLCR07A04M04V02-EC800KCNLCR07A09M04V02.bin\",1,50\r\r\n" },
+    { 'R', "+CME ERROR: 703\r\n" },
+    { 'T', "AT+QFOTADL=\"http://fota.local/EC800KCNLCR07A04M04V02-EC800KCNLCR07A09M04V02.bin\",1,50\r\n" },
+    { 'R', "AT+QFOTADL=\"http://fota.local/EC800KCNLCR07A04M04V02-EC800KCNLCR07A09M04V02.bin\",1,50\r\r\n"
+           "OK\r\n\r\n+QIND: \"FOTA\",\"HTTPSTART\"\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"DOWNLOADING\",36\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"HTTPEND\",0\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"START\"\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"UPD" },
+    { 'R', "ATING\",47\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"UPDATING\",96\r\n\r\n+QIND: \"FOTA\",\"END\",0\r\n" },
+    { 'R', "\r\nRDY\r\n" },
+};
+
+// R07A09：回显关闭；首条AT无应答（模组尚在启动）；AT+CSQ的应答中插入+CEREG上报；
+// HTTP读取进入数据模式，载荷中的"OK"不得结束事务；下载完成但升级以504失败
+const BenchTraceStep BENCH_SESSION_R07A09[] = {
+    { 'T', "AT\r\n" },
+    { 'T', "AT\r\n" },
+    { 'R', "\r\nOK\r\n" },
+    { 'T', "AT+QGMR\r\n" },
+    { 'R', "\r\nEC800KCNLCR07A09M04V02\r\n" },
+    { 'R', "\r\nOK\r\n" },
+    { 'T', "AT+CSQ\r\n" },
+    { 'R', "\r\n+CSQ: 18,99\r\n\r\n+CEREG: 5\r\n\r\nOK\r\n" },
+    { 'T', "AT+QHTTPURL=30,80\r\n" },
+    { 'R', "\r\nCONNECT\r\n" },
+    { 'T', "http://fota.local/manifest.txt" },
+    { 'R', "\r\nOK\r\n" },
+    { 'T', "AT+QHTTPGET=80\r\n" },
+    { 'R', "\r\nOK\r\n" },
+    { 'R', "\r\n+QHTTPGET: 0,200,12\r\n" },
+    { 'T', "AT+QHTTPREAD=80\r\n" },
+    { 'R', "\r\nCONNECT\r\nR07A09\r\nOK\r\n" },
+    { 'R', "\r\nOK\r\n\r\n+QHTTPREAD: 0\r\n" },
+    { 'T', "AT+QFOTADL=\"http://fota.local/EC800KCNLCR07A09M04V02-EC800KCNLCR07A04M04V02.bin\",0,50\r\n" },
+    { 'R', "\r\nOK\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"HTTPSTART\"\r\n\r\n+QIND: \"FOTA\",\"HTTPEND\",0\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"START\"\r\n\r\n+QIND: \"FOTA\",\"UPDATING\",12\r\n" },
+    { 'R', "\r\n+QIND: \"FOTA\",\"END\",504\r\n" },
+};
+
+typedef struct {
+    const char* name;
+    const BenchTraceStep* steps;
+    int step_count;
+    ReplayStats expect;     // 只核对commands..fota_progress、cereg_stat、rebooted与version
+} BenchSession;
+
+#define BENCH_STEPS(a) a, (int)(sizeof(a) / sizeof(a[0]))
+
+const BenchSession BENCH_SESSIONS[] = {
+    { "R07A04", BENCH_STEPS(BENCH_SESSION_R07A04),
+      { .commands = 6, .ok = 5, .errors = 1, .unanswered = 0, .data_modes = 0, .fota_result = 0,
+        .download_result = 0, .fota_stage = FOTA_STAGE_END, .fota_progress = 96, .cereg_stat = -1,
+        .rebooted = true, .version = "EC800KCNLCR07A04M04V02" } },
+    { "R07A09", BENCH_STEPS(BENCH_SESSION_R07A09),
+      { .commands = 8, .ok = 7, .errors = 0, .unanswered = 1, .data_modes = 2, .fota_result = 504,
+        .download_result = 0, .fota_stage = FOTA_STAGE_END, .fota_progress = 12, .cereg_stat = 5,
+        .rebooted = false, .version = "EC800KCNLCR07A09M04V02" } },
+};
+#define BENCH_SESSION_COUNT ((int)(sizeof(BENCH_SESSIONS) / sizeof(BENCH_SESSIONS[0])))
+
+// 各会话以通道名区分，记录交替写入，经--capture同一套代码生成记录文件
+bool bench_write_trace(const char* path) {
+    EC800KModem modems[BENCH_SESSION_COUNT];
+    
+    if (!trace_open(path)) return false;
+    for (int i = 0; i < BENCH_SESSION_COUNT; i++) {
+        modem_init(&modems[i], BENCH_SESSIONS[i].name, DEFAULT_BAUDRATE);
+    }
+    for (int step = 0; ; step++) {
+        bool more = false;
+        for (int i = 0; i < BENCH_SESSION_COUNT; i++) {
+            if (step >= BENCH_SESSIONS[i].step_count) continue;
+            const BenchTraceStep* st = &BENCH_SESSIONS[i].steps[step];
+            trace_capture(&modems[i], st->dir == 'T' ? TRACE_TX : TRACE_RX, st->data, strlen(st->data));
+            more = true;
+        }
+        if (!more) break;
+    }
+    trace_close();
+    for (int i = 0; i < BENCH_SESSION_COUNT; i++) {
+        modem_destroy(&modems[i]);
+    }
+    return true;
+}
+
+// 核对一个通道的解析结果，不一致的字段写入diff
+bool bench_check_replay(const ReplayStats* got, const ReplayStats* want, char* diff, size_t size) {
+    size_t len = 0;
+    diff[0] = '\0';
+#define BENCH_CHECK(field) \
+    if (got->field != want->field && len < size) \
+        len += (size_t)snprintf(diff + len, size - len, " " #field "=%d(应为%d)", (int)got->field, (int)want->field);
+    BENCH_CHECK(commands)
+    BENCH_CHECK(ok)
+    BENCH_CHECK(errors)
+    BENCH_CHECK(unanswered)
+    BENCH_CHECK(data_modes)
+    BENCH_CHECK(fota_result)
+    BENCH_CHECK(download_result)
+    BENCH_CHECK(fota_stage)
+    BENCH_CHECK(fota_progress)
+    BENCH_CHECK(cereg_stat)
+    BENCH_CHECK(rebooted)
+#undef BENCH_CHECK
+    if (strcmp(got->version, want->version) != 0 && len < size) {
+        snprintf(diff + len, size - len, " version=%s", got->version[0] ? got->version : "(空)");
+    }
+    return diff[0] == '\0';
+}
+
+// 回放合成记录：先核对各通道，再分别计时；返回核对失败的会话数，-1表示无法生成记录
+int bench_replay(FILE* report, int rounds) {
+    TraceFile t;
+    int failures = 0;
+    
+    if (!bench_write_trace(BENCH_TRACE_FILE) || !trace_load(BENCH_TRACE_FILE, &t)) return -1;
+    remove(BENCH_TRACE_FILE);
+    ReplayChannel* chans = replay_channels_create(&t);
+    if (chans == NULL) {
+        trace_free(&t);
+        return -1;
+    }
+    
+    fprintf(report, "固件       记录数     行数       行/秒   ns/行     MB/秒   核对\n");
+    for (int i = 0; i < t.channels && i < BENCH_SESSION_COUNT; i++) {
+        uint64_t us = replay_run(&t, chans, i, rounds);
+        const ReplayStats* s = &chans[i].stats;
+        char diff[256];
+        bool ok = bench_check_replay(s, &BENCH_SESSIONS[i].expect, diff, sizeof(diff));
+        if (!ok) failures++;
+        
+        double lines = (double)s->lines * rounds;
+        fprintf(report, "%-10s %6d %8llu %11.0f %7.1f %9.1f   %s%s\n", BENCH_SESSIONS[i].name,
+                BENCH_SESSIONS[i].step_count, (unsigned long long)s->lines, us > 0 ? lines * 1e6 / (double)us : 0,
+                lines > 0 ? (double)us * 1000.0 / lines : 0, us > 0 ? (double)s->rx_bytes * rounds / (double)us : 0,
+                ok ? "✅" : "❌", diff);
+        fflush(report);
+    }
+    replay_channels_destroy(chans, t.channels);
+    trace_free(&t);
+    return failures;
+}
+
+void bench_print_row(FILE* report, int delay_us, const char* mode, const BenchResult* r) {
+    fprintf(report, "%-10d %s %12.0f %10llu %10llu %10llu %6d\n", delay_us, mode, r->per_second,
+            (unsigned long long)r->p50_us, (unsigned long long)r->p99_us, (unsigned long long)r->max_us, r->errors);
+}
+
+// ================== 主函数 ==================
+
+int main(int argc, char* argv[]) {
+    int transactions = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_TRANSACTIONS;
+    int fleet_max = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_FLEET_MAX;
+    int urc_step_ms = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_URC_STEP_MS;
+    static const int delays_us[] = { 0, 200, 1000 };
+    
+    if (transactions < BENCH_WARMUP) transactions = BENCH_WARMUP;     // samples同时用于预热轮
+    if (fleet_max < 1) fleet_max = 1;
+    if (fleet_max > MAX_SERIAL_PORTS) fleet_max = MAX_SERIAL_PORTS;
+    
+    // 报告写到原stdout，被测代码的日志重定向到文件
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    int log_fd = open(BENCH_LOG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (report == NULL || log_fd < 0) {
+        perror(BENCH_LOG_FILE);
+        return 1;
+    }
+    fflush(stdout);
+    dup2(log_fd, STDOUT_FILENO);
+    close(log_fd);
+    log_init();
+    stats_init(STATS_OFF);
+    at_policy_init();
+    
+    fprintf(report, "==================================================\n");
+    fprintf(report, "⏱️ EC800K 基准测试（伪终端模拟模组）\n");
+    fprintf(report, "==================================================\n");
+    fprintf(report, "事务数: %d, 批量升级最多%d个模组, URC间隔%dms\n", transactions, fleet_max, urc_step_ms);
+    fprintf(report, "被测日志: %s\n\n", BENCH_LOG_FILE);
+    
+    // 1. 单模组AT事务
+    FakeModem fake;
+    EC800KModem modem;
+    uint64_t* samples = (uint64_t*)malloc((size_t)transactions * sizeof(uint64_t));
+    if (samples == NULL || !fake_modem_start(&fake, 0, 0, urc_step_ms)) {
+        fprintf(report, "❌ 无法创建模拟模组\n");
+        return 1;
+    }
+    modem_init(&modem, fake.path, DEFAULT_BAUDRATE);
+    if (!modem_connect(&modem)) {
+        fprintf(report, "❌ 无法打开模拟串口 %s\n", fake.path);
+        return 1;
+    }
+    
+    fprintf(report, "AT事务 (%s 轮流发送)\n", "AT/AT+QGMR/AT+CSQ/AT+CREG?");
+    // 中文列名按显示宽度手工对齐
+    fprintf(report, "延时(us)   方式        事务/秒    p50(us)    p99(us)   最大(us)   错误\n");
+    for (size_t d = 0; d < sizeof(delays_us) / sizeof(delays_us[0]); d++) {
+        fake.delay_us = delays_us[d];
+        // 预热一轮，排除首次打开等一次性开销
+        bench_transactions(&modem, BENCH_WARMUP, samples);
+    
+        BenchResult single = bench_transactions(&modem, transactions, samples);
+        BenchResult batch = bench_batches(&modem, transactions, samples);
+        bench_print_row(report, delays_us[d], "逐条  ", &single);
+        bench_print_row(report, delays_us[d], "批处理", &batch);
+        fflush(report);
+    }
+    modem_disconnect(&modem);
+    modem_destroy(&modem);
+    fake_modem_stop(&fake);
+    free(samples);
+    
+    // 2. 批量升级扩展曲线
+    fprintf(report, "\n批量升级 (每个模组%d条URC，间隔%dms)\n", FAKE_FOTA_URC_COUNT, urc_step_ms);
+    fprintf(report, "模组数        用时(ms)      模组/秒     加速比   失败\n");
+    uint64_t base_ms = 0;
+    for (int n = 1; ; ) {
+        int failures = 0;
+        uint64_t ms = bench_fleet(n, urc_step_ms, &failures);
+        if (ms == 0) {
+            fprintf(report, "%-11d ❌ 无法创建模拟模组\n", n);
+            break;
+        }
+        if (n == 1) base_ms = ms;
+        // 加速比 = n个模组串行所需时间 / 实际用时
+        double speedup = ms > 0 ? (double)base_ms * n / (double)ms : 0;
+        fprintf(report, "%-11d %10llu %12.1f %10.2f %6d\n", n, (unsigned long long)ms,
+                (double)n * 1000.0 / (double)ms, speedup, failures);
+        fflush(report);
+        // 按2的幂递增，最后一档补测fleet_max本身
+        if (n == fleet_max) break;
+        n = n * 2 > fleet_max ? fleet_max : n * 2;
+    }
+    
+    // 3. 回放解析
+    fprintf(report, "\n回放解析 (合成的EC800K会话记录，每个%d轮)\n", BENCH_REPLAY_ROUNDS);
+    int replay_failures = bench_replay(report, BENCH_REPLAY_ROUNDS);
+    if (replay_failures < 0) {
+        fprintf(report, "❌ 无法生成收发记录 %s\n", BENCH_TRACE_FILE);
+    }
+    
+    log_shutdown();
+    fprintf(report, "\n✨ 完成\n");
+    fclose(report);
+    return replay_failures == 0 ? 0 : 1;
+}
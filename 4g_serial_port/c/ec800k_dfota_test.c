@@ -12,539 +12,9246 @@
  *   gcc -o ec800k_dfota_test ec800k_dfota_test.c -Wall -lpthread
  * 
  * 编译 (Windows - MinGW):
- *   gcc -o ec800k_dfota_test.exe ec800k_dfota_test.c -Wall
+ *   gcc -o ec800k_dfota_test.exe ec800k_dfota_test.c -Wall -lsetupapi
  */
 
+#define _FILE_OFFSET_BITS 64    // 32位Linux上off_t为64位，fseeko可定位2GB以上的文件
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <time.h>
 
 #ifdef _WIN32
     #include <windows.h>
+    #include <initguid.h>
+    #include <setupapi.h>
+    #include <devguid.h>
+    #pragma comment(lib, "setupapi.lib")
+    #define strncasecmp _strnicmp
 #else
     #include <fcntl.h>
     #include <termios.h>
     #include <unistd.h>
     #include <errno.h>
+    #include <poll.h>
     #include <dirent.h>
+    #include <limits.h>
     #include <sys/ioctl.h>
     #include <sys/time.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <netdb.h>
+    #include <signal.h>
+    #include <strings.h>
     #include <pthread.h>
+    #ifdef __APPLE__
+        #include <IOKit/serial/ioss.h>
+    #endif
+    #ifdef __linux__
+        #include <sys/inotify.h>
+    #endif
 #endif
 
 #define DEFAULT_BAUDRATE 115200
-#define AT_TIMEOUT_MS 2000
+#define SERIAL_IO_TIMEOUT_MS 2000     // 串口写入无进展、CMUX本地端写阻塞的最长等待
+#define AT_TIMEOUT_POLICY 0           // AT事务按命令策略决定超时与重试（见"命令策略"）
+#define AT_DRAIN_QUIET_MS 100         // 命令超时后，再次发送前串口静默该时长视为迟到回复已排空
+#define AT_DRAIN_MAX_MS 1000          // 排空最长耗时，URC持续到达时不再等待静默
 #define BUFFER_SIZE 1024
 
-// ================== 日志函数 ==================
+// 模组上下文与AT收发缓冲区大小均在编译期确定，运行期不再分配。
+// make EMBEDDED=1 为小内存网关配置：单个模组上下文控制在MODEM_FOOTPRINT_MAX以内，
+// 便于同时驱动64路以上模组（footprint命令打印实际占用）
+#ifdef EC800K_EMBEDDED
+#define PORT_PATH_MAX 64
+#define AT_TX_SIZE 768              // 命令发送区，需容纳700字符URL的AT+QFOTADL
+#define AT_RX_SIZE 512              // 单条响应原始字节
+#define AT_READ_CHUNK 128           // 每次串口读取的字节数
+#define AT_MAX_LINES 16
+#define URC_BUF_SIZE 256
+#define MODEM_FOOTPRINT_MAX 2048
+#else
+#define PORT_PATH_MAX 256
+#define AT_TX_SIZE 1024
+#define AT_RX_SIZE BUFFER_SIZE
+#define AT_READ_CHUNK 256
+#define AT_MAX_LINES 32
+#define URC_BUF_SIZE BUFFER_SIZE
+#endif
+#define FOTA_COMPLETE_TIMEOUT_MS (10 * 60 * 1000)  // 等待+QIND: "FOTA","END"的最长时间
+#define MONITOR_POLL_MS 200
+#define NET_READY_TIMEOUT_MS 60000      // 升级前默认等待网络注册的时长（--net-wait）
+#define COS_DEFAULT_PREFIX "ticnote_rec/"  // upload默认对象键前缀
+#define COS_CHUNK_SIZE (32 * 1024)      // upload起始分片大小
+#define FLEET_DEFAULT_DOWNLOADS 8       // --max-downloads，同时下载差分包的模组数上限
+#define FLEET_INITIAL_WINDOW 2          // 起始并发下载数，下载顺利时逐个放开
+#define DAEMON_DEFAULT_SOCKET "/tmp/ec800k_dfota.sock"  // daemon命令的默认Unix域套接字
+#define TLS_CA_FILE "UFS:ec800k_cacert.pem"    // --cacert上传到模组UFS的文件名
 
-void log_msg(const char* format, ...) {
-    time_t now;
-    struct tm* tm_info;
-    char time_buf[32];
-    
-    time(&now);
-    tm_info = localtime(&now);
-    strftime(time_buf, sizeof(time_buf), "%H:%M:%S", tm_info);
-    
-    printf("[%s] ", time_buf);
-    
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
-    printf("\n");
-    fflush(stdout);
+// 命令行选项
+typedef struct {
+    int baud_rate;          // --baud
+    bool hw_flow;           // --rtscts
+    const char* md5;        // --md5，本地差分包的期望MD5
+    int stats;              // --stats json|table（StatsMode）
+    const char* serve;      // --serve HOST[:PORT]，局域网分发差分包
+    const char* cache_dir;  // --cache，差分包缓存目录
+    int net_wait_s;         // --net-wait，等待网络注册的秒数
+    const char* apn;        // --apn，PDP上下文未激活时使用的APN
+    bool list_parts;        // --list-parts，续传前用ListParts核对服务端分片
+    bool state_cache;       // --state-cache，按IMEI缓存固件版本/ICCID，跳过重复查询
+    bool force;             // --force，跳过差分包与当前版本的预检
+    int max_downloads;      // --max-downloads，fleet同时下载的模组数上限（0不限）
+    bool cmux;              // --cmux，27.010多路复用：URC、AT控制与大块传输各占一个DLC
+    const char* telemetry;  // --telemetry，后台信号采样的环形记录文件
+    int sample_interval_s;  // --sample-interval，各模组的采样周期
+    const char* capture;    // --capture，串口收发记录文件
+    const char* ca_cert;    // --cacert，HTTPS校验服务器证书用的CA证书（PEM）
+    bool insecure;          // --insecure，HTTPS不校验服务器证书
+} ToolOptions;
+
+// ================== 时间函数 ==================
+
+// 单调时钟毫秒数，用于超时计算（不受系统时间调整影响）
+uint64_t monotonic_ms(void) {
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
 }
 
-// ================== 串口操作 ==================
+// 单调时钟微秒数，用于耗时统计
+uint64_t monotonic_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart * 1000000 +
+                      now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+// 距离截止时间的剩余毫秒数，已超时返回0
+int remaining_ms(uint64_t deadline) {
+    uint64_t now = monotonic_ms();
+    return now >= deadline ? 0 : (int)(deadline - now);
+}
+
+// ================== 线程封装 ==================
 
 #ifdef _WIN32
-typedef HANDLE SerialHandle;
-#define INVALID_SERIAL INVALID_HANDLE_VALUE
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define THREAD_RETURN DWORD WINAPI
+#define THREAD_RESULT 0
+typedef DWORD (WINAPI *thread_fn)(LPVOID);
 #else
-typedef int SerialHandle;
-#define INVALID_SERIAL -1
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define THREAD_RETURN void*
+#define THREAD_RESULT NULL
+typedef void* (*thread_fn)(void*);
 #endif
 
-typedef struct {
-    SerialHandle handle;
-    char port_path[256];
-    int baud_rate;
-    volatile bool stop_monitor;
-    volatile bool fota_complete;
-    volatile int fota_result;
-} EC800KModem;
+bool thread_create(thread_t* thread, thread_fn fn, void* arg) {
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, fn, arg) == 0;
+#endif
+}
 
-// 初始化模块结构
-void modem_init(EC800KModem* modem, const char* port_path, int baud_rate) {
-    modem->handle = INVALID_SERIAL;
-    strncpy(modem->port_path, port_path, sizeof(modem->port_path) - 1);
-    modem->baud_rate = baud_rate;
-    modem->stop_monitor = false;
-    modem->fota_complete = false;
-    modem->fota_result = -1;
+void thread_join(thread_t thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
 }
 
-// 连接串口
-bool modem_connect(EC800KModem* modem) {
+void mutex_init(mutex_t* m) {
 #ifdef _WIN32
-    char full_path[256];
-    snprintf(full_path, sizeof(full_path), "\\\\.\\%s", modem->port_path);
-    
-    modem->handle = CreateFileA(
-        full_path,
-        GENERIC_READ | GENERIC_WRITE,
-        0,
-        NULL,
-        OPEN_EXISTING,
-        0,
-        NULL
-    );
+    InitializeCriticalSection(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+void mutex_destroy(mutex_t* m) {
+#ifdef _WIN32
+    DeleteCriticalSection(m);
+#else
+    pthread_mutex_destroy(m);
+#endif
+}
+
+void mutex_lock(mutex_t* m) {
+#ifdef _WIN32
+    EnterCriticalSection(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+// 不等待地尝试加锁，返回是否取得
+bool mutex_trylock(mutex_t* m) {
+#ifdef _WIN32
+    return TryEnterCriticalSection(m) != 0;
+#else
+    return pthread_mutex_trylock(m) == 0;
+#endif
+}
+
+void mutex_unlock(mutex_t* m) {
+#ifdef _WIN32
+    LeaveCriticalSection(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+void cond_init(cond_t* c) {
+#ifdef _WIN32
+    InitializeConditionVariable(c);
+#else
+    pthread_cond_init(c, NULL);
+#endif
+}
+
+void cond_destroy(cond_t* c) {
+#ifdef _WIN32
+    (void)c;
+#else
+    pthread_cond_destroy(c);
+#endif
+}
+
+void cond_broadcast(cond_t* c) {
+#ifdef _WIN32
+    WakeAllConditionVariable(c);
+#else
+    pthread_cond_broadcast(c);
+#endif
+}
+
+// 等待条件变量，最多timeout_ms毫秒；调用方需在循环中重新检查条件
+void cond_timedwait(cond_t* c, mutex_t* m, int timeout_ms) {
+#ifdef _WIN32
+    SleepConditionVariableCS(c, m, (DWORD)timeout_ms);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(c, m, &ts);
+#endif
+}
+
+void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+// ================== 日志函数 ==================
+
+// 异步日志：调用线程只把整行格式化进无锁环形队列（多生产者单消费者，
+// 按槽位序号发布），由后台线程批量写出并flush，串口线程不会被stdout阻塞。
+// 时间戳每秒只格式化一次（线程本地缓存），毫秒部分单独拼接。
+// 超过一个槽位的长行一次领取连续多个槽位，整行不与其他线程交错。
+// 队列满时log_msg丢弃并计数，不阻塞调用方；log_printf（报告/表格输出）等待空槽位。
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG   // 编译时-DLOG_LEVEL=1可去掉收发/URC逐条跟踪
+#endif
+
+#define LOG_SLOTS 256               // 必须为2的幂
+#define LOG_SLOT_SIZE 1024
+#define LOG_LINE_MAX 4096           // 单行上限（如2KB的响应原文），按槽位拆分，不超过LOG_SLOTS个槽位
+#define LOG_DRAIN_IDLE_MS 2
+#define LOG_DRAIN_BUFFER (64 * 1024)
+
+typedef struct {
+    atomic_size_t seq;              // 等于写入位置时可写，等于位置+1时可读
+    size_t len;
+    char text[LOG_SLOT_SIZE];
+} LogSlot;
+
+typedef struct {
+    LogSlot slots[LOG_SLOTS];
+    atomic_size_t head;             // 生产者领取位置
+    size_t tail;                    // 仅消费线程访问
+    atomic_ulong dropped;
+    atomic_bool running;
+    volatile bool stop;
+    thread_t thread;
+} AsyncLog;
+
+AsyncLog g_log;
+
+_Thread_local time_t log_cached_sec = (time_t)-1;
+_Thread_local char log_cached_prefix[16];   // "[HH:MM:SS."
+_Thread_local size_t log_cached_len;
+
+// 墙上时间（秒+毫秒）
+void wall_clock(time_t* sec, int* ms) {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t t = ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) / 10000 - 11644473600000ULL;
+    *sec = (time_t)(t / 1000);
+    *ms = (int)(t % 1000);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *sec = ts.tv_sec;
+    *ms = (int)(ts.tv_nsec / 1000000);
+#endif
+}
+
+// 写入"[HH:MM:SS.mmm] "，秒级部分按线程缓存
+size_t log_format_time(char* dst) {
+    time_t sec;
+    int ms;
+    wall_clock(&sec, &ms);
     
-    if (modem->handle == INVALID_HANDLE_VALUE) {
-        log_msg("❌ 串口连接失败: %s (错误码: %lu)", modem->port_path, GetLastError());
-        return false;
+    if (sec != log_cached_sec) {
+        struct tm tm_info;
+#ifdef _WIN32
+        localtime_s(&tm_info, &sec);
+#else
+        localtime_r(&sec, &tm_info);
+#endif
+        log_cached_len = strftime(log_cached_prefix, sizeof(log_cached_prefix), "[%H:%M:%S.", &tm_info);
+        log_cached_sec = sec;
     }
     
-    DCB dcb = {0};
-    dcb.DCBlength = sizeof(DCB);
+    memcpy(dst, log_cached_prefix, log_cached_len);
+    dst[log_cached_len] = (char)('0' + ms / 100);
+    dst[log_cached_len + 1] = (char)('0' + ms / 10 % 10);
+    dst[log_cached_len + 2] = (char)('0' + ms % 10);
+    dst[log_cached_len + 3] = ']';
+    dst[log_cached_len + 4] = ' ';
+    return log_cached_len + 5;
+}
+
+// 格式化到dst，stamp时加时间戳并补换行，返回长度
+size_t log_format(char* dst, size_t size, bool stamp, const char* format, va_list args) {
+    size_t len = stamp ? log_format_time(dst) : 0;
+    int n = vsnprintf(dst + len, size - len - 1, format, args);
+    if (n > 0) {
+        len += (size_t)n < size - len - 1 ? (size_t)n : size - len - 2;
+    }
+    if (stamp) dst[len++] = '\n';
+    dst[len] = '\0';
+    return len;
+}
+
+void log_vwrite(bool stamp, const char* format, va_list args) {
+    char line[LOG_LINE_MAX];
+    size_t len = log_format(line, sizeof(line), stamp, format, args);
+    if (len == 0) return;
     
-    if (!GetCommState(modem->handle, &dcb)) {
-        CloseHandle(modem->handle);
-        modem->handle = INVALID_HANDLE_VALUE;
-        return false;
+    // 领取连续count个槽位：最后一个可写时前面的也都已被消费线程释放
+    size_t count = (len + LOG_SLOT_SIZE - 1) / LOG_SLOT_SIZE;
+    size_t pos = atomic_load_explicit(&g_log.head, memory_order_relaxed);
+    for (;;) {
+        if (!atomic_load_explicit(&g_log.running, memory_order_acquire) || (!stamp && g_log.stop)) {
+            // 后台线程未启动（或已停止）时同步输出
+            fwrite(line, 1, len, stdout);
+            fflush(stdout);
+            return;
+        }
+        LogSlot* last = &g_log.slots[(pos + count - 1) & (LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&last->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + count - 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&g_log.head, &pos, pos + count,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            if (stamp) {
+                atomic_fetch_add_explicit(&g_log.dropped, 1, memory_order_relaxed);
+                return;
+            }
+            sleep_ms(1);    // 报告输出不能丢，等消费线程腾出槽位
+            pos = atomic_load_explicit(&g_log.head, memory_order_relaxed);
+        } else {
+            pos = atomic_load_explicit(&g_log.head, memory_order_relaxed);
+        }
     }
     
-    dcb.BaudRate = modem->baud_rate;
-    dcb.ByteSize = 8;
-    dcb.Parity = NOPARITY;
-    dcb.StopBits = ONESTOPBIT;
-    dcb.fBinary = TRUE;
-    dcb.fDtrControl = DTR_CONTROL_ENABLE;
-    dcb.fRtsControl = RTS_CONTROL_ENABLE;
+    for (size_t i = 0; i < count; i++) {
+        LogSlot* slot = &g_log.slots[(pos + i) & (LOG_SLOTS - 1)];
+        size_t offset = i * LOG_SLOT_SIZE;
+        slot->len = len - offset < LOG_SLOT_SIZE ? len - offset : LOG_SLOT_SIZE;
+        memcpy(slot->text, line + offset, slot->len);
+        atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+    }
+}
+
+// 带时间戳的一行日志
+void log_msg(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vwrite(true, format, args);
+    va_end(args);
+}
+
+// 原样输出（替代printf），与log_msg共用队列以保持先后顺序
+void log_printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vwrite(false, format, args);
+    va_end(args);
+}
+
+// 取出所有已发布的槽位，一次写出，返回取出条数
+int log_drain(char* out, size_t out_size) {
+    size_t len = 0;
+    int count = 0;
     
-    if (!SetCommState(modem->handle, &dcb)) {
-        CloseHandle(modem->handle);
-        modem->handle = INVALID_HANDLE_VALUE;
-        return false;
+    for (;;) {
+        LogSlot* slot = &g_log.slots[g_log.tail & (LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != g_log.tail + 1) break;
+        
+        if (len + slot->len > out_size) {
+            fwrite(out, 1, len, stdout);
+            len = 0;
+        }
+        memcpy(out + len, slot->text, slot->len);
+        len += slot->len;
+        atomic_store_explicit(&slot->seq, g_log.tail + LOG_SLOTS, memory_order_release);
+        g_log.tail++;
+        count++;
     }
     
-    COMMTIMEOUTS timeouts = {0};
-    timeouts.ReadIntervalTimeout = 50;
-    timeouts.ReadTotalTimeoutConstant = AT_TIMEOUT_MS;
-    timeouts.ReadTotalTimeoutMultiplier = 10;
-    timeouts.WriteTotalTimeoutConstant = 50;
-    timeouts.WriteTotalTimeoutMultiplier = 10;
-    SetCommTimeouts(modem->handle, &timeouts);
+    unsigned long dropped = atomic_exchange_explicit(&g_log.dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        // 调用方在out_size之外预留了64字节
+        len += (size_t)snprintf(out + len, 64, "⚠️ 日志队列已满，丢弃%lu条\n", dropped);
+    }
+    if (len > 0) {
+        fwrite(out, 1, len, stdout);
+        fflush(stdout);
+    }
+    return count;
+}
+
+THREAD_RETURN log_drain_thread(void* arg) {
+    static char out[LOG_DRAIN_BUFFER];
+    (void)arg;
     
-#else
-    modem->handle = open(modem->port_path, O_RDWR | O_NOCTTY | O_NDELAY);
+    while (!g_log.stop) {
+        if (log_drain(out, sizeof(out) - 64) == 0) {
+            sleep_ms(LOG_DRAIN_IDLE_MS);
+        }
+    }
+    log_drain(out, sizeof(out) - 64);
+    return THREAD_RESULT;
+}
+
+// 停止后台线程并写出剩余日志，之后的日志改为同步输出
+void log_shutdown(void) {
+    if (!atomic_load(&g_log.running)) return;
+    g_log.stop = true;
+    thread_join(g_log.thread);
+    atomic_store(&g_log.running, false);
+}
+
+void log_init(void) {
+    for (size_t i = 0; i < LOG_SLOTS; i++) {
+        atomic_init(&g_log.slots[i].seq, i);
+    }
+    atomic_init(&g_log.head, 0);
+    g_log.tail = 0;
+    atomic_init(&g_log.dropped, 0);
+    g_log.stop = false;
+    if (thread_create(&g_log.thread, log_drain_thread, NULL)) {
+        atomic_store(&g_log.running, true);
+        atexit(log_shutdown);
+    }
+}
+
+// ================== 耗时统计 ==================
+
+// 每条AT命令的首字节/最终结果耗时直方图与FOTA各阶段耗时，
+// --stats json输出JSON行到stderr，--stats table在结束时打印汇总表
+
+#define STATS_MAX_KEYS 48
+#define STATS_KEY_MAX 48
+#define STATS_SUB_BUCKETS 4     // 每个2的幂区间再细分4档，分位数误差不超过25%
+#define STATS_BUCKETS (28 * STATS_SUB_BUCKETS)  // 微秒，最后一档约134秒以上
+
+typedef enum {
+    STATS_OFF,
+    STATS_JSON,
+    STATS_TABLE
+} StatsMode;
+
+typedef struct {
+    char key[STATS_KEY_MAX];
+    bool phase;                 // FOTA阶段（否则为AT命令）
+    uint64_t count;
+    uint64_t errors;
+    uint64_t retries;
+    uint64_t bytes_tx;
+    uint64_t bytes_rx;
+    uint64_t final_sum_us;
+    uint64_t final_max_us;
+    uint64_t first_max_us;
+    uint32_t first_hist[STATS_BUCKETS];
+    uint32_t final_hist[STATS_BUCKETS];
+} StatsEntry;
+
+typedef struct {
+    StatsMode mode;
+    mutex_t lock;
+    StatsEntry entries[STATS_MAX_KEYS];
+    int count;
+} Stats;
+
+Stats g_stats;
+
+void stats_init(StatsMode mode) {
+    g_stats.mode = mode;
+    g_stats.count = 0;
+    mutex_init(&g_stats.lock);
+}
+
+// 对数-线性分档：2的幂区间[2^e, 2^(e+1))按最高位之后的2位再分4档
+int stats_bucket(uint64_t us) {
+    if (us < STATS_SUB_BUCKETS) return (int)us;
+    int e = 0;
+    while ((us >> e) >= 2 * STATS_SUB_BUCKETS) e++;
+    int b = (e + 1) * STATS_SUB_BUCKETS + (int)((us >> e) - STATS_SUB_BUCKETS);
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+// 分档上界（不含）
+uint64_t stats_bucket_limit(int b) {
+    if (b < STATS_SUB_BUCKETS) return (uint64_t)b + 1;
+    int e = b / STATS_SUB_BUCKETS - 1;
+    return ((uint64_t)(b % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS) + 1) << e;
+}
+
+// 直方图估算分位数，取所在分档上界且不超过实测最大值
+uint64_t stats_percentile(const uint32_t* hist, uint64_t count, uint64_t max_us, double q) {
+    uint64_t target = (uint64_t)((double)count * q + 0.5);
+    uint64_t seen = 0;
+    if (target == 0) target = 1;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= target) {
+            uint64_t limit = stats_bucket_limit(b);
+            return limit < max_us ? limit : max_us;
+        }
+    }
+    return max_us;
+}
+
+// 命令归一化为统计键：去掉参数，保留拼接结构，如"AT+CPIN;+CREG;+CSQ"
+void stats_command_key(const char* cmd, char* key, size_t size) {
+    size_t len = 0;
+    bool skip = false;
+    for (const char* p = cmd; *p != '\0' && len < size - 1; p++) {
+        if (*p == ';') {
+            skip = false;
+        } else if (*p == '=' || *p == '?') {
+            skip = true;
+        }
+        if (!skip) key[len++] = *p;
+    }
+    key[len] = '\0';
+}
+
+// 查找或新建统计项（需持有g_stats.lock）
+StatsEntry* stats_entry_locked(const char* key, bool phase) {
+    for (int i = 0; i < g_stats.count; i++) {
+        StatsEntry* e = &g_stats.entries[i];
+        if (e->phase == phase && strcmp(e->key, key) == 0) return e;
+    }
+    if (g_stats.count >= STATS_MAX_KEYS) return NULL;
+    StatsEntry* e = &g_stats.entries[g_stats.count++];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->phase = phase;
+    return e;
+}
+
+// 记录一次AT事务；first_us为发送到收到首字节的耗时（未收到为0）
+void stats_record_command(const char* port, const char* cmd, uint64_t first_us, uint64_t final_us,
+                          size_t tx, size_t rx, const char* result, bool ok) {
+    if (g_stats.mode == STATS_OFF) return;
+    char key[STATS_KEY_MAX];
+    stats_command_key(cmd, key, sizeof(key));
     
-    if (modem->handle < 0) {
-        log_msg("❌ 串口连接失败: %s (%s)", modem->port_path, strerror(errno));
-        return false;
+    mutex_lock(&g_stats.lock);
+    StatsEntry* e = stats_entry_locked(key, false);
+    if (e != NULL) {
+        e->count++;
+        e->errors += ok ? 0 : 1;
+        e->bytes_tx += tx;
+        e->bytes_rx += rx;
+        e->final_sum_us += final_us;
+        if (final_us > e->final_max_us) e->final_max_us = final_us;
+        if (first_us > e->first_max_us) e->first_max_us = first_us;
+        e->first_hist[stats_bucket(first_us)]++;
+        e->final_hist[stats_bucket(final_us)]++;
+    }
+    if (g_stats.mode == STATS_JSON) {
+        fprintf(stderr, "{\"type\":\"at\",\"port\":\"%s\",\"cmd\":\"%s\",\"first_us\":%llu,\"final_us\":%llu,"
+                "\"tx\":%zu,\"rx\":%zu,\"result\":\"%s\"}\n",
+                port, key, (unsigned long long)first_us, (unsigned long long)final_us, tx, rx, result);
     }
+    mutex_unlock(&g_stats.lock);
+}
+
+// 记录一次重试（如拼接命令被拒绝后逐条重发）
+void stats_record_retry(const char* port, const char* cmd) {
+    if (g_stats.mode == STATS_OFF) return;
+    char key[STATS_KEY_MAX];
+    stats_command_key(cmd, key, sizeof(key));
     
-    struct termios options;
-    tcgetattr(modem->handle, &options);
+    mutex_lock(&g_stats.lock);
+    StatsEntry* e = stats_entry_locked(key, false);
+    if (e != NULL) e->retries++;
+    if (g_stats.mode == STATS_JSON) {
+        fprintf(stderr, "{\"type\":\"retry\",\"port\":\"%s\",\"cmd\":\"%s\"}\n", port, key);
+    }
+    mutex_unlock(&g_stats.lock);
+}
+
+// 记录FOTA阶段耗时
+void stats_record_phase(const char* port, const char* phase, uint64_t us) {
+    if (g_stats.mode == STATS_OFF) return;
     
-    // 设置波特率
-    speed_t speed;
-    switch (modem->baud_rate) {
-        case 9600:   speed = B9600; break;
-        case 19200:  speed = B19200; break;
-        case 38400:  speed = B38400; break;
-        case 57600:  speed = B57600; break;
-        case 115200: speed = B115200; break;
-        default:     speed = B115200;
+    mutex_lock(&g_stats.lock);
+    StatsEntry* e = stats_entry_locked(phase, true);
+    if (e != NULL) {
+        e->count++;
+        e->final_sum_us += us;
+        if (us > e->final_max_us) e->final_max_us = us;
+        e->final_hist[stats_bucket(us)]++;
     }
-    cfsetispeed(&options, speed);
-    cfsetospeed(&options, speed);
+    if (g_stats.mode == STATS_JSON) {
+        fprintf(stderr, "{\"type\":\"phase\",\"port\":\"%s\",\"phase\":\"%s\",\"us\":%llu}\n",
+                port, phase, (unsigned long long)us);
+    }
+    mutex_unlock(&g_stats.lock);
+}
+
+double stats_ms(uint64_t us) {
+    return (double)us / 1000.0;
+}
+
+void at_policy_print_summary(StatsMode mode);
+
+// 汇总输出：table模式打印表格，json模式输出summary行
+void stats_print_summary(void) {
+    if (g_stats.mode == STATS_OFF) return;
     
-    // 8N1
-    options.c_cflag &= ~PARENB;
-    options.c_cflag &= ~CSTOPB;
-    options.c_cflag &= ~CSIZE;
-    options.c_cflag |= CS8;
-    options.c_cflag |= (CLOCAL | CREAD);
+    mutex_lock(&g_stats.lock);
+    if (g_stats.mode == STATS_TABLE) {
+        log_printf("\n==================================================\n");
+        log_printf("⏱️ AT命令耗时统计 (毫秒)\n");
+        log_printf("==================================================\n");
+        log_printf("命令                               次数 错误 重试 首字节p50       p50       p99      平均      最大 发送字节 接收字节\n");
+    }
+    for (int i = 0; i < g_stats.count; i++) {
+        const StatsEntry* e = &g_stats.entries[i];
+        if (e->phase || e->count == 0) continue;
+        uint64_t first_p50 = stats_percentile(e->first_hist, e->count, e->first_max_us, 0.50);
+        uint64_t p50 = stats_percentile(e->final_hist, e->count, e->final_max_us, 0.50);
+        uint64_t p99 = stats_percentile(e->final_hist, e->count, e->final_max_us, 0.99);
+        uint64_t avg = e->final_sum_us / e->count;
+        if (g_stats.mode == STATS_TABLE) {
+            log_printf("%-32s %6llu %4llu %4llu %9.1f %9.1f %9.1f %9.1f %9.1f %8llu %8llu\n", e->key,
+                   (unsigned long long)e->count, (unsigned long long)e->errors, (unsigned long long)e->retries,
+                   stats_ms(first_p50), stats_ms(p50), stats_ms(p99), stats_ms(avg), stats_ms(e->final_max_us),
+                   (unsigned long long)e->bytes_tx, (unsigned long long)e->bytes_rx);
+        } else {
+            fprintf(stderr, "{\"type\":\"summary\",\"cmd\":\"%s\",\"count\":%llu,\"errors\":%llu,\"retries\":%llu,"
+                    "\"first_p50_us\":%llu,\"p50_us\":%llu,\"p99_us\":%llu,\"avg_us\":%llu,\"max_us\":%llu,"
+                    "\"tx\":%llu,\"rx\":%llu}\n", e->key,
+                    (unsigned long long)e->count, (unsigned long long)e->errors, (unsigned long long)e->retries,
+                    (unsigned long long)first_p50, (unsigned long long)p50, (unsigned long long)p99,
+                    (unsigned long long)avg, (unsigned long long)e->final_max_us,
+                    (unsigned long long)e->bytes_tx, (unsigned long long)e->bytes_rx);
+        }
+    }
     
-    // Raw模式
-    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-    options.c_iflag &= ~(IXON | IXOFF | IXANY);
-    options.c_oflag &= ~OPOST;
+    if (g_stats.mode == STATS_TABLE) {
+        log_printf("\n⏱️ FOTA阶段耗时 (毫秒)\n");
+        log_printf("阶段                               次数       p50       p99      平均      最大\n");
+    }
+    for (int i = 0; i < g_stats.count; i++) {
+        const StatsEntry* e = &g_stats.entries[i];
+        if (!e->phase || e->count == 0) continue;
+        uint64_t p50 = stats_percentile(e->final_hist, e->count, e->final_max_us, 0.50);
+        uint64_t p99 = stats_percentile(e->final_hist, e->count, e->final_max_us, 0.99);
+        uint64_t avg = e->final_sum_us / e->count;
+        if (g_stats.mode == STATS_TABLE) {
+            log_printf("%-32s %6llu %9.1f %9.1f %9.1f %9.1f\n", e->key, (unsigned long long)e->count,
+                   stats_ms(p50), stats_ms(p99), stats_ms(avg), stats_ms(e->final_max_us));
+        } else {
+            fprintf(stderr, "{\"type\":\"summary\",\"phase\":\"%s\",\"count\":%llu,\"p50_us\":%llu,"
+                    "\"p99_us\":%llu,\"avg_us\":%llu,\"max_us\":%llu}\n", e->key, (unsigned long long)e->count,
+                    (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)avg,
+                    (unsigned long long)e->final_max_us);
+        }
+    }
+    at_policy_print_summary(g_stats.mode);
+    fflush(stderr);
+    mutex_unlock(&g_stats.lock);
+}
+
+// ================== 命令策略 ==================
+
+// 每类命令的超时与重试：样本足够后超时取实测p99加余量，限定在策略的下限与上限之间。
+// 查询类命令正常几十毫秒内返回，学到实际耗时后超时缩到数百毫秒，模组无响应时快速失败；
+// 入网、PDP激活、下载等依赖网络的命令下限保持初始值，学习只会把超时延长。
+// ERROR/+CME ERROR本身是最终结果码，收到即结束等待，不必等到超时
+
+#define AT_POLICY_MAX_KEYS 48
+#define AT_POLICY_MIN_SAMPLES 8         // 成功样本达到该数后改用p99
+#define AT_POLICY_P99_FACTOR 3          // 超时 = p99 × 3 + 余量
+#define AT_POLICY_SLACK_MS 100
+#define AT_POLICY_BACKOFF_MS 200        // 首次重试前等待，此后每次加倍
+#define AT_POLICY_DECAY_COUNT 4096      // 缓存中的样本数超过该值时减半，旧样本逐步淡出
+#define AT_POLICY_CACHE_FILE "ec800k_timing.cache"
+
+// X(标识, 命令前缀, 初始超时ms, 下限ms, 上限ms, 重试次数, 超时是否重试)
+// 按顺序匹配，最后一项为默认策略；有副作用的命令只在暂时性错误（模组拒绝执行）时重试
+#define AT_POLICY_TABLE(X) \
+    X(QFOTADL,   "AT+QFOTADL",   5000,  1000,  15000, 2, false) \
+    X(CGATT_SET, "AT+CGATT=",   30000, 30000,  75000, 1, false) \
+    X(QIACT_SET, "AT+QIACT=",   30000, 30000, 150000, 1, false) \
+    X(QFLST,     "AT+QFLST",     2000,   300,  10000, 1, true) \
+    X(DEFAULT,   "",             2000,   300,   5000, 1, true)
+
+typedef struct {
+    const char* name;
+    const char* prefix;
+    int initial_ms;
+    int min_ms;
+    int max_ms;
+    int retries;
+    bool retry_timeout;
+} AtPolicy;
+
+const AtPolicy at_policies[] = {
+#define X(id, prefix, initial, min, max, retries, retry_timeout) \
+    { #id, prefix, initial, min, max, retries, retry_timeout },
+    AT_POLICY_TABLE(X)
+#undef X
+};
+
+#define AT_POLICY_COUNT ((int)(sizeof(at_policies) / sizeof(at_policies[0])))
+
+// 按命令结构（保留'='与'?'，去掉参数）分别学习耗时，直方图与耗时统计共用分档
+typedef struct {
+    char key[STATS_KEY_MAX];
+    const AtPolicy* policy;
+    uint64_t count;
+    uint64_t max_us;
+    uint32_t hist[STATS_BUCKETS];
+} AtPolicyEntry;
+
+typedef struct {
+    mutex_t lock;
+    AtPolicyEntry entries[AT_POLICY_MAX_KEYS];
+    int count;
+} AtPolicyTable;
+
+AtPolicyTable g_at_policy;
+
+void at_policy_init(void) {
+    g_at_policy.count = 0;
+    mutex_init(&g_at_policy.lock);
+}
+
+const AtPolicy* at_policy_find(const char* cmd) {
+    for (int i = 0; i < AT_POLICY_COUNT - 1; i++) {
+        if (strncmp(cmd, at_policies[i].prefix, strlen(at_policies[i].prefix)) == 0) return &at_policies[i];
+    }
+    return &at_policies[AT_POLICY_COUNT - 1];
+}
+
+// "AT+CGATT=1" -> "AT+CGATT="，"AT+CGATT?"不变：查询与设置分开学习
+void at_policy_key(const char* cmd, char* key, size_t size) {
+    size_t len = 0;
+    bool skip = false;
+    for (const char* p = cmd; *p != '\0' && *p != ' ' && len < size - 1; p++) {
+        if (*p == ';') skip = false;
+        if (!skip) key[len++] = *p;
+        if (*p == '=') skip = true;
+    }
+    key[len] = '\0';
+}
+
+// 查找或新建学习项（需持有lock），表满返回NULL
+AtPolicyEntry* at_policy_entry_locked(const char* key) {
+    for (int i = 0; i < g_at_policy.count; i++) {
+        if (strcmp(g_at_policy.entries[i].key, key) == 0) return &g_at_policy.entries[i];
+    }
+    if (g_at_policy.count >= AT_POLICY_MAX_KEYS) return NULL;
+    AtPolicyEntry* e = &g_at_policy.entries[g_at_policy.count++];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->policy = at_policy_find(key);
+    return e;
+}
+
+// 由学习结果计算超时（需持有lock）
+int at_policy_timeout_locked(const AtPolicyEntry* e, const AtPolicy* policy) {
+    if (e == NULL || e->count < AT_POLICY_MIN_SAMPLES) return policy->initial_ms;
+    uint64_t p99 = stats_percentile(e->hist, e->count, e->max_us, 0.99);
+    uint64_t ms = p99 / 1000 * AT_POLICY_P99_FACTOR + AT_POLICY_SLACK_MS;
+    if (ms < (uint64_t)policy->min_ms) return policy->min_ms;
+    if (ms > (uint64_t)policy->max_ms) return policy->max_ms;
+    return (int)ms;
+}
+
+// 取命令的策略与本次应使用的超时
+int at_policy_timeout(const char* cmd, const AtPolicy** policy) {
+    char key[STATS_KEY_MAX];
+    at_policy_key(cmd, key, sizeof(key));
+    
+    mutex_lock(&g_at_policy.lock);
+    AtPolicyEntry* e = at_policy_entry_locked(key);
+    *policy = e != NULL ? e->policy : at_policy_find(key);
+    int timeout = at_policy_timeout_locked(e, *policy);
+    mutex_unlock(&g_at_policy.lock);
+    return timeout;
+}
+
+// 记录一次事务耗时；超时按所用超时值计入，持续超时的命令其超时会逐步放宽
+void at_policy_record(const char* cmd, uint64_t us, bool timed_out, int timeout_ms) {
+    char key[STATS_KEY_MAX];
+    at_policy_key(cmd, key, sizeof(key));
+    if (timed_out) us = (uint64_t)timeout_ms * 1000;
+    
+    mutex_lock(&g_at_policy.lock);
+    AtPolicyEntry* e = at_policy_entry_locked(key);
+    if (e != NULL) {
+        e->count++;
+        if (us > e->max_us) e->max_us = us;
+        e->hist[stats_bucket(us)]++;
+    }
+    mutex_unlock(&g_at_policy.lock);
+}
+
+// 模组暂时忙、稍后重发即可成功的错误码
+bool at_error_transient(int code) {
+    switch (code) {
+        case 14:    // SIM卡忙
+        case 703:   // HTTP(S)忙
+        case 704:   // UART忙
+        case 706:   // 网络忙
+            return true;
+        default:
+            return false;
+    }
+}
+
+// --stats汇总中附带各命令当前生效的超时
+void at_policy_print_summary(StatsMode mode) {
+    mutex_lock(&g_at_policy.lock);
+    if (mode == STATS_TABLE) {
+        log_printf("\n⏱️ 命令超时策略 (毫秒)\n");
+        log_printf("命令                               策略         样本       p99      超时 重试\n");
+    }
+    for (int i = 0; i < g_at_policy.count; i++) {
+        const AtPolicyEntry* e = &g_at_policy.entries[i];
+        uint64_t p99 = e->count > 0 ? stats_percentile(e->hist, e->count, e->max_us, 0.99) : 0;
+        int timeout = at_policy_timeout_locked(e, e->policy);
+        if (mode == STATS_TABLE) {
+            log_printf("%-32s %-10s %6llu %9.1f %9d %4d%s\n", e->key, e->policy->name, (unsigned long long)e->count,
+                       stats_ms(p99), timeout, e->policy->retries,
+                       e->count < AT_POLICY_MIN_SAMPLES ? " (样本不足，用初始值)" : "");
+        } else {
+            fprintf(stderr, "{\"type\":\"policy\",\"cmd\":\"%s\",\"policy\":\"%s\",\"samples\":%llu,\"p99_us\":%llu,"
+                    "\"timeout_ms\":%d,\"retries\":%d}\n", e->key, e->policy->name, (unsigned long long)e->count,
+                    (unsigned long long)p99, timeout, e->policy->retries);
+        }
+    }
+    mutex_unlock(&g_at_policy.lock);
+}
+
+// ================== 串口操作 ==================
+
+#ifdef _WIN32
+typedef HANDLE SerialHandle;
+#define INVALID_SERIAL INVALID_HANDLE_VALUE
+#else
+typedef int SerialHandle;
+#define INVALID_SERIAL -1
+#endif
+
+// FOTA阶段，按+QIND: "FOTA",...上报推进
+typedef enum {
+    FOTA_STAGE_IDLE,
+    FOTA_STAGE_DOWNLOADING,  // HTTPSTART/FTPSTART/FILESTART
+    FOTA_STAGE_DOWNLOADED,   // HTTPEND/FTPEND/FILEEND,0
+    FOTA_STAGE_UPDATING,     // START/UPDATING
+    FOTA_STAGE_END           // END或下载失败
+} FotaStage;
+
+// 每个模组独占的预分配缓冲区
+typedef struct {
+    char tx[AT_TX_SIZE];        // 命令发送区：命令直接格式化到此处（io_lock保护）
+    char urc[URC_BUF_SIZE];     // URC行接收区（io_lock保护）
+} ModemArena;
+
+struct CmuxMux;
+
+typedef struct EC800KModem {
+    SerialHandle handle;
+#ifdef _WIN32
+    HANDLE rx_event;    // 重叠读完成事件
+    HANDLE tx_event;    // 重叠写完成事件
+#endif
+    char port_path[PORT_PATH_MAX];
+    int baud_rate;
+    bool hw_flow;           // RTS/CTS硬件流控
+    volatile bool stop_monitor;
+    volatile bool fota_complete;
+    volatile int fota_result;
+    
+    // FOTA进度（由URC更新，state_lock保护）
+    FotaStage fota_stage;
+    int fota_progress;
+    uint64_t fota_start_ms;
+    uint64_t fota_end_ms;
+    int download_result;    // HTTPEND/FTPEND/FILEEND的错误码，-1表示下载尚未结束
+    uint64_t download_end_ms;
+    char fw_version[64];    // 升级前查询到的固件版本
+    char imei[32];
+    char iccid[32];         // SIM卡ICCID，未插卡为空
+    bool info_valid;        // 本次会话已取得版本/IMEI/ICCID（收到RDY后失效）
+    bool rebooted;          // 会话中收到RDY，模组重启过
+    bool state_cache;       // 启用设备信息缓存
+    bool fota_force;        // 跳过差分包版本预检
+    uint64_t download_start_us;     // 阶段计时起点（state_lock保护）
+    uint64_t update_start_us;
+    uint64_t update_step_us;
+    bool log_tag;           // 日志带端口名前缀（批量模式）
+    bool log_quiet;         // 不输出模组日志（replay回放）
+    
+    // CMUX多路复用（--cmux）：mux持有物理串口，handle为DLC1的本地端
+    bool cmux;
+    struct CmuxMux* mux;
+    struct EC800KModem* owner;      // 作为CMUX数据通道时指向所属模组
+    
+    // 断线重连（模组升级重启），由监听线程维护
+    volatile bool link_down;
+    uint64_t link_lost_ms;
+    uint64_t reconnect_at_ms;
+    int reconnect_backoff_ms;
+    int reconnects;
+    
+    // 网络注册状态（查询结果与+CREG/+CEREG URC更新，state_lock保护）
+    int creg_stat;          // -1表示未知
+    int cereg_stat;
+    int rssi;               // 最近一次AT+CSQ的信号强度，99表示未知
+    int net_wait_ms;        // 升级前等待网络注册的最长时间
+    char apn[64];           // PDP上下文未激活时配置的APN，空则使用模组现有配置
+    char http_urc[128];     // 最近一条+QHTTP*结果URC
+    const char* ca_cert;    // HTTPS用的CA证书路径，为NULL且未tls_insecure时拒绝HTTPS
+    bool tls_insecure;      // HTTPS不校验服务器证书（--insecure）
+    
+    // URC监听线程
+    mutex_t io_lock;        // 串口读操作互斥：AT事务与监听线程不同时读取
+    mutex_t state_lock;
+    cond_t state_cond;      // FOTA状态变化时广播
+    thread_t monitor_thread;
+    bool monitor_running;
+    size_t urc_len;
+    bool rx_stale;          // 上一条命令超时，迟到的回复可能还在串口中，下次发送前先排空（io_lock保护）
+    
+    ModemArena arena;
+} EC800KModem;
+
+#ifdef EC800K_EMBEDDED
+_Static_assert(sizeof(EC800KModem) <= MODEM_FOOTPRINT_MAX, "模组上下文超出嵌入式配置上限");
+#endif
+
+void modem_monitor_stop(EC800KModem* modem);
+bool cmux_start(EC800KModem* modem, bool verbose);
+void cmux_stop(EC800KModem* modem);
+void cmux_free(EC800KModem* modem);
+void telemetry_add(EC800KModem* modem);
+void telemetry_remove(EC800KModem* modem);
+void telemetry_record_download(EC800KModem* modem, uint32_t ms);
+
+// 收发记录的方向（--capture，见"收发记录与回放"）
+typedef enum {
+    TRACE_TX = 1,       // 写入串口的字节
+    TRACE_RX,           // 一次串口读取得到的字节
+    TRACE_NAME          // 通道名（端口路径，CMUX数据通道加":data"），先于该通道的收发记录
+} TraceDir;
+
+void trace_capture(const EC800KModem* modem, TraceDir dir, const void* data, size_t len);
+
+// 端口短名，如/dev/ttyUSB2 -> ttyUSB2
+const char* modem_name(const EC800KModem* modem) {
+    const char* name = strrchr(modem->port_path, '/');
+    return name ? name + 1 : modem->port_path;
+}
+
+// CMUX数据通道上的URC与HTTP结果记到所属模组
+EC800KModem* modem_owner(EC800KModem* modem) {
+    return modem->owner != NULL ? modem->owner : modem;
+}
+
+// 模组相关日志，批量模式下加端口名前缀以区分各模组输出
+void modem_log(const EC800KModem* modem, const char* format, ...) {
+    char msg[LOG_LINE_MAX];
+    va_list args;
+    
+    if (modem->log_quiet) return;
+    va_start(args, format);
+    vsnprintf(msg, sizeof(msg), format, args);
+    va_end(args);
+    
+    if (modem->log_tag) {
+        log_msg("[%s] %s", modem_name(modem), msg);
+    } else {
+        log_msg("%s", msg);
+    }
+}
+
+// 逐条收发/URC跟踪，LOG_LEVEL高于DEBUG时编译期去除
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define modem_debug(modem, ...) modem_log(modem, __VA_ARGS__)
+#else
+#define modem_debug(modem, ...) ((void)(modem))
+#endif
+
+// 初始化模块结构
+void modem_init(EC800KModem* modem, const char* port_path, int baud_rate) {
+    modem->handle = INVALID_SERIAL;
+#ifdef _WIN32
+    modem->rx_event = NULL;
+    modem->tx_event = NULL;
+#endif
+    strncpy(modem->port_path, port_path, sizeof(modem->port_path) - 1);
+    modem->port_path[sizeof(modem->port_path) - 1] = '\0';
+    modem->baud_rate = baud_rate;
+    modem->hw_flow = false;
+    modem->stop_monitor = false;
+    modem->fota_complete = false;
+    modem->fota_result = -1;
+    modem->fota_stage = FOTA_STAGE_IDLE;
+    modem->fota_progress = 0;
+    modem->fota_start_ms = 0;
+    modem->fota_end_ms = 0;
+    modem->download_result = -1;
+    modem->download_end_ms = 0;
+    modem->fw_version[0] = '\0';
+    modem->imei[0] = '\0';
+    modem->iccid[0] = '\0';
+    modem->info_valid = false;
+    modem->rebooted = false;
+    modem->state_cache = false;
+    modem->fota_force = false;
+    modem->download_start_us = 0;
+    modem->update_start_us = 0;
+    modem->update_step_us = 0;
+    modem->log_tag = false;
+    modem->log_quiet = false;
+    modem->cmux = false;
+    modem->mux = NULL;
+    modem->owner = NULL;
+    modem->link_down = false;
+    modem->rx_stale = false;
+    modem->link_lost_ms = 0;
+    modem->reconnect_at_ms = 0;
+    modem->reconnect_backoff_ms = 0;
+    modem->reconnects = 0;
+    modem->creg_stat = -1;
+    modem->rssi = 99;
+    modem->cereg_stat = -1;
+    modem->net_wait_ms = NET_READY_TIMEOUT_MS;
+    modem->apn[0] = '\0';
+    modem->ca_cert = NULL;
+    modem->tls_insecure = false;
+    mutex_init(&modem->io_lock);
+    mutex_init(&modem->state_lock);
+    cond_init(&modem->state_cond);
+    modem->monitor_running = false;
+    modem->urc_len = 0;
+}
+
+// 应用命令行选项中与单个模组相关的设置
+void modem_apply_options(EC800KModem* modem, const ToolOptions* opts) {
+    modem->hw_flow = opts->hw_flow;
+    modem->net_wait_ms = opts->net_wait_s * 1000;
+    if (opts->apn != NULL) snprintf(modem->apn, sizeof(modem->apn), "%s", opts->apn);
+    modem->state_cache = opts->state_cache;
+    modem->fota_force = opts->force;
+    modem->cmux = opts->cmux;
+    modem->ca_cert = opts->ca_cert;
+    modem->tls_insecure = opts->insecure;
+}
+
+// 释放模块结构持有的同步对象
+void modem_destroy(EC800KModem* modem) {
+    cmux_free(modem);
+    cond_destroy(&modem->state_cond);
+    mutex_destroy(&modem->state_lock);
+    mutex_destroy(&modem->io_lock);
+}
+
+#ifndef _WIN32
+// 波特率转换为termios常量，无对应常量返回0（需走非标准速率设置）
+speed_t baud_to_speed(int baud_rate) {
+    switch (baud_rate) {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+#ifdef B230400
+        case 230400:  return B230400;
+#endif
+#ifdef B460800
+        case 460800:  return B460800;
+#endif
+#ifdef B921600
+        case 921600:  return B921600;
+#endif
+#ifdef B1000000
+        case 1000000: return B1000000;
+#endif
+#ifdef B1500000
+        case 1500000: return B1500000;
+#endif
+#ifdef B2000000
+        case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+        case 3000000: return B3000000;
+#endif
+        default:      return (speed_t)0;
+    }
+}
+
+#ifdef __linux__
+// 内核struct termios2（asm/termbits.h与glibc的termios.h不能同时包含）
+struct termios2_compat {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#define TCGETS2_COMPAT _IOR('T', 0x2A, struct termios2_compat)
+#define TCSETS2_COMPAT _IOW('T', 0x2B, struct termios2_compat)
+#define BOTHER_COMPAT 0010000
+#endif
+
+// 设置任意波特率：Linux使用termios2/BOTHER，macOS使用IOSSIOSPEED
+bool serial_set_custom_speed(int fd, int baud_rate) {
+#if defined(__linux__)
+    struct termios2_compat tio;
+    if (ioctl(fd, TCGETS2_COMPAT, &tio) != 0) return false;
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER_COMPAT;
+    tio.c_ispeed = (speed_t)baud_rate;
+    tio.c_ospeed = (speed_t)baud_rate;
+    return ioctl(fd, TCSETS2_COMPAT, &tio) == 0;
+#elif defined(__APPLE__)
+    speed_t speed = (speed_t)baud_rate;
+    return ioctl(fd, IOSSIOSPEED, &speed) == 0;
+#else
+    (void)fd;
+    (void)baud_rate;
+    return false;
+#endif
+}
+#endif
+
+// 连接串口
+// 打开并配置串口；verbose为false时不输出日志（重连时反复尝试）
+bool modem_open_port(EC800KModem* modem, bool verbose) {
+#ifdef _WIN32
+    char full_path[256];
+    snprintf(full_path, sizeof(full_path), "\\\\.\\%s", modem->port_path);
+    
+    modem->handle = CreateFileA(
+        full_path,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_OVERLAPPED,
+        NULL
+    );
+    
+    if (modem->handle == INVALID_HANDLE_VALUE) {
+        if (verbose) modem_log(modem, "❌ 串口连接失败: %s (错误码: %lu)", modem->port_path, GetLastError());
+        return false;
+    }
+    
+    DCB dcb = {0};
+    dcb.DCBlength = sizeof(DCB);
+    
+    if (!GetCommState(modem->handle, &dcb)) {
+        CloseHandle(modem->handle);
+        modem->handle = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    
+    dcb.BaudRate = modem->baud_rate;
+    dcb.ByteSize = 8;
+    dcb.Parity = NOPARITY;
+    dcb.StopBits = ONESTOPBIT;
+    dcb.fBinary = TRUE;
+    dcb.fDtrControl = DTR_CONTROL_ENABLE;
+    dcb.fOutxCtsFlow = modem->hw_flow ? TRUE : FALSE;
+    dcb.fRtsControl = modem->hw_flow ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+    
+    if (!SetCommState(modem->handle, &dcb)) {
+        CloseHandle(modem->handle);
+        modem->handle = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    
+    // ReadIntervalTimeout与ReadTotalTimeoutMultiplier均为MAXDWORD时，
+    // ReadFile在有任意字节到达时立即完成，实际等待时长由serial_read控制
+    COMMTIMEOUTS timeouts = {0};
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = SERIAL_IO_TIMEOUT_MS;
+    timeouts.WriteTotalTimeoutConstant = 0;     // 写超时由serial_write_timeout控制
+    timeouts.WriteTotalTimeoutMultiplier = 0;
+    SetCommTimeouts(modem->handle, &timeouts);
+    
+    modem->rx_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    modem->tx_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (modem->rx_event == NULL || modem->tx_event == NULL) {
+        if (modem->rx_event != NULL) CloseHandle(modem->rx_event);
+        if (modem->tx_event != NULL) CloseHandle(modem->tx_event);
+        modem->rx_event = NULL;
+        modem->tx_event = NULL;
+        CloseHandle(modem->handle);
+        modem->handle = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    
+#else
+    modem->handle = open(modem->port_path, O_RDWR | O_NOCTTY | O_NDELAY);
+    
+    if (modem->handle < 0) {
+        if (verbose) modem_log(modem, "❌ 串口连接失败: %s (%s)", modem->port_path, strerror(errno));
+        return false;
+    }
+    
+    struct termios options;
+    tcgetattr(modem->handle, &options);
+    
+    // 设置波特率，非标准速率在tcsetattr之后单独设置
+    speed_t speed = baud_to_speed(modem->baud_rate);
+    bool custom_speed = speed == (speed_t)0;
+    if (custom_speed) speed = B115200;
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    
+    // 8N1
+    options.c_cflag &= ~PARENB;
+    options.c_cflag &= ~CSTOPB;
+    options.c_cflag &= ~CSIZE;
+    options.c_cflag |= CS8;
+    options.c_cflag |= (CLOCAL | CREAD);
+    
+    // Raw模式
+    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+    options.c_iflag &= ~(IXON | IXOFF | IXANY);
+    options.c_oflag &= ~OPOST;
+    
+    // 硬件流控
+    if (modem->hw_flow) {
+        options.c_cflag |= CRTSCTS;
+    } else {
+        options.c_cflag &= ~CRTSCTS;
+    }
+    
+    // 非阻塞读，等待由poll()完成
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    
+    tcsetattr(modem->handle, TCSANOW, &options);
+    if (custom_speed && !serial_set_custom_speed(modem->handle, modem->baud_rate)) {
+        if (verbose) modem_log(modem, "❌ 不支持的波特率: %d", modem->baud_rate);
+        close(modem->handle);
+        modem->handle = INVALID_SERIAL;
+        return false;
+    }
+    tcflush(modem->handle, TCIOFLUSH);
+    
+    // 物理串口交给复用线程，handle换成DLC1的本地端
+    if (modem->cmux && !cmux_start(modem, verbose)) {
+        close(modem->handle);
+        modem->handle = INVALID_SERIAL;
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool modem_connect(EC800KModem* modem) {
+    if (!modem_open_port(modem, true)) return false;
+    modem_log(modem, "✅ 串口连接成功: %s @ %dbps%s", modem->port_path, modem->baud_rate,
+              modem->hw_flow ? " (RTS/CTS)" : "");
+    if (modem->cmux) {
+        modem_log(modem, "🔀 已进入CMUX模式: DLC1 AT控制 / DLC2 URC / DLC3 数据传输");
+    }
+    telemetry_add(modem);
+    return true;
+}
+
+// 关闭串口句柄及其事件对象，返回此前是否处于打开状态
+bool serial_close(EC800KModem* modem) {
+#ifdef _WIN32
+    if (modem->rx_event != NULL) {
+        CloseHandle(modem->rx_event);
+        modem->rx_event = NULL;
+    }
+    if (modem->tx_event != NULL) {
+        CloseHandle(modem->tx_event);
+        modem->tx_event = NULL;
+    }
+#endif
+    cmux_stop(modem);
+    if (modem->handle == INVALID_SERIAL) return false;
+#ifdef _WIN32
+    CloseHandle(modem->handle);
+#else
+    close(modem->handle);
+#endif
+    modem->handle = INVALID_SERIAL;
+    return true;
+}
+
+// 断开连接
+void modem_disconnect(EC800KModem* modem) {
+    telemetry_remove(modem);
+    modem_monitor_stop(modem);
+    if (serial_close(modem)) {
+        modem_log(modem, "🔌 串口已断开");
+    }
+}
+
+// 写入全部数据，stall_ms内无任何进展（如流控长时间阻塞）视为失败
+bool serial_write_timeout(EC800KModem* modem, const void* data, size_t len, int stall_ms) {
+    const char* p = (const char*)data;
+    trace_capture(modem, TRACE_TX, data, len);
+#ifdef _WIN32
+    while (len > 0) {
+        OVERLAPPED ov = {0};
+        DWORD written = 0;
+        ov.hEvent = modem->tx_event;
+        ResetEvent(ov.hEvent);
+        if (!WriteFile(modem->handle, p, (DWORD)len, &written, &ov)) {
+            if (GetLastError() != ERROR_IO_PENDING) return false;
+            if (WaitForSingleObject(ov.hEvent, (DWORD)stall_ms) != WAIT_OBJECT_0) {
+                CancelIo(modem->handle);
+            }
+            if (!GetOverlappedResult(modem->handle, &ov, &written, TRUE) &&
+                GetLastError() != ERROR_OPERATION_ABORTED) {
+                return false;
+            }
+        }
+        if (written == 0) return false;
+        p += written;
+        len -= written;
+    }
+#else
+    while (len > 0) {
+        ssize_t n = write(modem->handle, p, len);
+        if (n > 0) {
+            p += n;
+            len -= (size_t)n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // 发送缓冲区满（或CTS无效），等待可写
+            struct pollfd pfd = { modem->handle, POLLOUT, 0 };
+            if (poll(&pfd, 1, stall_ms) <= 0) return false;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+bool serial_write(EC800KModem* modem, const void* data, size_t len) {
+    return serial_write_timeout(modem, data, len, SERIAL_IO_TIMEOUT_MS);
+}
+
+// 等待数据到达并读取，数据到达即返回
+// 返回读取字节数，0表示超时，-1表示串口错误
+int serial_read(EC800KModem* modem, void* buf, size_t size, int timeout_ms) {
+#ifdef _WIN32
+    OVERLAPPED ov = {0};
+    DWORD n = 0;
+    ov.hEvent = modem->rx_event;
+    ResetEvent(ov.hEvent);
+    if (!ReadFile(modem->handle, buf, (DWORD)size, &n, &ov)) {
+        if (GetLastError() != ERROR_IO_PENDING) return -1;
+        DWORD wait = WaitForSingleObject(ov.hEvent, (DWORD)timeout_ms);
+        if (wait != WAIT_OBJECT_0) {
+            // 超时：取消挂起的读操作，并收取取消前可能已到达的数据
+            CancelIo(modem->handle);
+        }
+        if (!GetOverlappedResult(modem->handle, &ov, &n, TRUE)) {
+            return GetLastError() == ERROR_OPERATION_ABORTED ? 0 : -1;
+        }
+    }
+    if (n > 0) trace_capture(modem, TRACE_RX, buf, n);
+    return (int)n;
+#else
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    for (;;) {
+        struct pollfd pfd = { modem->handle, POLLIN, 0 };
+        int ret = poll(&pfd, 1, remaining_ms(deadline));
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ret == 0) return 0;
+        if (pfd.revents & POLLIN) {
+            ssize_t n = read(modem->handle, buf, size);
+            if (n > 0) {
+                trace_capture(modem, TRACE_RX, buf, (size_t)n);
+                return (int)n;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            return -1;
+        }
+        // POLLERR/POLLHUP/POLLNVAL：设备已断开
+        return -1;
+    }
+#endif
+}
+
+// ================== CMUX多路复用 ==================
+
+// 3GPP TS 27.010基本模式：AT+CMUX=0之后物理串口上只传输帧
+//   F9 | 地址(DLCI<<2|C/R<<1|EA) | 控制 | 长度(EA=1时1字节) | 信息 | FCS | F9
+// 复用线程独占物理串口，DLC1与DLC3在本地各对应一对socket：
+//   DLC1 AT控制：modem->handle指向本地端，AT事务与监听线程照常读写
+//   DLC2 URC：复用线程直接按行分发，不经io_lock，大块传输或长事务期间FOTA进度照常推进
+//   DLC3 数据：mux->bulk是一个独立的EC800KModem（自有io_lock与arena），
+//              HTTP请求/读取、AT+QFDWL与本地差分包发送走这里，不阻塞DLC1上的状态查询
+// 模组URC从哪个DLC输出取决于固件，三个通道上收到的URC都会分发到所属模组
+
+#define CMUX_DLC_AT 1
+#define CMUX_DLC_URC 2
+#define CMUX_DLC_DATA 3
+#define CMUX_DLC_COUNT 4                // 含控制通道DLC0
+#define CMUX_N1 127                     // 单帧信息字段上限（AT+CMUX=0的默认N1）
+#define CMUX_RX_SIZE (2 * (CMUX_N1 + 8))
+#define CMUX_SETUP_TIMEOUT_MS 1000      // AT+CMUX=0及每个DLC的SABM/UA握手
+#define CMUX_URC_POLL_MS 20             // 数据通道等待经DLC2到达的HTTP结果URC时的读取分段
+
+#define CMUX_FLAG 0xF9
+#define CMUX_SABM 0x2F
+#define CMUX_UA 0x63
+#define CMUX_DM 0x0F
+#define CMUX_UIH 0xEF
+#define CMUX_PF 0x10
+#define CMUX_CLD 0xC3                   // DLC0上的多路复用关闭命令(CLD, C/R=1)
+
+#ifndef _WIN32
+
+typedef struct CmuxMux {
+    int uart;                           // 物理串口
+    int fds[CMUX_DLC_COUNT];            // 复用线程一侧的socket，-1表示无（DLC0与URC通道）
+    thread_t thread;
+    volatile bool running;
+    volatile bool stop;
+    volatile bool dead;                 // 物理串口断开、模组关闭复用或重启回到AT模式
+    int ack[CMUX_DLC_COUNT];            // 握手应答：1=UA，-1=DM
+    int text_result;                    // 帧外文本的结果码：1=OK，-1=ERROR
+    EC800KModem* owner;
+    EC800KModem bulk;                   // DLC3数据通道
+    unsigned char rx[CMUX_RX_SIZE];     // 尚未组成完整帧的接收字节
+    size_t rx_len;
+    char text[64];                      // 帧外文本行（AT+CMUX应答、重启后的RDY）
+    size_t text_len;
+    char urc[URC_BUF_SIZE];             // DLC2行缓冲
+    size_t urc_len;
+} CmuxMux;
+
+void modem_handle_urc(EC800KModem* modem, const char* line);
+
+// FCS：反射多项式x^8+x^2+x+1（0xE0），初值0xFF，结果取反；UIH帧只覆盖地址、控制与长度
+unsigned char cmux_fcs(const unsigned char* p, size_t len) {
+    unsigned char crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (unsigned char)((crc >> 1) ^ 0xE0) : (unsigned char)(crc >> 1);
+        }
+    }
+    return (unsigned char)(0xFF - crc);
+}
+
+// 写入全部数据；物理串口为非阻塞打开，发送缓冲满时等待可写
+bool cmux_write_all(int fd, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n > 0) {
+            p += n;
+            len -= (size_t)n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            if (poll(&pfd, 1, SERIAL_IO_TIMEOUT_MS) <= 0) return false;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 组帧并写入物理串口（本端为发起方，命令与UIH的C/R位为1），len不超过CMUX_N1
+bool cmux_send(CmuxMux* mux, int dlci, unsigned char control, const void* info, size_t len) {
+    unsigned char frame[CMUX_N1 + 6];
+    
+    frame[0] = CMUX_FLAG;
+    frame[1] = (unsigned char)((dlci << 2) | 0x03);
+    frame[2] = control;
+    frame[3] = (unsigned char)((len << 1) | 0x01);
+    if (len > 0) memcpy(frame + 4, info, len);
+    frame[4 + len] = cmux_fcs(frame + 1, 3);
+    frame[5 + len] = CMUX_FLAG;
+    return cmux_write_all(mux->uart, frame, len + 6);
+}
+
+// 请求模组关闭复用、回到AT模式
+void cmux_send_close(CmuxMux* mux) {
+    static const unsigned char cld[] = { CMUX_CLD, 0x01 };
+    cmux_send(mux, 0, CMUX_UIH, cld, sizeof(cld));
+}
+
+// 帧外的文本行：握手阶段为AT+CMUX=0的应答；复用建立后出现RDY说明模组已重启、退出了复用
+void cmux_feed_text(CmuxMux* mux, unsigned char c) {
+    if (c != '\r' && c != '\n') {
+        if (mux->text_len < sizeof(mux->text) - 1) mux->text[mux->text_len++] = (char)c;
+        return;
+    }
+    if (mux->text_len == 0) return;
+    mux->text[mux->text_len] = '\0';
+    mux->text_len = 0;
+    
+    if (strcmp(mux->text, "OK") == 0) {
+        mux->text_result = 1;
+    } else if (strcmp(mux->text, "ERROR") == 0 || strncmp(mux->text, "+CME ERROR:", 11) == 0) {
+        mux->text_result = -1;
+    } else if (strcmp(mux->text, "RDY") == 0 && mux->running) {
+        modem_handle_urc(mux->owner, mux->text);
+        mux->dead = true;
+    }
+}
+
+// DLC2上的数据按行分发URC
+void cmux_feed_urc(CmuxMux* mux, const unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = (char)data[i];
+        if (c == '\r' || c == '\n') {
+            if (mux->urc_len > 0) {
+                mux->urc[mux->urc_len] = '\0';
+                modem_debug(mux->owner, "📨 URC(DLC%d): %s", CMUX_DLC_URC, mux->urc);
+                modem_handle_urc(mux->owner, mux->urc);
+                mux->urc_len = 0;
+            }
+        } else if (mux->urc_len < sizeof(mux->urc) - 1) {
+            mux->urc[mux->urc_len++] = c;
+        }
+    }
+}
+
+// 处理一个完整帧：UA/DM记录握手结果，UIH按DLC交付
+void cmux_on_frame(CmuxMux* mux, int dlci, unsigned char control, const unsigned char* info, size_t len) {
+    unsigned char type = (unsigned char)(control & ~CMUX_PF);
+    
+    if (dlci >= CMUX_DLC_COUNT) return;
+    if (type == CMUX_UA || type == CMUX_DM) {
+        mux->ack[dlci] = type == CMUX_UA ? 1 : -1;
+        return;
+    }
+    if (type != CMUX_UIH || len == 0) return;
+    
+    if (dlci == 0) {
+        // 控制通道：模组关闭复用时下线，其余命令（如MSC）清除C/R位原样应答
+        if (info[0] == CMUX_CLD) {
+            mux->dead = true;
+        } else if (info[0] & 0x02) {
+            unsigned char reply[CMUX_N1];
+            memcpy(reply, info, len);
+            reply[0] &= (unsigned char)~0x02;
+            cmux_send(mux, 0, CMUX_UIH, reply, len);
+        }
+    } else if (dlci == CMUX_DLC_URC) {
+        cmux_feed_urc(mux, info, len);
+    } else if (mux->fds[dlci] >= 0 && !cmux_write_all(mux->fds[dlci], info, len)) {
+        modem_log(mux->owner, "⚠️ DLC%d本地端已关闭，丢弃%zu字节", dlci, len);
+    }
+}
+
+// 从物理串口收到的字节中切出帧；FCS或结束标志不对时从下一字节重新同步
+void cmux_rx_feed(CmuxMux* mux, const unsigned char* data, size_t n) {
+    unsigned char* rx = mux->rx;
+    size_t pos = 0;
+    
+    if (n > sizeof(mux->rx) - mux->rx_len) mux->rx_len = 0;    // 长时间失步，丢弃未成帧数据
+    memcpy(rx + mux->rx_len, data, n);
+    mux->rx_len += n;
+    
+    while (pos < mux->rx_len) {
+        if (rx[pos] != CMUX_FLAG) {
+            cmux_feed_text(mux, rx[pos++]);
+            continue;
+        }
+        // 相邻帧之间可能有多个标志
+        size_t p = pos + 1;
+        while (p < mux->rx_len && rx[p] == CMUX_FLAG) p++;
+        pos = p - 1;
+        if (mux->rx_len - p < 3) break;
+    
+        size_t head = 3;
+        size_t len = rx[p + 2] >> 1;
+        if (!(rx[p + 2] & 0x01)) {
+            if (mux->rx_len - p < 4) break;
+            len |= (size_t)rx[p + 3] << 7;
+            head = 4;
+        }
+        if (len > CMUX_N1) {
+            pos = p;        // 超过N1的长度按失步处理，与FCS错误一样从下一字节重新同步
+            continue;
+        }
+        if (mux->rx_len - p < head + len + 2) break;    // 帧未收全
+        if (rx[p + head + len] != cmux_fcs(rx + p, head) || rx[p + head + len + 1] != CMUX_FLAG) {
+            pos = p;
+            continue;
+        }
+        cmux_on_frame(mux, rx[p] >> 2, rx[p + 1], rx + p + head, len);
+        pos = p + head + len + 1;   // 结束标志兼作下一帧的起始标志
+    }
+    memmove(rx, rx + pos, mux->rx_len - pos);
+    mux->rx_len -= pos;
+}
+
+// 握手阶段（复用线程启动前）读取物理串口，直到*flag被置位或超时，返回是否为肯定应答
+bool cmux_wait(CmuxMux* mux, const int* flag, int timeout_ms) {
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    unsigned char buf[256];
+    
+    while (*flag == 0) {
+        int wait = remaining_ms(deadline);
+        if (wait <= 0) return false;
+        struct pollfd pfd = { mux->uart, POLLIN, 0 };
+        if (poll(&pfd, 1, wait) <= 0) continue;
+        ssize_t n = read(mux->uart, buf, sizeof(buf));
+        if (n > 0) {
+            cmux_rx_feed(mux, buf, (size_t)n);
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            return false;
+        }
+    }
+    return *flag > 0;
+}
+
+THREAD_RETURN cmux_thread(void* arg) {
+    CmuxMux* mux = (CmuxMux*)arg;
+    unsigned char buf[CMUX_RX_SIZE];
+    
+    while (!mux->stop && !mux->dead) {
+        struct pollfd pfds[CMUX_DLC_COUNT];
+        pfds[0].fd = mux->uart;
+        for (int i = 1; i < CMUX_DLC_COUNT; i++) pfds[i].fd = mux->fds[i];     // 负值fd被poll忽略
+        for (int i = 0; i < CMUX_DLC_COUNT; i++) {
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+    
+        int ret = poll(pfds, CMUX_DLC_COUNT, MONITOR_POLL_MS);
+        if (ret < 0 && errno != EINTR) break;
+        if (ret <= 0) continue;
+    
+        if (pfds[0].revents & POLLIN) {
+            ssize_t n = read(mux->uart, buf, sizeof(buf) / 2);
+            if (n > 0) {
+                cmux_rx_feed(mux, buf, (size_t)n);
+            } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                mux->dead = true;
+            }
+        } else if (pfds[0].revents != 0) {
+            mux->dead = true;       // 物理串口断开
+        }
+    
+        // 本地端写入的数据按N1分帧发出
+        for (int i = 1; i < CMUX_DLC_COUNT && !mux->dead; i++) {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP))) continue;
+            ssize_t n = read(mux->fds[i], buf, CMUX_N1);
+            if (n > 0) {
+                if (!cmux_send(mux, i, CMUX_UIH, buf, (size_t)n)) mux->dead = true;
+            } else if (n == 0) {
+                close(mux->fds[i]);
+                mux->fds[i] = -1;
+            }
+        }
+    }
+    if (!mux->dead) cmux_send_close(mux);
+    mux->dead = true;
+    
+    // 关闭本侧socket，通道另一端随即读到EOF，监听线程按断线处理并重新建立复用
+    for (int i = 1; i < CMUX_DLC_COUNT; i++) {
+        if (mux->fds[i] >= 0) close(mux->fds[i]);
+        mux->fds[i] = -1;
+    }
+    return THREAD_RESULT;
+}
+
+// 建立一个DLC的本地socket对，返回本地端（非阻塞，与串口句柄用法一致）
+int cmux_open_channel(CmuxMux* mux, int dlci) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return -1;
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+    mux->fds[dlci] = sv[0];
+    return sv[1];
+}
+
+// 在已打开的物理串口上进入CMUX（每次打开/重连时调用），成功后modem->handle换为DLC1本地端
+bool cmux_start(EC800KModem* modem, bool verbose) {
+    CmuxMux* mux = modem->mux;
+    static const char cmd[] = "AT+CMUX=0\r\n";
+    
+    if (mux == NULL) {
+        // 首次建立时分配，此后跨重连复用，数据通道的地址保持不变
+        mux = (CmuxMux*)calloc(1, sizeof(CmuxMux));
+        if (mux == NULL) {
+            modem_log(modem, "❌ 内存不足");
+            return false;
+        }
+        modem_init(&mux->bulk, modem->port_path, modem->baud_rate);
+        mux->bulk.owner = modem;
+        mux->owner = modem;
+        modem->mux = mux;
+    }
+    signal(SIGPIPE, SIG_IGN);   // 复用线程退出后本地端write返回EPIPE而不是终止进程
+    mux->bulk.hw_flow = modem->hw_flow;
+    mux->bulk.log_tag = modem->log_tag;
+    mux->uart = modem->handle;
+    mux->stop = false;
+    mux->dead = false;
+    mux->rx_len = 0;
+    mux->text_len = 0;
+    mux->urc_len = 0;
+    mux->text_result = 0;
+    for (int i = 0; i < CMUX_DLC_COUNT; i++) {
+        mux->fds[i] = -1;
+        mux->ack[i] = 0;
+    }
+    
+    // 先发一个关闭复用帧：模组若还处于上次遗留的复用模式则回到AT模式，AT模式下这几个字节不含CR会被忽略
+    cmux_send_close(mux);
+    sleep_ms(50);
+    tcflush(mux->uart, TCIFLUSH);
+    
+    if (!cmux_write_all(mux->uart, cmd, sizeof(cmd) - 1) ||
+        !cmux_wait(mux, &mux->text_result, CMUX_SETUP_TIMEOUT_MS)) {
+        if (verbose) modem_log(modem, "❌ AT+CMUX=0 失败，模组不支持或未就绪");
+        return false;
+    }
+    for (int dlci = 0; dlci < CMUX_DLC_COUNT; dlci++) {
+        if (!cmux_send(mux, dlci, CMUX_SABM | CMUX_PF, NULL, 0) ||
+            !cmux_wait(mux, &mux->ack[dlci], CMUX_SETUP_TIMEOUT_MS)) {
+            if (verbose) modem_log(modem, "❌ CMUX DLC%d建立失败", dlci);
+            cmux_send_close(mux);
+            return false;
+        }
+    }
+    
+    int at = cmux_open_channel(mux, CMUX_DLC_AT);
+    int data = at >= 0 ? cmux_open_channel(mux, CMUX_DLC_DATA) : -1;
+    if (data < 0 || !thread_create(&mux->thread, cmux_thread, mux)) {
+        if (verbose) modem_log(modem, "❌ CMUX本地通道创建失败");
+        if (at >= 0) close(at);
+        if (data >= 0) close(data);
+        for (int i = 1; i < CMUX_DLC_COUNT; i++) {
+            if (mux->fds[i] >= 0) close(mux->fds[i]);
+            mux->fds[i] = -1;
+        }
+        cmux_send_close(mux);
+        return false;
+    }
+    
+    modem->handle = at;
+    mutex_lock(&mux->bulk.io_lock);
+    mux->bulk.handle = data;
+    mutex_unlock(&mux->bulk.io_lock);
+    mux->running = true;
+    return true;
+}
+
+// 停止复用线程并关闭物理串口（modem->handle即DLC1本地端由调用方关闭）
+void cmux_stop(EC800KModem* modem) {
+    CmuxMux* mux = modem->mux;
+    if (mux == NULL || !mux->running) return;
+    
+    mux->running = false;   // 新的大块传输改走modem本身（随即一并关闭）
+    mux->stop = true;
+    thread_join(mux->thread);
+    
+    // 进行中的大块传输读到EOF后释放io_lock，再关闭数据通道
+    mutex_lock(&mux->bulk.io_lock);
+    serial_close(&mux->bulk);
+    mutex_unlock(&mux->bulk.io_lock);
+    close(mux->uart);
+    mux->uart = -1;
+}
+
+void cmux_free(EC800KModem* modem) {
+    CmuxMux* mux = modem->mux;
+    if (mux == NULL) return;
+    cmux_stop(modem);
+    modem_destroy(&mux->bulk);
+    free(mux);
+    modem->mux = NULL;
+}
+
+// 大块传输使用的通道：CMUX已建立时为DLC3数据通道，否则为模组本身
+EC800KModem* modem_bulk(EC800KModem* modem) {
+    return modem->mux != NULL && modem->mux->running ? &modem->mux->bulk : modem;
+}
+
+#else
+// Windows重叠I/O的串口句柄无法与socket统一等待，暂不支持（main中拒绝--cmux）
+bool cmux_start(EC800KModem* modem, bool verbose) {
+    (void)modem;
+    (void)verbose;
+    return false;
+}
+
+void cmux_stop(EC800KModem* modem) {
+    (void)modem;
+}
+
+void cmux_free(EC800KModem* modem) {
+    (void)modem;
+}
+
+EC800KModem* modem_bulk(EC800KModem* modem) {
+    return modem;
+}
+#endif
+
+// ================== AT行分类 ==================
+
+#define AT_TOKEN_MAX 16     // 表中最长前缀的长度上限
+
+// 行类别，决定一行在AT事务与URC监听中的去向
+typedef enum {
+    AT_CLASS_INFO,          // 命令的信息行
+    AT_CLASS_FINAL,         // 最终结果码
+    AT_CLASS_URC,           // 任何时候都是URC
+    AT_CLASS_REG,           // 注册状态：查询CREG/CEREG时为信息行，否则为URC
+    AT_CLASS_HTTP           // 模组HTTP结果URC，由监听路径记录到http_urc
+} AtLineClass;
+
+// 已知的结果码、URC与信息行前缀：X(标识, 前缀, 类别)
+// 以'+'开头的行按"+XXX:"比较，其余（OK、RDY等）整行比较
+#define AT_LINE_TABLE(X) \
+    X(OK,        "OK",          AT_CLASS_FINAL) \
+    X(ERROR,     "ERROR",       AT_CLASS_FINAL) \
+    X(CONNECT,   "CONNECT",     AT_CLASS_FINAL) \
+    X(CME_ERROR, "+CME ERROR:", AT_CLASS_FINAL) \
+    X(CMS_ERROR, "+CMS ERROR:", AT_CLASS_FINAL) \
+    X(RDY,       "RDY",         AT_CLASS_URC) \
+    X(QIND,      "+QIND:",      AT_CLASS_URC) \
+    X(CREG,      "+CREG:",      AT_CLASS_REG) \
+    X(CEREG,     "+CEREG:",     AT_CLASS_REG) \
+    X(QHTTPGET,  "+QHTTPGET:",  AT_CLASS_HTTP) \
+    X(QHTTPPOST, "+QHTTPPOST:", AT_CLASS_HTTP) \
+    X(QHTTPPUT,  "+QHTTPPUT:",  AT_CLASS_HTTP) \
+    X(QHTTPREAD, "+QHTTPREAD:", AT_CLASS_HTTP) \
+    X(CSQ,       "+CSQ:",       AT_CLASS_INFO) \
+    X(CPIN,      "+CPIN:",      AT_CLASS_INFO) \
+    X(QCCID,     "+QCCID:",     AT_CLASS_INFO) \
+    X(CGATT,     "+CGATT:",     AT_CLASS_INFO) \
+    X(QIACT,     "+QIACT:",     AT_CLASS_INFO) \
+    X(QFLST,     "+QFLST:",     AT_CLASS_INFO) \
+    X(QFDWL,     "+QFDWL:",     AT_CLASS_INFO) \
+    X(QENG,      "+QENG:",      AT_CLASS_INFO) \
+    X(QCSQ,      "+QCSQ:",      AT_CLASS_INFO)
+
+typedef enum {
+    AT_LINE_UNKNOWN,
+#define X(id, text, cls) AT_LINE_##id,
+    AT_LINE_TABLE(X)
+#undef X
+    AT_LINE_KIND_COUNT
+} AtLineKind;
+
+const AtLineClass at_line_class[AT_LINE_KIND_COUNT] = {
+    AT_CLASS_INFO,
+#define X(id, text, cls) cls,
+    AT_LINE_TABLE(X)
+#undef X
+};
+
+// +QIND: "FOTA","<事件>"[,<值>]：X(标识, 事件名)
+#define FOTA_EVENT_TABLE(X) \
+    X(HTTPSTART,   "HTTPSTART") \
+    X(FTPSTART,    "FTPSTART") \
+    X(FILESTART,   "FILESTART") \
+    X(DOWNLOADING, "DOWNLOADING") \
+    X(HTTPEND,     "HTTPEND") \
+    X(FTPEND,      "FTPEND") \
+    X(FILEEND,     "FILEEND") \
+    X(START,       "START") \
+    X(UPDATING,    "UPDATING") \
+    X(END,         "END")
+
+typedef enum {
+    FOTA_EVENT_UNKNOWN,
+#define X(id, text) FOTA_EVENT_##id,
+    FOTA_EVENT_TABLE(X)
+#undef X
+} FotaEvent;
+
+// 展开为按长度分桶的比较：长度是编译期常量，只有长度相同的项才会memcmp
+AtLineKind at_line_lookup(const char* s, size_t len) {
+#define X(id, text, cls) if (len == sizeof(text) - 1 && memcmp(s, text, sizeof(text) - 1) == 0) return AT_LINE_##id;
+    AT_LINE_TABLE(X)
+#undef X
+    return AT_LINE_UNKNOWN;
+}
+
+FotaEvent fota_event_lookup(const char* s, size_t len) {
+#define X(id, text) if (len == sizeof(text) - 1 && memcmp(s, text, sizeof(text) - 1) == 0) return FOTA_EVENT_##id;
+    FOTA_EVENT_TABLE(X)
+#undef X
+    return FOTA_EVENT_UNKNOWN;
+}
+
+// 行分类：每行只取一次行首标记并查表；*args指向前缀之后的参数（跳过空格）
+AtLineKind at_classify(const char* line, size_t len, const char** args) {
+    size_t token = len;
+    
+    if (len > 0 && line[0] == '+') {
+        const char* colon = (const char*)memchr(line, ':', len < AT_TOKEN_MAX ? len : AT_TOKEN_MAX);
+        if (colon == NULL) return AT_LINE_UNKNOWN;
+        token = (size_t)(colon - line) + 1;
+    } else if (len > AT_TOKEN_MAX) {
+        return AT_LINE_UNKNOWN;
+    }
+    
+    AtLineKind kind = at_line_lookup(line, token);
+    if (args != NULL) {
+        const char* p = line + token;
+        while (p < line + len && *p == ' ') p++;
+        *args = p;
+    }
+    return kind;
+}
+
+// 以下解析器的参数不要求'\0'结尾（行视图其后紧跟CR），遇到非数字即停止
+int at_parse_int(const char* args) {
+    return (int)strtol(args, NULL, 10);
+}
+
+// 读取一个整数并跳过其后的','，失败返回false
+bool at_parse_next_int(const char** p, int* value) {
+    char* end;
+    long v = strtol(*p, &end, 10);
+    if (end == *p) return false;
+    *value = (int)v;
+    *p = *end == ',' ? end + 1 : end;
+    return true;
+}
+
+// 注册状态：查询响应为<n>,<stat>[,...]，URC为<stat>[,...]
+bool at_parse_reg(const char* args, bool query, int* stat) {
+    int n;
+    if (query && !at_parse_next_int(&args, &n)) return false;
+    return at_parse_next_int(&args, stat);
+}
+
+// +CSQ: <rssi>,<ber>
+bool at_parse_csq(const char* args, int* rssi, int* ber) {
+    *ber = 99;
+    if (!at_parse_next_int(&args, rssi)) return false;
+    at_parse_next_int(&args, ber);
+    return true;
+}
+
+// +QHTTPxxx: <err>[,<httprspcode>[,...]]
+bool at_parse_http(const char* args, int* err, int* status) {
+    if (!at_parse_next_int(&args, err)) return false;
+    at_parse_next_int(&args, status);
+    return true;
+}
+
+// +QIND: "FOTA","<事件>"[,<值>]，非FOTA上报返回false（URC行以'\0'结尾）
+bool at_parse_fota_event(const char* args, FotaEvent* event, int* value, bool* has_value) {
+    if (strncmp(args, "\"FOTA\",\"", 8) != 0) return false;
+    const char* name = args + 8;
+    while (*name == ' ') name++;
+    const char* quote = strchr(name, '"');
+    if (quote == NULL) return false;
+    
+    *event = fota_event_lookup(name, (size_t)(quote - name));
+    const char* p = quote + 1;
+    *has_value = false;
+    if (*p == ',') {
+        p++;
+        *has_value = at_parse_next_int(&p, value);
+    }
+    return true;
+}
+
+// ================== URC处理 ==================
+
+// 重置FOTA状态，开始新一轮升级前调用
+void modem_fota_reset(EC800KModem* modem) {
+    mutex_lock(&modem->state_lock);
+    modem->fota_complete = false;
+    modem->fota_result = -1;
+    modem->fota_stage = FOTA_STAGE_IDLE;
+    modem->fota_progress = 0;
+    modem->fota_start_ms = monotonic_ms();
+    modem->fota_end_ms = 0;
+    modem->download_result = -1;
+    modem->download_end_ms = 0;
+    modem->download_start_us = 0;
+    modem->update_start_us = 0;
+    modem->update_step_us = 0;
+    mutex_unlock(&modem->state_lock);
+}
+
+// 标记FOTA结束并唤醒等待者（需持有state_lock）
+void modem_fota_finish_locked(EC800KModem* modem, int result) {
+    modem->fota_stage = FOTA_STAGE_END;
+    modem->fota_result = result;
+    modem->fota_complete = true;
+    modem->fota_end_ms = monotonic_ms();
+}
+
+bool reg_stat_registered(int stat) {
+    return stat == 1 || stat == 5;
+}
+
+const char* reg_stat_name(int stat) {
+    switch (stat) {
+        case 0: return "未注册";
+        case 1: return "已注册(本地)";
+        case 2: return "搜索中...";
+        case 3: return "注册被拒绝";
+        case 5: return "已注册(漫游)";
+        case -1: return "未查询";
+        default: return "未知";
+    }
+}
+
+// 注册状态URC: +CREG: <stat>[,<lac>,<ci>[,<AcT>]]（与查询响应不同，不含<n>）
+void modem_handle_reg_urc(EC800KModem* modem, bool eps, const char* args) {
+    int stat;
+    if (!at_parse_reg(args, false, &stat)) return;
+    
+    mutex_lock(&modem->state_lock);
+    if (eps) {
+        modem->cereg_stat = stat;
+    } else {
+        modem->creg_stat = stat;
+    }
+    cond_broadcast(&modem->state_cond);
+    mutex_unlock(&modem->state_lock);
+    modem_log(modem, "📶 %s: %s", eps ? "CEREG" : "CREG", reg_stat_name(stat));
+}
+
+// FOTA进度上报: +QIND: "FOTA","<事件>"[,<值>]
+void modem_handle_fota_urc(EC800KModem* modem, const char* args) {
+    FotaEvent event;
+    int value = 0;
+    bool has_value;
+    if (!at_parse_fota_event(args, &event, &value, &has_value)) return;
+    
+    uint64_t now_us = monotonic_us();
+    uint64_t download_us = 0;
+    mutex_lock(&modem->state_lock);
+    switch (event) {
+        case FOTA_EVENT_HTTPSTART:
+        case FOTA_EVENT_FTPSTART:
+        case FOTA_EVENT_FILESTART:
+            modem->download_start_us = now_us;
+            modem->fota_stage = FOTA_STAGE_DOWNLOADING;
+            modem->fota_progress = 0;
+            modem_log(modem, "📥 模组开始下载固件包");
+            break;
+        case FOTA_EVENT_DOWNLOADING:
+            if (!has_value) break;
+            modem->fota_stage = FOTA_STAGE_DOWNLOADING;
+            modem->fota_progress = value;
+            modem_log(modem, "📥 下载进度: %d", value);
+            break;
+        case FOTA_EVENT_HTTPEND:
+        case FOTA_EVENT_FTPEND:
+        case FOTA_EVENT_FILEEND:
+            if (!has_value) break;
+            if (modem->download_start_us != 0) {
+                download_us = now_us - modem->download_start_us;
+                stats_record_phase(modem_name(modem), "download", download_us);
+            }
+            modem->download_result = value;
+            modem->download_end_ms = monotonic_ms();
+            if (value == 0) {
+                modem->fota_stage = FOTA_STAGE_DOWNLOADED;
+                modem_log(modem, "✅ 固件包下载完成");
+            } else {
+                modem_log(modem, "❌ 固件包下载失败，错误码: %d", value);
+                modem_fota_finish_locked(modem, value);
+            }
+            break;
+        case FOTA_EVENT_START:
+            modem->update_start_us = now_us;
+            modem->update_step_us = now_us;
+            modem->fota_stage = FOTA_STAGE_UPDATING;
+            modem_log(modem, "🔄 模组开始升级");
+            break;
+        case FOTA_EVENT_UPDATING:
+            if (!has_value) break;
+            if (modem->update_step_us != 0) {
+                stats_record_phase(modem_name(modem), "updating_step", now_us - modem->update_step_us);
+            }
+            modem->update_step_us = now_us;
+            modem->fota_stage = FOTA_STAGE_UPDATING;
+            modem->fota_progress = value;
+            modem_log(modem, "🔄 升级进度: %d%%", value);
+            break;
+        case FOTA_EVENT_END:
+            if (!has_value) break;
+            if (modem->update_start_us != 0) {
+                stats_record_phase(modem_name(modem), "update", now_us - modem->update_start_us);
+            }
+            stats_record_phase(modem_name(modem), "total", (monotonic_ms() - modem->fota_start_ms) * 1000);
+            if (value == 0) {
+                modem_log(modem, "🎉 FOTA升级成功");
+            } else {
+                modem_log(modem, "❌ FOTA升级失败，错误码: %d", value);
+            }
+            modem_fota_finish_locked(modem, value);
+            break;
+        default:
+            break;
+    }
+    cond_broadcast(&modem->state_cond);
+    mutex_unlock(&modem->state_lock);
+    
+    // 只记录成功的下载，失败的耗时不能用于预估
+    if (download_us != 0 && value == 0) {
+        telemetry_record_download(modem, (uint32_t)(download_us / 1000));
+    }
+}
+
+// 按分类结果分发一行URC（AT事务中已分类的行直接调用，不再重复查表）
+// CMUX各通道收到的URC一律记到所属模组
+void modem_dispatch_urc(EC800KModem* modem, AtLineKind kind, const char* line, const char* args) {
+    modem = modem_owner(modem);
+    switch (kind) {
+        case AT_LINE_QIND:
+            modem_handle_fota_urc(modem, args);
+            break;
+        case AT_LINE_CREG:
+        case AT_LINE_CEREG:
+            modem_handle_reg_urc(modem, kind == AT_LINE_CEREG, args);
+            break;
+        case AT_LINE_RDY:
+            // 模组重启：已取得的设备信息不再可信（可能已升级或换卡）
+            mutex_lock(&modem->state_lock);
+            modem->rebooted = true;
+            modem->info_valid = false;
+            mutex_unlock(&modem->state_lock);
+            modem_log(modem, "🔁 模组已重启 (RDY)");
+            break;
+        default:
+            if (at_line_class[kind] == AT_CLASS_HTTP) {
+                mutex_lock(&modem->state_lock);
+                snprintf(modem->http_urc, sizeof(modem->http_urc), "%s", line);
+                mutex_unlock(&modem->state_lock);
+            }
+            break;
+    }
+}
+
+// 解析单行URC（以'\0'结尾）
+void modem_handle_urc(EC800KModem* modem, const char* line) {
+    const char* args;
+    AtLineKind kind = at_classify(line, strlen(line), &args);
+    modem_dispatch_urc(modem, kind, line, args);
+}
+
+// 累积AT事务之外读到的数据，按行分发URC
+void modem_feed_urc_bytes(EC800KModem* modem, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\r' || c == '\n') {
+            if (modem->urc_len > 0) {
+                modem->arena.urc[modem->urc_len] = '\0';
+                modem_debug(modem, "📨 URC: %s", modem->arena.urc);
+                modem_handle_urc(modem, modem->arena.urc);
+                modem->urc_len = 0;
+            }
+        } else if (modem->urc_len < sizeof(modem->arena.urc) - 1) {
+            modem->arena.urc[modem->urc_len++] = c;
+        }
+    }
+}
+
+// ================== AT响应解析 ==================
+
+#define AT_LINE_MAX 128     // 行分类所需的最大行首长度
+
+typedef enum {
+    AT_RESULT_NONE,         // 尚未收到结果码
+    AT_RESULT_OK,
+    AT_RESULT_ERROR,
+    AT_RESULT_CME_ERROR,    // +CME ERROR: <err>
+    AT_RESULT_CMS_ERROR,    // +CMS ERROR: <err>
+    AT_RESULT_TIMEOUT,
+    AT_RESULT_IO_ERROR,
+    AT_RESULT_CONNECT       // 进入数据模式，仅在allow_connect时识别
+} AtResult;
+
+const char* at_result_name(AtResult result) {
+    switch (result) {
+        case AT_RESULT_OK:        return "OK";
+        case AT_RESULT_ERROR:     return "ERROR";
+        case AT_RESULT_CME_ERROR: return "CME_ERROR";
+        case AT_RESULT_CMS_ERROR: return "CMS_ERROR";
+        case AT_RESULT_TIMEOUT:   return "TIMEOUT";
+        case AT_RESULT_IO_ERROR:  return "IO_ERROR";
+        case AT_RESULT_CONNECT:   return "CONNECT";
+        default:                  return "NONE";
+    }
+}
+
+// 响应行视图，指向AtResponse.buf内部，不以'\0'结尾（其后紧跟CR/LF）
+typedef struct {
+    const char* text;
+    size_t len;
+    AtLineKind kind;        // 到达时的分类结果
+    const char* args;       // 前缀之后的参数
+} AtLine;
+
+// 流式AT响应：字节到达即按CR/LF分行，只对完整行判断结果码
+typedef struct {
+    char buf[AT_RX_SIZE];           // 原始响应字节（'\0'结尾）
+    size_t len;
+    size_t line_start;              // 当前未完成行在buf中的起点
+    char cur[AT_LINE_MAX];          // 当前行行首，用于分类（不受buf容量影响）
+    size_t cur_len;
+    size_t echo_len;                // 当前行逐字节与cmd相符的长度，不符为SIZE_MAX（长命令的回显超出cur）
+    AtLine lines[AT_MAX_LINES];     // 信息行（不含回显、结果码、URC）
+    int line_count;
+    AtResult result;
+    int error_code;                 // +CME/+CMS ERROR的错误码
+    bool truncated;                 // buf或行表已满，部分内容被丢弃
+    const char* cmd;                // 发送的命令，用于识别回显
+    bool allow_connect;             // 数据模式命令：CONNECT视为结果码
+    bool policy_timeout;            // 超时取自命令策略；调用方指定的超时（如探测）超时后不计入策略
+    char rest[AT_READ_CHUNK];       // CONNECT之后同批到达的字节
+    size_t rest_len;
+} AtResponse;
+
+void at_response_init(AtResponse* resp, const char* cmd) {
+    resp->buf[0] = '\0';
+    resp->len = 0;
+    resp->line_start = 0;
+    resp->cur_len = 0;
+    resp->echo_len = 0;
+    resp->line_count = 0;
+    resp->result = AT_RESULT_NONE;
+    resp->error_code = 0;
+    resp->truncated = false;
+    resp->cmd = cmd;
+    resp->allow_connect = false;
+    resp->policy_timeout = false;
+    resp->rest_len = 0;
+}
+
+bool at_line_equals(const AtLine* line, const char* str) {
+    size_t n = strlen(str);
+    return line->len == n && memcmp(line->text, str, n) == 0;
+}
+
+bool at_line_starts_with(const AtLine* line, const char* prefix) {
+    size_t n = strlen(prefix);
+    return line->len >= n && memcmp(line->text, prefix, n) == 0;
+}
+
+// 复制行内容到dst（截断并以'\0'结尾）
+void at_line_copy(const AtLine* line, char* dst, size_t size) {
+    size_t n = line->len < size - 1 ? line->len : size - 1;
+    memcpy(dst, line->text, n);
+    dst[n] = '\0';
+}
+
+// 查找第一条以prefix开头的信息行
+const AtLine* at_response_find(const AtResponse* resp, const char* prefix) {
+    for (int i = 0; i < resp->line_count; i++) {
+        if (at_line_starts_with(&resp->lines[i], prefix)) {
+            return &resp->lines[i];
+        }
+    }
+    return NULL;
+}
+
+// 查找第一条指定类别的信息行
+const AtLine* at_response_find_kind(const AtResponse* resp, AtLineKind kind) {
+    for (int i = 0; i < resp->line_count; i++) {
+        if (resp->lines[i].kind == kind) {
+            return &resp->lines[i];
+        }
+    }
+    return NULL;
+}
+
+// 判断已分类的一行是否为最终结果码
+bool at_parse_final_result(AtResponse* resp, AtLineKind kind, const char* args) {
+    switch (kind) {
+        case AT_LINE_OK:
+            resp->result = AT_RESULT_OK;
+            return true;
+        case AT_LINE_ERROR:
+            resp->result = AT_RESULT_ERROR;
+            return true;
+        case AT_LINE_CONNECT:
+            if (!resp->allow_connect) return false;
+            resp->result = AT_RESULT_CONNECT;
+            return true;
+        case AT_LINE_CME_ERROR:
+            resp->result = AT_RESULT_CME_ERROR;
+            resp->error_code = at_parse_int(args);
+            return true;
+        case AT_LINE_CMS_ERROR:
+            resp->result = AT_RESULT_CMS_ERROR;
+            resp->error_code = at_parse_int(args);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 一行结束：先排除回显，再查表分类一次，按类别判断结果码、URC，其余作为信息行记录
+void at_response_end_line(AtResponse* resp, EC800KModem* modem, size_t line_end) {
+    const char* line = resp->cur;
+    const char* args;
+    
+    if (resp->cur_len == 0) return;
+    
+    if (resp->line_count == 0 && resp->cmd != NULL && resp->echo_len != SIZE_MAX &&
+        resp->cmd[resp->echo_len] == '\0') {
+        return;  // 命令回显
+    }
+    AtLineKind kind = at_classify(line, resp->cur_len, &args);
+    AtLineClass cls = at_line_class[kind];
+    if (cls == AT_CLASS_FINAL && at_parse_final_result(resp, kind, args)) {
+        return;
+    }
+    // 非注册查询命令期间插入的+CREG/+CEREG为URC
+    if (cls == AT_CLASS_URC ||
+        (cls == AT_CLASS_REG && resp->cmd != NULL &&
+         strstr(resp->cmd, "CREG") == NULL && strstr(resp->cmd, "CEREG") == NULL)) {
+        modem_dispatch_urc(modem, kind, line, args);
+        return;
+    }
+    
+    if (resp->line_count < AT_MAX_LINES && line_end > resp->line_start) {
+        AtLine* l = &resp->lines[resp->line_count++];
+        l->text = resp->buf + resp->line_start;
+        l->len = line_end - resp->line_start;
+        size_t offset = (size_t)(args - line);
+        l->kind = kind;
+        l->args = l->text + (offset < l->len ? offset : l->len);
+    } else {
+        resp->truncated = true;
+    }
+}
+
+// 喂入新到达的字节，每个字节只处理一次；返回已消费的字节数
+// 收到最终结果码后立即停止，剩余字节由调用方按URC处理
+size_t at_response_feed(AtResponse* resp, EC800KModem* modem, const char* data, size_t n) {
+    size_t i;
+    for (i = 0; i < n && resp->result == AT_RESULT_NONE; i++) {
+        char c = data[i];
+        bool stored = resp->len < sizeof(resp->buf) - 1;
+        
+        if (stored) {
+            resp->buf[resp->len++] = c;
+        } else {
+            resp->truncated = true;
+        }
+        
+        if (c == '\r' || c == '\n') {
+            resp->cur[resp->cur_len] = '\0';
+            at_response_end_line(resp, modem, stored ? resp->len - 1 : resp->len);
+            resp->cur_len = 0;
+            resp->echo_len = 0;
+            resp->line_start = resp->len;
+        } else {
+            if (resp->cur_len < sizeof(resp->cur) - 1) resp->cur[resp->cur_len++] = c;
+            if (resp->echo_len != SIZE_MAX) {
+                resp->echo_len = resp->cmd != NULL && resp->cmd[resp->echo_len] == c ? resp->echo_len + 1 : SIZE_MAX;
+            }
+        }
+    }
+    resp->buf[resp->len] = '\0';
+    return i;
+}
+
+// 读取响应直到结果码或超时（需持有io_lock），返回读到的字节数
+// 与结果码同批到达的后续字节：CONNECT时保存到resp->rest（数据模式的开头），否则按URC处理
+size_t modem_at_wait_locked(EC800KModem* modem, AtResponse* resp, int timeout_ms, uint64_t start_us,
+                            uint64_t* first_us) {
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    size_t rx = 0;
+    
+    for (;;) {
+        int wait = remaining_ms(deadline);
+        if (wait <= 0) {
+            resp->result = AT_RESULT_TIMEOUT;
+            modem->rx_stale = true;
+            break;
+        }
+        
+        char buf[AT_READ_CHUNK];
+        int n = serial_read(modem, buf, sizeof(buf), wait);
+        if (n < 0) {
+            resp->result = AT_RESULT_IO_ERROR;
+            break;
+        }
+        if (n > 0) {
+            if (rx == 0 && first_us != NULL) *first_us = monotonic_us() - start_us;
+            rx += (size_t)n;
+            size_t used = at_response_feed(resp, modem, buf, (size_t)n);
+            if (resp->result == AT_RESULT_CONNECT) {
+                resp->rest_len = (size_t)n - used;
+                memcpy(resp->rest, buf + used, resp->rest_len);
+                break;
+            }
+            if (resp->result != AT_RESULT_NONE) {
+                // 与结果码同批到达的后续数据（如紧随OK的+QIND）
+                modem->urc_len = 0;
+                modem_feed_urc_bytes(modem, buf + used, (size_t)n - used);
+                break;
+            }
+        }
+    }
+    return rx;
+}
+
+// 丢弃超时命令迟到的回复（需持有io_lock）：读到串口静默AT_DRAIN_QUIET_MS为止，
+// 否则迟到的OK/ERROR会被当作下一条命令的结果。其中的URC照常处理
+void modem_at_drain_locked(EC800KModem* modem) {
+    uint64_t deadline = monotonic_ms() + AT_DRAIN_MAX_MS;
+    size_t drained = 0;
+    char buf[AT_READ_CHUNK];
+    int n;
+    
+    modem->rx_stale = false;
+    modem->urc_len = 0;
+    while (remaining_ms(deadline) > 0 && (n = serial_read(modem, buf, sizeof(buf), AT_DRAIN_QUIET_MS)) > 0) {
+        modem_feed_urc_bytes(modem, buf, (size_t)n);
+        drained += (size_t)n;
+    }
+    modem->urc_len = 0;
+    if (drained > 0) {
+        modem_debug(modem, "🧹 发送前丢弃上条超时命令的迟到数据 %zu字节", drained);
+    }
+}
+
+// 发送命令并读取响应（需持有io_lock，resp已初始化）
+// 命令格式化到arena.tx（需持有io_lock），返回命令长度，超长返回0
+size_t modem_at_vformat_locked(EC800KModem* modem, const char* format, va_list args) {
+    // 预留"\r\n"
+    int n = vsnprintf(modem->arena.tx, sizeof(modem->arena.tx) - 2, format, args);
+    if (n < 0 || (size_t)n >= sizeof(modem->arena.tx) - 2) {
+        modem_log(modem, "❌ 命令超过%d字节: %.32s...", AT_TX_SIZE - 3, modem->arena.tx);
+        modem->arena.tx[0] = '\0';
+        return 0;
+    }
+    return (size_t)n;
+}
+
+size_t modem_at_format_locked(EC800KModem* modem, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t len = modem_at_vformat_locked(modem, format, args);
+    va_end(args);
+    return len;
+}
+
+// 发送命令并等待响应（需持有io_lock）。cmd可以就是arena.tx（已格式化），
+// 否则复制进arena.tx；行尾CRLF只在写出时临时补上
+void modem_at_exchange_locked(EC800KModem* modem, const char* cmd, AtResponse* resp, int timeout_ms) {
+    char* tx_buf = modem->arena.tx;
+    size_t len = strlen(cmd);
+    
+    if (cmd != tx_buf) {
+        if (len > sizeof(modem->arena.tx) - 3) {
+            modem_log(modem, "❌ 命令超过%d字节: %.32s...", AT_TX_SIZE - 3, cmd);
+            resp->result = AT_RESULT_IO_ERROR;
+            return;
+        }
+        memcpy(tx_buf, cmd, len + 1);
+    }
+    if (timeout_ms == AT_TIMEOUT_POLICY) {
+        const AtPolicy* policy;
+        timeout_ms = at_policy_timeout(tx_buf, &policy);    // 持锁的数据模式流程只取超时，不重试
+        resp->policy_timeout = true;
+    }
+    if (modem->rx_stale) modem_at_drain_locked(modem);
+    modem_debug(modem, "📤 发送: %s", tx_buf);
+    
+    size_t tx = len + 2;
+    size_t rx = 0;
+    uint64_t start_us = monotonic_us();
+    uint64_t first_us = 0;
+    
+    tx_buf[len] = '\r';
+    tx_buf[len + 1] = '\n';
+    bool written = serial_write(modem, tx_buf, tx);
+    tx_buf[len] = '\0';
+    
+    if (!written) {
+        resp->result = AT_RESULT_IO_ERROR;
+        tx = 0;
+    } else {
+        // 读取响应，数据到达立即解析，按单调时钟计算截止时间
+        rx = modem_at_wait_locked(modem, resp, timeout_ms, start_us, &first_us);
+    }
+    
+    bool ok = resp->result == AT_RESULT_OK || resp->result == AT_RESULT_CONNECT;
+    uint64_t final_us = monotonic_us() - start_us;
+    stats_record_command(modem_name(modem), tx_buf, first_us, final_us, tx, rx, at_result_name(resp->result), ok);
+    // 探测非AT口等固定短超时的超时不代表命令耗时，只计入策略超时下的超时
+    bool timed_out = resp->result == AT_RESULT_TIMEOUT;
+    if (resp->result != AT_RESULT_IO_ERROR && (!timed_out || resp->policy_timeout)) {
+        at_policy_record(tx_buf, final_us, timed_out, timeout_ms);
+    }
+    
+    // 去除首部空白后记录原始响应
+    const char* start = resp->buf;
+    while (*start == '\r' || *start == '\n' || *start == ' ') start++;
+    if (*start != '\0') {
+        modem_debug(modem, "📥 响应: %s", start);
+    }
+}
+
+// 按命令策略判断是否重试，返回退避毫秒数（0表示不再重试）；超时重试时超时加倍，不超过策略上限
+// 普通ERROR是确定的拒绝，串口错误与断线交给重连处理，均不重试（需持有io_lock，cmd可能就是arena.tx）
+int modem_at_retry_locked(EC800KModem* modem, const AtPolicy* policy, const char* cmd, const AtResponse* resp,
+                          int attempt, int* timeout_ms) {
+    if (policy == NULL || attempt >= policy->retries || modem->link_down) return 0;
+    bool transient = resp->result == AT_RESULT_CME_ERROR && at_error_transient(resp->error_code);
+    bool timeout = resp->result == AT_RESULT_TIMEOUT && policy->retry_timeout;
+    if (!transient && !timeout) return 0;
+    
+    int backoff = AT_POLICY_BACKOFF_MS << attempt;
+    if (timeout) {
+        *timeout_ms = *timeout_ms * 2 < policy->max_ms ? *timeout_ms * 2 : policy->max_ms;
+        modem_log(modem, "⚠️ %s 超时，%dms后重试 (%d/%d，超时%dms)", cmd, backoff, attempt + 1, policy->retries,
+                  *timeout_ms);
+    } else {
+        modem_log(modem, "⚠️ %s 暂时不可用 (+CME ERROR: %d)，%dms后重试 (%d/%d)", cmd, resp->error_code, backoff,
+                  attempt + 1, policy->retries);
+    }
+    stats_record_retry(modem_name(modem), cmd);
+    return backoff;
+}
+
+// timeout_ms为AT_TIMEOUT_POLICY时按命令策略取超时并在超时/暂时性错误时重试
+bool modem_at_transact(EC800KModem* modem, const char* cmd, AtResponse* resp, int timeout_ms) {
+    const AtPolicy* policy = NULL;
+    int timeout = timeout_ms;
+    
+    if (timeout_ms == AT_TIMEOUT_POLICY) timeout = at_policy_timeout(cmd, &policy);
+    for (int attempt = 0; ; attempt++) {
+        at_response_init(resp, cmd);
+        if (modem->handle == INVALID_SERIAL) {
+            resp->result = AT_RESULT_IO_ERROR;
+            return false;
+        }
+        
+        resp->policy_timeout = policy != NULL;
+        
+        // 整个事务期间独占串口读取，避免与URC监听线程争抢数据
+        mutex_lock(&modem->io_lock);
+        modem_at_exchange_locked(modem, cmd, resp, timeout);
+        int backoff = modem_at_retry_locked(modem, policy, cmd, resp, attempt, &timeout);
+        mutex_unlock(&modem->io_lock);
+        if (backoff == 0) break;
+        sleep_ms(backoff);
+    }
+    
+    return resp->result == AT_RESULT_OK;
+}
+
+// 格式化命令并执行事务，命令直接写入arena.tx，不经栈上临时缓冲
+// 重试时重新格式化：退避期间不持锁，arena.tx可能已被其他事务改写
+bool modem_at_transactf(EC800KModem* modem, AtResponse* resp, int timeout_ms, const char* format, ...) {
+    const AtPolicy* policy = NULL;
+    int timeout = timeout_ms;
+    va_list args;
+    
+    for (int attempt = 0; ; attempt++) {
+        if (modem->handle == INVALID_SERIAL) {
+            at_response_init(resp, NULL);
+            resp->result = AT_RESULT_IO_ERROR;
+            return false;
+        }
+        
+        int backoff = 0;
+        mutex_lock(&modem->io_lock);
+        va_start(args, format);
+        size_t len = modem_at_vformat_locked(modem, format, args);
+        va_end(args);
+        at_response_init(resp, modem->arena.tx);
+        if (len == 0) {
+            resp->result = AT_RESULT_IO_ERROR;
+        } else {
+            if (attempt == 0 && timeout_ms == AT_TIMEOUT_POLICY) timeout = at_policy_timeout(modem->arena.tx, &policy);
+            resp->policy_timeout = policy != NULL;
+            modem_at_exchange_locked(modem, modem->arena.tx, resp, timeout);
+            backoff = modem_at_retry_locked(modem, policy, modem->arena.tx, resp, attempt, &timeout);
+        }
+        mutex_unlock(&modem->io_lock);
+        if (backoff == 0) break;
+        sleep_ms(backoff);
+    }
+    
+    return resp->result == AT_RESULT_OK;
+}
+
+// 发送AT命令，response返回去除首部空白的原始响应文本
+bool modem_send_at_command(EC800KModem* modem, const char* cmd, char* response, size_t resp_size, int timeout_ms) {
+    AtResponse resp;
+    bool ok = modem_at_transact(modem, cmd, &resp, timeout_ms);
+    
+    if (resp.result == AT_RESULT_IO_ERROR && resp.len == 0) {
+        snprintf(response, resp_size, "%s", modem->handle == INVALID_SERIAL ? "串口未连接" : "发送失败");
+        return false;
+    }
+    
+    if (resp.truncated) {
+        modem_log(modem, "⚠️ %s 响应超过%d字节已截断，大数据请用数据模式流式读取", cmd, AT_RX_SIZE - 1);
+    }
+    const char* start = resp.buf;
+    while (*start == '\r' || *start == '\n' || *start == ' ') start++;
+    snprintf(response, resp_size, "%s", start);
+    
+    return ok;
+}
+
+// ================== AT命令批处理 ==================
+
+#define AT_BATCH_MAX 8
+#define AT_CMDLINE_MAX 256  // 拼接后的命令行长度上限
+
+typedef struct {
+    const char* cmd;        // 完整命令，如"AT+CSQ"
+    const char* prefix;     // 信息行前缀，如"+CSQ:"；NULL表示无前缀信息行（AT+GSN等）
+    AtLineKind kind;        // 前缀在行分类表中的类别，不在表中时按前缀比较
+    AtResult result;
+    int first_line;         // 在AtBatch.lines中的起始下标
+    int line_count;
+} AtBatchEntry;
+
+// 多条查询命令合并为一次往返：优先以';'拼接为一行发送，
+// 模组拒绝拼接（返回ERROR）时退回逐条发送
+typedef struct {
+    AtBatchEntry entries[AT_BATCH_MAX];
+    int count;
+    AtLine lines[AT_MAX_LINES];     // 按命令分组的信息行视图
+    int line_count;
+    AtResponse resp;                // 拼接模式下视图指向resp.buf
+    char store[AT_RX_SIZE];         // 逐条模式下各命令信息行的存放区
+    size_t store_len;
+    char cmdline[AT_CMDLINE_MAX];
+} AtBatch;
+
+void at_batch_init(AtBatch* batch) {
+    batch->count = 0;
+    batch->line_count = 0;
+    batch->store_len = 0;
+}
+
+// 加入一条命令，返回其下标（批次已满返回-1）
+int at_batch_add(AtBatch* batch, const char* cmd, const char* prefix) {
+    if (batch->count >= AT_BATCH_MAX) return -1;
+    AtBatchEntry* e = &batch->entries[batch->count];
+    e->cmd = cmd;
+    e->prefix = prefix;
+    e->kind = prefix != NULL ? at_classify(prefix, strlen(prefix), NULL) : AT_LINE_UNKNOWN;
+    e->result = AT_RESULT_NONE;
+    e->first_line = 0;
+    e->line_count = 0;
+    return batch->count++;
+}
+
+// 取第index条命令的第一条信息行，无结果返回NULL
+const AtLine* at_batch_line(const AtBatch* batch, int index) {
+    if (index < 0 || index >= batch->count) return NULL;
+    const AtBatchEntry* e = &batch->entries[index];
+    if (e->result != AT_RESULT_OK || e->line_count == 0) return NULL;
+    return &batch->lines[e->first_line];
+}
+
+// 拼接模式：把一次响应中的信息行分配回各命令
+// 带前缀的行按前缀归属；无前缀的行按出现顺序依次归属无前缀命令
+void at_batch_split(AtBatch* batch) {
+    const AtResponse* resp = &batch->resp;
+    int plain_index = 0;    // 当前命令在无前缀命令中的序号
+    
+    for (int i = 0; i < batch->count; i++) {
+        AtBatchEntry* e = &batch->entries[i];
+        e->result = AT_RESULT_OK;
+        e->first_line = batch->line_count;
+        
+        int plain_seen = 0;
+        for (int j = 0; j < resp->line_count && batch->line_count < AT_MAX_LINES; j++) {
+            const AtLine* line = &resp->lines[j];
+            bool match;
+            if (e->kind != AT_LINE_UNKNOWN) {
+                match = line->kind == e->kind;
+            } else if (e->prefix != NULL) {
+                match = at_line_starts_with(line, e->prefix);
+            } else {
+                match = !at_line_starts_with(line, "+") && plain_seen++ == plain_index;
+            }
+            if (match) {
+                batch->lines[batch->line_count++] = *line;
+                e->line_count++;
+            }
+        }
+        if (e->prefix == NULL) plain_index++;
+    }
+}
+
+// 逐条模式：依次执行，信息行复制到store
+void at_batch_run_sequential(EC800KModem* modem, AtBatch* batch, int timeout_ms) {
+    for (int i = 0; i < batch->count; i++) {
+        AtBatchEntry* e = &batch->entries[i];
+        modem_at_transact(modem, e->cmd, &batch->resp, timeout_ms);
+        e->result = batch->resp.result;
+        e->first_line = batch->line_count;
+        
+        for (int j = 0; j < batch->resp.line_count && batch->line_count < AT_MAX_LINES; j++) {
+            const AtLine* src = &batch->resp.lines[j];
+            if (batch->store_len + src->len + 1 > sizeof(batch->store)) break;
+            char* dst = batch->store + batch->store_len;
+            memcpy(dst, src->text, src->len);
+            dst[src->len] = '\r';     // 保持"视图后紧跟CR"的约定
+            batch->store_len += src->len + 1;
+            batch->lines[batch->line_count].text = dst;
+            batch->lines[batch->line_count].len = src->len;
+            batch->lines[batch->line_count].kind = src->kind;
+            batch->lines[batch->line_count].args = dst + (src->args - src->text);
+            batch->line_count++;
+            e->line_count++;
+        }
+    }
+}
+
+// 执行批处理，返回是否所有命令都成功
+bool modem_at_batch(EC800KModem* modem, AtBatch* batch, int timeout_ms) {
+    size_t len = 0;
+    bool concat = batch->count > 1;
+    
+    // AT+A;+B;+C：第一条保留"AT"，其余去掉
+    for (int i = 0; i < batch->count && concat; i++) {
+        const char* cmd = batch->entries[i].cmd;
+        const char* part = i == 0 ? cmd : cmd + 2;
+        size_t n = strlen(part);
+        if (strncmp(cmd, "AT", 2) != 0 || len + n + 2 > sizeof(batch->cmdline)) {
+            concat = false;
+            break;
+        }
+        if (i > 0) batch->cmdline[len++] = ';';
+        memcpy(batch->cmdline + len, part, n);
+        len += n;
+    }
+    
+    batch->line_count = 0;
+    batch->store_len = 0;
+    
+    if (concat) {
+        batch->cmdline[len] = '\0';
+        if (modem_at_transact(modem, batch->cmdline, &batch->resp, timeout_ms)) {
+            at_batch_split(batch);
+            return true;
+        }
+        if (batch->resp.result == AT_RESULT_IO_ERROR) {
+            return false;
+        }
+        modem_log(modem, "⚠️ 拼接命令未被接受，改为逐条发送");
+        stats_record_retry(modem_name(modem), batch->cmdline);
+    }
+    
+    at_batch_run_sequential(modem, batch, timeout_ms);
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->entries[i].result != AT_RESULT_OK) return false;
+    }
+    return true;
+}
+
+// ================== 数据模式读取 ==================
+
+// CONNECT之后的数据段逐块交给sink，不经固定大小缓冲，用于HTTP响应、UFS文件与模组日志
+// sink返回false表示不再需要数据：读取仍继续到数据段结束，使串口与模组保持同步
+
+#define AT_DATA_STALL_MS 10000      // 数据段中途无数据的最长时间
+#define AT_MARKER_MAX 32            // 结束标记最大长度
+
+typedef bool (*AtDataSink)(void* ctx, const void* data, size_t len);
+
+typedef struct {
+    AtDataSink sink;
+    void* ctx;
+    bool sink_ok;                   // sink未中止
+    bool skip_lf;                   // CONNECT行结尾的LF尚未跳过
+    uint64_t total;                 // 数据段字节数
+} AtDataStream;
+
+void at_data_stream_init(AtDataStream* ds, AtDataSink sink, void* ctx) {
+    ds->sink = sink;
+    ds->ctx = ctx;
+    ds->sink_ok = true;
+    ds->skip_lf = true;
+    ds->total = 0;
+}
+
+// 交付数据块；CONNECT行以CR结束，紧随其后的LF不属于数据
+void at_data_deliver(AtDataStream* ds, const char* data, size_t len) {
+    if (ds->skip_lf && len > 0) {
+        ds->skip_lf = false;
+        if (data[0] == '\n') {
+            data++;
+            len--;
+        }
+    }
+    if (len == 0) return;
+    ds->total += len;
+    if (ds->sink_ok && !ds->sink(ds->ctx, data, len)) {
+        ds->sink_ok = false;
+    }
+}
+
+// 在二进制数据中查找marker
+const char* at_data_find(const char* data, size_t len, const char* marker, size_t marker_len) {
+    const char* end = data + len;
+    for (const char* p = data; (size_t)(end - p) >= marker_len; p++) {
+        p = memchr(p, marker[0], (size_t)(end - p) - marker_len + 1);
+        if (p == NULL) return NULL;
+        if (memcmp(p, marker, marker_len) == 0) return p;
+    }
+    return NULL;
+}
+
+// 数据段之后的结果行解析到resp：先解析已读到的剩余字节，不足时继续读取到最终结果码
+bool modem_at_finish_data_locked(EC800KModem* modem, AtResponse* resp, const char* tail, size_t tail_len,
+                                 int timeout_ms) {
+    at_response_init(resp, NULL);
+    size_t used = at_response_feed(resp, modem, tail, tail_len);
+    if (resp->result == AT_RESULT_NONE) {
+        modem_at_wait_locked(modem, resp, timeout_ms, monotonic_us(), NULL);
+    } else {
+        modem->urc_len = 0;
+        modem_feed_urc_bytes(modem, tail + used, tail_len - used);
+    }
+    return resp->result == AT_RESULT_OK;
+}
+
+// 读取已知长度的数据段（如AT+QFDWL），resp为CONNECT响应，返回时保存其后的结果行
+bool modem_at_read_length_locked(EC800KModem* modem, AtResponse* resp, uint64_t length, AtDataStream* ds) {
+    char buf[AT_READ_CHUNK];
+    size_t n = resp->rest_len;
+    
+    memcpy(buf, resp->rest, n);
+    for (;;) {
+        // 跳过的LF不计入长度
+        size_t lead = ds->skip_lf && n > 0 && buf[0] == '\n' ? 1 : 0;
+        size_t want = length - ds->total < n - lead ? (size_t)(length - ds->total) + lead : n;
+        at_data_deliver(ds, buf, want);
+        if (ds->total >= length) {
+            return modem_at_finish_data_locked(modem, resp, buf + want, n - want, AT_DATA_STALL_MS);
+        }
+        
+        uint64_t left = length - ds->total + (ds->skip_lf ? 1 : 0);
+        int got = serial_read(modem, buf, left < AT_READ_CHUNK ? (size_t)left : AT_READ_CHUNK, AT_DATA_STALL_MS);
+        if (got <= 0) {
+            resp->result = got < 0 ? AT_RESULT_IO_ERROR : AT_RESULT_TIMEOUT;
+            return false;
+        }
+        n = (size_t)got;
+    }
+}
+
+// 读取以marker结束的数据段（长度未知，如AT+QHTTPREAD），marker起的内容按结果行解析到resp
+// 末尾始终保留不足一个marker长度的字节，防止跨块的marker被当作数据交付
+bool modem_at_read_until_locked(EC800KModem* modem, AtResponse* resp, const char* marker, AtDataStream* ds) {
+    char win[AT_READ_CHUNK + AT_MARKER_MAX];
+    size_t marker_len = strlen(marker);
+    size_t held = resp->rest_len;
+    
+    memcpy(win, resp->rest, held);
+    for (;;) {
+        const char* end = at_data_find(win, held, marker, marker_len);
+        if (end != NULL) {
+            at_data_deliver(ds, win, (size_t)(end - win));
+            return modem_at_finish_data_locked(modem, resp, end, held - (size_t)(end - win), AT_DATA_STALL_MS);
+        }
+        size_t keep = held < marker_len - 1 ? held : marker_len - 1;
+        at_data_deliver(ds, win, held - keep);
+        memmove(win, win + held - keep, keep);
+        held = keep;
+        
+        int got = serial_read(modem, win + held, sizeof(win) - held, AT_DATA_STALL_MS);
+        if (got <= 0) {
+            resp->result = got < 0 ? AT_RESULT_IO_ERROR : AT_RESULT_TIMEOUT;
+            return false;
+        }
+        held += (size_t)got;
+    }
+}
+
+// 写入调用方缓冲（'\0'结尾），超出容量时中止而不截断
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+} AtBufferSink;
+
+bool at_sink_buffer(void* ctx, const void* data, size_t len) {
+    AtBufferSink* b = (AtBufferSink*)ctx;
+    if (len > b->size - 1 - b->len) return false;
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    b->buf[b->len] = '\0';
+    return true;
+}
+
+bool at_sink_file(void* ctx, const void* data, size_t len) {
+    return fwrite(data, 1, len, (FILE*)ctx) == len;
+}
+
+// ================== 断线重连 ==================
+
+// 升级过程中模组会多次重启（7%、60%及END之后），USB口随之消失再出现。
+// 监听线程检测到断开后关闭句柄，按指数退避重新打开同一路径；
+// Linux下同时监视端口所在目录（inotify），设备节点出现或权限变更时立即重试。
+// FOTA阶段与进度保存在modem中，重连后继续按URC推进。
+
+#define RECONNECT_BACKOFF_MIN_MS 20
+#define RECONNECT_BACKOFF_MAX_MS 2000
+
+typedef struct {
+    int fd;             // inotify描述符，不可用时为-1
+} PortWatch;
+
+void port_watch_open(PortWatch* watch, const char* port_path) {
+    watch->fd = -1;
+#ifdef __linux__
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", port_path);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) return;
+    *slash = '\0';
+    
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) return;
+    if (inotify_add_watch(watch->fd, dir[0] != '\0' ? dir : "/", IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+        close(watch->fd);
+        watch->fd = -1;
+    }
+#else
+    (void)port_path;
+#endif
+}
+
+void port_watch_close(PortWatch* watch) {
+#ifndef _WIN32
+    if (watch->fd >= 0) close(watch->fd);
+#endif
+    watch->fd = -1;
+}
+
+// 读空事件队列，返回是否有事件（不区分具体文件，任何变化都值得重试）
+bool port_watch_drain(PortWatch* watch) {
+    bool any = false;
+#ifdef __linux__
+    char buf[4096];
+    while (watch->fd >= 0 && read(watch->fd, buf, sizeof(buf)) > 0) {
+        any = true;
+    }
+#else
+    (void)watch;
+#endif
+    return any;
+}
+
+// 等待目录变化或超时，返回是否有变化
+bool port_watch_wait(PortWatch* watch, int timeout_ms) {
+#ifndef _WIN32
+    if (watch->fd >= 0) {
+        struct pollfd pfd = { watch->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) > 0) return port_watch_drain(watch);
+        return false;
+    }
+#endif
+    sleep_ms(timeout_ms);
+    return false;
+}
+
+// 串口断开：关闭句柄并进入重连状态（需持有io_lock）
+void modem_link_lost_locked(EC800KModem* modem) {
+    if (modem->link_down) return;
+    serial_close(modem);
+    modem->link_down = true;
+    modem->link_lost_ms = monotonic_ms();
+    modem->reconnect_backoff_ms = RECONNECT_BACKOFF_MIN_MS;
+    modem->reconnect_at_ms = 0;
+    modem->urc_len = 0;
+    modem_log(modem, "🔌 串口断开（模组重启？），等待重连...");
+}
+
+void modem_link_lost(EC800KModem* modem) {
+    mutex_lock(&modem->io_lock);
+    modem_link_lost_locked(modem);
+    mutex_unlock(&modem->io_lock);
+}
+
+// 退避时间到达后尝试打开一次，返回链路是否可用（不阻塞）
+bool modem_link_check(EC800KModem* modem) {
+    if (!modem->link_down) return true;
+    if (monotonic_ms() < modem->reconnect_at_ms) return false;
+    
+    mutex_lock(&modem->io_lock);
+    bool ok = modem_open_port(modem, false);
+    if (ok) {
+        uint64_t down_ms = monotonic_ms() - modem->link_lost_ms;
+        modem->link_down = false;
+        modem->reconnects++;
+        modem->urc_len = 0;
+        modem->rx_stale = false;
+        stats_record_phase(modem_name(modem), "reconnect", down_ms * 1000);
+        modem_log(modem, "🔁 串口已重连 (第%d次, 断开%.1f秒)，继续监听升级进度", modem->reconnects,
+                  (double)down_ms / 1000.0);
+    } else {
+        modem->reconnect_at_ms = monotonic_ms() + (uint64_t)modem->reconnect_backoff_ms;
+        modem->reconnect_backoff_ms = modem->reconnect_backoff_ms * 2 < RECONNECT_BACKOFF_MAX_MS
+                                      ? modem->reconnect_backoff_ms * 2 : RECONNECT_BACKOFF_MAX_MS;
+    }
+    mutex_unlock(&modem->io_lock);
+    return ok;
+}
+
+// 距离下次重试的等待时间
+int modem_reconnect_wait_ms(const EC800KModem* modem) {
+    return remaining_ms(modem->reconnect_at_ms);
+}
+
+// ================== URC监听线程 ==================
+
+// 在io_lock内读取一次串口并分发URC，返回值同serial_read
+// arena.urc与AT事务共用，分发同样需在锁内完成
+int modem_monitor_service(EC800KModem* modem, int wait_ms) {
+    char buf[256];
+    
+    mutex_lock(&modem->io_lock);
+    int n = serial_read(modem, buf, sizeof(buf), wait_ms);
+    if (n > 0) {
+        modem_feed_urc_bytes(modem, buf, (size_t)n);
+    }
+    mutex_unlock(&modem->io_lock);
+    
+    return n;
+}
+
+THREAD_RETURN modem_monitor_thread(void* arg) {
+    EC800KModem* modem = (EC800KModem*)arg;
+    PortWatch watch;
+    port_watch_open(&watch, modem->port_path);
+    
+    while (!modem->stop_monitor) {
+        if (modem->link_down) {
+            if (!modem_link_check(modem)) {
+                int wait = modem_reconnect_wait_ms(modem);
+                if (wait > MONITOR_POLL_MS) wait = MONITOR_POLL_MS;
+                if (port_watch_wait(&watch, wait)) {
+                    modem->reconnect_at_ms = 0;     // 设备节点有变化，立即重试
+                }
+            }
+            continue;
+        }
+        port_watch_drain(&watch);
+        
+#ifdef _WIN32
+        // 重叠读无法脱离io_lock等待，使用短时间片以免阻塞AT事务
+        int wait = 20;
+#else
+        // 不持锁等待数据到达，AT事务进行中时由事务本身读取
+        // CMUX时同时监听空闲的数据通道（如发送差分包之后的FILEEND）
+        EC800KModem* bulk = modem_bulk(modem);
+        struct pollfd pfds[2] = {
+            { modem->handle, POLLIN, 0 },
+            { bulk != modem ? bulk->handle : INVALID_SERIAL, POLLIN, 0 },   // 负值fd被poll忽略
+        };
+        int ret = poll(pfds, 2, MONITOR_POLL_MS);
+        if (ret <= 0) continue;
+        if (pfds[1].revents & POLLIN) {
+            modem_monitor_service(bulk, 0);
+        }
+        if (pfds[0].revents == 0) continue;
+        if (!(pfds[0].revents & POLLIN)) {
+            modem_link_lost(modem);
+            continue;
+        }
+        int wait = 0;
+#endif
+        if (modem_monitor_service(modem, wait) < 0) {
+            modem_link_lost(modem);
+        }
+    }
+    port_watch_close(&watch);
+    return THREAD_RESULT;
+}
+
+// 启动后台URC监听线程
+bool modem_monitor_start(EC800KModem* modem) {
+    if (modem->monitor_running) return true;
+    if (modem->handle == INVALID_SERIAL) return false;
+    
+    modem->stop_monitor = false;
+    modem->urc_len = 0;
+    if (!thread_create(&modem->monitor_thread, modem_monitor_thread, modem)) {
+        modem_log(modem, "❌ URC监听线程启动失败");
+        return false;
+    }
+    modem->monitor_running = true;
+    return true;
+}
+
+// 停止并回收URC监听线程
+void modem_monitor_stop(EC800KModem* modem) {
+    modem->stop_monitor = true;
+    if (modem->monitor_running) {
+        thread_join(modem->monitor_thread);
+        modem->monitor_running = false;
+    }
+}
+
+// 阻塞等待+QIND: "FOTA","END"（或下载失败），返回是否在超时前结束
+bool modem_wait_fota_complete(EC800KModem* modem, int timeout_ms) {
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    
+    mutex_lock(&modem->state_lock);
+    while (!modem->fota_complete) {
+        int wait = remaining_ms(deadline);
+        if (wait <= 0) break;
+        cond_timedwait(&modem->state_cond, &modem->state_lock, wait);
+    }
+    bool complete = modem->fota_complete;
+    mutex_unlock(&modem->state_lock);
+    
+    return complete;
+}
+
+// 等待FOTA进入指定阶段（或提前结束），返回是否在超时前到达
+bool modem_wait_fota_stage(EC800KModem* modem, FotaStage stage, int timeout_ms) {
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    
+    mutex_lock(&modem->state_lock);
+    while (modem->fota_stage < stage && !modem->fota_complete) {
+        int wait = remaining_ms(deadline);
+        if (wait <= 0) break;
+        cond_timedwait(&modem->state_cond, &modem->state_lock, wait);
+    }
+    bool reached = modem->fota_stage >= stage;
+    mutex_unlock(&modem->state_lock);
+    
+    return reached;
+}
+
+// ================== 收发记录与回放 ==================
+
+// --capture FILE把各串口的收发字节连同时间戳写入记录文件；replay把记录中的接收字节
+// 按原来的读取分块重新送入AT响应解析与URC分发，不经串口也不等超时
+// 用于在桌面上复现只在真机出现的固件差异（回显开关、\r\r\n分行、被拆到两次读取里的URC），
+// 并给解析路径一个可重复的吞吐基准
+// 记录点在serial_read/serial_write：--cmux时记下的是DLC1与DLC3解复用后的字节，DLC2上的URC不在其中
+
+#define TRACE_MAX_CHANNELS 255
+#define TRACE_NAME_MAX (PORT_PATH_MAX + 8)
+#define TRACE_DEFAULT_ROUNDS 200        // replay计时回放的轮数
+
+// 记录头16字节，其后紧跟len字节数据，按主机字节序写入
+typedef struct {
+    uint64_t t_us;      // 自开始记录起的微秒数
+    uint32_t len;
+    uint8_t dir;        // TraceDir
+    uint8_t chan;
+    uint16_t reserved;
+} TraceRecord;
+
+typedef struct {
+    char magic[4];      // "ECTR"
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t reserved[2];
+} TraceHeader;
+
+_Static_assert(sizeof(TraceRecord) == 16, "收发记录头须为16字节");
+_Static_assert(sizeof(TraceHeader) == 16, "收发记录文件头须为16字节");
+
+typedef struct {
+    mutex_t lock;               // 各模组的收发线程共用一个文件
+    FILE* fp;
+    uint64_t start_us;
+    uint64_t records;
+    uint64_t bytes;
+    int channels;
+    char names[TRACE_MAX_CHANNELS][TRACE_NAME_MAX];
+} Trace;
+
+Trace g_trace;
+
+void trace_channel_name(const EC800KModem* modem, char* name, size_t size) {
+    snprintf(name, size, "%s%s", modem->port_path, modem->owner != NULL ? ":data" : "");
+}
+
+// 需持有lock
+void trace_write_locked(TraceDir dir, int chan, const void* data, size_t len) {
+    TraceRecord rec;
+    rec.t_us = monotonic_us() - g_trace.start_us;
+    rec.len = (uint32_t)len;
+    rec.dir = (uint8_t)dir;
+    rec.chan = (uint8_t)chan;
+    rec.reserved = 0;
+    fwrite(&rec, sizeof(rec), 1, g_trace.fp);
+    fwrite(data, 1, len, g_trace.fp);
+    g_trace.records++;
+    g_trace.bytes += len;
+}
+
+bool trace_open(const char* path) {
+    TraceHeader h;
+    
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        log_msg("❌ 无法创建收发记录文件: %s", path);
+        return false;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "ECTR", 4);
+    h.version = 1;
+    h.record_size = sizeof(TraceRecord);
+    fwrite(&h, sizeof(h), 1, fp);
+    
+    mutex_init(&g_trace.lock);
+    g_trace.start_us = monotonic_us();
+    g_trace.records = 0;
+    g_trace.bytes = 0;
+    g_trace.channels = 0;
+    g_trace.fp = fp;
+    log_msg("📼 记录串口收发到%s", path);
+    return true;
+}
+
+// 各模组应已断开
+void trace_close(void) {
+    if (g_trace.fp == NULL) return;
+    mutex_lock(&g_trace.lock);
+    fclose(g_trace.fp);
+    g_trace.fp = NULL;
+    mutex_unlock(&g_trace.lock);
+    mutex_destroy(&g_trace.lock);
+    log_msg("📼 收发记录: %llu条, %llu字节, %d个通道", (unsigned long long)g_trace.records,
+            (unsigned long long)g_trace.bytes, g_trace.channels);
+}
+
+// 由serial_read/serial_write调用，未开启记录时只有一次判断
+void trace_capture(const EC800KModem* modem, TraceDir dir, const void* data, size_t len) {
+    char name[TRACE_NAME_MAX];
+    
+    if (g_trace.fp == NULL || len == 0) return;
+    trace_channel_name(modem, name, sizeof(name));
+    mutex_lock(&g_trace.lock);
+    int chan = 0;
+    while (chan < g_trace.channels && strcmp(g_trace.names[chan], name) != 0) chan++;
+    if (chan == g_trace.channels && chan < TRACE_MAX_CHANNELS) {
+        snprintf(g_trace.names[chan], sizeof(g_trace.names[chan]), "%s", name);
+        g_trace.channels++;
+        trace_write_locked(TRACE_NAME, chan, name, strlen(name));
+    }
+    if (chan < g_trace.channels) trace_write_locked(dir, chan, data, len);
+    mutex_unlock(&g_trace.lock);
+}
+
+// 整个读入内存的记录文件；通道名指向data内部，不以'\0'结尾
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t records;
+    int channels;
+    const char* names[TRACE_MAX_CHANNELS];
+    uint32_t name_len[TRACE_MAX_CHANNELS];
+} TraceFile;
+
+// 读入并校验：每条记录的长度都在文件之内，收发记录的通道都已命名
+bool trace_load(const char* path, TraceFile* t) {
+    memset(t, 0, sizeof(*t));
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || ftell(fp) < (long)sizeof(TraceHeader)) {
+        log_msg("❌ 无法读取收发记录文件: %s", path);
+        if (fp != NULL) fclose(fp);
+        return false;
+    }
+    t->size = (size_t)ftell(fp);
+    t->data = (unsigned char*)malloc(t->size);
+    rewind(fp);
+    bool read_ok = t->data != NULL && fread(t->data, 1, t->size, fp) == t->size;
+    fclose(fp);
+    if (!read_ok) {
+        log_msg("❌ 无法读取收发记录文件: %s", path);
+        free(t->data);
+        t->data = NULL;
+        return false;
+    }
+    
+    const TraceHeader* h = (const TraceHeader*)t->data;
+    if (memcmp(h->magic, "ECTR", 4) != 0 || h->version != 1 || h->record_size != sizeof(TraceRecord)) {
+        log_msg("❌ %s不是收发记录文件", path);
+        free(t->data);
+        t->data = NULL;
+        return false;
+    }
+    for (size_t off = sizeof(TraceHeader); off < t->size; t->records++) {
+        TraceRecord rec;
+        bool valid = off + sizeof(rec) <= t->size;
+        if (valid) {
+            memcpy(&rec, t->data + off, sizeof(rec));
+            valid = rec.len <= t->size - off - sizeof(rec) &&
+                    (rec.dir == TRACE_NAME ? rec.chan == t->channels : rec.chan < t->channels);
+        }
+        if (!valid) {
+            log_msg("⚠️ %s在第%zu条记录处损坏，只回放之前的部分", path, t->records + 1);
+            t->size = off;
+            break;
+        }
+        if (rec.dir == TRACE_NAME) {
+            t->names[t->channels] = (const char*)t->data + off + sizeof(rec);
+            t->name_len[t->channels++] = rec.len;
+        }
+        off += sizeof(rec) + rec.len;
+    }
+    return true;
+}
+
+void trace_free(TraceFile* t) {
+    free(t->data);
+    t->data = NULL;
+}
+
+// 通道名匹配完整路径或端口短名
+bool trace_channel_matches(const TraceFile* t, int chan, const char* name) {
+    const char* s = t->names[chan];
+    size_t len = t->name_len[chan];
+    size_t n = strlen(name);
+    if (len == n && memcmp(s, name, n) == 0) return true;
+    for (size_t i = len; i > 0; i--) {
+        if (s[i - 1] == '/') return len - i == n && memcmp(s + i, name, n) == 0;
+    }
+    return false;
+}
+
+// 一个通道回放后的解析结果，用于核对固件差异下的解析是否正确
+typedef struct {
+    uint64_t lines;         // 接收字节中的非空行
+    uint64_t rx_bytes;
+    int commands;
+    int ok;
+    int errors;             // ERROR/+CME ERROR/+CMS ERROR
+    int unanswered;         // 下一条命令发出时仍未收到结果码
+    int data_modes;         // CONNECT进入数据模式的次数，其后的接收字节不解析
+    int fota_result;
+    int download_result;
+    FotaStage fota_stage;
+    int fota_progress;
+    int creg_stat;
+    int cereg_stat;
+    bool rebooted;
+    char version[64];       // 最后一次AT+QGMR的应答
+} ReplayStats;
+
+// 每个通道一份解析状态：modem只承接URC分发与FOTA/注册状态，不打开串口
+typedef struct {
+    EC800KModem modem;
+    AtResponse resp;
+    char cmd[AT_TX_SIZE];
+    bool pending;           // 命令已发出、尚未收到结果码
+    bool data_mode;         // CONNECT之后到下一条命令之前
+    bool in_line;           // 统计行数用
+    ReplayStats stats;
+} ReplayChannel;
+
+void replay_channel_reset(ReplayChannel* ch) {
+    modem_fota_reset(&ch->modem);
+    ch->modem.urc_len = 0;
+    ch->modem.creg_stat = -1;
+    ch->modem.cereg_stat = -1;
+    ch->modem.rebooted = false;
+    ch->pending = false;
+    ch->data_mode = false;
+    ch->in_line = false;
+    memset(&ch->stats, 0, sizeof(ch->stats));
+}
+
+// 一条命令收到结果码
+void replay_command_done(ReplayChannel* ch) {
+    const AtResponse* resp = &ch->resp;
+    ch->pending = false;
+    if (resp->result == AT_RESULT_OK || resp->result == AT_RESULT_CONNECT) {
+        ch->stats.ok++;
+    } else {
+        ch->stats.errors++;
+    }
+    // AT+QGMR可能在拼接命令的开头，此时第一条信息行仍是版本号
+    if (resp->result == AT_RESULT_OK && resp->line_count > 0 && strncmp(ch->cmd, "AT+QGMR", 7) == 0 &&
+        (ch->cmd[7] == '\0' || ch->cmd[7] == ';')) {
+        at_line_copy(&resp->lines[0], ch->stats.version, sizeof(ch->stats.version));
+    }
+}
+
+// 与在线流程一致，只有走数据模式的命令（modem_at_send_data_locked、HTTP读取、UFS下载）识别CONNECT
+bool replay_allows_connect(const char* cmd) {
+    static const char* data_cmds[] = {
+        "AT+QHTTPURL=", "AT+QHTTPREAD=", "AT+QHTTPPOST=", "AT+QHTTPPUT=", "AT+QHTTPGET=",
+        "AT+QFUPL=", "AT+QFDWL=",
+    };
+    for (size_t i = 0; i < sizeof(data_cmds) / sizeof(data_cmds[0]); i++) {
+        if (strncasecmp(cmd, data_cmds[i], strlen(data_cmds[i])) == 0) return true;
+    }
+    return false;
+}
+
+// 数据模式下写出的是载荷而不是命令，以"AT"开头的写入才开始新的事务
+void replay_tx(ReplayChannel* ch, const char* data, size_t len) {
+    if (len < 2 || strncasecmp(data, "AT", 2) != 0) return;
+    while (len > 0 && (data[len - 1] == '\r' || data[len - 1] == '\n')) len--;
+    if (len >= sizeof(ch->cmd)) len = sizeof(ch->cmd) - 1;
+    
+    if (ch->pending) ch->stats.unanswered++;
+    memcpy(ch->cmd, data, len);
+    ch->cmd[len] = '\0';
+    at_response_init(&ch->resp, ch->cmd);
+    ch->resp.allow_connect = replay_allows_connect(ch->cmd);
+    ch->pending = true;
+    ch->data_mode = false;
+    ch->stats.commands++;
+}
+
+// 与modem_at_wait_locked相同：事务中按响应解析，结果码之后同批到达的字节与事务外的字节按URC处理
+void replay_rx(ReplayChannel* ch, const char* data, size_t len) {
+    size_t used = 0;
+    
+    ch->stats.rx_bytes += len;
+    if (ch->data_mode) return;
+    if (ch->pending) {
+        used = at_response_feed(&ch->resp, &ch->modem, data, len);
+        if (ch->resp.result == AT_RESULT_NONE) return;
+        replay_command_done(ch);
+        if (ch->resp.result == AT_RESULT_CONNECT) {
+            ch->data_mode = true;
+            ch->stats.data_modes++;
+            return;
+        }
+        ch->modem.urc_len = 0;
+    }
+    modem_feed_urc_bytes(&ch->modem, data + used, len - used);
+}
+
+// 回放一轮：按记录顺序把收发送入各通道；only >= 0时只回放该通道
+void replay_round(const TraceFile* t, ReplayChannel* chans, int only) {
+    for (int i = 0; i < t->channels; i++) {
+        if (only < 0 || i == only) replay_channel_reset(&chans[i]);
+    }
+    for (size_t off = sizeof(TraceHeader); off < t->size; ) {
+        TraceRecord rec;
+        memcpy(&rec, t->data + off, sizeof(rec));
+        const char* data = (const char*)t->data + off + sizeof(rec);
+        off += sizeof(rec) + rec.len;
+        if (only >= 0 && rec.chan != only) continue;
+        
+        if (rec.dir == TRACE_TX) {
+            replay_tx(&chans[rec.chan], data, rec.len);
+        } else if (rec.dir == TRACE_RX) {
+            replay_rx(&chans[rec.chan], data, rec.len);
+        }
+    }
+    for (int i = 0; i < t->channels; i++) {
+        if (only >= 0 && i != only) continue;
+        ReplayStats* s = &chans[i].stats;
+        const EC800KModem* m = &chans[i].modem;
+        if (chans[i].pending) s->unanswered++;
+        s->fota_result = m->fota_result;
+        s->download_result = m->download_result;
+        s->fota_stage = m->fota_stage;
+        s->fota_progress = m->fota_progress;
+        s->creg_stat = m->creg_stat;
+        s->cereg_stat = m->cereg_stat;
+        s->rebooted = m->rebooted;
+    }
+}
+
+// 非空行数单独统计，不计入回放耗时
+void replay_count_lines(const TraceFile* t, ReplayChannel* chans, int only) {
+    for (size_t off = sizeof(TraceHeader); off < t->size; ) {
+        TraceRecord rec;
+        memcpy(&rec, t->data + off, sizeof(rec));
+        const unsigned char* data = t->data + off + sizeof(rec);
+        off += sizeof(rec) + rec.len;
+        if (rec.dir != TRACE_RX || (only >= 0 && rec.chan != only)) continue;
+        
+        ReplayChannel* ch = &chans[rec.chan];
+        for (uint32_t i = 0; i < rec.len; i++) {
+            bool eol = data[i] == '\r' || data[i] == '\n';
+            if (eol && ch->in_line) ch->stats.lines++;
+            ch->in_line = !eol;
+        }
+    }
+}
+
+// 为记录中的各通道分配解析状态，模组日志静默
+ReplayChannel* replay_channels_create(const TraceFile* t) {
+    ReplayChannel* chans = (ReplayChannel*)calloc((size_t)(t->channels > 0 ? t->channels : 1), sizeof(ReplayChannel));
+    if (chans == NULL) return NULL;
+    for (int i = 0; i < t->channels; i++) {
+        char name[TRACE_NAME_MAX];
+        snprintf(name, sizeof(name), "%.*s", (int)t->name_len[i], t->names[i]);
+        modem_init(&chans[i].modem, name, DEFAULT_BAUDRATE);
+        chans[i].modem.log_quiet = true;
+    }
+    return chans;
+}
+
+void replay_channels_destroy(ReplayChannel* chans, int count) {
+    for (int i = 0; i < count; i++) {
+        modem_destroy(&chans[i].modem);
+    }
+    free(chans);
+}
+
+// 连续回放rounds轮，返回总耗时（微秒）；stats为最后一轮的解析结果
+uint64_t replay_run(const TraceFile* t, ReplayChannel* chans, int only, int rounds) {
+    uint64_t start = monotonic_us();
+    for (int r = 0; r < rounds; r++) {
+        replay_round(t, chans, only);
+    }
+    uint64_t elapsed = monotonic_us() - start;
+    replay_count_lines(t, chans, only);
+    return elapsed;
+}
+
+// replay命令：channel为auto/all时回放全部通道，否则只回放匹配的一个
+int run_replay(const char* channel, const char* path, int rounds) {
+    TraceFile t;
+    int only = -1;
+    
+    if (rounds < 1) rounds = 1;
+    if (!trace_load(path, &t)) return 1;
+    if (strcmp(channel, "auto") != 0 && strcmp(channel, "all") != 0) {
+        for (int i = 0; i < t.channels && only < 0; i++) {
+            if (trace_channel_matches(&t, i, channel)) only = i;
+        }
+        if (only < 0) {
+            log_msg("❌ %s中没有通道%s，共%d个通道:", path, channel, t.channels);
+            for (int i = 0; i < t.channels; i++) log_printf("   %.*s\n", (int)t.name_len[i], t.names[i]);
+            trace_free(&t);
+            return 1;
+        }
+    }
+    ReplayChannel* chans = replay_channels_create(&t);
+    if (chans == NULL) {
+        log_msg("❌ 内存不足");
+        trace_free(&t);
+        return 1;
+    }
+    
+    uint64_t us = replay_run(&t, chans, only, rounds);
+    
+    log_printf("\n==================================================\n");
+    log_printf("📼 回放: %s (%zu条记录, %d个通道)\n", path, t.records, t.channels);
+    log_printf("==================================================\n");
+    log_printf("通道                 命令    OK  错误 未应答 数据模式     接收字节       行数  注册URC     下载  FOTA  固件版本\n");
+    uint64_t lines = 0, bytes = 0;
+    for (int i = 0; i < t.channels; i++) {
+        if (only >= 0 && i != only) continue;
+        const ReplayStats* s = &chans[i].stats;
+        lines += s->lines;
+        bytes += s->rx_bytes;
+        log_printf("%-20.*s %5d %5d %5d %6d %8d %12llu %10llu  %4d/%-5d  %4d  %4d  %s%s\n",
+                   (int)t.name_len[i], t.names[i], s->commands, s->ok, s->errors, s->unanswered, s->data_modes,
+                   (unsigned long long)s->rx_bytes, (unsigned long long)s->lines, s->creg_stat, s->cereg_stat,
+                   s->download_result, s->fota_result, s->version[0] ? s->version : "-", s->rebooted ? " (RDY)" : "");
+    }
+    if (lines > 0 && us > 0) {
+        log_printf("\n⏱️ 回放%d轮用时%.1fms: 每秒%.0f行, 每行%.0fns, 每秒%.1fMB\n", rounds, us / 1000.0,
+                   (double)lines * rounds * 1e6 / (double)us, (double)us * 1000.0 / ((double)lines * rounds),
+                   (double)bytes * rounds / (double)us);
+    } else {
+        log_printf("\n⚠️ 记录中没有可回放的接收数据\n");
+    }
+    
+    replay_channels_destroy(chans, t.channels);
+    trace_free(&t);
+    return 0;
+}
+
+// ================== 串口发现 ==================
+
+// 先从sysfs（Windows为SetupAPI）读取USB VID/PID/接口号/序列号，按型号表直接认出Quectel AT口；
+// 其余候选口并发短超时探测，结果按USB身份缓存到文件，下次身份一致时不再探测
+
+#define MAX_SERIAL_PORTS 128
+#define QUECTEL_VID 0x2c7c
+#define DISCOVER_PROBE_MS 300           // 探测AT响应的超时
+#define DISCOVER_PROBE_THREADS 64
+#define DISCOVER_CACHE_FILE "ec800k_ports.cache"
+
+typedef struct {
+    char path[64];
+    char usb_path[32];          // USB拓扑位置（如1-1.2），机架上对应固定槽位；空为身份未知
+    char serial[64];            // USB序列号，可能为空
+    unsigned int vid;
+    unsigned int pid;
+    int interface;              // USB接口号，-1为未知
+    bool at_port;               // 型号表中的AT接口，或探测/缓存确认有AT响应
+    bool probed;                // 本次经AT探测
+    bool cached;                // 身份与缓存一致，沿用缓存结果
+    char imei[32];
+} SerialPortInfo;
+
+int compare_port_names(const void* a, const void* b) {
+    return strcmp((const char*)a, (const char*)b);
+}
+
+// 扫描候选串口，返回数量（按名称排序）
+int scan_serial_ports(char ports[][64], int max_ports) {
+    int count = 0;
+#ifdef _WIN32
+    (void)ports;
+    (void)max_ports;
+#else
+    DIR* dir = opendir("/dev");
+    if (dir) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL && count < max_ports) {
+#ifdef __APPLE__
+            if (strstr(entry->d_name, "tty.usb") || strstr(entry->d_name, "cu.usb")) {
+#else
+            if (strstr(entry->d_name, "ttyUSB") || strstr(entry->d_name, "ttyACM")) {
+#endif
+                snprintf(ports[count++], 64, "/dev/%.58s", entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    qsort(ports, (size_t)count, 64, compare_port_names);
+#endif
+    return count;
+}
+
+// 已知型号的AT接口号，未收录的型号（如EC800K等ASR平台）返回-1，需逐个接口探测
+int quectel_at_interface(unsigned int pid, const char** model) {
+    static const struct {
+        unsigned int pid;
+        int at_interface;
+        const char* model;
+    } models[] = {
+        { 0x0121, 2, "EC21" },
+        { 0x0125, 2, "EC25/EC20" },
+        { 0x0191, 2, "EG91" },
+        { 0x0195, 2, "EG95" },
+        { 0x0296, 2, "BG96" },
+        { 0x0306, 2, "EP06/EG06" },
+    };
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+        if (models[i].pid == pid) {
+            if (model != NULL) *model = models[i].model;
+            return models[i].at_interface;
+        }
+    }
+    if (model != NULL) *model = "Quectel";
+    return -1;
+}
+
+// 型号表已排除的非AT接口（DM/NMEA/PPP口）
+bool port_known_non_at(const SerialPortInfo* info) {
+    if (info->vid != QUECTEL_VID || info->interface < 0) return false;
+    int at_interface = quectel_at_interface(info->pid, NULL);
+    return at_interface >= 0 && at_interface != info->interface;
+}
+
+#ifdef __linux__
+bool sysfs_read(const char* dir, const char* name, char* buf, size_t size) {
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    bool ok = fgets(buf, (int)size, fp) != NULL;
+    fclose(fp);
+    if (ok) buf[strcspn(buf, "\r\n")] = '\0';
+    return ok;
+}
+
+// /sys/class/tty/<name>/device指向USB接口目录（cdc-acm）或其下的usb-serial设备，
+// 向上找到含bInterfaceNumber的接口目录，其父目录即USB设备
+void sysfs_identify(SerialPortInfo* info) {
+    char link[PATH_MAX];
+    char dir[PATH_MAX];
+    char value[64];
+    const char* name = strrchr(info->path, '/');
+    
+    snprintf(link, sizeof(link), "/sys/class/tty/%s/device", name != NULL ? name + 1 : info->path);
+    if (realpath(link, dir) == NULL) return;
+    
+    for (int depth = 0; depth < 3; depth++) {
+        if (sysfs_read(dir, "bInterfaceNumber", value, sizeof(value))) {
+            info->interface = (int)strtol(value, NULL, 16);
+            char* slash = strrchr(dir, '/');
+            if (slash == NULL) return;
+            *slash = '\0';
+            if (sysfs_read(dir, "idVendor", value, sizeof(value))) info->vid = (unsigned int)strtoul(value, NULL, 16);
+            if (sysfs_read(dir, "idProduct", value, sizeof(value))) info->pid = (unsigned int)strtoul(value, NULL, 16);
+            if (!sysfs_read(dir, "serial", info->serial, sizeof(info->serial))) info->serial[0] = '\0';
+            slash = strrchr(dir, '/');
+            snprintf(info->usb_path, sizeof(info->usb_path), "%.31s", slash != NULL ? slash + 1 : dir);
+            return;
+        }
+        char* slash = strrchr(dir, '/');
+        if (slash == NULL || slash == dir) return;
+        *slash = '\0';
+    }
+}
+#endif
+
+#ifdef _WIN32
+// 设备实例ID形如 USB\VID_2C7C&PID_0125&MI_02\6&2F1B3F2&0&0002
+void setupapi_identify(const char* id, SerialPortInfo* info) {
+    const char* vid = strstr(id, "VID_");
+    const char* pid = strstr(id, "PID_");
+    const char* mi = strstr(id, "&MI_");
+    const char* inst = strrchr(id, '\\');
+    if (vid != NULL) info->vid = (unsigned int)strtoul(vid + 4, NULL, 16);
+    if (pid != NULL) info->pid = (unsigned int)strtoul(pid + 4, NULL, 16);
+    if (mi != NULL) info->interface = (int)strtol(mi + 4, NULL, 16);
+    if (vid != NULL && inst != NULL) snprintf(info->usb_path, sizeof(info->usb_path), "%.31s", inst + 1);
+}
+#endif
+
+// 枚举系统串口及其USB身份（不打开串口），按名称排序
+int discover_enumerate(SerialPortInfo* infos, int max_ports) {
+    int count = 0;
+#ifdef _WIN32
+    HDEVINFO set = SetupDiGetClassDevsA(&GUID_DEVCLASS_PORTS, NULL, NULL, DIGCF_PRESENT);
+    if (set == INVALID_HANDLE_VALUE) return 0;
+    SP_DEVINFO_DATA dev;
+    dev.cbSize = sizeof(dev);
+    for (DWORD i = 0; count < max_ports && SetupDiEnumDeviceInfo(set, i, &dev); i++) {
+        char port[64];
+        char id[256];
+        DWORD size = sizeof(port) - 1;
+        DWORD type = 0;
+        HKEY key = SetupDiOpenDevRegKey(set, &dev, DICS_FLAG_GLOBAL, 0, DIREG_DEV, KEY_READ);
+        if (key == INVALID_HANDLE_VALUE) continue;
+        LONG rc = RegQueryValueExA(key, "PortName", NULL, &type, (LPBYTE)port, &size);
+        RegCloseKey(key);
+        if (rc != ERROR_SUCCESS || type != REG_SZ || strncmp(port, "COM", 3) != 0) continue;
+        port[size] = '\0';
+        
+        SerialPortInfo* info = &infos[count++];
+        memset(info, 0, sizeof(*info));
+        info->interface = -1;
+        snprintf(info->path, sizeof(info->path), "%s", port);
+        if (SetupDiGetDeviceInstanceIdA(set, &dev, id, sizeof(id), NULL)) {
+            setupapi_identify(id, info);
+        }
+    }
+    SetupDiDestroyDeviceInfoList(set);
+    qsort(infos, (size_t)count, sizeof(SerialPortInfo), compare_port_names);
+#else
+    char (*ports)[64] = (char (*)[64])malloc((size_t)MAX_SERIAL_PORTS * 64);
+    if (ports == NULL) return 0;
+    count = scan_serial_ports(ports, max_ports < MAX_SERIAL_PORTS ? max_ports : MAX_SERIAL_PORTS);
+    for (int i = 0; i < count; i++) {
+        SerialPortInfo* info = &infos[i];
+        memset(info, 0, sizeof(*info));
+        info->interface = -1;
+        memcpy(info->path, ports[i], sizeof(info->path));
+#ifdef __linux__
+        sysfs_identify(info);
+#endif
+    }
+    free(ports);
+#endif
+    for (int i = 0; i < count; i++) {
+        infos[i].at_port = infos[i].vid == QUECTEL_VID && infos[i].interface >= 0 &&
+                           quectel_at_interface(infos[i].pid, NULL) == infos[i].interface;
+    }
+    return count;
+}
+
+// 给定的端口列表：从枚举结果中取USB身份，未枚举到的（如伪终端）身份未知
+int discover_identify(const char ports[][64], int count, SerialPortInfo* infos) {
+    SerialPortInfo* all = (SerialPortInfo*)malloc(MAX_SERIAL_PORTS * sizeof(SerialPortInfo));
+    int total = all != NULL ? discover_enumerate(all, MAX_SERIAL_PORTS) : 0;
+    
+    for (int i = 0; i < count; i++) {
+        memset(&infos[i], 0, sizeof(infos[i]));
+        infos[i].interface = -1;
+        snprintf(infos[i].path, sizeof(infos[i].path), "%s", ports[i]);
+        for (int j = 0; j < total; j++) {
+            if (strcmp(all[j].path, ports[i]) == 0) {
+                infos[i] = all[j];
+                break;
+            }
+        }
+    }
+    free(all);
+    return count;
+}
+
+// 缓存行: <端口> <USB位置> <VID:PID> <接口号> <序列号|-> <IMEI|->，IMEI为"-"表示无AT响应
+void discover_cache_load(SerialPortInfo* infos, int count) {
+    FILE* fp = fopen(DISCOVER_CACHE_FILE, "r");
+    char line[256];
+    if (fp == NULL) return;
+    
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char path[64], usb_path[32], serial[64], imei[32];
+        unsigned int vid, pid;
+        int interface;
+        if (line[0] == '#' ||
+            sscanf(line, "%63s %31s %x:%x %d %63s %31s", path, usb_path, &vid, &pid, &interface, serial,
+                   imei) != 7) {
+            continue;
+        }
+        if (strcmp(serial, "-") == 0) serial[0] = '\0';
+        for (int i = 0; i < count; i++) {
+            SerialPortInfo* info = &infos[i];
+            if (info->usb_path[0] != '\0' && strcmp(info->path, path) == 0 &&
+                strcmp(info->usb_path, usb_path) == 0 && info->vid == vid && info->pid == pid &&
+                info->interface == interface && strcmp(info->serial, serial) == 0) {
+                info->cached = true;
+                info->at_port = strcmp(imei, "-") != 0;
+                snprintf(info->imei, sizeof(info->imei), "%s", info->at_port ? imei : "");
+            }
+        }
+    }
+    fclose(fp);
+}
+
+// 以临时文件替换缓存文件（Windows的rename不覆盖已有文件）
+bool cache_file_replace(FILE* fp, const char* tmp_path, const char* path) {
+    bool ok = fclose(fp) == 0;
+#ifdef _WIN32
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+// 只缓存身份已知且有结论的端口，保留文件中其他端口的条目；原子替换，避免并发运行读到半个文件
+void discover_cache_save(const SerialPortInfo* infos, int count) {
+    char tmp_path[64];
+    char line[256];
+    int identified = 0;
+    for (int i = 0; i < count; i++) {
+        if (infos[i].usb_path[0] != '\0') identified++;
+    }
+    if (identified == 0) return;
+    
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", DISCOVER_CACHE_FILE);
+    FILE* fp = fopen(tmp_path, "w");
+    if (fp == NULL) return;
+    
+    fprintf(fp, "# 端口 USB位置 VID:PID 接口号 序列号 IMEI\n");
+    FILE* old = fopen(DISCOVER_CACHE_FILE, "r");
+    while (old != NULL && fgets(line, sizeof(line), old) != NULL) {
+        bool replaced = line[0] == '#';
+        size_t path_len = strcspn(line, " ");
+        for (int i = 0; i < count && !replaced; i++) {
+            replaced = strlen(infos[i].path) == path_len && strncmp(infos[i].path, line, path_len) == 0;
+        }
+        if (!replaced) fputs(line, fp);
+    }
+    if (old != NULL) fclose(old);
+    for (int i = 0; i < count; i++) {
+        const SerialPortInfo* info = &infos[i];
+        if (info->usb_path[0] == '\0' || !(info->probed || info->cached)) continue;
+        if (info->at_port && info->imei[0] == '\0') continue;     // IMEI未读到，下次重新探测
+        fprintf(fp, "%s %s %04x:%04x %d %s %s\n", info->path, info->usb_path, info->vid, info->pid,
+                info->interface, info->serial[0] ? info->serial : "-", info->at_port ? info->imei : "-");
+    }
+    cache_file_replace(fp, tmp_path, DISCOVER_CACHE_FILE);
+}
+
+typedef struct {
+    SerialPortInfo* infos;
+    int* todo;
+    int count;
+    int next;
+    mutex_t lock;
+} DiscoverProbe;
+
+// 短超时探测AT响应并读取IMEI
+void discover_probe_port(SerialPortInfo* info) {
+    EC800KModem modem;
+    AtResponse resp;
+    
+    info->probed = true;
+    info->at_port = false;
+    info->imei[0] = '\0';
+    modem_init(&modem, info->path, DEFAULT_BAUDRATE);
+    if (modem_open_port(&modem, false)) {
+        if (modem_at_transact(&modem, "AT", &resp, DISCOVER_PROBE_MS)) {
+            info->at_port = true;
+            if (modem_at_transact(&modem, "AT+GSN", &resp, AT_TIMEOUT_POLICY) && resp.line_count > 0) {
+                at_line_copy(&resp.lines[0], info->imei, sizeof(info->imei));
+            }
+        }
+        serial_close(&modem);
+    }
+    modem_destroy(&modem);
+}
+
+THREAD_RETURN discover_probe_worker(void* arg) {
+    DiscoverProbe* probe = (DiscoverProbe*)arg;
+    
+    for (;;) {
+        mutex_lock(&probe->lock);
+        int index = probe->next < probe->count ? probe->todo[probe->next++] : -1;
+        mutex_unlock(&probe->lock);
+        if (index < 0) break;
+        
+        discover_probe_port(&probe->infos[index]);
+    }
+    return THREAD_RESULT;
+}
+
+// 确定各端口是否为AT口及其IMEI：缓存命中的直接沿用，其余（型号表排除的接口除外）并发探测
+void discover_resolve(SerialPortInfo* infos, int count) {
+    int todo[MAX_SERIAL_PORTS];
+    thread_t threads[DISCOVER_PROBE_THREADS];
+    DiscoverProbe probe;
+    
+    discover_cache_load(infos, count);
+    probe.infos = infos;
+    probe.todo = todo;
+    probe.count = 0;
+    probe.next = 0;
+    for (int i = 0; i < count && i < MAX_SERIAL_PORTS; i++) {
+        if (!infos[i].cached && !port_known_non_at(&infos[i])) todo[probe.count++] = i;
+    }
+    if (probe.count == 0) return;
+    
+    mutex_init(&probe.lock);
+    int workers = probe.count < DISCOVER_PROBE_THREADS ? probe.count : DISCOVER_PROBE_THREADS;
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        if (thread_create(&threads[started], discover_probe_worker, &probe)) started++;
+    }
+    if (started == 0) discover_probe_worker(&probe);
+    for (int i = 0; i < started; i++) {
+        thread_join(threads[i]);
+    }
+    mutex_destroy(&probe.lock);
+    
+    discover_cache_save(infos, count);
+}
+
+// 自动发现AT口，同一模组（IMEI相同）的多个AT口只保留第一个，返回数量
+int discover_at_ports(char ports[][64], int max_ports) {
+    static SerialPortInfo infos[MAX_SERIAL_PORTS];
+    uint64_t start = monotonic_ms();
+    int found = 0;
+    int probed = 0;
+    int cached = 0;
+    
+    int count = discover_enumerate(infos, MAX_SERIAL_PORTS);
+    discover_resolve(infos, count);
+    for (int i = 0; i < count; i++) {
+        if (infos[i].probed) probed++;
+        if (infos[i].cached) cached++;
+        if (!infos[i].at_port || found >= max_ports) continue;
+        
+        bool duplicate = false;
+        for (int j = 0; j < i && infos[i].imei[0] != '\0'; j++) {
+            if (infos[j].at_port && strcmp(infos[j].imei, infos[i].imei) == 0) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate) snprintf(ports[found++], 64, "%s", infos[i].path);
+    }
+    log_msg("🔎 发现%d个AT口 (串口%d个, 探测%d个, 缓存命中%d个, 用时%llums)", found, count, probed, cached,
+            (unsigned long long)(monotonic_ms() - start));
+    return found;
+}
+
+void print_port_table(const SerialPortInfo* infos, int count) {
+    log_printf("端口                 VID:PID    接口   USB位置      IMEI             说明\n");
+    for (int i = 0; i < count; i++) {
+        const SerialPortInfo* info = &infos[i];
+        char id[16] = "-";
+        char iface[12] = "-";
+        const char* note = "";
+        const char* model = NULL;
+        
+        if (info->vid != 0) snprintf(id, sizeof(id), "%04x:%04x", info->vid, info->pid);
+        if (info->interface >= 0) snprintf(iface, sizeof(iface), "%d", info->interface);
+        if (info->vid == QUECTEL_VID) quectel_at_interface(info->pid, &model);
+        if (info->at_port) {
+            note = info->cached ? "AT口(缓存)" : info->probed ? "AT口(探测)" : "AT口";
+        } else if (info->probed || info->cached) {
+            note = "无AT响应";
+        } else if (port_known_non_at(info)) {
+            note = "非AT接口";
+        }
+        log_printf("%-20s %-10s %-6s %-12s %-16s %s%s%s\n", info->path, id, iface,
+                   info->usb_path[0] ? info->usb_path : "-", info->imei[0] ? info->imei : "-", note,
+                   model != NULL ? " " : "", model != NULL ? model : "");
+    }
+}
+
+// 列出串口及USB身份，不打开串口
+void list_serial_ports(void) {
+    static SerialPortInfo infos[MAX_SERIAL_PORTS];
+    
+    log_printf("\n📋 可用串口列表:\n");
+    log_printf("--------------------------------------------------\n");
+    int count = discover_enumerate(infos, MAX_SERIAL_PORTS);
+    if (count > 0) {
+        print_port_table(infos, count);
+    }
+#ifdef _WIN32
+    if (count == 0) {
+        log_printf("  未发现COM端口，请在设备管理器中确认驱动\n");
+    }
+#endif
+    log_printf("\n");
+}
+
+// 解析逗号分隔的串口列表，"auto"时自动发现AT口
+int parse_port_list(const char* ports_arg, char ports[][64], int max_ports) {
+    int count = 0;
+    
+    if (strcmp(ports_arg, "auto") == 0) {
+        return discover_at_ports(ports, max_ports);
+    }
+    const char* p = ports_arg;
+    while (*p && count < max_ports) {
+        size_t len = strcspn(p, ",");
+        if (len > 0 && len < 64) {
+            memcpy(ports[count], p, len);
+            ports[count++][len] = '\0';
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+    return count;
+}
+
+// discover命令：枚举（auto）或给定列表，探测并打印端口表
+int run_discover(const char* ports_arg) {
+    static SerialPortInfo infos[MAX_SERIAL_PORTS];
+    static char ports[MAX_SERIAL_PORTS][64];
+    uint64_t start = monotonic_ms();
+    int count;
+    
+    if (strcmp(ports_arg, "auto") == 0) {
+        count = discover_enumerate(infos, MAX_SERIAL_PORTS);
+    } else {
+        count = discover_identify(ports, parse_port_list(ports_arg, ports, MAX_SERIAL_PORTS), infos);
+    }
+    if (count == 0) {
+        log_msg("❌ 没有可用的串口");
+        return 1;
+    }
+    discover_resolve(infos, count);
+    
+    log_printf("\n==================================================\n");
+    log_printf("🔎 串口发现 (用时%llums，缓存: %s)\n", (unsigned long long)(monotonic_ms() - start),
+               DISCOVER_CACHE_FILE);
+    log_printf("==================================================\n");
+    print_port_table(infos, count);
+    return 0;
+}
+
+// ================== 设备信息缓存 ==================
+
+// --state-cache：按IMEI缓存固件版本与SIM ICCID。IMEI由串口发现缓存按USB身份给出，
+// 再用一条AT+QGMR校验：版本一致即沿用缓存，跳过AT+GSN/AT+QCCID；版本变化时重新查询，
+// 会话中收到RDY（模组重启，可能已换卡）且未重新查询时淘汰该条目
+
+#define DEVICE_CACHE_FILE "ec800k_devices.cache"
+
+typedef struct {
+    char imei[32];
+    char iccid[32];
+    char version[64];
+} DeviceInfo;
+
+mutex_t device_cache_lock;      // 批量模式下各线程读写同一缓存文件
+
+void device_cache_init(void) {
+    mutex_init(&device_cache_lock);
+}
+
+// 缓存行: <IMEI> <ICCID|-> <固件版本>
+bool device_cache_find(const char* imei, DeviceInfo* info) {
+    char line[256];
+    bool found = false;
+    
+    mutex_lock(&device_cache_lock);
+    FILE* fp = fopen(DEVICE_CACHE_FILE, "r");
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        DeviceInfo entry;
+        if (line[0] == '#' ||
+            sscanf(line, "%31s %31s %63[^\r\n]", entry.imei, entry.iccid, entry.version) != 3 ||
+            strcmp(entry.imei, imei) != 0) {
+            continue;
+        }
+        if (strcmp(entry.iccid, "-") == 0) entry.iccid[0] = '\0';
+        *info = entry;
+        found = true;
+    }
+    if (fp != NULL) fclose(fp);
+    mutex_unlock(&device_cache_lock);
+    return found;
+}
+
+// 写入（info非NULL）或删除imei对应的条目
+void device_cache_update(const char* imei, const DeviceInfo* info) {
+    char tmp_path[64];
+    char line[256];
+    size_t imei_len = strlen(imei);
+    
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", DEVICE_CACHE_FILE);
+    mutex_lock(&device_cache_lock);
+    FILE* fp = fopen(tmp_path, "w");
+    if (fp != NULL) {
+        fprintf(fp, "# IMEI ICCID 固件版本\n");
+        FILE* old = fopen(DEVICE_CACHE_FILE, "r");
+        while (old != NULL && fgets(line, sizeof(line), old) != NULL) {
+            if (line[0] == '#' || (strncmp(line, imei, imei_len) == 0 && line[imei_len] == ' ')) continue;
+            fputs(line, fp);
+        }
+        if (old != NULL) fclose(old);
+        if (info != NULL) {
+            fprintf(fp, "%s %s %s\n", info->imei, info->iccid[0] ? info->iccid : "-", info->version);
+        }
+        cache_file_replace(fp, tmp_path, DEVICE_CACHE_FILE);
+    }
+    mutex_unlock(&device_cache_lock);
+}
+
+// 按USB身份从串口发现缓存取得IMEI，不打开串口
+bool modem_cached_imei(const EC800KModem* modem, char* imei, size_t size) {
+    SerialPortInfo info;
+    char ports[1][64];
+    
+    snprintf(ports[0], sizeof(ports[0]), "%.63s", modem->port_path);
+    discover_identify(ports, 1, &info);
+    mutex_lock(&device_cache_lock);
+    discover_cache_load(&info, 1);
+    mutex_unlock(&device_cache_lock);
+    if (!info.cached || !info.at_port || info.imei[0] == '\0') return false;
+    snprintf(imei, size, "%s", info.imei);
+    return true;
+}
+
+// 完整查询后把端口→IMEI记入串口发现缓存（身份未知的端口不记录）
+void modem_remember_port(const EC800KModem* modem) {
+    SerialPortInfo info;
+    char ports[1][64];
+    
+    snprintf(ports[0], sizeof(ports[0]), "%.63s", modem->port_path);
+    discover_identify(ports, 1, &info);
+    if (info.usb_path[0] == '\0') return;
+    info.at_port = true;
+    info.probed = true;
+    snprintf(info.imei, sizeof(info.imei), "%s", modem->imei);
+    mutex_lock(&device_cache_lock);
+    discover_cache_save(&info, 1);
+    mutex_unlock(&device_cache_lock);
+}
+
+// 设备信息查询可与其他查询合并为一个批次：缓存命中时只加入AT+QGMR用于校验
+typedef struct {
+    DeviceInfo cached;
+    bool hit;
+    int i_qgmr;
+    int i_gsn;
+    int i_qccid;
+} DeviceInfoQuery;
+
+void device_info_batch_add(EC800KModem* modem, AtBatch* batch, DeviceInfoQuery* q) {
+    q->hit = modem->state_cache && !modem->rebooted &&
+             modem_cached_imei(modem, q->cached.imei, sizeof(q->cached.imei)) &&
+             device_cache_find(q->cached.imei, &q->cached);
+    q->i_qgmr = at_batch_add(batch, "AT+QGMR", NULL);
+    q->i_gsn = q->hit ? -1 : at_batch_add(batch, "AT+GSN", NULL);
+    q->i_qccid = q->hit ? -1 : at_batch_add(batch, "AT+QCCID", "+QCCID:");
+}
+
+// 由批次结果更新模组的版本/IMEI/ICCID；缓存校验不通过（版本变化）时补查IMEI与ICCID
+bool device_info_batch_apply(EC800KModem* modem, const AtBatch* batch, DeviceInfoQuery* q) {
+    const AtLine* line;
+    AtBatch refresh;
+    int i_gsn = q->i_gsn;
+    int i_qccid = q->i_qccid;
+    
+    modem->fw_version[0] = '\0';
+    if ((line = at_batch_line(batch, q->i_qgmr)) != NULL) {
+        at_line_copy(line, modem->fw_version, sizeof(modem->fw_version));
+    }
+    if (modem->fw_version[0] == '\0') return false;
+    
+    if (q->hit) {
+        if (strcmp(q->cached.version, modem->fw_version) == 0) {
+            snprintf(modem->imei, sizeof(modem->imei), "%s", q->cached.imei);
+            snprintf(modem->iccid, sizeof(modem->iccid), "%s", q->cached.iccid);
+            modem->info_valid = true;
+            modem_log(modem, "📌 设备信息缓存命中 (IMEI %s)", modem->imei);
+            return true;
+        }
+        modem_log(modem, "♻️ 固件版本已变化 (%s → %s)，重新查询设备信息", q->cached.version, modem->fw_version);
+        at_batch_init(&refresh);
+        i_gsn = at_batch_add(&refresh, "AT+GSN", NULL);
+        i_qccid = at_batch_add(&refresh, "AT+QCCID", "+QCCID:");
+        modem_at_batch(modem, &refresh, AT_TIMEOUT_POLICY);
+        batch = &refresh;
+    }
+    
+    modem->imei[0] = '\0';
+    modem->iccid[0] = '\0';
+    if ((line = at_batch_line(batch, i_gsn)) != NULL) {
+        at_line_copy(line, modem->imei, sizeof(modem->imei));
+    }
+    if ((line = at_batch_line(batch, i_qccid)) != NULL) {
+        // +QCCID: <ICCID>
+        char text[AT_LINE_MAX];
+        at_line_copy(line, text, sizeof(text));
+        const char* p = text + 7;
+        while (*p == ' ') p++;
+        snprintf(modem->iccid, sizeof(modem->iccid), "%.31s", p);
+    }
+    if (modem->imei[0] == '\0') return false;
+    modem->info_valid = true;
+    
+    if (modem->state_cache) {
+        DeviceInfo info;
+        snprintf(info.imei, sizeof(info.imei), "%s", modem->imei);
+        snprintf(info.iccid, sizeof(info.iccid), "%s", modem->iccid);
+        snprintf(info.version, sizeof(info.version), "%s", modem->fw_version);
+        device_cache_update(modem->imei, &info);
+        modem_remember_port(modem);
+    }
+    return true;
+}
+
+// 取得固件版本/IMEI/ICCID，缓存命中时只需一条AT+QGMR
+bool modem_load_static_info(EC800KModem* modem) {
+    AtBatch batch;
+    DeviceInfoQuery q;
+    
+    at_batch_init(&batch);
+    device_info_batch_add(modem, &batch, &q);
+    modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY);
+    return device_info_batch_apply(modem, &batch, &q);
+}
+
+// 会话结束：收到RDY后未重新查询的条目已不可信，从缓存中淘汰
+void modem_state_cache_flush(EC800KModem* modem) {
+    if (!modem->state_cache || modem->imei[0] == '\0' || !modem->rebooted || modem->info_valid) return;
+    device_cache_update(modem->imei, NULL);
+    modem_log(modem, "♻️ 模组已重启，淘汰设备信息缓存");
+}
+
+// 缓存行: <命令> <样本数> <最大微秒> <分档>:<次数>...（--state-cache时读写）
+void at_policy_load(void) {
+    char line[1024];
+    
+    FILE* fp = fopen(AT_POLICY_CACHE_FILE, "r");
+    if (fp == NULL) return;
+    mutex_lock(&g_at_policy.lock);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char key[STATS_KEY_MAX];
+        unsigned long long count, max_us;
+        int used;
+        if (line[0] == '#' || sscanf(line, "%47s %llu %llu%n", key, &count, &max_us, &used) != 3) continue;
+        AtPolicyEntry* e = at_policy_entry_locked(key);
+        if (e == NULL) break;
+        
+        const char* p = line + used;
+        int bucket;
+        unsigned int n;
+        while (sscanf(p, " %d:%u%n", &bucket, &n, &used) == 2) {
+            if (bucket >= 0 && bucket < STATS_BUCKETS) {
+                e->hist[bucket] += n;
+                e->count += n;
+            }
+            p += used;
+        }
+        if (max_us > e->max_us) e->max_us = max_us;
+    }
+    mutex_unlock(&g_at_policy.lock);
+    fclose(fp);
+}
+
+void at_policy_save(void) {
+    char tmp_path[64];
+    
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", AT_POLICY_CACHE_FILE);
+    FILE* fp = fopen(tmp_path, "w");
+    if (fp == NULL) return;
+    fprintf(fp, "# 命令 样本数 最大微秒 分档:次数...\n");
+    mutex_lock(&g_at_policy.lock);
+    for (int i = 0; i < g_at_policy.count; i++) {
+        AtPolicyEntry* e = &g_at_policy.entries[i];
+        if (e->count == 0) continue;
+        bool decay = e->count > AT_POLICY_DECAY_COUNT;
+        fprintf(fp, "%s %llu %llu", e->key, (unsigned long long)e->count, (unsigned long long)e->max_us);
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            uint32_t n = decay ? (e->hist[b] + 1) / 2 : e->hist[b];
+            if (n > 0) fprintf(fp, " %d:%u", b, n);
+        }
+        fprintf(fp, "\n");
+    }
+    mutex_unlock(&g_at_policy.lock);
+    cache_file_replace(fp, tmp_path, AT_POLICY_CACHE_FILE);
+}
+
+// ================== 信号采样记录 ==================
+
+#define TELEMETRY_DEFAULT_FILE "ec800k_telemetry.bin"
+#define TELEMETRY_DEFAULT_INTERVAL_S 30     // --sample-interval
+#define TELEMETRY_DEFAULT_RUN_S 300         // telemetry命令默认采样时长
+#define TELEMETRY_RING_RECORDS 8192         // 环形文件槽数（256KB），写满后覆盖最旧的记录
+#define TELEMETRY_JITTER_PCT 20             // 每次间隔随机±20%，各模组的查询互相错开
+#define TELEMETRY_BUSY_RETRY_MS 3000        // 模组忙（事务/大块传输/重启中）时稍后重试
+#define TELEMETRY_MATCH_S 600               // 事件只关联此时长内的最近一次采样
+#define TELEMETRY_SITES_MAX 256             // 报告统计的站点数上限
+#define TELEMETRY_UNKNOWN INT16_MIN
+#define TELEMETRY_PORT_KEY (1ULL << 63)     // IMEI未知时以端口名哈希作为站点标识
+
+typedef enum {
+    TELEMETRY_SAMPLE = 1,       // 周期采样
+    TELEMETRY_DOWNLOAD,         // 差分包下载完成（HTTPSTART到HTTPEND）
+    TELEMETRY_UPLOAD            // 一个COS分片上传完成
+} TelemetryType;
+
+// 定长32字节记录，按主机字节序写入；事件记录附带同一模组最近一次采样的信号值
+typedef struct {
+    uint64_t site;              // IMEI数值，或TELEMETRY_PORT_KEY|端口名哈希
+    uint32_t time_s;            // Unix时间
+    uint8_t type;               // TelemetryType
+    uint8_t rssi;               // AT+CSQ，99未知
+    int16_t rsrp;               // dBm，以下未知均为TELEMETRY_UNKNOWN
+    int16_t rsrq;               // dB
+    int16_t sinr;               // dB
+    uint32_t cell_id;           // 服务小区ID，0未知
+    union {
+        struct {
+            uint32_t earfcn;
+            uint16_t pci;
+            uint16_t band;
+        } sample;
+        struct {
+            uint32_t ms;        // 下载或分片上传耗时
+            uint32_t bytes;     // 分片字节数，下载为0
+        } event;
+    } u;
+} TelemetryRecord;
+
+typedef struct {
+    char magic[4];              // "ECTM"
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;          // 槽数
+    uint32_t head;              // 下一条记录写入的槽
+    uint32_t count;             // 有效记录数
+    uint32_t reserved[3];
+} TelemetryHeader;
+
+_Static_assert(sizeof(TelemetryRecord) == 32, "采样记录须为32字节");
+_Static_assert(sizeof(TelemetryHeader) == 32, "采样文件头须为32字节");
+
+// 所有模组共用一个采样线程，按各自的到期时间依次查询；
+// 模组在modem_connect时登记、modem_disconnect时注销，升级与上传流程不感知采样
+typedef struct {
+    mutex_t lock;               // 保护登记表与记录文件
+    cond_t cond;                // 登记表变化或一次采样结束时广播
+    thread_t thread;
+    bool running;
+    volatile bool stop;
+    FILE* fp;
+    TelemetryHeader header;
+    int interval_ms;
+    uint32_t seed;              // 抖动用的xorshift状态
+    int count;
+    EC800KModem* modems[MAX_SERIAL_PORTS];
+    uint64_t due_ms[MAX_SERIAL_PORTS];
+    uint64_t site[MAX_SERIAL_PORTS];        // 0表示尚未取得IMEI
+    TelemetryRecord last[MAX_SERIAL_PORTS]; // 最近一次采样，time_s为0表示还没有
+    EC800KModem* sampling;      // 正在查询的模组，注销时需等其结束
+} Telemetry;
+
+Telemetry g_telemetry;
+
+// 需持有lock
+uint32_t telemetry_random(void) {
+    uint32_t x = g_telemetry.seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_telemetry.seed = x;
+    return x;
+}
+
+// 采样周期加±TELEMETRY_JITTER_PCT的随机偏移（需持有lock）
+int telemetry_jitter_ms(int period_ms) {
+    int span = period_ms * TELEMETRY_JITTER_PCT / 100;
+    return period_ms - span + (int)(telemetry_random() % (uint32_t)(2 * span + 1));
+}
+
+uint64_t telemetry_imei_key(const char* imei) {
+    char* end;
+    unsigned long long value = strtoull(imei, &end, 10);
+    return end != imei && value < TELEMETRY_PORT_KEY ? (uint64_t)value : 0;
+}
+
+// FNV-1a
+uint64_t telemetry_port_key(const char* port) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = port; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return TELEMETRY_PORT_KEY | hash;
+}
+
+// 需持有lock
+int telemetry_find(const EC800KModem* modem) {
+    for (int i = 0; i < g_telemetry.count; i++) {
+        if (g_telemetry.modems[i] == modem) return i;
+    }
+    return -1;
+}
+
+void telemetry_record_clear(TelemetryRecord* rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->rssi = 99;
+    rec->rsrp = TELEMETRY_UNKNOWN;
+    rec->rsrq = TELEMETRY_UNKNOWN;
+    rec->sinr = TELEMETRY_UNKNOWN;
+}
+
+bool telemetry_header_valid(const TelemetryHeader* h) {
+    return memcmp(h->magic, "ECTM", 4) == 0 && h->version == 1 &&
+           h->record_size == sizeof(TelemetryRecord) && h->capacity > 0 &&
+           h->head < h->capacity && h->count <= h->capacity;
+}
+
+// 先写记录再更新文件头，中途掉电最多丢失最后一条
+void telemetry_write_locked(const TelemetryRecord* rec) {
+    TelemetryHeader* h = &g_telemetry.header;
+    FILE* fp = g_telemetry.fp;
+    
+    long offset = (long)(sizeof(*h) + (size_t)h->head * sizeof(*rec));
+    if (fseek(fp, offset, SEEK_SET) != 0 || fwrite(rec, sizeof(*rec), 1, fp) != 1) return;
+    h->head = (h->head + 1) % h->capacity;
+    if (h->count < h->capacity) h->count++;
+    rewind(fp);
+    fwrite(h, sizeof(*h), 1, fp);
+    fflush(fp);
+}
+
+// 按','就地切分参数并去掉字符串两端的引号，返回字段数
+int telemetry_split(char* p, char* fields[], int max) {
+    int n = 0;
+    
+    while (n < max) {
+        char* comma = strchr(p, ',');
+        if (comma != NULL) *comma = '\0';
+        while (*p == ' ') p++;
+        size_t len = strlen(p);
+        if (len >= 2 && p[0] == '"' && p[len - 1] == '"') {
+            p[len - 1] = '\0';
+            p++;
+        }
+        fields[n++] = p;
+        if (comma == NULL) break;
+        p = comma + 1;
+    }
+    return n;
+}
+
+// 取信息行参数的可写副本
+char* telemetry_line_args(const AtLine* line, char* text, size_t size) {
+    at_line_copy(line, text, size);
+    size_t offset = (size_t)(line->args - line->text);
+    return offset < strlen(text) ? text + offset : text + strlen(text);
+}
+
+// 一次采样：服务小区、信号质量与CSQ合并为一次往返，尚无IMEI时顺带查询
+void telemetry_sample(EC800KModem* modem, uint64_t* site, TelemetryRecord* rec) {
+    AtBatch batch;
+    const AtLine* line;
+    char text[AT_LINE_MAX];
+    char* f[20];
+    int n;
+    
+    at_batch_init(&batch);
+    int i_gsn = *site == 0 ? at_batch_add(&batch, "AT+GSN", NULL) : -1;
+    int i_qeng = at_batch_add(&batch, "AT+QENG=\"servingcell\"", "+QENG:");
+    int i_qcsq = at_batch_add(&batch, "AT+QCSQ", "+QCSQ:");
+    int i_csq = at_batch_add(&batch, "AT+CSQ", "+CSQ:");
+    modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY);
+    
+    telemetry_record_clear(rec);
+    rec->type = TELEMETRY_SAMPLE;
+    rec->time_s = (uint32_t)time(NULL);
+    if ((line = at_batch_line(&batch, i_gsn)) != NULL) {
+        at_line_copy(line, text, sizeof(text));
+        *site = telemetry_imei_key(text);
+    }
+    rec->site = *site != 0 ? *site : telemetry_port_key(modem->port_path);
+    
+    int rssi, ber;
+    if ((line = at_batch_line(&batch, i_csq)) != NULL && at_parse_csq(line->args, &rssi, &ber)) {
+        rec->rssi = (uint8_t)rssi;
+    }
+    // +QCSQ: "LTE",<rssi>,<rsrp>,<sinr>,<rsrq>，sinr的0~250对应-20~30dB
+    if ((line = at_batch_line(&batch, i_qcsq)) != NULL) {
+        n = telemetry_split(telemetry_line_args(line, text, sizeof(text)), f, 20);
+        if (n >= 5 && strcmp(f[0], "LTE") == 0) {
+            rec->rsrp = (int16_t)atoi(f[2]);
+            rec->sinr = (int16_t)(atoi(f[3]) / 5 - 20);
+            rec->rsrq = (int16_t)atoi(f[4]);
+        }
+    }
+    // +QENG: "servingcell",<state>,"LTE",<is_tdd>,<MCC>,<MNC>,<cellID>,<PCID>,<earfcn>,<band>,
+    //        <ul_bw>,<dl_bw>,<TAC>,<RSRP>,<RSRQ>,<RSSI>,<SINR>,<srxlev>（搜网时只有前两项）
+    if ((line = at_batch_line(&batch, i_qeng)) != NULL) {
+        n = telemetry_split(telemetry_line_args(line, text, sizeof(text)), f, 20);
+        if (n >= 15 && strcmp(f[0], "servingcell") == 0 && strcmp(f[2], "LTE") == 0) {
+            rec->cell_id = (uint32_t)strtoul(f[6], NULL, 16);
+            rec->u.sample.pci = (uint16_t)atoi(f[7]);
+            rec->u.sample.earfcn = (uint32_t)strtoul(f[8], NULL, 10);
+            rec->u.sample.band = (uint16_t)atoi(f[9]);
+            if (rec->rsrp == TELEMETRY_UNKNOWN) {
+                rec->rsrp = (int16_t)atoi(f[13]);
+                rec->rsrq = (int16_t)atoi(f[14]);
+            }
+        }
+    }
+    modem_debug(modem, "📡 采样: CSQ %d, RSRP %d, SINR %d, 小区 %X", rec->rssi, rec->rsrp, rec->sinr,
+                rec->cell_id);
+}
+
+THREAD_RETURN telemetry_thread(void* arg) {
+    (void)arg;
+    
+    mutex_lock(&g_telemetry.lock);
+    while (!g_telemetry.stop) {
+        uint64_t now = monotonic_ms();
+        int next = -1;
+        for (int i = 0; i < g_telemetry.count; i++) {
+            if (next < 0 || g_telemetry.due_ms[i] < g_telemetry.due_ms[next]) next = i;
+        }
+        if (next < 0 || g_telemetry.due_ms[next] > now) {
+            int wait = next < 0 ? 1000 : (int)(g_telemetry.due_ms[next] - now);
+            cond_timedwait(&g_telemetry.cond, &g_telemetry.lock, wait);
+            continue;
+        }
+        
+        // 链路断开（升级重启）或串口正被事务/大块传输占用时不插入查询，稍后再试
+        EC800KModem* modem = g_telemetry.modems[next];
+        if (modem->link_down || !mutex_trylock(&modem->io_lock)) {
+            g_telemetry.due_ms[next] = now + TELEMETRY_BUSY_RETRY_MS;
+            continue;
+        }
+        mutex_unlock(&modem->io_lock);
+        
+        TelemetryRecord rec;
+        uint64_t site = g_telemetry.site[next];
+        g_telemetry.sampling = modem;
+        mutex_unlock(&g_telemetry.lock);
+        telemetry_sample(modem, &site, &rec);
+        mutex_lock(&g_telemetry.lock);
+        g_telemetry.sampling = NULL;
+        
+        int i = telemetry_find(modem);
+        if (i >= 0) {
+            g_telemetry.site[i] = site;
+            g_telemetry.last[i] = rec;
+            g_telemetry.due_ms[i] = monotonic_ms() + (uint64_t)telemetry_jitter_ms(g_telemetry.interval_ms);
+        }
+        telemetry_write_locked(&rec);
+        cond_broadcast(&g_telemetry.cond);
+    }
+    mutex_unlock(&g_telemetry.lock);
+    return THREAD_RESULT;
+}
+
+// 打开（不存在或为空时创建）环形记录文件并启动采样线程
+bool telemetry_open(const char* path, int interval_s) {
+    TelemetryHeader* h = &g_telemetry.header;
+    
+    FILE* fp = fopen(path, "r+b");
+    bool valid = fp != NULL && fread(h, sizeof(*h), 1, fp) == 1 && telemetry_header_valid(h);
+    if (fp != NULL && !valid) {
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) > 0) {
+            log_msg("❌ %s不是采样记录文件", path);
+            fclose(fp);
+            return false;
+        }
+    }
+    if (fp == NULL) fp = fopen(path, "w+b");
+    if (fp == NULL) {
+        log_msg("❌ 无法创建采样记录文件: %s", path);
+        return false;
+    }
+    if (!valid) {
+        memset(h, 0, sizeof(*h));
+        memcpy(h->magic, "ECTM", 4);
+        h->version = 1;
+        h->record_size = sizeof(TelemetryRecord);
+        h->capacity = TELEMETRY_RING_RECORDS;
+        rewind(fp);
+        fwrite(h, sizeof(*h), 1, fp);
+        fflush(fp);
+    }
+    
+    mutex_init(&g_telemetry.lock);
+    cond_init(&g_telemetry.cond);
+    g_telemetry.fp = fp;
+    g_telemetry.interval_ms = interval_s * 1000;
+    g_telemetry.seed = (uint32_t)time(NULL) ^ (uint32_t)monotonic_us() ^ 0x9E3779B9u;
+    g_telemetry.count = 0;
+    g_telemetry.sampling = NULL;
+    g_telemetry.stop = false;
+    if (!thread_create(&g_telemetry.thread, telemetry_thread, NULL)) {
+        log_msg("❌ 信号采样线程启动失败");
+        fclose(fp);
+        cond_destroy(&g_telemetry.cond);
+        mutex_destroy(&g_telemetry.lock);
+        return false;
+    }
+    g_telemetry.running = true;
+    log_msg("📡 后台信号采样: 每%d秒(±%d%%)，记录到%s (已有%u条)", interval_s, TELEMETRY_JITTER_PCT, path,
+            h->count);
+    return true;
+}
+
+// 停止采样线程并关闭记录文件（各模组应已断开）
+void telemetry_close(void) {
+    if (!g_telemetry.running) return;
+    mutex_lock(&g_telemetry.lock);
+    g_telemetry.stop = true;
+    cond_broadcast(&g_telemetry.cond);
+    mutex_unlock(&g_telemetry.lock);
+    thread_join(g_telemetry.thread);
+    g_telemetry.running = false;
+    fclose(g_telemetry.fp);
+    g_telemetry.fp = NULL;
+    cond_destroy(&g_telemetry.cond);
+    mutex_destroy(&g_telemetry.lock);
+}
+
+// 登记已连接的模组，首次采样落在一个周期内的随机时刻，同时连接的模组也不会同时查询
+void telemetry_add(EC800KModem* modem) {
+    if (!g_telemetry.running || modem->owner != NULL) return;
+    mutex_lock(&g_telemetry.lock);
+    if (telemetry_find(modem) < 0 && g_telemetry.count < MAX_SERIAL_PORTS) {
+        int i = g_telemetry.count++;
+        g_telemetry.modems[i] = modem;
+        g_telemetry.site[i] = 0;
+        g_telemetry.last[i].time_s = 0;
+        g_telemetry.due_ms[i] = monotonic_ms() + telemetry_random() % (uint32_t)g_telemetry.interval_ms;
+        cond_broadcast(&g_telemetry.cond);
+    }
+    mutex_unlock(&g_telemetry.lock);
+}
+
+// 注销模组，正在对其采样时等采样结束后再返回
+void telemetry_remove(EC800KModem* modem) {
+    if (!g_telemetry.running) return;
+    mutex_lock(&g_telemetry.lock);
+    while (g_telemetry.sampling == modem) {
+        cond_timedwait(&g_telemetry.cond, &g_telemetry.lock, 1000);
+    }
+    int i = telemetry_find(modem);
+    if (i >= 0) {
+        int last = --g_telemetry.count;
+        g_telemetry.modems[i] = g_telemetry.modems[last];
+        g_telemetry.due_ms[i] = g_telemetry.due_ms[last];
+        g_telemetry.site[i] = g_telemetry.site[last];
+        g_telemetry.last[i] = g_telemetry.last[last];
+    }
+    mutex_unlock(&g_telemetry.lock);
+}
+
+// 记录一次下载/上传事件，信号值取同一模组最近一次采样
+void telemetry_record_event(EC800KModem* modem, TelemetryType type, uint32_t ms, uint32_t bytes) {
+    TelemetryRecord rec;
+    uint32_t now = (uint32_t)time(NULL);
+    
+    if (!g_telemetry.running) return;
+    mutex_lock(&g_telemetry.lock);
+    int i = telemetry_find(modem);
+    if (i >= 0 && g_telemetry.last[i].time_s != 0 && now - g_telemetry.last[i].time_s <= TELEMETRY_MATCH_S) {
+        rec = g_telemetry.last[i];
+    } else {
+        telemetry_record_clear(&rec);
+    }
+    rec.site = i >= 0 ? g_telemetry.site[i] : 0;
+    if (rec.site == 0) rec.site = telemetry_imei_key(modem->imei);
+    if (rec.site == 0) rec.site = telemetry_port_key(modem->port_path);
+    rec.time_s = now;
+    rec.type = (uint8_t)type;
+    rec.u.event.ms = ms;
+    rec.u.event.bytes = bytes;
+    telemetry_write_locked(&rec);
+    mutex_unlock(&g_telemetry.lock);
+}
+
+void telemetry_record_download(EC800KModem* modem, uint32_t ms) {
+    telemetry_record_event(modem, TELEMETRY_DOWNLOAD, ms, 0);
+}
+
+void telemetry_record_upload(EC800KModem* modem, uint32_t ms, uint32_t bytes) {
+    telemetry_record_event(modem, TELEMETRY_UPLOAD, ms, bytes);
+}
+
+// 最小二乘拟合y = a + b*x；点数不足或x没有变化时退化为均值，预测时x限定在已观测范围内
+typedef struct {
+    int n;
+    double sx, sy, sxx, sxy;
+    double x_min, x_max;
+} TelemetryFit;
+
+void telemetry_fit_add(TelemetryFit* fit, double x, double y) {
+    if (fit->n == 0 || x < fit->x_min) fit->x_min = x;
+    if (fit->n == 0 || x > fit->x_max) fit->x_max = x;
+    fit->n++;
+    fit->sx += x;
+    fit->sy += y;
+    fit->sxx += x * x;
+    fit->sxy += x * y;
+}
+
+double telemetry_fit_predict(const TelemetryFit* fit, double x) {
+    double n = fit->n;
+    double den = n * fit->sxx - fit->sx * fit->sx;
+    if (fit->n < 3 || fit->x_max - fit->x_min < 1.0 || den <= 0) return fit->sy / n;
+    
+    double b = (n * fit->sxy - fit->sx * fit->sy) / den;
+    double a = (fit->sy - b * fit->sx) / n;
+    if (x < fit->x_min) x = fit->x_min;
+    if (x > fit->x_max) x = fit->x_max;
+    double y = a + b * x;
+    return y > 0 ? y : fit->sy / n;
+}
+
+typedef struct {
+    uint64_t site;
+    int samples;
+    int rsrp_n;
+    double rsrp_sum;
+    int sinr_n;
+    double sinr_sum;
+    int csq_n;
+    double csq_sum;
+    uint32_t cell_id;           // 最近一次采样的服务小区
+    uint16_t pci;
+    int downloads;
+    double download_ms;
+    int uploads;
+    double upload_ms;
+    double upload_bytes;
+} TelemetrySite;
+
+TelemetrySite* telemetry_site(TelemetrySite* sites, int* count, uint64_t key) {
+    for (int i = 0; i < *count; i++) {
+        if (sites[i].site == key) return &sites[i];
+    }
+    if (*count >= TELEMETRY_SITES_MAX) return NULL;
+    TelemetrySite* site = &sites[(*count)++];
+    memset(site, 0, sizeof(*site));
+    site->site = key;
+    return site;
+}
+
+// 汇总环形文件：各站点的信号均值与实测耗时，并按RSRP拟合预估下载用时与上传吞吐
+bool telemetry_report(const char* path) {
+    static TelemetrySite sites[TELEMETRY_SITES_MAX];
+    TelemetryHeader h;
+    TelemetryFit download_fit = {0};
+    TelemetryFit upload_fit = {0};
+    int site_count = 0;
+    uint32_t first_s = 0, last_s = 0;
+    
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL || fread(&h, sizeof(h), 1, fp) != 1 || !telemetry_header_valid(&h)) {
+        log_msg("❌ 无法读取采样记录文件: %s", path);
+        if (fp != NULL) fclose(fp);
+        return false;
+    }
+    TelemetryRecord* recs = h.count > 0 ? (TelemetryRecord*)malloc(h.capacity * sizeof(TelemetryRecord)) : NULL;
+    size_t n = recs != NULL ? fread(recs, sizeof(TelemetryRecord), h.capacity, fp) : 0;
+    fclose(fp);
+    
+    // 从最旧的记录开始，"最近小区"取时间上最后一次采样
+    for (uint32_t k = 0; k < h.count; k++) {
+        uint32_t slot = (h.head + h.capacity - h.count + k) % h.capacity;
+        if (slot >= n) continue;
+        const TelemetryRecord* rec = &recs[slot];
+        TelemetrySite* site = telemetry_site(sites, &site_count, rec->site);
+        if (site == NULL) continue;
+        if (first_s == 0 || rec->time_s < first_s) first_s = rec->time_s;
+        if (rec->time_s > last_s) last_s = rec->time_s;
+        
+        switch (rec->type) {
+            case TELEMETRY_SAMPLE:
+                site->samples++;
+                if (rec->rsrp != TELEMETRY_UNKNOWN) {
+                    site->rsrp_n++;
+                    site->rsrp_sum += rec->rsrp;
+                }
+                if (rec->sinr != TELEMETRY_UNKNOWN) {
+                    site->sinr_n++;
+                    site->sinr_sum += rec->sinr;
+                }
+                if (rec->rssi != 99) {
+                    site->csq_n++;
+                    site->csq_sum += rec->rssi;
+                }
+                if (rec->cell_id != 0) {
+                    site->cell_id = rec->cell_id;
+                    site->pci = rec->u.sample.pci;
+                }
+                break;
+            case TELEMETRY_DOWNLOAD:
+                site->downloads++;
+                site->download_ms += rec->u.event.ms;
+                if (rec->rsrp != TELEMETRY_UNKNOWN) {
+                    telemetry_fit_add(&download_fit, rec->rsrp, rec->u.event.ms / 1000.0);
+                }
+                break;
+            case TELEMETRY_UPLOAD:
+                site->uploads++;
+                site->upload_ms += rec->u.event.ms;
+                site->upload_bytes += rec->u.event.bytes;
+                if (rec->rsrp != TELEMETRY_UNKNOWN && rec->u.event.ms > 0) {
+                    telemetry_fit_add(&upload_fit, rec->rsrp, rec->u.event.bytes / 1024.0 * 1000.0 / rec->u.event.ms);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    free(recs);
+    
+    char first[32] = "-", last[32] = "-";
+    if (h.count > 0) {
+        time_t t = (time_t)first_s;
+        strftime(first, sizeof(first), "%Y-%m-%d %H:%M", localtime(&t));
+        t = (time_t)last_s;
+        strftime(last, sizeof(last), "%Y-%m-%d %H:%M", localtime(&t));
+    }
+    log_printf("\n==================================================\n");
+    log_printf("📊 信号采样报告: %s (%u条, %s ~ %s)\n", path, h.count, first, last);
+    log_printf("==================================================\n");
+    if (site_count == 0) {
+        log_printf("  尚无记录\n");
+        return true;
+    }
+    
+    log_printf("站点              采样  RSRP  SINR  CSQ  小区(PCI)       下载  实测(s)  预计(s)  分片  KB/s   预计KB/s\n");
+    for (int i = 0; i < site_count; i++) {
+        const TelemetrySite* site = &sites[i];
+        char name[24], rsrp[8] = "-", sinr[8] = "-", csq[8] = "-", cell[20] = "-";
+        char dl[12] = "-", dl_pred[12] = "-", ul[12] = "-", ul_pred[12] = "-";
+        
+        if (site->site & TELEMETRY_PORT_KEY) {
+            snprintf(name, sizeof(name), "端口#%08X", (unsigned)(site->site & 0xFFFFFFFFu));
+        } else {
+            snprintf(name, sizeof(name), "%llu", (unsigned long long)site->site);
+        }
+        if (site->rsrp_n > 0) snprintf(rsrp, sizeof(rsrp), "%.0f", site->rsrp_sum / site->rsrp_n);
+        if (site->sinr_n > 0) snprintf(sinr, sizeof(sinr), "%.0f", site->sinr_sum / site->sinr_n);
+        if (site->csq_n > 0) snprintf(csq, sizeof(csq), "%.0f", site->csq_sum / site->csq_n);
+        if (site->cell_id != 0) snprintf(cell, sizeof(cell), "%X(%u)", site->cell_id, site->pci);
+        if (site->downloads > 0) snprintf(dl, sizeof(dl), "%.1f", site->download_ms / site->downloads / 1000.0);
+        if (site->upload_ms > 0) {
+            snprintf(ul, sizeof(ul), "%.1f", site->upload_bytes / 1024.0 * 1000.0 / site->upload_ms);
+        }
+        if (site->rsrp_n > 0 && download_fit.n > 0) {
+            snprintf(dl_pred, sizeof(dl_pred), "%.1f", telemetry_fit_predict(&download_fit, site->rsrp_sum / site->rsrp_n));
+        }
+        if (site->rsrp_n > 0 && upload_fit.n > 0) {
+            snprintf(ul_pred, sizeof(ul_pred), "%.1f", telemetry_fit_predict(&upload_fit, site->rsrp_sum / site->rsrp_n));
+        }
+        log_printf("%-17s %4d  %4s  %4s  %3s  %-15s %4d  %7s  %7s  %4d  %-6s %s\n", name, site->samples, rsrp, sinr,
+                   csq, cell, site->downloads, dl, dl_pred, site->uploads, ul, ul_pred);
+    }
+    if (download_fit.n == 0 && upload_fit.n == 0) {
+        log_printf("\n💡 尚无附带信号值的下载/上传记录，暂无法预估（升级或上传时加--telemetry）\n");
+    } else {
+        log_printf("\n💡 预计值按RSRP对全部站点的实测拟合 (下载%d次，分片%d个)，可据此安排升级批次与超时\n",
+                   download_fit.n, upload_fit.n);
+    }
+    return true;
+}
+
+// telemetry命令：连接各模组采样seconds秒（0则只读取已有记录）后打印报告
+int run_telemetry(const char* ports_arg, int seconds, const ToolOptions* opts) {
+    static char ports[MAX_SERIAL_PORTS][64];
+    const char* path = opts->telemetry != NULL ? opts->telemetry : TELEMETRY_DEFAULT_FILE;
+    
+    if (seconds > 0) {
+        int count = parse_port_list(ports_arg, ports, MAX_SERIAL_PORTS);
+        EC800KModem* modems = count > 0 ? (EC800KModem*)calloc((size_t)count, sizeof(EC800KModem)) : NULL;
+        if (modems == NULL) {
+            log_msg(count == 0 ? "❌ 没有可用的串口" : "❌ 内存不足");
+            return 1;
+        }
+        if (!telemetry_open(path, opts->sample_interval_s)) {
+            free(modems);
+            return 1;
+        }
+        
+        int connected = 0;
+        for (int i = 0; i < count; i++) {
+            modem_init(&modems[connected], ports[i], opts->baud_rate);
+            modem_apply_options(&modems[connected], opts);
+            modems[connected].log_tag = count > 1;
+            if (modem_connect(&modems[connected])) {
+                connected++;
+            } else {
+                modem_destroy(&modems[connected]);
+            }
+        }
+        if (connected > 0) {
+            log_msg("⏳ %d个模组采样%d秒...", connected, seconds);
+            sleep_ms(seconds * 1000);
+        }
+        for (int i = 0; i < connected; i++) {
+            modem_disconnect(&modems[i]);
+            modem_destroy(&modems[i]);
+        }
+        free(modems);
+        telemetry_close();
+        if (connected == 0) {
+            log_printf("\n💡 提示: 请检查串口连接和权限\n");
+            return 1;
+        }
+    }
+    return telemetry_report(path) ? 0 : 1;
+}
+
+// ================== 功能函数 ==================
+
+bool modem_test_at(EC800KModem* modem) {
+    AtResponse resp;
+    return modem_at_transact(modem, "AT", &resp, AT_TIMEOUT_POLICY);
+}
+
+// 获取固件版本 (使用AT+QGMR)
+void modem_get_firmware_version(EC800KModem* modem, char* version, size_t size) {
+    AtResponse resp;
+    version[0] = '\0';
+    
+    // 回显和OK已由解析器剔除，第一条信息行即版本号
+    if (modem_at_transact(modem, "AT+QGMR", &resp, AT_TIMEOUT_POLICY) && resp.line_count > 0) {
+        at_line_copy(&resp.lines[0], version, size);
+    }
+}
+
+// 打印模块信息（版本、IMEI、ICCID、SIM状态）
+void report_module_info(const EC800KModem* modem, const AtBatch* batch, int i_cpin) {
+    const AtLine* line;
+    
+    log_printf("\n模块信息:\n");
+    
+    // 固件版本 (使用AT+QGMR)
+    if (modem->fw_version[0] != '\0') {
+        log_printf("  firmware_version: %s\n", modem->fw_version);
+    }
+    
+    // IMEI
+    if (modem->imei[0] != '\0') {
+        log_printf("  imei: %s\n", modem->imei);
+    }
+    if (modem->iccid[0] != '\0') {
+        log_printf("  iccid: %s\n", modem->iccid);
+    }
+    
+    // SIM状态
+    if ((line = at_batch_line(batch, i_cpin)) != NULL) {
+        if (at_line_equals(line, "+CPIN: READY")) {
+            log_printf("  sim_status: 已就绪\n");
+        } else {
+            log_printf("  sim_status: %.*s\n", (int)line->len, line->text);
+        }
+    }
+}
+
+// 打印网络状态（注册、信号），返回是否已注册
+bool report_network_status(const AtBatch* batch, int i_creg, int i_csq, char* net_reg, size_t size) {
+    const AtLine* line;
+    net_reg[0] = '\0';
+    
+    log_printf("\n网络状态:\n");
+    
+    // 网络注册: +CREG: <n>,<stat>
+    if ((line = at_batch_line(batch, i_creg)) != NULL) {
+        int stat;
+        if (at_parse_reg(line->args, true, &stat)) {
+            const char* status_str = reg_stat_name(stat);
+            strncpy(net_reg, status_str, size - 1);
+            net_reg[size - 1] = '\0';
+            log_printf("  network_reg: %s\n", status_str);
+        }
+    }
+    
+    // 信号强度
+    if ((line = at_batch_line(batch, i_csq)) != NULL) {
+        int rssi, ber;
+        if (at_parse_csq(line->args, &rssi, &ber)) {
+            if (rssi == 99) {
+                log_printf("  signal: 未知或不可检测\n");
+            } else {
+                int dbm = -113 + 2 * rssi;
+                log_printf("  signal: RSSI=%d (%ddBm)\n", rssi, dbm);
+            }
+        }
+    }
+    
+    return (strcmp(net_reg, "已注册(本地)") == 0 || strcmp(net_reg, "已注册(漫游)") == 0);
+}
+
+void modem_get_module_info(EC800KModem* modem) {
+    AtBatch batch;
+    DeviceInfoQuery info;
+    at_batch_init(&batch);
+    device_info_batch_add(modem, &batch, &info);
+    int i_cpin = at_batch_add(&batch, "AT+CPIN?", "+CPIN:");
+    
+    modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY);
+    device_info_batch_apply(modem, &batch, &info);
+    report_module_info(modem, &batch, i_cpin);
+}
+
+bool modem_check_network_status(EC800KModem* modem, char* net_reg, size_t size) {
+    AtBatch batch;
+    at_batch_init(&batch);
+    int i_creg = at_batch_add(&batch, "AT+CREG?", "+CREG:");
+    int i_csq = at_batch_add(&batch, "AT+CSQ", "+CSQ:");
+    
+    modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY);
+    return report_network_status(&batch, i_creg, i_csq, net_reg, size);
+}
+
+// ================== 差分包预检 ==================
+
+#define FOTA_PACKAGE_MAX 8              // fleet一次可提供的差分包数（不同方向/不同源版本）
+#define MINIFOTA_URL_MAX 128            // MiniFOTA的URL长度上限
+
+// MiniFOTA差分包（.mini_1/.mini_2）只能由模组联网下载
+bool fota_is_minifota_package(const char* path) {
+    const char* ext = strrchr(path, '.');
+    return ext != NULL && strncmp(ext, ".mini", 5) == 0;
+}
+
+// URL路径最后一段（去掉查询参数），用作缓存文件的对外名称
+void url_basename(const char* url, char* name, size_t size) {
+    const char* end = url + strcspn(url, "?#");
+    const char* start = end;
+    while (start > url && start[-1] != '/') start--;
+    const char* scheme = strstr(url, "://");
+    const char* host = scheme != NULL ? scheme + 3 : url;
+    size_t len = (size_t)(end - start);
+    if (len == 0 || start <= host) {
+        snprintf(name, size, "package.bin");
+        return;
+    }
+    if (len >= size) len = size - 1;
+    memcpy(name, start, len);
+    name[len] = '\0';
+}
+
+// 差分包文件名约定：[signed_]<源版本>-<目标版本>.<扩展名>，版本即AT+QGMR的返回值
+// 文件头不含可读的版本信息，升级方向只能取自文件名
+typedef struct {
+    char from[64];
+    char to[64];
+    int mini_part;      // 0=普通DFOTA包，1/2=MiniFOTA第一/第二部分
+} FotaPackageInfo;
+
+bool fota_version_token(const char* s, size_t len) {
+    if (len == 0 || len >= 64) return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 从URL或本地路径解析升级方向；文件名不符合约定时返回false，调用方不做版本预检
+bool fota_package_parse(const char* url, FotaPackageInfo* info) {
+    char name[256];
+    
+    memset(info, 0, sizeof(*info));
+    if (strstr(url, "://") != NULL) {
+        url_basename(url, name, sizeof(name));
+    } else {
+        const char* base = url;
+        for (const char* p = url; *p != '\0'; p++) {
+            if (*p == '/' || *p == '\\') base = p + 1;
+        }
+        snprintf(name, sizeof(name), "%s", base);
+    }
+    
+    const char* base = name;
+    if (strncmp(base, "signed_", 7) == 0) base += 7;
+    const char* ext = strrchr(base, '.');
+    size_t len = ext != NULL ? (size_t)(ext - base) : strlen(base);
+    if (ext != NULL && strcmp(ext, ".mini_1") == 0) info->mini_part = 1;
+    if (ext != NULL && strcmp(ext, ".mini_2") == 0) info->mini_part = 2;
+    
+    const char* dash = (const char*)memchr(base, '-', len);
+    if (dash == NULL) return false;
+    size_t from_len = (size_t)(dash - base);
+    size_t to_len = len - from_len - 1;
+    if (!fota_version_token(base, from_len) || !fota_version_token(dash + 1, to_len)) return false;
+    
+    memcpy(info->from, base, from_len);
+    info->from[from_len] = '\0';
+    memcpy(info->to, dash + 1, to_len);
+    info->to[to_len] = '\0';
+    return true;
+}
+
+// MiniFOTA两部分的文件头分别为"FOTA_FIRATOF"与"FOTA_SEC"，返回0表示不是MiniFOTA包
+int fota_package_header_part(const char* path) {
+    unsigned char head[16];
+    
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return 0;
+    size_t n = fread(head, 1, sizeof(head), fp);
+    fclose(fp);
+    
+    if (n >= 12 && memcmp(head, "FOTA_FIRATOF", 12) == 0) return 1;
+    if (n >= 8 && memcmp(head, "FOTA_SEC", 8) == 0) return 2;
+    return 0;
+}
+
+// 版本号形如EC800KCNLC R07 A04 M04 V02：项目名之后以Rxx基线开头
+size_t fota_version_project_len(const char* version) {
+    for (const char* p = version; *p != '\0'; p++) {
+        if (p[0] == 'R' && p[1] >= '0' && p[1] <= '9' && p[2] >= '0' && p[2] <= '9' && p[3] == 'A') {
+            return (size_t)(p - version);
+        }
+    }
+    return strlen(version);
+}
+
+// 源版本不符时模组下载并重启后才会报错，这里按版本号各段预估其错误码
+int fota_predict_error(const char* current, const char* from) {
+    size_t project = fota_version_project_len(current);
+    if (project != fota_version_project_len(from) || strncmp(current, from, project) != 0) {
+        return 552;     // 包项目名不匹配
+    }
+    if (strncmp(current + project, from + project, 3) != 0) {
+        return 553;     // 包基线名不匹配
+    }
+    return 507;         // 包版本不匹配
+}
+
+// MiniFOTA的URL限制：仅HTTP、不超过128字节、必须指向.mini_1（模组随后自动下载同名.mini_2）
+bool modem_fota_check_url(EC800KModem* modem, const char* url) {
+    FotaPackageInfo info;
+    
+    fota_package_parse(url, &info);
+    if (info.mini_part == 0) return true;
+    
+    if (strncmp(url, "https://", 8) == 0) {
+        modem_log(modem, "❌ MiniFOTA不支持HTTPS下载，请改用http://");
+        return false;
+    }
+    if (strlen(url) > MINIFOTA_URL_MAX) {
+        modem_log(modem, "❌ MiniFOTA的URL长度不能超过%d字节: %zu", MINIFOTA_URL_MAX, strlen(url));
+        return false;
+    }
+    if (info.mini_part == 2) {
+        modem_log(modem, "❌ MiniFOTA需提供.mini_1的URL，模组会自动下载同名的.mini_2");
+        return false;
+    }
+    return true;
+}
+
+// 下载前核对差分包源版本与AT+QGMR，方向不对时避免白白下载一次并重启
+bool modem_fota_check_version(EC800KModem* modem, const char* url) {
+    FotaPackageInfo info;
+    
+    if (!fota_package_parse(url, &info)) return true;
+    modem_log(modem, "📎 差分包: %s → %s", info.from, info.to);
+    
+    if (modem->fota_force) {
+        modem_log(modem, "⚠️ 已指定--force，跳过差分包版本预检");
+        return true;
+    }
+    if (modem->fw_version[0] == '\0') {
+        modem_log(modem, "⚠️ 未能查询到当前版本，跳过差分包版本预检");
+        return true;
+    }
+    if (strcmp(modem->fw_version, info.to) == 0) {
+        modem_log(modem, "✅ 当前已是目标版本%s，无需升级", info.to);
+        return false;
+    }
+    if (strcmp(modem->fw_version, info.from) != 0) {
+        modem_log(modem, "❌ 差分包源版本%s与当前版本%s不一致，升级将以错误码%d失败（--force跳过检查）",
+                  info.from, modem->fw_version, fota_predict_error(modem->fw_version, info.from));
+        return false;
+    }
+    modem_log(modem, "✅ 差分包与当前版本匹配");
+    return true;
+}
+
+// fleet的差分包集合：按各模组的当前版本选择升级方向
+typedef struct {
+    char url[512];
+    FotaPackageInfo info;
+    bool parsed;        // 文件名符合约定，可按版本选择
+} FotaPackage;
+
+typedef struct {
+    FotaPackage items[FOTA_PACKAGE_MAX];
+    int count;
+} FotaPackageSet;
+
+// 加入一个差分包；MiniFOTA的.mini_2改用同名.mini_1，重复的URL只保留一份
+bool fota_package_set_add(FotaPackageSet* set, const char* url) {
+    if (set->count >= FOTA_PACKAGE_MAX) {
+        log_msg("⚠️ 差分包超过%d个，忽略: %s", FOTA_PACKAGE_MAX, url);
+        return false;
+    }
+    
+    FotaPackage* pkg = &set->items[set->count];
+    snprintf(pkg->url, sizeof(pkg->url), "%s", url);
+    char* end = pkg->url + strcspn(pkg->url, "?#");
+    if (end - pkg->url >= 7 && strncmp(end - 7, ".mini_2", 7) == 0) {
+        end[-1] = '1';
+        log_msg("🔁 MiniFOTA需从.mini_1开始下载，改用: %s", pkg->url);
+    }
+    
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->items[i].url, pkg->url) == 0) return true;
+    }
+    pkg->parsed = fota_package_parse(pkg->url, &pkg->info);
+    if (pkg->parsed) {
+        log_msg("📦 差分包%d: %s → %s", set->count + 1, pkg->info.from, pkg->info.to);
+    }
+    set->count++;
+    return true;
+}
+
+// 选择源版本与当前版本一致的差分包；文件名不符合约定的包作为兜底
+// 没有匹配且当前版本已是某个包的目标版本时返回NULL并置*at_target
+const FotaPackage* fota_package_select(const FotaPackageSet* set, const char* version, bool* at_target) {
+    const FotaPackage* fallback = NULL;
+    
+    *at_target = false;
+    for (int i = 0; i < set->count; i++) {
+        const FotaPackage* pkg = &set->items[i];
+        if (!pkg->parsed) {
+            if (fallback == NULL) fallback = pkg;
+        } else if (version[0] != '\0' && strcmp(pkg->info.from, version) == 0) {
+            return pkg;
+        } else if (version[0] != '\0' && strcmp(pkg->info.to, version) == 0) {
+            *at_target = true;
+        }
+    }
+    return *at_target ? NULL : fallback;
+}
+
+// ================== 网络就绪等待 ==================
+
+// CS域(CREG)或EPS域(CEREG)任一注册即可，EC800K等Cat.1模组通常只有CEREG
+bool modem_registered_locked(const EC800KModem* modem) {
+    return reg_stat_registered(modem->creg_stat) || reg_stat_registered(modem->cereg_stat);
+}
+
+// 解析查询响应 +CREG/+CEREG: <n>,<stat>[,...]
+int parse_reg_query(const AtLine* line) {
+    int stat;
+    if (line == NULL || !at_parse_reg(line->args, true, &stat)) return -1;
+    return stat;
+}
+
+// 数据业务：确认已附着并激活PDP上下文1，AT+QFOTADL经此上下文下载
+bool modem_ensure_data_ready(EC800KModem* modem) {
+    AtResponse resp;
+    const AtLine* line;
+    int attached = 0;
+    
+    if (modem_at_transact(modem, "AT+CGATT?", &resp, AT_TIMEOUT_POLICY) &&
+        (line = at_response_find_kind(&resp, AT_LINE_CGATT)) != NULL) {
+        attached = at_parse_int(line->args);
+    }
+    if (!attached) {
+        modem_log(modem, "📶 数据业务未附着，执行AT+CGATT=1...");
+        if (!modem_at_transact(modem, "AT+CGATT=1", &resp, AT_TIMEOUT_POLICY)) {
+            modem_log(modem, "❌ 数据业务附着失败");
+            return false;
+        }
+    }
+    
+    // +QIACT: <contextID>,<state>,<type>,"<ip>"，只列出已激活的上下文
+    if (modem_at_transact(modem, "AT+QIACT?", &resp, AT_TIMEOUT_POLICY) &&
+        (line = at_response_find(&resp, "+QIACT: 1,1")) != NULL) {
+        char ip[64];
+        at_line_copy(line, ip, sizeof(ip));
+        modem_log(modem, "✅ PDP上下文已激活: %s", ip);
+        return true;
+    }
+    
+    if (modem->apn[0] != '\0') {
+        if (!modem_at_transactf(modem, &resp, AT_TIMEOUT_POLICY, "AT+QICSGP=1,1,\"%s\",\"\",\"\",1", modem->apn)) {
+            modem_log(modem, "❌ APN配置失败: %s", modem->apn);
+            return false;
+        }
+    }
+    modem_log(modem, "📶 激活PDP上下文1...");
+    if (!modem_at_transact(modem, "AT+QIACT=1", &resp, AT_TIMEOUT_POLICY)) {
+        modem_log(modem, "❌ PDP上下文激活失败%s", modem->apn[0] != '\0' ? "" : "，可用--apn指定APN");
+        return false;
+    }
+    modem_log(modem, "✅ PDP上下文已激活");
+    return true;
+}
+
+// 等待网络就绪：打开CREG/CEREG注册URC，未注册时阻塞在state_cond上直到
+// 注册成功或超时（由URC唤醒，无需轮询），随后检查数据附着与PDP上下文
+bool modem_wait_network_ready(EC800KModem* modem, int timeout_ms, char* net_reg, size_t size) {
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    AtBatch batch;
+    at_batch_init(&batch);
+    at_batch_add(&batch, "AT+CREG=2", NULL);
+    at_batch_add(&batch, "AT+CEREG=2", NULL);
+    int i_creg = at_batch_add(&batch, "AT+CREG?", "+CREG:");
+    int i_cereg = at_batch_add(&batch, "AT+CEREG?", "+CEREG:");
+    int i_csq = at_batch_add(&batch, "AT+CSQ", "+CSQ:");
+    modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY);
+    
+    mutex_lock(&modem->state_lock);
+    int creg = parse_reg_query(at_batch_line(&batch, i_creg));
+    int cereg = parse_reg_query(at_batch_line(&batch, i_cereg));
+    if (creg >= 0) modem->creg_stat = creg;
+    if (cereg >= 0) modem->cereg_stat = cereg;
+    bool ready = modem_registered_locked(modem);
+    mutex_unlock(&modem->state_lock);
+    
+    const AtLine* line = at_batch_line(&batch, i_csq);
+    int rssi = 99;
+    int ber;
+    if (line != NULL) at_parse_csq(line->args, &rssi, &ber);
+    modem->rssi = rssi;
+    modem_log(modem, "📶 CREG: %s, CEREG: %s, CSQ: %d", reg_stat_name(creg), reg_stat_name(cereg), rssi);
+    
+    if (!ready) {
+        bool started = !modem->monitor_running;
+        if (!modem_monitor_start(modem)) return false;
+        modem_log(modem, "⏳ 等待网络注册 (最长%d秒)...", timeout_ms / 1000);
+        
+        mutex_lock(&modem->state_lock);
+        while (!(ready = modem_registered_locked(modem))) {
+            int wait = remaining_ms(deadline);
+            if (wait <= 0) break;
+            cond_timedwait(&modem->state_cond, &modem->state_lock, wait);
+        }
+        creg = modem->creg_stat;
+        cereg = modem->cereg_stat;
+        mutex_unlock(&modem->state_lock);
+        
+        if (started) modem_monitor_stop(modem);
+    }
+    
+    snprintf(net_reg, size, "%s", reg_stat_name(reg_stat_registered(cereg) ? cereg : creg));
+    if (!ready) return false;
+    return modem_ensure_data_ready(modem);
+}
+
+// FOTA步骤1-2：查询版本并预检差分包、等待网络就绪
+bool modem_fota_prepare(EC800KModem* modem, const char* url) {
+    char net_reg[64];
+    
+    if (strlen(url) > 700) {
+        modem_log(modem, "❌ URL长度超过700字符限制");
+        return false;
+    }
+    if (!modem_fota_check_url(modem, url)) {
+        return false;
+    }
+    
+    log_printf("\n==================================================\n");
+    modem_log(modem, "🔄 开始FOTA升级");
+    log_printf("==================================================\n");
+    
+    // 1. 查询当前版本
+    modem_log(modem, "\n[步骤1] 查询当前固件版本...");
+    uint64_t phase_us = monotonic_us();
+    if (!modem->info_valid) {
+        modem_load_static_info(modem);
+    }
+    stats_record_phase(modem_name(modem), "version", monotonic_us() - phase_us);
+    if (strlen(modem->fw_version) > 0) {
+        modem_log(modem, "📌 当前版本: %s", modem->fw_version);
+    }
+    if (!modem_fota_check_version(modem, url)) {
+        return false;
+    }
+    
+    // 2. 等待网络注册与数据业务就绪
+    modem_log(modem, "\n[步骤2] 检查网络状态...");
+    phase_us = monotonic_us();
+    bool registered = modem_wait_network_ready(modem, modem->net_wait_ms, net_reg, sizeof(net_reg));
+    stats_record_phase(modem_name(modem), "network", monotonic_us() - phase_us);
+    if (!registered) {
+        modem_log(modem, "❌ 网络未就绪: %s", net_reg);
+        return false;
+    }
+    modem_log(modem, "✅ 网络已连接: %s", net_reg);
+    return true;
+}
+
+// FOTA步骤3：发送AT+QFOTADL，成功后模组开始后台下载
+bool modem_fota_send(EC800KModem* modem, const char* url, int auto_reset, int timeout) {
+    AtResponse resp;
+    
+    // 3. 发送FOTA升级指令
+    modem_log(modem, "\n[步骤3] 发送FOTA升级指令...");
+    modem_log(modem, "📎 URL: %s", url);
+    modem_log(modem, "📎 升级模式: %s", auto_reset == 1 ? "自动重启" : "手动重启");
+    modem_log(modem, "📎 超时时间: %d秒", timeout);
+    
+    // AT+QFOTADL="URL",升级模式,超时时间
+    modem_fota_reset(modem);
+    uint64_t phase_us = monotonic_us();
+    bool sent = modem_at_transactf(modem, &resp, AT_TIMEOUT_POLICY, "AT+QFOTADL=\"%s\",%d,%d", url, auto_reset, timeout);
+    stats_record_phase(modem_name(modem), "command", monotonic_us() - phase_us);
+    if (!sent) {
+        if (resp.result == AT_RESULT_CME_ERROR) {
+            modem_log(modem, "❌ 指令发送失败: +CME ERROR: %d", resp.error_code);
+        } else {
+            modem_log(modem, "❌ 指令发送失败: %s", at_result_name(resp.result));
+        }
+        return false;
+    }
+    
+    modem_log(modem, "✅ 指令发送成功，模组开始下载固件包...");
+    return true;
+}
+
+// FOTA步骤1-3，成功后模组开始后台下载
+bool modem_fota_start(EC800KModem* modem, const char* url, int auto_reset, int timeout) {
+    return modem_fota_prepare(modem, url) && modem_fota_send(modem, url, auto_reset, timeout);
+}
+
+// 完整FOTA流程：发送升级指令后后台监听+QIND上报直到升级结束
+bool modem_fota_upgrade(EC800KModem* modem, const char* url, int auto_reset, int timeout) {
+    if (!modem_fota_start(modem, url, auto_reset, timeout)) {
+        return false;
+    }
+    
+    // 4. 后台监听+QIND上报直到升级结束
+    modem_log(modem, "\n[步骤4] 等待升级进度上报...");
+    if (!modem_monitor_start(modem)) {
+        return false;
+    }
+    
+    bool complete = modem_wait_fota_complete(modem, FOTA_COMPLETE_TIMEOUT_MS);
+    modem_monitor_stop(modem);
+    
+    if (!complete) {
+        modem_log(modem, "❌ 等待升级结果超时 (%d秒)", FOTA_COMPLETE_TIMEOUT_MS / 1000);
+        return false;
+    }
+    
+    modem_log(modem, "%s FOTA结果码: %d", modem->fota_result == 0 ? "✅" : "❌", modem->fota_result);
+    return modem->fota_result == 0;
+}
+
+// ================== MD5 ==================
+
+// RFC 1321 MD5，用于边发送边校验差分包
+typedef struct {
+    uint32_t state[4];
+    uint64_t count;         // 已处理字节数
+    unsigned char block[64];
+} Md5Context;
+
+#define MD5_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void md5_transform(uint32_t state[4], const unsigned char block[64]) {
+    static const uint32_t K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+    static const int R[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+    };
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = (uint32_t)block[i * 4] | ((uint32_t)block[i * 4 + 1] << 8) |
+               ((uint32_t)block[i * 4 + 2] << 16) | ((uint32_t)block[i * 4 + 3] << 24);
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16)      { f = (b & c) | (~b & d); g = i; }
+        else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) % 16; }
+        else if (i < 48) { f = b ^ c ^ d;          g = (3 * i + 5) % 16; }
+        else             { f = c ^ (b | ~d);       g = (7 * i) % 16; }
+        uint32_t tmp = d;
+        d = c;
+        c = b;
+        b = b + MD5_ROTL(a + f + K[i] + m[g], R[i]);
+        a = tmp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void md5_init(Md5Context* ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->count = 0;
+}
+
+void md5_update(Md5Context* ctx, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t used = (size_t)(ctx->count % 64);
+    ctx->count += len;
+    
+    if (used > 0) {
+        size_t fill = 64 - used < len ? 64 - used : len;
+        memcpy(ctx->block + used, p, fill);
+        p += fill;
+        len -= fill;
+        if (used + fill < 64) return;
+        md5_transform(ctx->state, ctx->block);
+    }
+    // 整块直接从调用方缓冲区（如映射内存）计算，不经拷贝
+    while (len >= 64) {
+        md5_transform(ctx->state, p);
+        p += 64;
+        len -= 64;
+    }
+    memcpy(ctx->block, p, len);
+}
+
+// 输出32位小写十六进制摘要
+void md5_final_hex(Md5Context* ctx, char hex[33]) {
+    unsigned char pad[72] = { 0x80 };
+    uint64_t bits = ctx->count * 8;
+    size_t used = (size_t)(ctx->count % 64);
+    size_t pad_len = used < 56 ? 56 - used : 120 - used;
+    unsigned char len_le[8];
+    for (int i = 0; i < 8; i++) len_le[i] = (unsigned char)(bits >> (8 * i));
+    
+    md5_update(ctx, pad, pad_len);
+    md5_update(ctx, len_le, 8);
+    
+    for (int i = 0; i < 16; i++) {
+        snprintf(hex + i * 2, 3, "%02x", (unsigned)((ctx->state[i / 4] >> (8 * (i % 4))) & 0xff));
+    }
+}
+
+// ================== SHA1/HMAC ==================
+
+// FIPS 180-1 SHA1与RFC 2104 HMAC-SHA1，用于COS请求签名
+typedef struct {
+    uint32_t state[5];
+    uint64_t count;
+    unsigned char block[64];
+} Sha1Context;
+
+#define SHA1_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void sha1_transform(uint32_t state[5], const unsigned char block[64]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = SHA1_ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20)      { f = (b & c) | (~b & d);           k = 0x5a827999; }
+        else if (i < 40) { f = b ^ c ^ d;                    k = 0x6ed9eba1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d);  k = 0x8f1bbcdc; }
+        else             { f = b ^ c ^ d;                    k = 0xca62c1d6; }
+        uint32_t tmp = SHA1_ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = SHA1_ROTL(b, 30);
+        b = a;
+        a = tmp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha1_init(Sha1Context* ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xc3d2e1f0;
+    ctx->count = 0;
+}
+
+void sha1_update(Sha1Context* ctx, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t used = (size_t)(ctx->count % 64);
+    ctx->count += len;
+    
+    if (used > 0) {
+        size_t fill = 64 - used < len ? 64 - used : len;
+        memcpy(ctx->block + used, p, fill);
+        p += fill;
+        len -= fill;
+        if (used + fill < 64) return;
+        sha1_transform(ctx->state, ctx->block);
+    }
+    while (len >= 64) {
+        sha1_transform(ctx->state, p);
+        p += 64;
+        len -= 64;
+    }
+    memcpy(ctx->block, p, len);
+}
+
+void sha1_final(Sha1Context* ctx, unsigned char digest[20]) {
+    unsigned char pad[72] = { 0x80 };
+    uint64_t bits = ctx->count * 8;
+    size_t used = (size_t)(ctx->count % 64);
+    size_t pad_len = used < 56 ? 56 - used : 120 - used;
+    unsigned char len_be[8];
+    for (int i = 0; i < 8; i++) len_be[i] = (unsigned char)(bits >> (56 - 8 * i));
+    
+    sha1_update(ctx, pad, pad_len);
+    sha1_update(ctx, len_be, 8);
+    
+    for (int i = 0; i < 20; i++) {
+        digest[i] = (unsigned char)(ctx->state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+void hex_encode(const unsigned char* data, size_t len, char* hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        hex[i * 2] = digits[data[i] >> 4];
+        hex[i * 2 + 1] = digits[data[i] & 0x0f];
+    }
+    hex[len * 2] = '\0';
+}
+
+// HMAC密钥预处理：内外层状态在吸收K^ipad、K^opad后保存，同一密钥的后续计算从副本继续，
+// 每条消息省去两次分组压缩
+typedef struct {
+    Sha1Context inner;
+    Sha1Context outer;
+} HmacSha1Key;
+
+void hmac_sha1_key_init(HmacSha1Key* hk, const void* key, size_t key_len) {
+    unsigned char k[64];
+    unsigned char pad[64];
+    
+    memset(k, 0, sizeof(k));
+    if (key_len > sizeof(k)) {
+        sha1_init(&hk->inner);
+        sha1_update(&hk->inner, key, key_len);
+        sha1_final(&hk->inner, k);
+    } else {
+        memcpy(k, key, key_len);
+    }
+    
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x36;
+    sha1_init(&hk->inner);
+    sha1_update(&hk->inner, pad, sizeof(pad));
+    
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x5c;
+    sha1_init(&hk->outer);
+    sha1_update(&hk->outer, pad, sizeof(pad));
+}
+
+void hmac_sha1_keyed(const HmacSha1Key* hk, const void* msg, size_t msg_len, unsigned char digest[20]) {
+    Sha1Context ctx = hk->inner;
+    sha1_update(&ctx, msg, msg_len);
+    sha1_final(&ctx, digest);
+    
+    ctx = hk->outer;
+    sha1_update(&ctx, digest, 20);
+    sha1_final(&ctx, digest);
+}
+
+void hmac_sha1(const void* key, size_t key_len, const void* msg, size_t msg_len, unsigned char digest[20]) {
+    HmacSha1Key hk;
+    hmac_sha1_key_init(&hk, key, key_len);
+    hmac_sha1_keyed(&hk, msg, msg_len, digest);
+}
+
+// ================== 本地文件升级 ==================
+
+#define FILE_START_TIMEOUT_MS 10000     // 等待+QIND: "FOTA","FILESTART"
+#define FILE_STALL_TIMEOUT_MS 30000     // 流控阻塞超过该时长视为传输失败
+#define FILE_CHUNK_FLOW 4096            // 硬件流控下每次写入字节数
+#define FILE_CHUNK_NOFLOW 32            // 无流控时每次发送需控制在32字节内
+#define FILE_NOFLOW_RATE (15 * 1024)    // 无流控时模组接收速率上限（字节/秒）
+
+// 打开模组侧硬件流控：USB AT口使用AT+QCFG="usbifc"，主串口使用AT+IFC
+bool modem_enable_flow_control(EC800KModem* modem) {
+    AtResponse resp;
+    bool usb = strstr(modem->port_path, "ttyUSB") != NULL || strstr(modem->port_path, "ttyACM") != NULL ||
+               strstr(modem->port_path, "usb") != NULL;
+    return modem_at_transact(modem, usb ? "AT+QCFG=\"usbifc\",2,2" : "AT+IFC=2,2",
+                             &resp, AT_TIMEOUT_POLICY);
+}
+
+// 只读映射的差分包，发送时直接从映射内存写入串口
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} PackageMap;
+
+bool package_map_open(const char* path, PackageMap* pkg) {
+    pkg->data = NULL;
+    pkg->size = 0;
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    pkg->mapping = NULL;
+    pkg->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (pkg->file == INVALID_HANDLE_VALUE) return false;
+    if (!GetFileSizeEx(pkg->file, &size) || size.QuadPart == 0) {
+        CloseHandle(pkg->file);
+        return false;
+    }
+    pkg->mapping = CreateFileMappingA(pkg->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (pkg->mapping != NULL) {
+        pkg->data = (const unsigned char*)MapViewOfFile(pkg->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (pkg->data == NULL) {
+        if (pkg->mapping != NULL) CloseHandle(pkg->mapping);
+        CloseHandle(pkg->file);
+        return false;
+    }
+    pkg->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // 映射建立后文件描述符可关闭
+    if (data == MAP_FAILED) return false;
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    pkg->data = (const unsigned char*)data;
+    pkg->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void package_map_close(PackageMap* pkg) {
+    if (pkg->data == NULL) return;
+#ifdef _WIN32
+    UnmapViewOfFile(pkg->data);
+    CloseHandle(pkg->mapping);
+    CloseHandle(pkg->file);
+#else
+    munmap((void*)pkg->data, pkg->size);
+#endif
+    pkg->data = NULL;
+}
+
+// 读取期望MD5：优先使用--md5，其次读取同名.md5文件（md5sum格式）
+// 两者都没有时md5置空并返回true；--md5或.md5文件内容无效时返回false
+bool package_expected_md5(const char* path, const char* option, char md5[33]) {
+    char line[128];
+    const char* src = option;
+    
+    md5[0] = '\0';
+    if (src == NULL) {
+        char md5_path[1024];
+        snprintf(md5_path, sizeof(md5_path), "%s.md5", path);
+        FILE* fp = fopen(md5_path, "r");
+        if (fp == NULL) return true;
+        src = fgets(line, sizeof(line), fp);
+        fclose(fp);
+        if (src == NULL) return false;
+    }
+    
+    for (int i = 0; i < 32; i++) {
+        char c = src[i];
+        if (c >= 'A' && c <= 'F') c = (char)(c - 'A' + 'a');
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            md5[0] = '\0';
+            return false;
+        }
+        md5[i] = c;
+    }
+    md5[32] = '\0';
+    // --md5必须恰好32位；.md5文件中摘要之后只能是行尾，或空白分隔的文件名（md5sum格式）
+    char next = src[32];
+    bool valid = option != NULL ? next == '\0'
+                                : next == '\0' || next == ' ' || next == '\t' || next == '\r' || next == '\n';
+    if (!valid) md5[0] = '\0';
+    return valid;
+}
+
+// 把差分包写入串口：硬件流控下大块写入由CTS节流，否则按32字节分包限速
+// 每块先计入MD5再发送；最后一块发送前核对摘要，不一致时扣住最后一块，
+// 模组收不满<length>字节就不会进入升级重启
+bool modem_stream_package(EC800KModem* modem, const PackageMap* pkg, const char* expected_md5) {
+    size_t chunk = modem->hw_flow ? FILE_CHUNK_FLOW : FILE_CHUNK_NOFLOW;
+    size_t size = pkg->size;
+    size_t sent = 0;
+    int last_decile = -1;
+    uint64_t start = monotonic_ms();
+    Md5Context md5;
+    char digest[33];
+    
+    md5_init(&md5);
+    
+    while (sent < size) {
+        size_t n = size - sent < chunk ? size - sent : chunk;
+        const unsigned char* p = pkg->data + sent;
+        
+        md5_update(&md5, p, n);
+        if (sent + n == size) {
+            md5_final_hex(&md5, digest);
+            modem_log(modem, "🔐 差分包MD5: %s", digest);
+            if (expected_md5 != NULL && strcmp(digest, expected_md5) != 0) {
+                modem_log(modem, "❌ MD5不匹配（期望%s），已停止发送，模组不会进入升级", expected_md5);
+                return false;
+            }
+        }
+        
+        if (!serial_write_timeout(modem, p, n, FILE_STALL_TIMEOUT_MS)) {
+            modem_log(modem, "❌ 写入串口失败（已发送%zu/%zu字节）", sent, size);
+            return false;
+        }
+        sent += n;
+        
+        if (!modem->hw_flow) {
+            // 按速率上限计算本块应到达的时间点
+            uint64_t due = start + (uint64_t)sent * 1000 / FILE_NOFLOW_RATE;
+            int ahead = remaining_ms(due);
+            if (ahead > 0) sleep_ms(ahead);
+        }
+        
+        int decile = (int)(sent * 10 / size);
+        if (decile != last_decile) {
+            last_decile = decile;
+            modem_log(modem, "📤 已发送: %zu/%zu字节 (%d%%)", sent, size, decile * 10);
+        }
+    }
+    
+#ifndef _WIN32
+    tcdrain(modem->handle);
+#endif
+    stats_record_phase(modem_name(modem), "file_send", (monotonic_ms() - start) * 1000);
+    double seconds = (double)(monotonic_ms() - start) / 1000.0;
+    modem_log(modem, "✅ 差分包发送完成: %zu字节, 用时%.1f秒 (%.1fKB/s)", size, seconds,
+              seconds > 0 ? (double)size / 1024.0 / seconds : 0.0);
+    return true;
+}
+
+// 本地文件FOTA：AT+QFOTADL="FILE:<length>"后经串口直接发送差分包，模组无需联网下载
+bool modem_fota_upgrade_file(EC800KModem* modem, const char* path, int auto_reset, int urc_max,
+                             const char* md5_option) {
+    char expected_md5[33];
+    bool verify = false;
+    AtResponse resp;
+    PackageMap pkg;
+    
+    if (fota_is_minifota_package(path)) {
+        modem_log(modem, "❌ MiniFOTA差分包(.mini_1/.mini_2)不支持本地文件升级，请使用fota命令通过HTTP/FTP下载");
+        return false;
+    }
+    int mini_part = fota_package_header_part(path);
+    if (mini_part != 0) {
+        modem_log(modem, "❌ 文件头为MiniFOTA格式(第%d部分)，不支持本地文件升级", mini_part);
+        return false;
+    }
+    
+    if (!package_expected_md5(path, md5_option, expected_md5)) {
+        if (md5_option != NULL) {
+            modem_log(modem, "❌ 无效的MD5: %s", md5_option);
+        } else {
+            modem_log(modem, "❌ 无效的MD5文件: %s.md5", path);
+        }
+        return false;
+    }
+    verify = expected_md5[0] != '\0';
+    
+    if (!package_map_open(path, &pkg)) {
+        modem_log(modem, "❌ 无法打开差分包: %s", path);
+        return false;
+    }
+    
+    modem_fota_reset(modem);
+    
+    log_printf("\n==================================================\n");
+    modem_log(modem, "🔄 开始本地文件FOTA升级");
+    log_printf("==================================================\n");
+    
+    // 1. 查询当前版本
+    modem_log(modem, "\n[步骤1] 查询当前固件版本...");
+    if (!modem->info_valid) {
+        modem_load_static_info(modem);
+    }
+    if (strlen(modem->fw_version) > 0) {
+        modem_log(modem, "📌 当前版本: %s", modem->fw_version);
+    }
+    if (!modem_fota_check_version(modem, path)) {
+        package_map_close(&pkg);
+        return false;
+    }
+    
+    // 2. 配置流控
+    modem_log(modem, "\n[步骤2] 配置流控...");
+    if (modem->hw_flow) {
+        if (!modem_enable_flow_control(modem)) {
+            modem_log(modem, "❌ 模组硬件流控打开失败");
+            package_map_close(&pkg);
+            return false;
+        }
+        modem_log(modem, "✅ 已启用RTS/CTS硬件流控");
+    } else {
+        modem_log(modem, "⚠️ 未启用硬件流控(--rtscts)，将按%d字节分包限速发送 (约%dKB/s)",
+                  FILE_CHUNK_NOFLOW, FILE_NOFLOW_RATE / 1024);
+    }
+    
+    // 3. 发送升级指令，等待模组准备接收
+    modem_log(modem, "\n[步骤3] 发送FOTA升级指令...");
+    modem_log(modem, "📎 文件: %s (%zu字节)", path, pkg.size);
+    modem_log(modem, "📎 MD5校验: %s", verify ? expected_md5 : "未提供（仅计算）");
+    
+    if (!modem_monitor_start(modem)) {
+        package_map_close(&pkg);
+        return false;
+    }
+    // CMUX时差分包经DLC3发送，DLC1上的查询不受影响
+    EC800KModem* data = modem_bulk(modem);
+    if (!modem_at_transactf(data, &resp, AT_TIMEOUT_POLICY, "AT+QFOTADL=\"FILE:%zu\",%d,%d", pkg.size, auto_reset, urc_max)) {
+        modem_log(modem, "❌ 指令发送失败");
+        modem_monitor_stop(modem);
+        package_map_close(&pkg);
+        return false;
+    }
+    if (!modem_wait_fota_stage(modem, FOTA_STAGE_DOWNLOADING, FILE_START_TIMEOUT_MS) || modem->fota_complete) {
+        modem_log(modem, "❌ 未收到FILESTART上报");
+        modem_monitor_stop(modem);
+        package_map_close(&pkg);
+        return false;
+    }
+    
+    // 4. 发送差分包，期间监听线程继续接收下载进度
+    modem_log(modem, "\n[步骤4] 发送差分包...");
+    bool sent = modem_stream_package(data, &pkg, verify ? expected_md5 : NULL);
+    package_map_close(&pkg);
+    if (!sent) {
+        modem_monitor_stop(modem);
+        return false;
+    }
+    
+    // 5. 等待FILEEND以及后续升级进度
+    modem_log(modem, "\n[步骤5] 等待升级进度上报...");
+    bool complete = modem_wait_fota_complete(modem, FOTA_COMPLETE_TIMEOUT_MS);
+    modem_monitor_stop(modem);
+    
+    if (!complete) {
+        modem_log(modem, "❌ 等待升级结果超时 (%d秒)", FOTA_COMPLETE_TIMEOUT_MS / 1000);
+        return false;
+    }
+    
+    modem_log(modem, "%s FOTA结果码: %d", modem->fota_result == 0 ? "✅" : "❌", modem->fota_result);
+    return modem->fota_result == 0;
+}
+
+// ================== 差分包缓存 ==================
+
+// 批量升级时差分包只从上游下载一次，按内容MD5存入缓存目录，
+// 再由内置HTTP服务在局域网内分发，AT+QFOTADL的URL改写为本机地址
+
+#define CACHE_DEFAULT_DIR "fota_cache"
+#define CACHE_DEFAULT_PORT 8080
+#define CACHE_MAX_REDIRECTS 3
+#define HTTP_IO_TIMEOUT_MS 30000
+#define HTTP_HEADER_MAX 4096
+
+typedef struct {
+    char cache_dir[512];
+    char public_host[128];      // 写入URL的地址（模组可访问的本机IP）
+    int port;
+    bool running;
+#ifndef _WIN32
+    int listen_fd;
+    volatile bool stop;
+    thread_t thread;
+#endif
+} FotaServer;
+
+bool is_md5_hex(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!((s[i] >= '0' && s[i] <= '9') || (s[i] >= 'a' && s[i] <= 'f'))) return false;
+    }
+    return true;
+}
+
+// 在索引中查找URL对应的内容MD5，且缓存文件仍存在
+bool fota_cache_lookup(const char* dir, const char* url, char md5[33]) {
+    char path[1024];
+    char line[1200];
+    bool found = false;
+    
+    snprintf(path, sizeof(path), "%s/index.txt", dir);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strlen(line) > 33 && line[32] == ' ' && strcmp(line + 33, url) == 0 && is_md5_hex(line, 32)) {
+            memcpy(md5, line, 32);
+            md5[32] = '\0';
+            found = true;
+        }
+    }
+    fclose(fp);
+    
+    if (found) {
+        snprintf(path, sizeof(path), "%s/%s", dir, md5);
+        FILE* pkg = fopen(path, "rb");
+        if (pkg == NULL) return false;
+        fclose(pkg);
+    }
+    return found;
+}
+
+// 不区分大小写查找头部字段值
+bool http_header_value(const char* header, const char* name, char* value, size_t size) {
+    size_t name_len = strlen(name);
+    for (const char* p = strstr(header, "\r\n"); p != NULL; p = strstr(p, "\r\n")) {
+        p += 2;
+        if (strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            const char* v = p + name_len + 1;
+            while (*v == ' ') v++;
+            size_t len = strcspn(v, "\r\n");
+            if (len >= size) len = size - 1;
+            memcpy(value, v, len);
+            value[len] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifndef _WIN32
+
+void fota_cache_mkdir(const char* dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        log_msg("⚠️ 无法创建缓存目录 %s: %s", dir, strerror(errno));
+    }
+}
+
+// 解析http://host[:port]/path，上游仅支持明文HTTP
+bool http_parse_url(const char* url, char* host, size_t host_size, char* port, size_t port_size,
+                    const char** path) {
+    if (strncmp(url, "http://", 7) != 0) return false;
+    const char* p = url + 7;
+    const char* slash = strchr(p, '/');
+    const char* end = slash != NULL ? slash : p + strlen(p);
+    const char* colon = memchr(p, ':', (size_t)(end - p));
+    const char* host_end = colon != NULL ? colon : end;
+    
+    if (host_end == p || (size_t)(host_end - p) >= host_size) return false;
+    memcpy(host, p, (size_t)(host_end - p));
+    host[host_end - p] = '\0';
+    
+    if (colon != NULL) {
+        size_t len = (size_t)(end - colon - 1);
+        if (len == 0 || len >= port_size) return false;
+        memcpy(port, colon + 1, len);
+        port[len] = '\0';
+    } else {
+        snprintf(port, port_size, "80");
+    }
+    *path = slash != NULL ? slash : "/";
+    return true;
+}
+
+// 按当前URL解析Location：绝对地址直接使用，/开头替换路径，其余相对当前目录
+void http_resolve_location(char* current, size_t size, const char* location) {
+    char base[1024];
+    
+    if (strstr(location, "://") != NULL) {
+        snprintf(current, size, "%s", location);
+        return;
+    }
+    snprintf(base, sizeof(base), "%s", current);
+    char* authority = strstr(base, "://");
+    authority = authority != NULL ? authority + 3 : base;
+    char* path = strchr(authority, '/');
+    if (location[0] == '/') {
+        if (path != NULL) *path = '\0';
+    } else if (path != NULL) {
+        path[strcspn(path, "?#")] = '\0';
+        strrchr(path, '/')[1] = '\0';
+    } else {
+        snprintf(base + strlen(base), sizeof(base) - strlen(base), "/");
+    }
+    snprintf(current, size, "%s%s", base, location);
+}
+
+int tcp_connect(const char* host, const char* port) {
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    int fd = -1;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+    
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// 带超时的socket读取，超时或出错返回-1
+ssize_t socket_read(int fd, void* buf, size_t size, int timeout_ms) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+    return read(fd, buf, size);
+}
+
+bool socket_write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, HTTP_IO_TIMEOUT_MS) <= 0) return false;
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// 读取HTTP头部直到空行，返回头部长度，body起始部分留在buf中
+int http_read_header(int fd, char* buf, size_t size, size_t* total) {
+    *total = 0;
+    while (*total < size - 1) {
+        ssize_t n = socket_read(fd, buf + *total, size - 1 - *total, HTTP_IO_TIMEOUT_MS);
+        if (n <= 0) return -1;
+        *total += (size_t)n;
+        buf[*total] = '\0';
+        char* end = strstr(buf, "\r\n\r\n");
+        if (end != NULL) return (int)(end + 4 - buf);
+    }
+    return -1;
+}
+
+// HTTP/1.0 GET下载到文件，边接收边计算MD5；跟随有限次重定向
+bool http_download(const char* url, FILE* out, char md5_hex[33], size_t* bytes) {
+    char current[1024];
+    snprintf(current, sizeof(current), "%s", url);
+    
+    for (int redirect = 0; redirect <= CACHE_MAX_REDIRECTS; redirect++) {
+        char host[256];
+        char port[16];
+        const char* path;
+        char buf[HTTP_HEADER_MAX];
+        size_t total;
+        
+        if (!http_parse_url(current, host, sizeof(host), port, sizeof(port), &path)) {
+            log_msg("❌ 缓存仅支持http://上游地址: %s", current);
+            return false;
+        }
+        int fd = tcp_connect(host, port);
+        if (fd < 0) {
+            log_msg("❌ 无法连接上游服务器 %s:%s", host, port);
+            return false;
+        }
+        
+        int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+        int header_len = len > 0 && (size_t)len < sizeof(buf) && socket_write_all(fd, buf, (size_t)len)
+                         ? http_read_header(fd, buf, sizeof(buf), &total) : -1;
+        if (header_len < 0) {
+            log_msg("❌ 上游服务器响应异常");
+            close(fd);
+            return false;
+        }
+        
+        int status = 0;
+        sscanf(buf, "HTTP/%*s %d", &status);
+        if (status == 301 || status == 302 || status == 303 || status == 307 || status == 308) {
+            char location[1024];
+            close(fd);
+            if (!http_header_value(buf, "Location", location, sizeof(location))) return false;
+            http_resolve_location(current, sizeof(current), location);
+            log_msg("↪️ 重定向: %s", current);
+            continue;
+        }
+        if (status != 200) {
+            log_msg("❌ 上游服务器返回HTTP %d", status);
+            close(fd);
+            return false;
+        }
+        
+        // 有Content-Length时必须收满，否则只能以连接关闭为结束
+        char length_text[32];
+        long long expected = -1;
+        if (http_header_value(buf, "Content-Length", length_text, sizeof(length_text))) {
+            char* end = NULL;
+            expected = strtoll(length_text, &end, 10);
+            if (end == length_text || expected < 0) {
+                log_msg("❌ 上游服务器Content-Length无效: %s", length_text);
+                close(fd);
+                return false;
+            }
+        }
+        
+        Md5Context md5;
+        md5_init(&md5);
+        *bytes = total - (size_t)header_len;
+        md5_update(&md5, buf + header_len, *bytes);
+        bool ok = fwrite(buf + header_len, 1, *bytes, out) == *bytes;
+        
+        while (ok && (expected < 0 || *bytes < (size_t)expected)) {
+            ssize_t n = socket_read(fd, buf, sizeof(buf), HTTP_IO_TIMEOUT_MS);
+            if (n == 0) break;
+            if (n < 0) {
+                log_msg("❌ 读取上游数据超时或出错 (已接收%zu字节)", *bytes);
+                ok = false;
+                break;
+            }
+            md5_update(&md5, buf, (size_t)n);
+            ok = fwrite(buf, 1, (size_t)n, out) == (size_t)n;
+            *bytes += (size_t)n;
+        }
+        close(fd);
+        
+        if (ok && expected >= 0 && *bytes != (size_t)expected) {
+            log_msg("❌ 下载不完整: %zu/%lld字节", *bytes, expected);
+            ok = false;
+        }
+        md5_final_hex(&md5, md5_hex);
+        return ok && *bytes > 0;
+    }
+    log_msg("❌ 重定向次数过多");
+    return false;
+}
+
+// 取得URL对应的缓存包，未命中时下载一次并写入索引
+bool fota_cache_fetch(const char* dir, const char* url, char md5[33]) {
+    char tmp_path[1024];
+    char path[1024];
+    size_t bytes = 0;
+    
+    if (fota_cache_lookup(dir, url, md5)) {
+        log_msg("📦 缓存命中: %s", md5);
+        return true;
+    }
+    
+    fota_cache_mkdir(dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.download-%d", dir, (int)getpid());
+    FILE* out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        log_msg("❌ 无法写入缓存目录: %s", dir);
+        return false;
+    }
+    
+    log_msg("⬇️ 从上游下载差分包: %s", url);
+    uint64_t start = monotonic_ms();
+    bool ok = http_download(url, out, md5, &bytes);
+    ok = fclose(out) == 0 && ok;
+    
+    snprintf(path, sizeof(path), "%s/%s", dir, md5);
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    
+    snprintf(tmp_path, sizeof(tmp_path), "%s/index.txt", dir);
+    FILE* index = fopen(tmp_path, "a");
+    if (index != NULL) {
+        fprintf(index, "%s %s\n", md5, url);
+        fclose(index);
+    }
+    
+    double seconds = (double)(monotonic_ms() - start) / 1000.0;
+    log_msg("✅ 已缓存: %s (%zu字节, %.1f秒)", md5, bytes, seconds);
+    return true;
+}
+
+typedef struct {
+    int fd;
+    char cache_dir[512];
+} FotaServerConn;
+
+// 处理一个GET/HEAD请求：/<md5>/<文件名>，支持Range断点续传
+void fota_server_handle(FotaServerConn* conn) {
+    char buf[HTTP_HEADER_MAX];
+    char method[8];
+    char target[512];
+    char range[64];
+    size_t total;
+    PackageMap pkg;
+    
+    if (http_read_header(conn->fd, buf, sizeof(buf), &total) < 0 ||
+        sscanf(buf, "%7s %511s", method, target) != 2) {
+        return;
+    }
+    
+    bool head = strcmp(method, "HEAD") == 0;
+    const char* hex = target + 1;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%.32s", conn->cache_dir, hex);
+    
+    if ((!head && strcmp(method, "GET") != 0) || target[0] != '/' || strlen(hex) < 32 ||
+        !is_md5_hex(hex, 32) || (hex[32] != '\0' && hex[32] != '/') || !package_map_open(path, &pkg)) {
+        const char* resp = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        socket_write_all(conn->fd, resp, strlen(resp));
+        log_msg("🌐 404 %s", target);
+        return;
+    }
+    
+    size_t offset = 0;
+    if (http_header_value(buf, "Range", range, sizeof(range))) {
+        unsigned long long from = 0;
+        if (sscanf(range, "bytes=%llu-", &from) == 1 && from < pkg.size) {
+            offset = (size_t)from;
+        }
+    }
+    
+    int len;
+    if (offset > 0) {
+        len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\n"
+                       "Content-Length: %zu\r\nContent-Range: bytes %zu-%zu/%zu\r\nConnection: close\r\n\r\n",
+                       pkg.size - offset, offset, pkg.size - 1, pkg.size);
+    } else {
+        len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                       "Content-Length: %zu\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n",
+                       pkg.size);
+    }
+    
+    uint64_t start = monotonic_ms();
+    bool ok = socket_write_all(conn->fd, buf, (size_t)len);
+    if (ok && !head) {
+        ok = socket_write_all(conn->fd, pkg.data + offset, pkg.size - offset);
+    }
+    log_msg("🌐 %s %s %s (%zu字节, %llums)", ok ? "✅" : "❌", method, target,
+            head ? 0 : pkg.size - offset, (unsigned long long)(monotonic_ms() - start));
+    package_map_close(&pkg);
+}
+
+THREAD_RETURN fota_server_conn_thread(void* arg) {
+    FotaServerConn* conn = (FotaServerConn*)arg;
+    fota_server_handle(conn);
+    close(conn->fd);
+    free(conn);
+    return THREAD_RESULT;
+}
+
+// 监听线程：每个连接一个分离线程，多台模组可同时下载
+THREAD_RETURN fota_server_thread(void* arg) {
+    FotaServer* server = (FotaServer*)arg;
+    
+    while (!server->stop) {
+        struct pollfd pfd = { server->listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, MONITOR_POLL_MS) <= 0) continue;
+        
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        
+        FotaServerConn* conn = (FotaServerConn*)malloc(sizeof(FotaServerConn));
+        thread_t thread;
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        snprintf(conn->cache_dir, sizeof(conn->cache_dir), "%s", server->cache_dir);
+        if (!thread_create(&thread, fota_server_conn_thread, conn)) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return THREAD_RESULT;
+}
+
+bool fota_server_start(FotaServer* server) {
+    struct sockaddr_in addr;
+    int on = 1;
+    
+    signal(SIGPIPE, SIG_IGN);   // 模组中途断开时write返回EPIPE而不是终止进程
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) return false;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)server->port);
+    if (bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, 64) != 0) {
+        log_msg("❌ 无法监听端口%d: %s", server->port, strerror(errno));
+        close(server->listen_fd);
+        return false;
+    }
+    
+    server->stop = false;
+    if (!thread_create(&server->thread, fota_server_thread, server)) {
+        close(server->listen_fd);
+        return false;
+    }
+    server->running = true;
+    log_msg("🌐 差分包服务已启动: http://%s:%d/ (目录%s)", server->public_host, server->port, server->cache_dir);
+    return true;
+}
+
+void fota_server_stop(FotaServer* server) {
+    if (!server->running) return;
+    server->stop = true;
+    thread_join(server->thread);
+    close(server->listen_fd);
+    server->running = false;
+}
+
+#else
+
+void fota_server_stop(FotaServer* server) {
+    (void)server;
+}
+
+#endif
+
+// 根据--serve选项准备本地分发：缓存差分包、启动服务并返回改写后的URL；
+// 未启用或失败时返回原始URL。server首次使用前需清零，已启动的服务直接复用（fleet的多个差分包）
+const char* fota_resolve_url(FotaServer* server, const char* url, const ToolOptions* opts,
+                             char* local_url, size_t size) {
+    if (opts->serve == NULL) return url;
+    
+#ifdef _WIN32
+    (void)local_url;
+    (void)size;
+    log_msg("⚠️ 本地差分包服务仅支持Linux/macOS，使用原始URL");
+    return url;
+#else
+    char md5[33];
+    char name[256];
+    char path[1024];
+    FotaPackageInfo info;
+    
+    if (!server->running) {
+        snprintf(server->cache_dir, sizeof(server->cache_dir), "%s", opts->cache_dir);
+        snprintf(server->public_host, sizeof(server->public_host), "%s", opts->serve);
+        server->port = CACHE_DEFAULT_PORT;
+        char* colon = strrchr(server->public_host, ':');
+        if (colon != NULL) {
+            server->port = atoi(colon + 1);
+            *colon = '\0';
+        }
+    }
+    
+    if (!fota_cache_fetch(server->cache_dir, url, md5)) {
+        log_msg("⚠️ 差分包缓存失败，使用原始URL");
+        return url;
+    }
+    if (!server->running && !fota_server_start(server)) {
+        log_msg("⚠️ 差分包服务启动失败，使用原始URL");
+        return url;
+    }
+    
+    // 缓存后可核对MiniFOTA文件头，发现把第二部分误当作.mini_1上传的情况
+    snprintf(path, sizeof(path), "%s/%s", server->cache_dir, md5);
+    fota_package_parse(url, &info);
+    int part = fota_package_header_part(path);
+    if (info.mini_part != 0 && part != 0 && part != info.mini_part) {
+        log_msg("⚠️ 差分包内容为MiniFOTA第%d部分，与文件名不符，模组校验将失败", part);
+    }
+    
+    url_basename(url, name, sizeof(name));
+    snprintf(local_url, size, "http://%s:%d/%s/%s", server->public_host, server->port, md5, name);
+    if (fota_is_minifota_package(name) && strlen(local_url) > MINIFOTA_URL_MAX) {
+        log_msg("⚠️ MiniFOTA的URL长度不能超过%d字节: %zu", MINIFOTA_URL_MAX, strlen(local_url));
+    }
+    log_msg("🔗 升级URL改写为: %s", local_url);
+    return local_url;
+#endif
+}
+
+// ================== 工具函数 ==================
+
+void run_basic_test(EC800KModem* modem) {
+    log_printf("\n==================================================\n");
+    log_printf("📡 EC800K/EG800K 基本测试\n");
+    log_printf("==================================================\n");
+    
+    log_printf("\n[1/3] AT通信测试...\n");
+    if (modem_test_at(modem)) {
+        log_printf("✅ AT通信正常\n");
+    } else {
+        log_printf("❌ AT通信失败\n");
+        return;
+    }
+    
+    // 模块信息与网络状态合并为一次往返，设备信息缓存命中时其中只含AT+QGMR
+    AtBatch batch;
+    DeviceInfoQuery info;
+    at_batch_init(&batch);
+    device_info_batch_add(modem, &batch, &info);
+    int i_cpin = at_batch_add(&batch, "AT+CPIN?", "+CPIN:");
+    int i_creg = at_batch_add(&batch, "AT+CREG?", "+CREG:");
+    int i_csq = at_batch_add(&batch, "AT+CSQ", "+CSQ:");
+    modem_at_batch(modem, &batch, AT_TIMEOUT_POLICY);
+    
+    log_printf("\n[2/3] 获取模块信息...\n");
+    device_info_batch_apply(modem, &batch, &info);
+    report_module_info(modem, &batch, i_cpin);
+    
+    log_printf("\n[3/3] 检查网络状态...\n");
+    char net_reg[64];
+    report_network_status(&batch, i_creg, i_csq, net_reg, sizeof(net_reg));
+}
+
+void print_error_codes(void) {
+    log_printf("\n==================================================\n");
+    log_printf("📖 FOTA 错误码说明\n");
+    log_printf("==================================================\n");
+    
+    log_printf("\n【FOTA升级错误码】(+QIND: \"FOTA\",\"END\",<err>)\n");
+    log_printf("  0:   升级成功\n");
+    log_printf("  504: 升级失败\n");
+    log_printf("  505: 包校验出错\n");
+    log_printf("  506: 固件MD5检查错误\n");
+    log_printf("  507: 包版本不匹配\n");
+    log_printf("  552: 包项目名不匹配\n");
+    log_printf("  553: 包基线名不匹配\n");
+    
+    log_printf("\n【+QIND URC上报说明】\n");
+    log_printf("  +QIND: \"FOTA\",\"HTTPSTART\"     - 开始HTTP下载\n");
+    log_printf("  +QIND: \"FOTA\",\"HTTPEND\",<err> - HTTP下载结束\n");
+    log_printf("  +QIND: \"FOTA\",\"UPDATING\",<%%>  - 升级进度(7%%-96%%)\n");
+    log_printf("  +QIND: \"FOTA\",\"END\",<err>     - 升级结束(0=成功)\n");
+}
+
+// 每模组内存占用：嵌入式网关按此估算可同时管理的模组数
+void print_footprint(void) {
+    log_printf("\n==================================================\n");
+    log_printf("📐 内存占用 (%s配置)\n",
+#ifdef EC800K_EMBEDDED
+               "嵌入式"
+#else
+               "默认"
+#endif
+    );
+    log_printf("==================================================\n");
+    log_printf("  模组上下文 EC800KModem: %6zu 字节\n", sizeof(EC800KModem));
+    log_printf("    其中收发缓冲 ModemArena: %6zu 字节\n", sizeof(ModemArena));
+    log_printf("  单次事务 AtResponse:    %6zu 字节 (栈上)\n", sizeof(AtResponse));
+    log_printf("  批量事务 AtBatch:       %6zu 字节 (栈上)\n", sizeof(AtBatch));
+#ifndef _WIN32
+    log_printf("  CMUX复用 CmuxMux:       %6zu 字节 (--cmux时按模组分配)\n", sizeof(CmuxMux));
+#endif
+    log_printf("  信号采样 Telemetry:     %6zu 字节 (全局，--telemetry时启用)\n", sizeof(Telemetry));
+    log_printf("  收发记录 Trace:         %6zu 字节 (全局，--capture时启用)\n", sizeof(Trace));
+    log_printf("  %d个模组常驻合计:       %6zu 字节\n", MAX_SERIAL_PORTS,
+               MAX_SERIAL_PORTS * sizeof(EC800KModem));
+}
+
+void print_usage(const char* prog_name) {
+    log_printf("\n使用方法:\n");
+    log_printf("  %s [选项] <串口> [命令] [参数...]\n", prog_name);
+    log_printf("\n选项:\n");
+    log_printf("  --baud N               - 波特率（默认%d，支持至3000000）\n", DEFAULT_BAUDRATE);
+    log_printf("  --rtscts               - 启用RTS/CTS硬件流控\n");
+    log_printf("  --md5 HEX              - fota-file差分包的期望MD5（默认读取<PATH>.md5）\n");
+    log_printf("  --stats json|table     - 统计AT命令与FOTA阶段耗时（json行输出到stderr）\n");
+    log_printf("  --net-wait SEC         - 升级前等待网络注册的最长时间 (默认%d秒)\n", NET_READY_TIMEOUT_MS / 1000);
+    log_printf("  --apn APN              - PDP上下文未激活时配置的APN，如cmnet\n");
+    log_printf("  --list-parts           - upload续传前用ListParts核对服务端已有分片\n");
+    log_printf("  --state-cache          - 按IMEI缓存固件版本/ICCID（%s），仅用AT+QGMR校验\n", DEVICE_CACHE_FILE);
+    log_printf("                           各命令实测耗时同时记入%s，下次启动即按p99设定超时\n", AT_POLICY_CACHE_FILE);
+    log_printf("  --force                - 跳过差分包源版本预检（文件名[signed_]<源版本>-<目标版本>）\n");
+    log_printf("  --max-downloads N      - fleet同时下载的模组数上限 (默认%d，0不限)\n", FLEET_DEFAULT_DOWNLOADS);
+    log_printf("                           从%d个起步，下载顺利时逐个放开，HTTPEND出错时减半并重试\n", FLEET_INITIAL_WINDOW);
+#ifndef _WIN32
+    log_printf("  --cmux                 - 27.010多路复用单个串口：DLC1 AT控制、DLC2 URC、DLC3 数据传输\n");
+    log_printf("                           HTTP读写/ufs-get/fota-file走DLC3，不阻塞状态查询与升级进度\n");
+#endif
+    log_printf("  --telemetry FILE       - 后台采样各模组AT+QENG/AT+QCSQ/AT+CSQ，记入环形文件（%d条）\n",
+               TELEMETRY_RING_RECORDS);
+    log_printf("                           同时记录下载与分片上传耗时，telemetry命令据此预估各站点用时\n");
+    log_printf("  --sample-interval SEC  - 采样周期 (默认%d秒，随机±%d%%错开各模组)\n",
+               TELEMETRY_DEFAULT_INTERVAL_S, TELEMETRY_JITTER_PCT);
+    log_printf("  --capture FILE         - 记录各串口收发字节与时间戳，replay命令可离线回放\n");
+    log_printf("  --cacert FILE          - HTTPS校验服务器证书用的CA证书（PEM），连接前上传到模组%s\n", TLS_CA_FILE);
+    log_printf("  --insecure             - HTTPS不校验服务器证书（仅限测试，未指定--cacert时HTTPS需显式开启）\n");
+    log_printf("  --serve HOST[:PORT]    - 下载一次并在局域网分发差分包，URL改写为本机地址\n");
+    log_printf("  --cache DIR            - 差分包缓存目录 (默认%s)\n", CACHE_DEFAULT_DIR);
+    log_printf("\n命令:\n");
+    log_printf("  test                   - 基本测试（默认）\n");
+    log_printf("  info                   - 显示错误码说明\n");
+    log_printf("  footprint              - 显示每模组内存占用（make EMBEDDED=1 为小内存配置）\n");
+    log_printf("  version                - 仅查询固件版本\n");
+    log_printf("  fota URL [mode] [timeout]\n");
+    log_printf("                         - FOTA升级\n");
+    log_printf("                           mode: 0=手动重启, 1=自动重启\n");
+    log_printf("  fota-file PATH [mode] [urc_max]\n");
+    log_printf("                         - 本地文件FOTA（经串口发送差分包，不支持MiniFOTA包）\n");
+    log_printf("  upload FILE [key] [chunk_kb]\n");
+    log_printf("                         - 经模组HTTP(S)分片上传文件到COS（默认%s<文件名>）\n",
+               COS_DEFAULT_PREFIX);
+    log_printf("                           <串口>可为逗号分隔列表，多模组并发上传分片\n");
+    log_printf("                           未指定chunk_kb时按信号强度与实测吞吐自适应（起始%dKB）\n",
+               COS_CHUNK_SIZE / 1024);
+    log_printf("                           进度记录在<FILE>.upload，中断后重新执行即从缺失分片续传\n");
+    log_printf("                           存储桶与凭证取自环境变量COS_HOST/COS_SECRET_ID/COS_SECRET_KEY/COS_SESSION_TOKEN\n");
+    log_printf("  fetch URL OUT          - 经模组HTTP(S)下载到本地文件（流式写入，不限大小）\n");
+    log_printf("  ufs-get NAME OUT       - 读取模组UFS文件（如UFS:xxx.log）到本地，核对长度与校验和\n");
+    log_printf("  discover               - 识别各串口USB身份并并发探测AT口/IMEI，<串口>为列表或auto\n");
+    log_printf("                           结果按USB身份缓存在%s，身份不变时不再探测\n", DISCOVER_CACHE_FILE);
+    log_printf("  telemetry [SEC]        - 采样SEC秒 (默认%d) 后打印各站点信号与预计用时，SEC=0只读取已有记录\n",
+               TELEMETRY_DEFAULT_RUN_S);
+    log_printf("                           记录文件为--telemetry指定的文件，默认%s\n", TELEMETRY_DEFAULT_FILE);
+    log_printf("  replay TRACE [rounds]  - 离线回放--capture记录的接收字节，核对解析结果并测量行/秒 (默认%d轮)\n",
+               TRACE_DEFAULT_ROUNDS);
+    log_printf("                           <串口>为记录中的通道名，all回放全部通道\n");
+    log_printf("  daemon [SOCKET]        - 常驻运行，在Unix域套接字上接受JSON行请求 (默认%s)\n", DAEMON_DEFAULT_SOCKET);
+    log_printf("                           op: list/test/version/fota/fota-file/upload/shutdown，推送accepted/progress/done事件\n");
+    log_printf("  fleet URL[,URL...] [mode] [timeout] [workers]\n");
+    log_printf("                         - 批量FOTA升级，<串口>为逗号分隔列表或auto（自动发现AT口）\n");
+    log_printf("                           多个差分包时按各模组AT+QGMR选择源版本一致的包（.mini_2改用.mini_1）\n");
+    log_printf("\n示例:\n");
+#ifdef _WIN32
+    log_printf("  %s COM3 test\n", prog_name);
+    log_printf("  %s COM3 fota \"http://server/fota.bin\" 0 50\n", prog_name);
+    log_printf("  %s COM3,COM4,COM5 fleet \"http://server/fota.bin\" 1 50\n", prog_name);
+#else
+    log_printf("  %s /dev/ttyUSB0 test\n", prog_name);
+    log_printf("  %s /dev/ttyUSB0 fota \"http://server/fota.bin\" 0 50\n", prog_name);
+    log_printf("  %s auto fleet \"http://server/fota.bin\" 1 50 16\n", prog_name);
+#endif
+}
+
+// ================== 批量升级 ==================
+
+#define FLEET_DEFAULT_WORKERS 8
+#define FLEET_PROBE_TIMEOUT_MS 500
+#define FLEET_SLOW_FACTOR 2             // 下载耗时超过最快一次的该倍数时不再扩大窗口
+#define FLEET_MAX_RETRIES 2             // HTTPEND失败后重新排队的次数
+#define FLEET_SCHED_POLL_MS 100
+
+// 单线程事件循环：统一监听所有已下发升级指令模组的URC
+typedef struct {
+    EC800KModem* modems[MAX_SERIAL_PORTS];
+    int count;
+    mutex_t lock;
+    volatile bool stop;
+    thread_t thread;
+} UrcLoop;
+
+void urc_loop_add(UrcLoop* loop, EC800KModem* modem) {
+    mutex_lock(&loop->lock);
+    if (loop->count < MAX_SERIAL_PORTS) {
+        loop->modems[loop->count++] = modem;
+    }
+    mutex_unlock(&loop->lock);
+}
+
+THREAD_RETURN urc_loop_thread(void* arg) {
+    UrcLoop* loop = (UrcLoop*)arg;
+    EC800KModem* active[MAX_SERIAL_PORTS];
+    PortWatch watch;
+    bool watching = false;
+    
+    while (!loop->stop) {
+        mutex_lock(&loop->lock);
+        int count = loop->count;
+        memcpy(active, loop->modems, sizeof(active[0]) * (size_t)count);
+        mutex_unlock(&loop->lock);
+        
+        if (count <= 0) {
+            sleep_ms(MONITOR_POLL_MS);
+            continue;
+        }
+        if (!watching) {
+            // 批量模式的端口通常位于同一目录（/dev），监视第一个即可
+            port_watch_open(&watch, active[0]->port_path);
+            watching = true;
+        }
+        
+        // 断开的模组到达退避时间后重试打开
+        int timeout = MONITOR_POLL_MS;
+        for (int i = 0; i < count; i++) {
+            if (!modem_link_check(active[i])) {
+                int wait = modem_reconnect_wait_ms(active[i]);
+                if (wait < timeout) timeout = wait;
+            }
+        }
+        
+#ifdef _WIN32
+        // Windows串口句柄无法统一poll，依次短时读取
+        for (int i = 0; i < count; i++) {
+            if (!active[i]->link_down && modem_monitor_service(active[i], 5) < 0) {
+                modem_link_lost(active[i]);
+            }
+        }
+#else
+        // 新加入的模组在下一轮poll时生效，期间数据由内核缓存
+        struct pollfd pfds[MAX_SERIAL_PORTS + 1];
+        for (int i = 0; i < count; i++) {
+            pfds[i].fd = active[i]->link_down ? -1 : active[i]->handle;   // 负值fd被poll忽略
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+        pfds[count].fd = watch.fd;
+        pfds[count].events = POLLIN;
+        pfds[count].revents = 0;
+        
+        int ret = poll(pfds, (nfds_t)count + 1, timeout);
+        if (ret <= 0) continue;
+        
+        if (pfds[count].revents & POLLIN && port_watch_drain(&watch)) {
+            for (int i = 0; i < count; i++) {
+                active[i]->reconnect_at_ms = 0;     // 设备节点有变化，断开的模组立即重试
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (pfds[i].revents & POLLIN) {
+                if (modem_monitor_service(active[i], 0) < 0) modem_link_lost(active[i]);
+            } else if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                modem_link_lost(active[i]);
+            }
+        }
+#endif
+    }
+    if (watching) port_watch_close(&watch);
+    return THREAD_RESULT;
+}
+
+typedef enum {
+    FLEET_PENDING,
+    FLEET_QUEUED,       // 已就绪，等待下载名额
+    FLEET_SKIPPED,      // 非AT口、同一模组的其他端口或已是目标版本
+    FLEET_FAILED,       // 准备失败或升级指令未能下发
+    FLEET_UPGRADING,
+    FLEET_FINISHED,     // 收到END或下载失败
+    FLEET_TIMEOUT
+} FleetJobState;
+
+typedef struct {
+    EC800KModem modem;
+    FleetJobState state;
+    char imei[32];
+    char note[64];      // 跳过/失败原因
+    uint64_t start_ms;
+    const FotaPackage* package;
+    int retries;        // HTTPEND失败后重新排队的次数
+    bool downloading;   // 占用一个下载名额（已下发，尚未HTTPEND）
+    uint64_t sent_ms;   // 最近一次下发AT+QFOTADL的时间
+} FleetJob;
+
+typedef struct {
+    FleetJob* jobs;
+    int count;
+    int next;           // 下一个待领取的任务
+    mutex_t lock;
+    const FotaPackageSet* packages;
+    int auto_reset;
+    int timeout;
+    bool probe;         // 自动发现的端口需先探测AT响应
+    UrcLoop loop;
+    
+    // 分阶段下发：就绪的模组按优先级排队，同时下载数按AIMD调整
+    int* queue;         // 二叉堆（fleet->lock保护）
+    int queued;
+    int prepared;       // 已结束准备阶段的任务数（fleet->lock保护）
+    int* active;        // 已下发、尚未结束的任务（仅调度循环访问）
+    int active_count;
+    int downloading;
+    int window;
+    int max_downloads;  // 0表示不限
+    int peak;
+    int http_errors;
+    uint64_t baseline_ms;   // 最快的一次成功下载耗时
+    uint64_t backoff_ms;    // 上次收缩窗口的时间
+} Fleet;
+
+// 优先级：重试少的在前，其次信号强的在前（下载快、占用小区时间短），最后按端口顺序
+bool fleet_job_before(const Fleet* fleet, int a, int b) {
+    const FleetJob* x = &fleet->jobs[a];
+    const FleetJob* y = &fleet->jobs[b];
+    if (x->retries != y->retries) return x->retries < y->retries;
+    int rx = x->modem.rssi == 99 ? -1 : x->modem.rssi;
+    int ry = y->modem.rssi == 99 ? -1 : y->modem.rssi;
+    if (rx != ry) return rx > ry;
+    return a < b;
+}
+
+// 入队（需持有fleet->lock）
+void fleet_queue_push_locked(Fleet* fleet, int index) {
+    int i = fleet->queued++;
+    fleet->queue[i] = index;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!fleet_job_before(fleet, fleet->queue[i], fleet->queue[parent])) break;
+        fleet->queue[i] = fleet->queue[parent];
+        fleet->queue[parent] = index;
+        i = parent;
+    }
+}
+
+// 取出优先级最高的任务，队列为空返回-1（需持有fleet->lock）
+int fleet_queue_pop_locked(Fleet* fleet) {
+    if (fleet->queued == 0) return -1;
+    int top = fleet->queue[0];
+    int index = fleet->queue[--fleet->queued];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= fleet->queued) break;
+        if (child + 1 < fleet->queued && fleet_job_before(fleet, fleet->queue[child + 1], fleet->queue[child])) {
+            child++;
+        }
+        if (!fleet_job_before(fleet, fleet->queue[child], index)) break;
+        fleet->queue[i] = fleet->queue[child];
+        i = child;
+    }
+    fleet->queue[i] = index;
+    return top;
+}
+
+// 领取IMEI，已被其他端口占用时返回false（同一模组的多个USB口）
+bool fleet_claim_imei(Fleet* fleet, FleetJob* job, const char* imei, char* owner, size_t owner_size) {
+    bool claimed = true;
+    mutex_lock(&fleet->lock);
+    for (int i = 0; i < fleet->count; i++) {
+        FleetJob* other = &fleet->jobs[i];
+        if (other != job && strcmp(other->imei, imei) == 0) {
+            snprintf(owner, owner_size, "%s", other->modem.port_path);
+            claimed = false;
+            break;
+        }
+    }
+    if (claimed) {
+        snprintf(job->imei, sizeof(job->imei), "%s", imei);
+    }
+    mutex_unlock(&fleet->lock);
+    return claimed;
+}
+
+// 准备阶段：打开串口、识别模组、选择差分包并等待网络就绪，随后排队等待下载名额
+void fleet_run_job(Fleet* fleet, FleetJob* job) {
+    EC800KModem* modem = &job->modem;
+    AtResponse resp;
+    
+    job->start_ms = monotonic_ms();
+    if (!modem_connect(modem)) {
+        job->state = FLEET_FAILED;
+        snprintf(job->note, sizeof(job->note), "串口打开失败");
+        return;
+    }
+    
+    if (fleet->probe && !modem_at_transact(modem, "AT", &resp, FLEET_PROBE_TIMEOUT_MS)) {
+        job->state = FLEET_SKIPPED;
+        snprintf(job->note, sizeof(job->note), "无AT响应");
+        modem_disconnect(modem);
+        return;
+    }
+    
+    // 版本/IMEI一次取得（缓存命中时只需AT+QGMR），随后的升级步骤1不再重复查询
+    if (modem_load_static_info(modem)) {
+        char owner[64];
+        if (!fleet_claim_imei(fleet, job, modem->imei, owner, sizeof(owner))) {
+            job->state = FLEET_SKIPPED;
+            snprintf(job->note, sizeof(job->note), "同一模组: %.40s", owner);
+            modem_disconnect(modem);
+            return;
+        }
+    }
+    
+    // 按当前版本选择差分包，方向不对的模组不再下载后才报507
+    bool at_target;
+    const FotaPackage* pkg = fota_package_select(fleet->packages, modem->fw_version, &at_target);
+    if (pkg == NULL && at_target) {
+        job->state = FLEET_SKIPPED;
+        snprintf(job->note, sizeof(job->note), "已是目标版本");
+        modem_disconnect(modem);
+        return;
+    }
+    if (pkg == NULL && modem->fota_force) {
+        pkg = &fleet->packages->items[0];
+    }
+    if (pkg == NULL) {
+        job->state = FLEET_FAILED;
+        snprintf(job->note, sizeof(job->note), "无匹配的差分包");
+        modem_log(modem, "❌ 没有源版本为%s的差分包", modem->fw_version[0] ? modem->fw_version : "(未知)");
+        modem_disconnect(modem);
+        return;
+    }
+    
+    if (!modem_fota_prepare(modem, pkg->url)) {
+        job->state = FLEET_FAILED;
+        snprintf(job->note, sizeof(job->note), "升级准备失败");
+        modem_disconnect(modem);
+        return;
+    }
+    
+    job->package = pkg;
+    mutex_lock(&fleet->lock);
+    job->state = FLEET_QUEUED;
+    fleet_queue_push_locked(fleet, (int)(job - fleet->jobs));
+    mutex_unlock(&fleet->lock);
+}
+
+THREAD_RETURN fleet_worker(void* arg) {
+    Fleet* fleet = (Fleet*)arg;
+    
+    for (;;) {
+        mutex_lock(&fleet->lock);
+        int index = fleet->next < fleet->count ? fleet->next++ : -1;
+        mutex_unlock(&fleet->lock);
+        if (index < 0) break;
+        
+        fleet_run_job(fleet, &fleet->jobs[index]);
+        mutex_lock(&fleet->lock);
+        fleet->prepared++;
+        mutex_unlock(&fleet->lock);
+    }
+    return THREAD_RESULT;
+}
+
+// AIMD：下载成功且耗时不超过最快一次的FLEET_SLOW_FACTOR倍时窗口+1；
+// HTTPEND出错时窗口减半，收缩前已开始的下载再出错不重复收缩
+void fleet_download_done(Fleet* fleet, const FleetJob* job, bool ok, uint64_t elapsed_ms) {
+    int window = fleet->window;
+    
+    if (fleet->max_downloads <= 0) return;
+    if (ok) {
+        if (fleet->baseline_ms == 0 || elapsed_ms < fleet->baseline_ms) fleet->baseline_ms = elapsed_ms;
+        if (elapsed_ms <= fleet->baseline_ms * FLEET_SLOW_FACTOR && fleet->window < fleet->max_downloads) {
+            fleet->window++;
+        }
+    } else {
+        fleet->http_errors++;
+        if (job->sent_ms >= fleet->backoff_ms && fleet->window > 1) {
+            fleet->window /= 2;
+            fleet->backoff_ms = monotonic_ms();
+        }
+    }
+    
+    if (fleet->window > fleet->peak) fleet->peak = fleet->window;
+    if (fleet->window > window) {
+        log_msg("📈 下载顺利(%.1f秒)，并发下载数 %d → %d", (double)elapsed_ms / 1000.0, window, fleet->window);
+    } else if (fleet->window < window) {
+        log_msg("📉 下载出错，并发下载数 %d → %d", window, fleet->window);
+    }
+}
+
+// 窗口有空余时按优先级下发AT+QFOTADL
+void fleet_dispatch(Fleet* fleet) {
+    while (fleet->downloading < fleet->window) {
+        mutex_lock(&fleet->lock);
+        int index = fleet_queue_pop_locked(fleet);
+        mutex_unlock(&fleet->lock);
+        if (index < 0) return;
+        
+        FleetJob* job = &fleet->jobs[index];
+        EC800KModem* modem = &job->modem;
+        modem_log(modem, "🚦 获得下载名额 (%d/%d)", fleet->downloading + 1, fleet->window);
+        if (!modem_fota_send(modem, job->package->url, fleet->auto_reset, fleet->timeout)) {
+            job->state = FLEET_FAILED;
+            snprintf(job->note, sizeof(job->note), "升级指令下发失败");
+            continue;
+        }
+        
+        int len = job->package->parsed ? snprintf(job->note, sizeof(job->note), "→ %.40s", job->package->info.to) : 0;
+        if (job->retries > 0) {
+            snprintf(job->note + len, sizeof(job->note) - (size_t)len, "%s重试%d次", len > 0 ? " " : "", job->retries);
+        }
+        if (job->retries == 0) urc_loop_add(&fleet->loop, modem);
+        job->state = FLEET_UPGRADING;
+        job->downloading = true;
+        job->sent_ms = monotonic_ms();
+        fleet->downloading++;
+        fleet->active[fleet->active_count++] = index;
+    }
+}
+
+// 调度循环（主线程）：回收下载名额、调整窗口、HTTPEND失败的模组重新排队，直到全部任务结束
+void fleet_schedule(Fleet* fleet) {
+    for (;;) {
+        uint64_t now = monotonic_ms();
+        int kept = 0;
+        
+        for (int i = 0; i < fleet->active_count; i++) {
+            int index = fleet->active[i];
+            FleetJob* job = &fleet->jobs[index];
+            EC800KModem* modem = &job->modem;
+            
+            mutex_lock(&modem->state_lock);
+            int download = modem->download_result;
+            uint64_t download_end = modem->download_end_ms;
+            bool complete = modem->fota_complete;
+            mutex_unlock(&modem->state_lock);
+            
+            if (job->downloading && (download >= 0 || complete || now - job->sent_ms > FOTA_COMPLETE_TIMEOUT_MS)) {
+                job->downloading = false;
+                fleet->downloading--;
+                if (download >= 0) fleet_download_done(fleet, job, download == 0, download_end - job->sent_ms);
+                if (download > 0 && job->retries < FLEET_MAX_RETRIES) {
+                    job->retries++;
+                    job->state = FLEET_QUEUED;
+                    modem_log(modem, "🔁 下载失败(%d)，重新排队 (第%d次重试)", download, job->retries);
+                    mutex_lock(&fleet->lock);
+                    fleet_queue_push_locked(fleet, index);
+                    mutex_unlock(&fleet->lock);
+                    continue;
+                }
+            }
+            if (complete) {
+                job->state = FLEET_FINISHED;
+            } else if (now - job->sent_ms > FOTA_COMPLETE_TIMEOUT_MS) {
+                job->state = FLEET_TIMEOUT;
+            } else {
+                fleet->active[kept++] = index;
+            }
+        }
+        fleet->active_count = kept;
+        
+        fleet_dispatch(fleet);
+        
+        mutex_lock(&fleet->lock);
+        bool idle = fleet->prepared == fleet->count && fleet->queued == 0;
+        mutex_unlock(&fleet->lock);
+        if (idle && fleet->active_count == 0) break;
+        sleep_ms(FLEET_SCHED_POLL_MS);
+    }
+}
+
+void fleet_print_report(const Fleet* fleet) {
+    int ok = 0, failed = 0, skipped = 0;
+    
+    log_printf("\n==================================================\n");
+    log_printf("📊 批量升级结果\n");
+    log_printf("==================================================\n");
+    log_printf("%-16s %-16s %-24s %-14s %8s\n", "端口", "IMEI", "原版本", "结果", "耗时(s)");
+    
+    for (int i = 0; i < fleet->count; i++) {
+        const FleetJob* job = &fleet->jobs[i];
+        const EC800KModem* modem = &job->modem;
+        char result[64];
+        double seconds = 0;
+        
+        switch (job->state) {
+            case FLEET_FINISHED:
+                if (modem->fota_result == 0) {
+                    snprintf(result, sizeof(result), "成功");
+                    ok++;
+                } else {
+                    snprintf(result, sizeof(result), "失败(%d)", modem->fota_result);
+                    failed++;
+                }
+                seconds = (double)(modem->fota_end_ms - job->start_ms) / 1000.0;
+                break;
+            case FLEET_TIMEOUT:
+                snprintf(result, sizeof(result), "超时");
+                failed++;
+                break;
+            case FLEET_SKIPPED:
+                snprintf(result, sizeof(result), "跳过");
+                skipped++;
+                break;
+            default:
+                snprintf(result, sizeof(result), "失败");
+                failed++;
+                break;
+        }
+        
+        log_printf("%-16s %-16s %-24s %-14s %8.1f %s\n", modem->port_path,
+               job->imei[0] ? job->imei : "-",
+               modem->fw_version[0] ? modem->fw_version : "-",
+               result, seconds, job->note);
+    }
+    
+    log_printf("\n成功: %d  失败: %d  跳过: %d\n", ok, failed, skipped);
+}
+
+// 批量升级：ports为逗号分隔的串口列表或"auto"
+// 返回未成功升级的模组数量
+int run_fleet(const char* ports_arg, const FotaPackageSet* packages, int auto_reset, int timeout, int workers,
+              const ToolOptions* opts) {
+    static char ports[MAX_SERIAL_PORTS][64];
+    int count;
+    Fleet fleet;
+    
+    fleet.probe = strcmp(ports_arg, "auto") == 0;
+    count = parse_port_list(ports_arg, ports, MAX_SERIAL_PORTS);
+    
+    if (count == 0) {
+        log_msg("❌ 没有可用的串口");
+        return 1;
+    }
+    
+    fleet.jobs = (FleetJob*)calloc((size_t)count, sizeof(FleetJob));
+    fleet.queue = (int*)calloc((size_t)count, sizeof(int));
+    fleet.active = (int*)calloc((size_t)count, sizeof(int));
+    if (fleet.jobs == NULL || fleet.queue == NULL || fleet.active == NULL) {
+        log_msg("❌ 内存不足");
+        free(fleet.jobs);
+        free(fleet.queue);
+        free(fleet.active);
+        return 1;
+    }
+    fleet.count = count;
+    fleet.next = 0;
+    fleet.packages = packages;
+    fleet.auto_reset = auto_reset;
+    fleet.timeout = timeout;
+    fleet.queued = 0;
+    fleet.prepared = 0;
+    fleet.active_count = 0;
+    fleet.downloading = 0;
+    fleet.max_downloads = opts->max_downloads;
+    fleet.window = opts->max_downloads > 0 ? FLEET_INITIAL_WINDOW : count;
+    if (opts->max_downloads > 0 && fleet.window > opts->max_downloads) fleet.window = opts->max_downloads;
+    fleet.peak = fleet.window;
+    fleet.http_errors = 0;
+    fleet.baseline_ms = 0;
+    fleet.backoff_ms = 0;
+    mutex_init(&fleet.lock);
+    fleet.loop.count = 0;
+    fleet.loop.stop = false;
+    mutex_init(&fleet.loop.lock);
+    
+    for (int i = 0; i < count; i++) {
+        modem_init(&fleet.jobs[i].modem, ports[i], opts->baud_rate);
+        modem_apply_options(&fleet.jobs[i].modem, opts);
+        fleet.jobs[i].modem.log_tag = true;
+        fleet.jobs[i].state = FLEET_PENDING;
+    }
+    
+    if (workers < 1) workers = 1;
+    if (workers > count) workers = count;
+    
+    log_printf("\n==================================================\n");
+    log_msg("🚀 批量FOTA升级: %d个串口, %d个并发准备线程", count, workers);
+    if (fleet.max_downloads > 0) {
+        log_msg("🚦 同时下载: 起始%d, 上限%d", fleet.window, fleet.max_downloads);
+    }
+    log_printf("==================================================\n");
+    
+    thread_t* threads = (thread_t*)calloc((size_t)workers, sizeof(thread_t));
+    if (threads == NULL || !thread_create(&fleet.loop.thread, urc_loop_thread, &fleet.loop)) {
+        log_msg("❌ 线程启动失败");
+        free(threads);
+        free(fleet.jobs);
+        free(fleet.queue);
+        free(fleet.active);
+        return 1;
+    }
+    
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        if (thread_create(&threads[started], fleet_worker, &fleet)) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // 无法创建工作线程时在当前线程内依次准备
+        fleet_worker(&fleet);
+    }
+    
+    // 准备线程运行期间即开始按窗口下发，直到全部模组升级结束
+    fleet_schedule(&fleet);
+    for (int i = 0; i < started; i++) {
+        thread_join(threads[i]);
+    }
+    free(threads);
+    
+    fleet.loop.stop = true;
+    thread_join(fleet.loop.thread);
+    
+    fleet_print_report(&fleet);
+    if (fleet.max_downloads > 0) {
+        log_printf("同时下载: 峰值%d, 结束时%d, 下载出错%d次\n", fleet.peak, fleet.window, fleet.http_errors);
+    }
+    
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        FleetJob* job = &fleet.jobs[i];
+        if (job->state != FLEET_SKIPPED &&
+            !(job->state == FLEET_FINISHED && job->modem.fota_result == 0)) {
+            failures++;
+        }
+        modem_state_cache_flush(&job->modem);
+        modem_disconnect(&job->modem);
+        modem_destroy(&job->modem);
+    }
+    
+    mutex_destroy(&fleet.loop.lock);
+    mutex_destroy(&fleet.lock);
+    free(fleet.jobs);
+    free(fleet.queue);
+    free(fleet.active);
+    return failures;
+}
+
+// ================== 模组HTTP(S) ==================
+
+// 基于AT+QHTTP*的HTTP客户端：requestheader=1时请求行与头部由本工具组装，
+// 随数据一起写入；responseheader=1时AT+QHTTPREAD返回完整响应头（用于读取ETag）
+
+#define HTTP_URL_INPUT_S 80         // AT+QHTTPURL输入URL的最长时间
+#define HTTP_RSP_TIMEOUT_S 60       // 等待服务器响应
+#define HTTP_READ_WAIT_S 80         // AT+QHTTPREAD等待数据
+#define HTTP_READ_MAX 8192          // AT+QHTTPREAD缓存的响应上限
+#define TLS_CA_MAX (64 * 1024)
+#define TLS_CA_UPLOAD_S 30          // AT+QFUPL输入证书的最长时间
+
+bool modem_at_send_data_locked(EC800KModem* modem, const char* cmd, const void* head, size_t head_len,
+                               const void* body, size_t body_len, int timeout_ms);
+
+// 上传CA证书到UFS（覆盖上一次的文件），SSL上下文1改为校验服务器证书（seclevel 1）
+bool modem_tls_load_ca(EC800KModem* modem) {
+    PackageMap ca;
+    AtResponse resp;
+    
+    if (!package_map_open(modem->ca_cert, &ca) || ca.size > TLS_CA_MAX) {
+        modem_log(modem, "❌ 无法读取CA证书（不超过%dKB）: %s", TLS_CA_MAX / 1024, modem->ca_cert);
+        package_map_close(&ca);
+        return false;
+    }
+    modem_at_transact(modem, "AT+QFDEL=\"" TLS_CA_FILE "\"", &resp, AT_TIMEOUT_POLICY);   // 文件不存在时报错，忽略
+    
+    EC800KModem* bulk = modem_bulk(modem);
+    mutex_lock(&bulk->io_lock);
+    bool ok = modem_at_format_locked(bulk, "AT+QFUPL=\"%s\",%zu,%d", TLS_CA_FILE, ca.size, TLS_CA_UPLOAD_S) > 0 &&
+              modem_at_send_data_locked(bulk, bulk->arena.tx, NULL, 0, ca.data, ca.size,
+                                        (TLS_CA_UPLOAD_S + 5) * 1000);
+    mutex_unlock(&bulk->io_lock);
+    package_map_close(&ca);
+    if (!ok) {
+        modem_log(modem, "❌ CA证书上传失败: %s", modem->ca_cert);
+        return false;
+    }
+    return modem_at_transact(modem, "AT+QSSLCFG=\"cacert\",1,\"" TLS_CA_FILE "\"", &resp, AT_TIMEOUT_POLICY) &&
+           modem_at_transact(modem, "AT+QSSLCFG=\"seclevel\",1,1", &resp, AT_TIMEOUT_POLICY);
+}
+
+// 配置HTTP(S)上下文：PDP上下文1、自定义请求头、返回响应头；https额外配置SSL上下文1
+// HTTPS默认用--cacert校验服务器证书，只有显式--insecure才关闭校验（请求头带有COS签名与临时凭证）
+bool modem_http_setup(EC800KModem* modem, bool https) {
+    static const char* common[] = {
+        "AT+QHTTPCFG=\"contextid\",1",
+        "AT+QHTTPCFG=\"requestheader\",1",
+        "AT+QHTTPCFG=\"responseheader\",1",
+    };
+    static const char* ssl[] = {
+        "AT+QHTTPCFG=\"sslctxid\",1",
+        "AT+QSSLCFG=\"sslversion\",1,4",
+        "AT+QSSLCFG=\"ciphersuite\",1,0xFFFF",
+    };
+    AtResponse resp;
+    
+    if (https && modem->ca_cert == NULL && !modem->tls_insecure) {
+        modem_log(modem, "❌ HTTPS需要--cacert指定CA证书，或用--insecure显式跳过证书校验");
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(common) / sizeof(common[0]); i++) {
+        if (!modem_at_transact(modem, common[i], &resp, AT_TIMEOUT_POLICY)) return false;
+    }
+    if (!https) return true;
+    for (size_t i = 0; i < sizeof(ssl) / sizeof(ssl[0]); i++) {
+        if (!modem_at_transact(modem, ssl[i], &resp, AT_TIMEOUT_POLICY)) return false;
+    }
+    if (modem->tls_insecure) {
+        modem_log(modem, "⚠️ --insecure: 不校验服务器证书");
+        return modem_at_transact(modem, "AT+QSSLCFG=\"seclevel\",1,0", &resp, AT_TIMEOUT_POLICY);
+    }
+    return modem_tls_load_ca(modem);
+}
+
+// 数据模式命令：收到CONNECT后依次写入head与body，再等待OK（需持有io_lock）
+bool modem_at_send_data_locked(EC800KModem* modem, const char* cmd, const void* head, size_t head_len,
+                               const void* body, size_t body_len, int timeout_ms) {
+    AtResponse resp;
+    at_response_init(&resp, cmd);
+    resp.allow_connect = true;
+    
+    modem_at_exchange_locked(modem, cmd, &resp, timeout_ms);
+    if (resp.result != AT_RESULT_CONNECT) {
+        modem_log(modem, "❌ %s 未进入数据模式 (%s %d)", cmd, at_result_name(resp.result), resp.error_code);
+        return false;
+    }
+    
+    const unsigned char* p = (const unsigned char*)body;
+    bool ok = head_len == 0 || serial_write_timeout(modem, head, head_len, FILE_STALL_TIMEOUT_MS);
+    for (size_t sent = 0; ok && sent < body_len; ) {
+        size_t n = body_len - sent < FILE_CHUNK_FLOW ? body_len - sent : FILE_CHUNK_FLOW;
+        ok = serial_write_timeout(modem, p + sent, n, FILE_STALL_TIMEOUT_MS);
+        sent += n;
+    }
+    if (!ok) {
+        modem_log(modem, "❌ 数据写入串口失败");
+        return false;
+    }
+    
+    at_response_init(&resp, NULL);
+    modem_at_wait_locked(modem, &resp, timeout_ms, monotonic_us(), NULL);
+    if (resp.result != AT_RESULT_OK) {
+        modem_log(modem, "❌ %s 数据发送失败 (%s %d)", cmd, at_result_name(resp.result), resp.error_code);
+        return false;
+    }
+    return true;
+}
+
+// 清除上一条+QHTTP结果URC
+void modem_http_urc_clear(EC800KModem* modem) {
+    EC800KModem* owner = modem_owner(modem);
+    mutex_lock(&owner->state_lock);
+    owner->http_urc[0] = '\0';
+    mutex_unlock(&owner->state_lock);
+}
+
+bool modem_http_urc_is(EC800KModem* modem, const char* prefix) {
+    EC800KModem* owner = modem_owner(modem);
+    mutex_lock(&owner->state_lock);
+    bool match = strncmp(owner->http_urc, prefix, strlen(prefix)) == 0;
+    mutex_unlock(&owner->state_lock);
+    return match;
+}
+
+// 持锁读取并分发URC，直到收到以prefix开头的+QHTTP结果URC（需持有io_lock）
+// CMUX数据通道上结果URC也可能由复用线程从DLC2分发，读取分段以便及时发现
+bool modem_wait_http_urc_locked(EC800KModem* modem, const char* prefix, int timeout_ms) {
+    uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+    
+    while (!modem_http_urc_is(modem, prefix)) {
+        int wait = remaining_ms(deadline);
+        if (wait <= 0) return false;
+        if (modem->owner != NULL && wait > CMUX_URC_POLL_MS) wait = CMUX_URC_POLL_MS;
+        char buf[256];
+        int got = serial_read(modem, buf, sizeof(buf), wait);
+        if (got < 0) return false;
+        modem_feed_urc_bytes(modem, buf, (size_t)got);
+    }
+    return true;
+}
+
+bool modem_http_set_url(EC800KModem* modem, const char* url) {
+    modem = modem_bulk(modem);      // CMUX时HTTP收发走DLC3
+    mutex_lock(&modem->io_lock);
+    bool ok = modem_at_format_locked(modem, "AT+QHTTPURL=%zu,%d", strlen(url), HTTP_URL_INPUT_S) > 0 &&
+              modem_at_send_data_locked(modem, modem->arena.tx, url, strlen(url), NULL, 0,
+                                        (HTTP_URL_INPUT_S + 5) * 1000);
+    mutex_unlock(&modem->io_lock);
+    return ok;
+}
+
+// 发送请求（method为"GET"、"POST"或"PUT"），返回HTTP状态码，失败返回-1
+// 结果URC: +QHTTPPOST: <err>[,<httprspcode>[,<content_length>]]
+int modem_http_request(EC800KModem* modem, const char* method, const char* head, const void* body,
+                       size_t body_len) {
+    char prefix[24];
+    size_t head_len = strlen(head);
+    size_t total = head_len + body_len;
+    // 输入时间按波特率估算并留足余量
+    int input_s = (int)(total * 10 / (size_t)modem->baud_rate) * 2 + 10;
+    int err = -1;
+    int status = -1;
+    
+    snprintf(prefix, sizeof(prefix), "+QHTTP%s:", method);
+    
+    modem = modem_bulk(modem);
+    mutex_lock(&modem->io_lock);
+    modem_http_urc_clear(modem);
+    size_t cmd_len = strcmp(method, "GET") == 0
+                     ? modem_at_format_locked(modem, "AT+QHTTPGET=%d,%zu,%d", HTTP_RSP_TIMEOUT_S, total, input_s)
+                     : modem_at_format_locked(modem, "AT+QHTTP%s=%zu,%d,%d", method, total, input_s,
+                                              HTTP_RSP_TIMEOUT_S);
+    bool ok = cmd_len > 0 &&
+              modem_at_send_data_locked(modem, modem->arena.tx, head, head_len, body, body_len,
+                                        (input_s + 5) * 1000) &&
+              modem_wait_http_urc_locked(modem, prefix, (HTTP_RSP_TIMEOUT_S + 5) * 1000);
+    if (ok && at_parse_http(modem_owner(modem)->http_urc + strlen(prefix), &err, &status) && err != 0) {
+        modem_log(modem, "❌ %s 失败，错误码: %d", prefix, err);
+        status = -1;
+    }
+    mutex_unlock(&modem->io_lock);
+    return ok ? status : -1;
+}
+
+// 流式读取响应：CONNECT\r\n<数据>\r\nOK\r\n\r\n+QHTTPREAD: <err>\r\n，数据逐块交给sink
+bool modem_http_read_stream(EC800KModem* modem, AtDataSink sink, void* ctx, uint64_t* total) {
+    AtResponse resp;
+    AtDataStream ds;
+    bool ok = false;
+    
+    at_data_stream_init(&ds, sink, ctx);
+    modem = modem_bulk(modem);
+    mutex_lock(&modem->io_lock);
+    modem_http_urc_clear(modem);
+    modem_at_format_locked(modem, "AT+QHTTPREAD=%d", HTTP_READ_WAIT_S);
+    at_response_init(&resp, modem->arena.tx);
+    resp.allow_connect = true;
+    modem_at_exchange_locked(modem, modem->arena.tx, &resp, (HTTP_READ_WAIT_S + 5) * 1000);
+    if (resp.result == AT_RESULT_CONNECT) {
+        // 标记带上URC前缀，避免响应体中的"\r\nOK\r\n"被误判为结束
+        ok = modem_at_read_until_locked(modem, &resp, "\r\nOK\r\n\r\n+QHTTPREAD:", &ds) &&
+             modem_wait_http_urc_locked(modem, "+QHTTPREAD:", AT_DATA_STALL_MS) &&
+             modem_http_urc_is(modem, "+QHTTPREAD: 0");
+    }
+    mutex_unlock(&modem->io_lock);
+    
+    if (!ok) modem_log(modem, "❌ 读取HTTP响应失败 (%s)", at_result_name(resp.result));
+    if (total != NULL) *total = ds.total;
+    return ok && ds.sink_ok;
+}
+
+// 读取完整响应到buf（'\0'结尾），超出容量视为失败
+bool modem_http_read(EC800KModem* modem, char* buf, size_t size, size_t* len) {
+    AtBufferSink sink = { buf, size, 0 };
+    uint64_t total = 0;
+    
+    buf[0] = '\0';
+    bool ok = modem_http_read_stream(modem, at_sink_buffer, &sink, &total);
+    if (total > sink.len) {
+        modem_log(modem, "❌ HTTP响应%llu字节超过缓冲%zu字节", (unsigned long long)total, size - 1);
+    }
+    *len = sink.len;
+    return ok;
+}
+
+// 响应状态行中的状态码
+int http_status_code(const char* response) {
+    int status = 0;
+    sscanf(response, "HTTP/%*s %d", &status);
+    return status;
+}
+
+// 响应头在内存中解析，响应体直接写入文件
+typedef struct {
+    char head[HTTP_HEADER_MAX];
+    size_t head_len;
+    bool in_body;
+    int status;
+    FILE* out;
+    Md5Context md5;
+} HttpBodySink;
+
+bool http_body_sink(void* ctx, const void* data, size_t len) {
+    HttpBodySink* hs = (HttpBodySink*)ctx;
+    const char* p = (const char*)data;
+    
+    if (!hs->in_body) {
+        size_t n = len < sizeof(hs->head) - 1 - hs->head_len ? len : sizeof(hs->head) - 1 - hs->head_len;
+        memcpy(hs->head + hs->head_len, p, n);
+        hs->head[hs->head_len + n] = '\0';
+        char* end = strstr(hs->head, "\r\n\r\n");
+        if (end == NULL) {
+            hs->head_len += n;
+            return hs->head_len < sizeof(hs->head) - 1;
+        }
+        size_t used = (size_t)(end + 4 - hs->head) - hs->head_len;
+        hs->head_len = (size_t)(end + 4 - hs->head);
+        hs->status = http_status_code(hs->head);
+        hs->in_body = true;
+        if (hs->status != 200) return false;
+        p += used;
+        len -= used;
+    }
+    md5_update(&hs->md5, p, len);
+    return fwrite(p, 1, len, hs->out) == len;
+}
+
+// 经模组HTTP(S) GET下载到文件，响应体不受缓冲大小限制
+bool modem_http_fetch(EC800KModem* modem, const char* url, const char* out_path) {
+    char head[1536];
+    const char* host = strstr(url, "://");
+    host = host != NULL ? host + 3 : url;
+    size_t host_len = strcspn(host, "/");
+    const char* path = host[host_len] != '\0' ? host + host_len : "/";
+    
+    int head_len = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: %.*s\r\nConnection: close\r\n\r\n",
+                            path, (int)host_len, host);
+    if (head_len < 0 || (size_t)head_len >= sizeof(head)) {
+        modem_log(modem, "❌ URL过长");
+        return false;
+    }
+    if (!modem_test_at(modem) || !modem_http_setup(modem, strncmp(url, "https://", 8) == 0) ||
+        !modem_http_set_url(modem, url)) {
+        return false;
+    }
+    
+    uint64_t start = monotonic_ms();
+    int status = modem_http_request(modem, "GET", head, NULL, 0);
+    if (status != 200) {
+        modem_log(modem, "❌ 下载失败 (HTTP %d)", status);
+        return false;
+    }
+    
+    HttpBodySink* hs = (HttpBodySink*)calloc(1, sizeof(HttpBodySink));
+    if (hs == NULL) {
+        modem_log(modem, "❌ 内存不足");
+        return false;
+    }
+    FILE* out = fopen(out_path, "wb");
+    if (out == NULL) {
+        modem_log(modem, "❌ 无法创建文件: %s", out_path);
+        free(hs);
+        return false;
+    }
+    hs->out = out;
+    md5_init(&hs->md5);
+    uint64_t total = 0;
+    bool ok = modem_http_read_stream(modem, http_body_sink, hs, &total);
+    ok = fclose(out) == 0 && ok;
+    
+    if (ok) {
+        char md5[33];
+        uint64_t body = total - hs->head_len;
+        double seconds = (double)(monotonic_ms() - start) / 1000.0;
+        md5_final_hex(&hs->md5, md5);
+        stats_record_phase(modem_name(modem), "http_fetch", (monotonic_ms() - start) * 1000);
+        modem_log(modem, "✅ 已下载 %llu 字节 (%.1fKB/s), MD5: %s", (unsigned long long)body,
+                  seconds > 0 ? (double)body / 1024.0 / seconds : 0.0, md5);
+    } else if (hs->in_body && hs->status != 200) {
+        modem_log(modem, "❌ 服务器返回HTTP %d", hs->status);
+    }
+    free(hs);
+    return ok;
+}
+
+// ================== 模组文件系统 ==================
+
+// AT+QFDWL输出: CONNECT\r\n<数据>\r\n+QFDWL: <长度>,<校验和>\r\n\r\nOK
+// 长度预先由AT+QFLST查询，校验和为数据按16位大端字逐个异或（奇数长度末字节作高8位）
+
+typedef struct {
+    FILE* out;
+    uint16_t checksum;
+    bool odd;
+} UfsFileSink;
+
+bool ufs_file_sink(void* ctx, const void* data, size_t len) {
+    UfsFileSink* fs = (UfsFileSink*)ctx;
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        fs->checksum ^= fs->odd ? p[i] : (uint16_t)(p[i] << 8);
+        fs->odd = !fs->odd;
+    }
+    return fwrite(data, 1, len, fs->out) == len;
+}
+
+// 查询UFS文件大小，不存在返回-1
+long long modem_ufs_size(EC800KModem* modem, const char* name) {
+    AtResponse resp;
+    if (!modem_at_transactf(modem, &resp, AT_TIMEOUT_POLICY, "AT+QFLST=\"%s\"", name)) return -1;
+    
+    // +QFLST: "UFS:<name>",<size>
+    const AtLine* line = at_response_find_kind(&resp, AT_LINE_QFLST);
+    char text[AT_LINE_MAX];
+    if (line == NULL) return -1;
+    at_line_copy(line, text, sizeof(text));
+    const char* comma = strrchr(text, ',');
+    return comma != NULL ? atoll(comma + 1) : -1;
+}
+
+// 从模组UFS读取文件（如模组日志）到本地，边收边写并核对长度与校验和
+bool modem_ufs_download(EC800KModem* modem, const char* name, const char* out_path) {
+    AtResponse resp;
+    AtDataStream ds;
+    UfsFileSink fs = { NULL, 0, false };
+    
+    long long size = modem_ufs_size(modem, name);
+    if (size < 0) {
+        modem_log(modem, "❌ 模组上不存在文件: %s", name);
+        return false;
+    }
+    fs.out = fopen(out_path, "wb");
+    if (fs.out == NULL) {
+        modem_log(modem, "❌ 无法创建文件: %s", out_path);
+        return false;
+    }
+    modem_log(modem, "📥 读取 %s (%lld字节)", name, size);
+    
+    uint64_t start = monotonic_ms();
+    at_data_stream_init(&ds, ufs_file_sink, &fs);
+    EC800KModem* data = modem_bulk(modem);
+    mutex_lock(&data->io_lock);
+    bool ok = modem_at_format_locked(data, "AT+QFDWL=\"%s\"", name) > 0;
+    if (ok) {
+        at_response_init(&resp, data->arena.tx);
+        resp.allow_connect = true;
+        modem_at_exchange_locked(data, data->arena.tx, &resp, AT_TIMEOUT_POLICY);
+        ok = resp.result == AT_RESULT_CONNECT &&
+             modem_at_read_length_locked(data, &resp, (uint64_t)size, &ds);
+    }
+    mutex_unlock(&data->io_lock);
+    ok = fclose(fs.out) == 0 && ok && ds.sink_ok;
+    
+    unsigned long long length = 0;
+    unsigned int checksum = 0;
+    const AtLine* line = ok ? at_response_find_kind(&resp, AT_LINE_QFDWL) : NULL;
+    if (line != NULL) sscanf(line->args, "%llu,%x", &length, &checksum);
+    if (!ok || line == NULL) {
+        modem_log(modem, "❌ AT+QFDWL 读取失败 (%s %d)", at_result_name(resp.result), resp.error_code);
+        return false;
+    }
+    if (length != (unsigned long long)size || checksum != fs.checksum) {
+        modem_log(modem, "❌ 文件校验失败: 长度%llu/%lld, 校验和%04x/%04x", length, size, checksum, fs.checksum);
+        return false;
+    }
+    
+    double seconds = (double)(monotonic_ms() - start) / 1000.0;
+    stats_record_phase(modem_name(modem), "ufs_download", (monotonic_ms() - start) * 1000);
+    modem_log(modem, "✅ 已保存到 %s (%.1fKB/s, 校验和%04x)", out_path,
+              seconds > 0 ? (double)size / 1024.0 / seconds : 0.0, checksum);
+    return true;
+}
+
+// ================== COS分片上传 ==================
+
+// 与4g_upload/cos_multipart_upload.py相同的流程：初始化->逐片PUT->完成，
+// 请求经模组的HTTP(S)协议栈发出，分片数据直接从映射文件写入串口
+
+#define COS_CHUNK_MIN (8 * 1024)
+#define COS_CHUNK_MAX (256 * 1024)
+#define COS_PART_TARGET_MS 8000         // 自适应分片的目标单片耗时，链路中断时损失不超过数秒的传输
+#define COS_PART_RETRIES 3              // 单个模组连续失败的分片重试次数
+#define COS_RETRY_BACKOFF_MS 500
+#define COS_RECONNECT_TIMEOUT_MS 60000  // 分片失败后等待串口恢复的最长时间
+#define COS_LIST_PAGE 25                // ListParts每页分片数（响应需放入HTTP_READ_MAX）
+#define COS_SIGN_EXPIRE_S 3600
+#define COS_KEY_TIME_MAX 48
+#define COS_SIGN_REFRESH_S 300       // KeyTime剩余有效期低于该值时换新窗口，避免长分片到达时签名过期
+#define COS_MAX_PARTS 10000
+#define COS_ETAG_MAX 72
+
+// 凭证从环境变量读取：COS_HOST、COS_SECRET_ID、COS_SECRET_KEY、COS_SESSION_TOKEN
+// 签名密钥链按KeyTime窗口缓存：SecretKey的HMAC状态只算一次，SignKey在窗口内复用，
+// 每个请求只需哈希HttpString并对StringToSign做一次HMAC
+typedef struct {
+    const char* host;
+    const char* secret_id;
+    const char* secret_key;
+    const char* token;      // 临时凭证的x-cos-security-token，可为空
+    
+    mutex_t sign_lock;
+    HmacSha1Key secret;     // HMAC(SecretKey, ·)的预处理状态
+    HmacSha1Key sign_key;   // HMAC(SignKey, ·)的预处理状态，随KeyTime窗口更新
+    long long key_end;      // 当前KeyTime窗口的结束时间，0表示尚未生成
+    char key_time[COS_KEY_TIME_MAX];
+} CosCredentials;
+
+bool cos_credentials_from_env(CosCredentials* cred) {
+    cred->host = getenv("COS_HOST");
+    cred->secret_id = getenv("COS_SECRET_ID");
+    cred->secret_key = getenv("COS_SECRET_KEY");
+    cred->token = getenv("COS_SESSION_TOKEN");
+    if (cred->host == NULL || cred->host[0] == '\0' || cred->secret_id == NULL || cred->secret_id[0] == '\0' ||
+        cred->secret_key == NULL || cred->secret_key[0] == '\0') {
+        return false;
+    }
+    
+    mutex_init(&cred->sign_lock);
+    hmac_sha1_key_init(&cred->secret, cred->secret_key, strlen(cred->secret_key));
+    cred->key_end = 0;
+    cred->key_time[0] = '\0';
+    return true;
+}
+
+void cos_credentials_destroy(CosCredentials* cred) {
+    mutex_destroy(&cred->sign_lock);
+}
+
+// 取当前窗口的KeyTime与SignKey状态，剩余有效期不足COS_SIGN_REFRESH_S时生成新窗口
+void cos_sign_key(CosCredentials* cred, char key_time[COS_KEY_TIME_MAX], HmacSha1Key* sign_key) {
+    long long now = (long long)time(NULL);
+    
+    mutex_lock(&cred->sign_lock);
+    if (now + COS_SIGN_REFRESH_S >= cred->key_end) {
+        unsigned char digest[20];
+        char hex[41];
+        
+        cred->key_end = now + COS_SIGN_EXPIRE_S;
+        snprintf(cred->key_time, sizeof(cred->key_time), "%lld;%lld", now, cred->key_end);
+        hmac_sha1_keyed(&cred->secret, cred->key_time, strlen(cred->key_time), digest);
+        hex_encode(digest, sizeof(digest), hex);
+        hmac_sha1_key_init(&cred->sign_key, hex, 40);
+    }
+    memcpy(key_time, cred->key_time, sizeof(cred->key_time));
+    *sign_key = cred->sign_key;
+    mutex_unlock(&cred->sign_lock);
+}
+
+// COS V5签名，params为签名用的小写参数串（如"partnumber=1&uploadid=xxx"），
+// param_list为排序后的参数名（如"partnumber;uploadid"）；调用方按字典序给出，此处不再排序
+void cos_sign(CosCredentials* cred, const char* method, const char* uri, const char* params,
+              const char* param_list, char* auth, size_t size) {
+    char key_time[COS_KEY_TIME_MAX];
+    HmacSha1Key sign_key;
+    char string_to_sign[128];
+    char hex[41];
+    unsigned char digest[20];
+    Sha1Context ctx;
+    
+    // Step 1-2: KeyTime与SignKey（窗口内缓存）
+    cos_sign_key(cred, key_time, &sign_key);
+    
+    // Step 3-4: HttpString分段送入SHA1，不拼接中间串
+    sha1_init(&ctx);
+    sha1_update(&ctx, method, strlen(method));
+    sha1_update(&ctx, "\n", 1);
+    sha1_update(&ctx, uri, strlen(uri));
+    sha1_update(&ctx, "\n", 1);
+    sha1_update(&ctx, params, strlen(params));
+    sha1_update(&ctx, "\nhost=", 6);
+    sha1_update(&ctx, cred->host, strlen(cred->host));
+    sha1_update(&ctx, "\n", 1);
+    sha1_final(&ctx, digest);
+    hex_encode(digest, sizeof(digest), hex);
+    int len = snprintf(string_to_sign, sizeof(string_to_sign), "sha1\n%s\n%s\n", key_time, hex);
+    
+    // Step 5-6: Signature与Authorization
+    hmac_sha1_keyed(&sign_key, string_to_sign, (size_t)len, digest);
+    hex_encode(digest, sizeof(digest), hex);
+    snprintf(auth, size,
+             "q-sign-algorithm=sha1&q-ak=%s&q-sign-time=%s&q-key-time=%s"
+             "&q-header-list=host&q-url-param-list=%s&q-signature=%s",
+             cred->secret_id, key_time, key_time, param_list, hex);
+}
+
+// 组装自定义请求头（requestheader=1），返回长度
+size_t cos_build_header(const CosCredentials* cred, const char* method_upper, const char* target,
+                        const char* auth, const char* content_type, size_t content_len,
+                        char* head, size_t size) {
+    int len = snprintf(head, size,
+                       "%s %s HTTP/1.1\r\nHost: %s\r\nAuthorization: %s\r\n%s%s%s"
+                       "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                       method_upper, target, cred->host, auth,
+                       cred->token != NULL ? "x-cos-security-token: " : "",
+                       cred->token != NULL ? cred->token : "",
+                       cred->token != NULL ? "\r\n" : "",
+                       content_type, content_len);
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+// 发送一次COS请求并读取响应，返回HTTP状态码（失败为-1）
+int cos_request(EC800KModem* modem, CosCredentials* cred, const char* method, const char* target,
+                const char* params, const char* param_list, const char* content_type,
+                const void* body, size_t body_len, char* response, size_t response_size) {
+    char url[1024];
+    char auth[512];
+    char head[4096];
+    char uri[512];
+    char method_upper[8];
+    size_t response_len;
+    
+    // 签名只覆盖路径部分
+    snprintf(uri, sizeof(uri), "%.*s", (int)strcspn(target, "?"), target);
+    snprintf(url, sizeof(url), "https://%s%s", cred->host, target);
+    for (size_t i = 0; i < sizeof(method_upper) - 1; i++) {
+        method_upper[i] = (char)(method[i] >= 'a' && method[i] <= 'z' ? method[i] - 32 : method[i]);
+        if (method[i] == '\0') break;
+    }
+    method_upper[sizeof(method_upper) - 1] = '\0';
+    
+    cos_sign(cred, method, uri, params, param_list, auth, sizeof(auth));
+    if (cos_build_header(cred, method_upper, target, auth, content_type, body_len, head, sizeof(head)) == 0) {
+        modem_log(modem, "❌ 请求头过长");
+        return -1;
+    }
+    
+    if (!modem_http_set_url(modem, url)) return -1;
+    int status = modem_http_request(modem, method_upper, head, body, body_len);
+    if (status < 0) return -1;
+    if (!modem_http_read(modem, response, response_size, &response_len)) return -1;
+    return status;
+}
+
+// 提取<Tag>value</Tag>
+bool xml_extract(const char* xml, const char* tag, char* value, size_t size) {
+    char open_tag[64];
+    char close_tag[64];
+    snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
+    snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+    const char* start = strstr(xml, open_tag);
+    if (start == NULL) return false;
+    start += strlen(open_tag);
+    const char* end = strstr(start, close_tag);
+    if (end == NULL || (size_t)(end - start) >= size) return false;
+    memcpy(value, start, (size_t)(end - start));
+    value[end - start] = '\0';
+    return true;
+}
+
+// 查询信号强度RSSI（0-31，99为未知），失败返回-1
+int modem_get_rssi(EC800KModem* modem) {
+    AtResponse resp;
+    const AtLine* line;
+    int rssi = -1;
+    int ber;
+    
+    if (modem_at_transact(modem, "AT+CSQ", &resp, AT_TIMEOUT_POLICY) &&
+        (line = at_response_find_kind(&resp, AT_LINE_CSQ)) != NULL) {
+        at_parse_csq(line->args, &rssi, &ber);
+    }
+    return rssi;
+}
+
+// 按信号强度选择起始分片：弱信号下单片失败重传的代价更高，用小分片；强信号用大分片减少请求开销
+size_t cos_initial_chunk(int rssi) {
+    if (rssi < 0 || rssi == 99) return COS_CHUNK_SIZE;
+    if (rssi < 10) return COS_CHUNK_MIN * 2;
+    if (rssi < 20) return COS_CHUNK_SIZE;
+    return COS_CHUNK_SIZE * 2;
+}
+
+// 按实测吞吐调整分片，使单片耗时接近COS_PART_TARGET_MS；每次最多翻倍或减半以平滑抖动
+size_t cos_adapt_chunk(size_t chunk, size_t len, uint64_t ms) {
+    size_t target = ms > 0 ? (size_t)((double)len * COS_PART_TARGET_MS / (double)ms) : chunk * 2;
+    size_t next = (chunk + target) / 2;
+    
+    if (next > chunk * 2) next = chunk * 2;
+    if (next < chunk / 2) next = chunk / 2;
+    if (next > COS_CHUNK_MAX) next = COS_CHUNK_MAX;
+    if (next < COS_CHUNK_MIN) next = COS_CHUNK_MIN;
+    return next & ~(size_t)(4096 - 1);
+}
+
+typedef enum {
+    COS_PART_CLAIMED,       // 已领取，上传中
+    COS_PART_PENDING,       // 待（重新）上传：失败或续传时发现缺失
+    COS_PART_DONE,
+} CosPartState;
+
+typedef struct {
+    size_t offset;
+    size_t len;
+    CosPartState state;
+    char etag[COS_ETAG_MAX];
+} CosPart;
+
+// 一次分片上传的共享状态：各模组线程优先领取待重传分片，其次从next_offset切出新分片
+typedef struct {
+    CosCredentials* cred;
+    const char* path;
+    const char* object_key;
+    char upload_id[128];
+    size_t file_size;
+    size_t next_offset;
+    CosPart* parts;         // 按分片号-1索引
+    int part_count;
+    int part_capacity;
+    int pending;            // state为PENDING的分片数
+    int done;
+    size_t fixed_chunk;     // 非0时使用固定分片，不做自适应
+    size_t buf_size;        // 缓冲池中每块的大小，即分片上限
+    int active_workers;
+    bool failed;
+    FILE* journal;
+    char journal_path[512];
+    mutex_t lock;
+} CosUpload;
+
+typedef struct {
+    CosUpload* upload;
+    EC800KModem* modem;
+    unsigned char* buf;     // 缓冲池中归属本线程的一块
+    size_t chunk;
+    size_t bytes;
+    int parts;
+    thread_t thread;
+} CosWorker;
+
+// ---------- 续传日志 ----------
+// <FILE>.upload，追加写入的文本行：
+//   upload <upload_id> <file_size> <object_key>
+//   claim <n> <offset> <len>      分片n对应的字节范围（领取时写入）
+//   done <n> <etag>               分片n已上传
+// 中断后重新执行upload，从日志恢复分片表，只上传未完成的分片
+
+void cos_journal_append(CosUpload* up, const char* format, ...) {
+    if (up->journal == NULL) return;
+    va_list args;
+    va_start(args, format);
+    vfprintf(up->journal, format, args);
+    va_end(args);
+    fflush(up->journal);
+}
+
+// 读取续传日志，与当前文件和对象键一致时恢复分片表，返回恢复的已完成分片数（无可用日志返回-1）
+int cos_journal_load(CosUpload* up) {
+    FILE* fp = fopen(up->journal_path, "r");
+    char line[512];
+    char key[256];
+    char id[128];
+    size_t size = 0;
+    
+    if (fp == NULL) return -1;
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        sscanf(line, "upload %127s %zu %255s", id, &size, key) != 3 ||
+        size != up->file_size || strcmp(key, up->object_key) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), fp) != NULL) {
+        int n;
+        size_t offset, len;
+        char etag[COS_ETAG_MAX];
+        if (sscanf(line, "claim %d %zu %zu", &n, &offset, &len) == 3) {
+            // 分片号按领取顺序连续递增
+            valid = n == up->part_count + 1 && n <= up->part_capacity && len <= up->buf_size &&
+                    offset + len <= up->file_size;
+            if (!valid) break;
+            up->parts[n - 1].offset = offset;
+            up->parts[n - 1].len = len;
+            up->parts[n - 1].state = COS_PART_PENDING;
+            up->parts[n - 1].etag[0] = '\0';
+            up->part_count = n;
+            if (offset + len > up->next_offset) up->next_offset = offset + len;
+        } else if (sscanf(line, "done %d %71s", &n, etag) == 2) {
+            valid = n >= 1 && n <= up->part_count;
+            if (!valid) break;
+            up->parts[n - 1].state = COS_PART_DONE;
+            snprintf(up->parts[n - 1].etag, COS_ETAG_MAX, "%s", etag);
+        }
+    }
+    fclose(fp);
+    
+    if (!valid) {
+        log_msg("⚠️ 续传日志损坏，重新上传: %s", up->journal_path);
+        up->part_count = 0;
+        up->next_offset = 0;
+        return -1;
+    }
+    snprintf(up->upload_id, sizeof(up->upload_id), "%s", id);
+    up->pending = 0;
+    up->done = 0;
+    for (int i = 0; i < up->part_count; i++) {
+        if (up->parts[i].state == COS_PART_DONE) {
+            up->done++;
+        } else {
+            up->pending++;
+        }
+    }
+    return up->done;
+}
+
+// 重写日志（新上传或ListParts核对之后），此后以追加方式记录
+bool cos_journal_rewrite(CosUpload* up) {
+    if (up->journal != NULL) fclose(up->journal);
+    up->journal = fopen(up->journal_path, "w");
+    if (up->journal == NULL) {
+        log_msg("⚠️ 无法写入续传日志 %s，本次上传中断后无法续传", up->journal_path);
+        return false;
+    }
+    fprintf(up->journal, "upload %s %zu %s\n", up->upload_id, up->file_size, up->object_key);
+    for (int i = 0; i < up->part_count; i++) {
+        fprintf(up->journal, "claim %d %zu %zu\n", i + 1, up->parts[i].offset, up->parts[i].len);
+    }
+    for (int i = 0; i < up->part_count; i++) {
+        if (up->parts[i].state == COS_PART_DONE) fprintf(up->journal, "done %d %s\n", i + 1, up->parts[i].etag);
+    }
+    fflush(up->journal);
+    return true;
+}
+
+// ListParts核对服务端已有分片：ETag和大小一致的保留，其余标记为待重传
+// 返回0成功，1表示UploadId已失效（需重新初始化），-1请求失败
+int cos_list_parts(EC800KModem* modem, CosUpload* up) {
+    char target[512];
+    char params[256];
+    char response[HTTP_READ_MAX];
+    int marker = 0;
+    bool* confirmed = (bool*)calloc((size_t)up->part_capacity, sizeof(bool));
+    if (confirmed == NULL) return -1;
+    
+    for (;;) {
+        snprintf(target, sizeof(target), "/%s?max-parts=%d&part-number-marker=%d&uploadId=%s",
+                 up->object_key, COS_LIST_PAGE, marker, up->upload_id);
+        snprintf(params, sizeof(params), "max-parts=%d&part-number-marker=%d&uploadid=%s",
+                 COS_LIST_PAGE, marker, up->upload_id);
+        int status = cos_request(modem, up->cred, "get", target, params, "max-parts;part-number-marker;uploadid",
+                                 "application/xml", NULL, 0, response, sizeof(response));
+        if (status == 404) {
+            free(confirmed);
+            return 1;
+        }
+        if (status != 200) {
+            modem_log(modem, "❌ ListParts失败 (HTTP %d)", status);
+            free(confirmed);
+            return -1;
+        }
+        
+        const char* p = response;
+        while ((p = strstr(p, "<Part>")) != NULL) {
+            char number[16], etag[COS_ETAG_MAX], size[24];
+            const char* end = strstr(p, "</Part>");
+            if (end == NULL) break;
+            if (xml_extract(p, "PartNumber", number, sizeof(number)) && xml_extract(p, "ETag", etag, sizeof(etag)) &&
+                xml_extract(p, "Size", size, sizeof(size))) {
+                int n = atoi(number);
+                if (n >= 1 && n <= up->part_count && up->parts[n - 1].state == COS_PART_DONE &&
+                    strcmp(up->parts[n - 1].etag, etag) == 0 && strtoull(size, NULL, 10) == up->parts[n - 1].len) {
+                    confirmed[n - 1] = true;
+                }
+            }
+            p = end;
+        }
+        
+        char truncated[8], next[16];
+        if (!xml_extract(response, "IsTruncated", truncated, sizeof(truncated)) || strcmp(truncated, "true") != 0 ||
+            !xml_extract(response, "NextPartNumberMarker", next, sizeof(next)) || atoi(next) <= marker) {
+            break;
+        }
+        marker = atoi(next);
+    }
+    
+    for (int i = 0; i < up->part_count; i++) {
+        if (up->parts[i].state == COS_PART_DONE && !confirmed[i]) {
+            modem_log(modem, "⚠️ 服务端缺少分片%d，重新上传", i + 1);
+            up->parts[i].state = COS_PART_PENDING;
+            up->done--;
+            up->pending++;
+        }
+    }
+    free(confirmed);
+    return 0;
+}
+
+// ---------- 上传线程 ----------
+
+// 领取下一个分片，返回分片号（1起），无剩余或已失败返回0
+int cos_claim_part(CosUpload* up, size_t chunk, size_t* offset, size_t* len) {
+    int number = 0;
+    
+    mutex_lock(&up->lock);
+    if (up->failed) {
+        // 不再领取
+    } else if (up->pending > 0) {
+        for (int i = 0; i < up->part_count; i++) {
+            if (up->parts[i].state == COS_PART_PENDING) {
+                up->parts[i].state = COS_PART_CLAIMED;
+                up->pending--;
+                *offset = up->parts[i].offset;
+                *len = up->parts[i].len;
+                number = i + 1;
+                break;
+            }
+        }
+    } else if (up->next_offset < up->file_size) {
+        size_t remaining = up->file_size - up->next_offset;
+        // 余下分片号不足时加大分片，保证总数不超过COS_MAX_PARTS
+        size_t slots = (size_t)(up->part_capacity - up->part_count);
+        size_t min_chunk = slots > 0 ? (remaining + slots - 1) / slots : remaining;
+        if (chunk < min_chunk) chunk = min_chunk;
+        if (chunk > up->buf_size) chunk = up->buf_size;
+        
+        if (up->part_count < up->part_capacity) {
+            CosPart* part = &up->parts[up->part_count];
+            *offset = up->next_offset;
+            *len = remaining < chunk ? remaining : chunk;
+            up->next_offset += *len;
+            part->offset = *offset;
+            part->len = *len;
+            part->state = COS_PART_CLAIMED;
+            part->etag[0] = '\0';
+            number = ++up->part_count;
+            cos_journal_append(up, "claim %d %zu %zu\n", number, *offset, *len);
+        } else {
+            up->failed = true;
+        }
+    }
+    mutex_unlock(&up->lock);
+    return number;
+}
+
+void cos_finish_part(CosUpload* up, int number, const char* etag) {
+    mutex_lock(&up->lock);
+    if (etag != NULL) {
+        up->parts[number - 1].state = COS_PART_DONE;
+        snprintf(up->parts[number - 1].etag, COS_ETAG_MAX, "%s", etag);
+        up->done++;
+        cos_journal_append(up, "done %d %s\n", number, etag);
+    } else {
+        // 放回队列，由本线程恢复后或其他模组重传
+        up->parts[number - 1].state = COS_PART_PENDING;
+        up->pending++;
+    }
+    mutex_unlock(&up->lock);
+}
+
+// 分片失败后恢复：串口断开时等待重连并重新配置HTTP(S)，返回模组是否可继续使用
+bool cos_worker_recover(CosWorker* worker, int attempt) {
+    EC800KModem* modem = worker->modem;
+    uint64_t deadline = monotonic_ms() + COS_RECONNECT_TIMEOUT_MS;
+    
+    sleep_ms(COS_RETRY_BACKOFF_MS << (attempt - 1));
+    if (!modem->link_down && modem_test_at(modem)) return true;
+    
+    modem_link_lost(modem);
+    while (!modem_link_check(modem)) {
+        int wait = remaining_ms(deadline);
+        if (wait <= 0) {
+            modem_log(modem, "❌ 串口%d秒内未恢复，停止使用该模组", COS_RECONNECT_TIMEOUT_MS / 1000);
+            return false;
+        }
+        int backoff = modem_reconnect_wait_ms(modem);
+        sleep_ms(backoff < wait ? (backoff > 0 ? backoff : 1) : wait);
+    }
+    // 模组可能已重启，HTTP(S)配置需重新下发
+    return modem_test_at(modem) && modem_http_setup(modem, true);
+}
+
+// 按64位偏移定位，long在Windows与32位系统上只有32位，fseek无法越过2GB
+int file_seek(FILE* fp, uint64_t offset, int whence) {
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)offset, whence);
+#else
+    return fseeko(fp, (off_t)offset, whence);
+#endif
+}
+
+int64_t file_tell(FILE* fp) {
+#ifdef _WIN32
+    return (int64_t)_ftelli64(fp);
+#else
+    return (int64_t)ftello(fp);
+#endif
+}
+
+THREAD_RETURN cos_upload_worker(void* arg) {
+    CosWorker* worker = (CosWorker*)arg;
+    CosUpload* up = worker->upload;
+    EC800KModem* modem = worker->modem;
+    FILE* fp = fopen(up->path, "rb");
+    char target[512];
+    char params[256];
+    char response[HTTP_READ_MAX];
+    size_t offset;
+    size_t len;
+    int number;
+    int failures = 0;
+    
+    while (fp != NULL && failures <= COS_PART_RETRIES &&
+           (number = cos_claim_part(up, worker->chunk, &offset, &len)) > 0) {
+        uint64_t part_start = monotonic_ms();
+        if (file_seek(fp, offset, SEEK_SET) != 0 || fread(worker->buf, 1, len, fp) != len) {
+            modem_log(modem, "❌ 读取分片%d失败", number);
+            cos_finish_part(up, number, NULL);
+            break;
+        }
+        
+        char etag[COS_ETAG_MAX];
+        snprintf(target, sizeof(target), "/%s?partNumber=%d&uploadId=%s", up->object_key, number, up->upload_id);
+        snprintf(params, sizeof(params), "partnumber=%d&uploadid=%s", number, up->upload_id);
+        int status = cos_request(modem, up->cred, "put", target, params, "partnumber;uploadid",
+                                 "application/octet-stream", worker->buf, len, response, sizeof(response));
+        if (status != 200 || !http_header_value(response, "ETag", etag, sizeof(etag))) {
+            modem_log(modem, "❌ 分片%d上传失败 (HTTP %d)，第%d次", number, status, failures + 1);
+            cos_finish_part(up, number, NULL);
+            failures++;
+            stats_record_retry(modem_name(modem), "AT+QHTTPPUT");
+            if (failures > COS_PART_RETRIES || !cos_worker_recover(worker, failures)) break;
+            continue;
+        }
+        
+        uint64_t part_ms = monotonic_ms() - part_start;
+        cos_finish_part(up, number, etag);
+        failures = 0;
+        worker->bytes += len;
+        worker->parts++;
+        stats_record_phase(modem_name(modem), "upload_part", part_ms * 1000);
+        telemetry_record_upload(modem, (uint32_t)part_ms, (uint32_t)len);
+        modem_log(modem, "✅ 分片%d: %zu字节 @%zu, %.1fKB/s, ETag: %s", number, len, offset,
+                  part_ms > 0 ? (double)len / 1024.0 * 1000.0 / (double)part_ms : 0.0, etag);
+        
+        if (up->fixed_chunk == 0) {
+            worker->chunk = cos_adapt_chunk(worker->chunk, len, part_ms);
+        }
+    }
+    if (fp == NULL) modem_log(modem, "❌ 无法打开文件: %s", up->path);
+    else fclose(fp);
+    
+    // 最后一个退出的线程：仍有分片未完成则整体失败
+    mutex_lock(&up->lock);
+    if (--up->active_workers == 0 && up->done < up->part_count) up->failed = true;
+    mutex_unlock(&up->lock);
+    return THREAD_RESULT;
+}
+
+// 初始化分片上传，获取新的UploadId
+bool cos_init_upload(EC800KModem* modem, CosUpload* up) {
+    char target[512];
+    char response[HTTP_READ_MAX];
+    
+    snprintf(target, sizeof(target), "/%s?uploads", up->object_key);
+    int status = cos_request(modem, up->cred, "post", target, "uploads=", "uploads", "application/xml",
+                             NULL, 0, response, sizeof(response));
+    if (status != 200 || !xml_extract(response, "UploadId", up->upload_id, sizeof(up->upload_id))) {
+        modem_log(modem, "❌ 初始化失败 (HTTP %d)", status);
+        return false;
+    }
+    up->part_count = 0;
+    up->next_offset = 0;
+    up->pending = 0;
+    up->done = 0;
+    modem_log(modem, "✅ UploadId: %s", up->upload_id);
+    return true;
+}
+
+// 分片上传文件到COS，object_key为对象键（如ticnote_rec/a.opus）
+// 多个模组时各自占用一路HTTP会话并发上传分片，初始化与完成请求由第一个模组发出；
+// 进度记录在<FILE>.upload，中断后重新执行即续传，list_parts为true时先用ListParts核对服务端分片
+bool modem_cos_upload(EC800KModem* modems, int count, CosCredentials* cred, const char* path,
+                      const char* object_key, size_t fixed_chunk, bool list_parts) {
+    EC800KModem* lead = &modems[0];
+    CosUpload up;
+    CosWorker workers[MAX_SERIAL_PORTS];
+    char target[512];
+    char params[256];
+    char response[HTTP_READ_MAX];
+    unsigned char* pool = NULL;
+    bool ok = false;
+    
+    memset(&up, 0, sizeof(up));
+    up.cred = cred;
+    up.path = path;
+    up.object_key = object_key;
+    up.fixed_chunk = fixed_chunk;
+    snprintf(up.journal_path, sizeof(up.journal_path), "%s.upload", path);
+    
+    FILE* fp = fopen(path, "rb");
+    int64_t file_size = fp != NULL && file_seek(fp, 0, SEEK_END) == 0 ? file_tell(fp) : -1;
+    if (fp != NULL) fclose(fp);
+    if (file_size <= 0 || (uint64_t)file_size > SIZE_MAX) {
+        modem_log(lead, "❌ 无法打开文件: %s", path);
+        return false;
+    }
+    up.file_size = (size_t)file_size;
+    
+    // 缓冲池：每个模组线程一块，文件按片读入而不整体载入内存
+    size_t min_chunk = fixed_chunk > 0 ? fixed_chunk : COS_CHUNK_MIN;
+    size_t parts_needed = up.file_size / min_chunk + 1;
+    up.part_capacity = parts_needed < COS_MAX_PARTS ? (int)parts_needed : COS_MAX_PARTS;
+    up.buf_size = fixed_chunk > 0 ? fixed_chunk : COS_CHUNK_MAX;
+    if (up.buf_size < (up.file_size + COS_MAX_PARTS - 1) / COS_MAX_PARTS) {
+        up.buf_size = (up.file_size + COS_MAX_PARTS - 1) / COS_MAX_PARTS;
+    }
+    up.parts = (CosPart*)calloc((size_t)up.part_capacity, sizeof(CosPart));
+    pool = (unsigned char*)malloc(up.buf_size * (size_t)count);
+    if (up.parts == NULL || pool == NULL) {
+        modem_log(lead, "❌ 内存不足");
+        goto out;
+    }
+    mutex_init(&up.lock);
+    
+    log_printf("\n==================================================\n");
+    modem_log(lead, "📤 COS分片上传（经模组HTTP协议栈）");
+    log_printf("==================================================\n");
+    modem_log(lead, "📎 文件: %s (%zu字节, %.1fKB)", path, up.file_size, (double)up.file_size / 1024.0);
+    modem_log(lead, "📎 目标: https://%s/%s", cred->host, object_key);
+    modem_log(lead, "📎 并发: %d个模组, 缓冲池%d x %zuKB", count, count, up.buf_size / 1024);
+    
+    // 0. 各模组HTTP(S)上下文与起始分片
+    for (int i = 0; i < count; i++) {
+        if (!modem_test_at(&modems[i]) || !modem_http_setup(&modems[i], true)) {
+            modem_log(&modems[i], "❌ HTTP(S)配置失败");
+            goto out_lock;
+        }
+        workers[i].upload = &up;
+        workers[i].modem = &modems[i];
+        workers[i].buf = pool + up.buf_size * (size_t)i;
+        workers[i].bytes = 0;
+        workers[i].parts = 0;
+        if (fixed_chunk > 0) {
+            workers[i].chunk = fixed_chunk;
+        } else {
+            int rssi = modem_get_rssi(&modems[i]);
+            workers[i].chunk = cos_initial_chunk(rssi);
+            modem_log(&modems[i], "📶 RSSI=%d, 起始分片%zuKB", rssi, workers[i].chunk / 1024);
+        }
+    }
+    
+    // 1. 续传或初始化分片上传
+    int resumed = cos_journal_load(&up);
+    if (resumed >= 0) {
+        modem_log(lead, "\n[步骤1] 续传: UploadId %s, 已完成%d/%d片", up.upload_id, resumed, up.part_count);
+        if (list_parts) {
+            int checked = cos_list_parts(lead, &up);
+            if (checked < 0) goto out_lock;
+            if (checked > 0) {
+                modem_log(lead, "⚠️ UploadId已失效，重新初始化");
+                resumed = -1;
+            } else {
+                modem_log(lead, "✅ ListParts核对完成，已完成%d片", up.done);
+            }
+        }
+    }
+    if (resumed < 0) {
+        modem_log(lead, "\n[步骤1] 初始化分片上传...");
+        if (!cos_init_upload(lead, &up)) goto out_lock;
+    }
+    cos_journal_rewrite(&up);
+    
+    // 2. 并发上传分片
+    modem_log(lead, "\n[步骤2] 上传分片...");
+    uint64_t start = monotonic_ms();
+    size_t skipped = 0;
+    for (int i = 0; i < up.part_count; i++) {
+        if (up.parts[i].state == COS_PART_DONE) skipped += up.parts[i].len;
+    }
+    int started = 0;
+    up.active_workers = count;
+    for (; started < count; started++) {
+        if (!thread_create(&workers[started].thread, cos_upload_worker, &workers[started])) break;
+    }
+    mutex_lock(&up.lock);
+    up.active_workers -= count - started;
+    if (up.active_workers == 0) up.failed = true;
+    mutex_unlock(&up.lock);
+    for (int i = 0; i < started; i++) {
+        thread_join(workers[i].thread);
+    }
+    double seconds = (double)(monotonic_ms() - start) / 1000.0;
+    if (up.failed || up.done < up.part_count || up.next_offset < up.file_size) {
+        modem_log(lead, "❌ 分片上传未完成 (%d/%d片)，重新执行将从缺失分片续传", up.done, up.part_count);
+        goto out_lock;
+    }
+    
+    // 3. 完成上传
+    modem_log(lead, "\n[步骤3] 完成分片上传...");
+    size_t xml_size = (size_t)up.part_count * (COS_ETAG_MAX + 64) + 64;
+    char* xml = (char*)malloc(xml_size);
+    if (xml == NULL) goto out_lock;
+    size_t xml_len = (size_t)snprintf(xml, xml_size, "<CompleteMultipartUpload>\n");
+    for (int i = 0; i < up.part_count; i++) {
+        xml_len += (size_t)snprintf(xml + xml_len, xml_size - xml_len,
+                                    "  <Part>\n    <PartNumber>%d</PartNumber>\n    <ETag>%s</ETag>\n  </Part>\n",
+                                    i + 1, up.parts[i].etag);
+    }
+    xml_len += (size_t)snprintf(xml + xml_len, xml_size - xml_len, "</CompleteMultipartUpload>");
     
-    // 超时设置
-    options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = 20;  // 2秒超时
+    snprintf(target, sizeof(target), "/%s?uploadId=%s", object_key, up.upload_id);
+    snprintf(params, sizeof(params), "uploadid=%s", up.upload_id);
+    int status = cos_request(lead, cred, "post", target, params, "uploadid", "application/xml",
+                             xml, xml_len, response, sizeof(response));
+    free(xml);
+    if (status != 200) {
+        modem_log(lead, "❌ 完成上传失败 (HTTP %d)", status);
+        goto out_lock;
+    }
     
-    tcsetattr(modem->handle, TCSANOW, &options);
-    tcflush(modem->handle, TCIOFLUSH);
-#endif
+    modem_log(lead, "🎉 上传成功: https://%s/%s", cred->host, object_key);
+    modem_log(lead, "📊 分片阶段: %zu字节 (续传跳过%zu字节), %d片, 用时%.1f秒 (%.1fKB/s)", up.file_size - skipped,
+              skipped, up.part_count, seconds,
+              seconds > 0 ? (double)(up.file_size - skipped) / 1024.0 / seconds : 0.0);
+    for (int i = 0; count > 1 && i < count; i++) {
+        modem_log(&modems[i], "📊 %d片, %zu字节", workers[i].parts, workers[i].bytes);
+    }
+    ok = true;
     
-    log_msg("✅ 串口连接成功: %s @ %dbps", modem->port_path, modem->baud_rate);
-    return true;
+out_lock:
+    if (up.journal != NULL) fclose(up.journal);
+    if (ok) remove(up.journal_path);
+    mutex_destroy(&up.lock);
+out:
+    free(pool);
+    free(up.parts);
+    return ok;
 }
 
-// 断开连接
-void modem_disconnect(EC800KModem* modem) {
-    modem->stop_monitor = true;
-    if (modem->handle != INVALID_SERIAL) {
-#ifdef _WIN32
-        CloseHandle(modem->handle);
-#else
-        close(modem->handle);
-#endif
-        modem->handle = INVALID_SERIAL;
-        log_msg("🔌 串口已断开");
+// 连接<串口>列表中的各模组并执行分片上传
+bool run_upload(const char* ports_arg, const char* path, const char* object_key, size_t fixed_chunk,
+                const ToolOptions* opts) {
+    static char ports[MAX_SERIAL_PORTS][64];
+    CosCredentials cred;
+    
+    if (!cos_credentials_from_env(&cred)) {
+        log_msg("❌ 未设置COS_HOST/COS_SECRET_ID/COS_SECRET_KEY环境变量");
+        return false;
     }
-}
-
-// 发送AT命令
-bool modem_send_at_command(EC800KModem* modem, const char* cmd, char* response, size_t resp_size, int timeout_ms) {
-    if (modem->handle == INVALID_SERIAL) {
-        strcpy(response, "串口未连接");
+    int count = parse_port_list(ports_arg, ports, MAX_SERIAL_PORTS);
+    EC800KModem* modems = count > 0 ? (EC800KModem*)calloc((size_t)count, sizeof(EC800KModem)) : NULL;
+    if (modems == NULL) {
+        log_msg(count == 0 ? "❌ 没有可用的串口" : "❌ 内存不足");
+        cos_credentials_destroy(&cred);
         return false;
     }
     
-    log_msg("📤 发送: %s", cmd);
-    
-    // 构建命令
-    char full_cmd[512];
-    snprintf(full_cmd, sizeof(full_cmd), "%s\r\n", cmd);
+    int connected = 0;
+    for (int i = 0; i < count; i++) {
+        modem_init(&modems[connected], ports[i], opts->baud_rate);
+        modem_apply_options(&modems[connected], opts);
+        modems[connected].log_tag = count > 1;
+        if (modem_connect(&modems[connected])) {
+            connected++;
+        } else {
+            modem_destroy(&modems[connected]);
+        }
+    }
     
-    // 清空缓冲区
-    memset(response, 0, resp_size);
+    bool ok = connected > 0 &&
+              modem_cos_upload(modems, connected, &cred, path, object_key, fixed_chunk, opts->list_parts);
+    if (connected == 0) log_printf("\n💡 提示: 请检查串口连接和权限\n");
     
-#ifdef _WIN32
-    DWORD bytes_written;
-    if (!WriteFile(modem->handle, full_cmd, strlen(full_cmd), &bytes_written, NULL)) {
-        strcpy(response, "发送失败");
-        return false;
+    for (int i = 0; i < connected; i++) {
+        modem_disconnect(&modems[i]);
+        modem_destroy(&modems[i]);
     }
+    free(modems);
+    cos_credentials_destroy(&cred);
+    return ok;
+}
+
+// ================== 守护进程 ==================
+
+// daemon命令：常驻进程保持各模组连接与URC监听，在Unix域套接字上接受JSON行请求，
+// 每行一个对象，如{"id":1,"op":"fota","port":"ttyUSB2","url":"http://...","mode":1}。
+// 同一模组同时只执行一个请求；请求被接受后回复accepted，FOTA阶段推进时推送progress，
+// 结束时回复done（ok与结果字段），串口断开/重连时向所有客户端广播link
+
+#define DAEMON_MAX_CLIENTS 16
+#define DAEMON_LINE_MAX 2048
+#define DAEMON_EVENT_MAX 4096
+#define DAEMON_OUT_MAX (16 * 1024)  // 每个客户端未写出事件的上限，读得太慢超出时断开该客户端
+#define DAEMON_POLL_MS 100          // 进度、任务结束与链路状态的检查周期
+
+#ifndef _WIN32
+typedef enum {
+    DAEMON_OP_TEST,
+    DAEMON_OP_VERSION,
+    DAEMON_OP_FOTA,
+    DAEMON_OP_FOTA_FILE,
+    DAEMON_OP_UPLOAD
+} DaemonOp;
+
+typedef struct {
+    int fd;                     // -1为空闲
+    unsigned int gen;           // 槽位复用计数，任务只向发起它的那次连接推送事件
+    char buf[DAEMON_LINE_MAX];
+    size_t len;
+    char out[DAEMON_OUT_MAX];   // 非阻塞写不完的事件，等POLLOUT时续写
+    size_t out_len;
+} DaemonClient;
+
+struct Daemon;
+
+typedef struct {
+    struct Daemon* daemon;
+    bool active;
+    DaemonOp op;
+    char id[32];                // 请求中的id，原样带回
+    int client;
+    unsigned int gen;
+    int first;                  // 作用的模组区间（upload可为全部模组）
+    int count;
+    char url[512];              // fota的URL，fota-file/upload的本地路径
+    char key[256];              // upload的对象键，fota-file的md5（可选）
+    int mode;
+    int limit;                  // fota的timeout或fota-file的urc_max
+    size_t chunk;
+    thread_t thread;
+    volatile bool done;         // 工作线程写入结果后置位
+    bool ok;
+    char result[512];           // done事件中的附加字段（JSON片段）
+    FotaStage stage;            // 最近一次推送的进度
+    int progress;
+} DaemonJob;
+
+typedef struct Daemon {
+    EC800KModem* modems;
+    int count;
+    DaemonJob* busy[MAX_SERIAL_PORTS];      // 各模组正在执行的任务
+    bool link_up[MAX_SERIAL_PORTS];         // 最近一次广播的链路状态
+    DaemonJob jobs[MAX_SERIAL_PORTS];
+    DaemonClient clients[DAEMON_MAX_CLIENTS];
+    int listen_fd;
+    const ToolOptions* opts;
+    bool stopping;
+} Daemon;
+
+volatile sig_atomic_t g_daemon_stop = 0;
+
+void daemon_on_signal(int sig) {
+    (void)sig;
+    g_daemon_stop = 1;
+}
+
+// 平面JSON对象中取name的值：字符串去掉引号并处理转义，其余取到','或'}'为止
+bool json_field(const char* json, const char* name, char* value, size_t size) {
+    char key[64];
+    size_t len = 0;
     
-    // 读取响应
-    DWORD bytes_read;
-    DWORD total_read = 0;
-    DWORD start_time = GetTickCount();
+    snprintf(key, sizeof(key), "\"%s\"", name);
+    const char* p = strstr(json, key);
+    if (p == NULL) return false;
+    p += strlen(key);
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p++ != ':') return false;
+    while (*p == ' ' || *p == '\t') p++;
     
-    while (GetTickCount() - start_time < (DWORD)timeout_ms && total_read < resp_size - 1) {
-        char buf[256];
-        if (ReadFile(modem->handle, buf, sizeof(buf) - 1, &bytes_read, NULL) && bytes_read > 0) {
-            buf[bytes_read] = '\0';
-            strncat(response, buf, resp_size - total_read - 1);
-            total_read += bytes_read;
-            
-            if (strstr(response, "OK") || strstr(response, "ERROR")) {
-                break;
-            }
+    if (*p == '"') {
+        for (p++; *p != '\0' && *p != '"'; p++) {
+            if (*p == '\\' && p[1] != '\0') p++;
+            if (len + 1 < size) value[len++] = *p;
         }
-        Sleep(50);
+        if (*p != '"') return false;
+    } else {
+        while (*p != '\0' && *p != ',' && *p != '}' && *p != ' ' && len + 1 < size) value[len++] = *p++;
+        if (len == 0) return false;
     }
-#else
-    ssize_t written = write(modem->handle, full_cmd, strlen(full_cmd));
-    if (written < 0) {
-        strcpy(response, "发送失败");
-        return false;
+    value[len] = '\0';
+    return true;
+}
+
+int json_field_int(const char* json, const char* name, int fallback) {
+    char value[32];
+    return json_field(json, name, value, sizeof(value)) ? atoi(value) : fallback;
+}
+
+// 转义为JSON字符串内容（不含两端引号）
+void json_escape(const char* s, char* out, size_t size) {
+    size_t len = 0;
+    for (; *s != '\0' && len + 7 < size; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out[len++] = '\\';
+            out[len++] = (char)c;
+        } else if (c < 0x20) {
+            len += (size_t)snprintf(out + len, size - len, "\\u%04x", c);
+        } else {
+            out[len++] = (char)c;
+        }
     }
-    
-    // 读取响应
-    size_t total_read = 0;
-    int elapsed = 0;
-    
-    while (elapsed < timeout_ms && total_read < resp_size - 1) {
-        char buf[256];
-        ssize_t n = read(modem->handle, buf, sizeof(buf) - 1);
-        if (n > 0) {
-            buf[n] = '\0';
-            strncat(response, buf, resp_size - total_read - 1);
-            total_read += n;
-            
-            if (strstr(response, "OK") || strstr(response, "ERROR")) {
-                break;
-            }
+    out[len] = '\0';
+}
+
+const char* fota_stage_name(FotaStage stage) {
+    switch (stage) {
+        case FOTA_STAGE_IDLE:        return "idle";
+        case FOTA_STAGE_DOWNLOADING: return "downloading";
+        case FOTA_STAGE_DOWNLOADED:  return "downloaded";
+        case FOTA_STAGE_UPDATING:    return "updating";
+        case FOTA_STAGE_END:         return "end";
+        default:                     return "unknown";
+    }
+}
+
+void daemon_drop_client(Daemon* d, int client) {
+    close(d->clients[client].fd);
+    d->clients[client].fd = -1;
+    d->clients[client].out_len = 0;
+}
+
+// 非阻塞写出积压的事件，套接字缓冲区满时留待POLLOUT，写失败时关闭该连接
+void daemon_flush_client(Daemon* d, int client) {
+    DaemonClient* c = &d->clients[client];
+    size_t sent = 0;
+    while (sent < c->out_len) {
+        ssize_t w = write(c->fd, c->out + sent, c->out_len - sent);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (w <= 0) {
+            daemon_drop_client(d, client);
+            return;
         }
-        usleep(50000);
-        elapsed += 50;
+        sent += (size_t)w;
     }
-#endif
+    c->out_len -= sent;
+    memmove(c->out, c->out + sent, c->out_len);
+}
+
+// 向一个客户端发送一行事件：追加到发送队列后立即尝试写出，不阻塞轮询循环
+// 队列放不下（客户端长时间不读）时断开该连接
+void daemon_send(Daemon* d, int client, const char* format, ...) {
+    char line[DAEMON_EVENT_MAX];
+    va_list args;
     
-    // 去除首尾空白
-    char* start = response;
-    while (*start == '\r' || *start == '\n' || *start == ' ') start++;
-    if (start != response) {
-        memmove(response, start, strlen(start) + 1);
-    }
+    if (client < 0 || d->clients[client].fd < 0) return;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n > sizeof(line) - 2) n = (int)sizeof(line) - 2;
+    line[n++] = '\n';
     
-    if (strlen(response) > 0) {
-        log_msg("📥 响应: %s", response);
+    DaemonClient* c = &d->clients[client];
+    if (c->out_len + (size_t)n > sizeof(c->out)) {
+        log_msg("⚠️ 客户端%d未及时读取事件，断开连接", client);
+        daemon_drop_client(d, client);
+        return;
     }
-    
-    return strstr(response, "OK") != NULL;
+    memcpy(c->out + c->out_len, line, (size_t)n);
+    c->out_len += (size_t)n;
+    daemon_flush_client(d, client);
 }
 
-// ================== 功能函数 ==================
+// 任务的发起连接仍在时才推送
+void daemon_job_send(Daemon* d, const DaemonJob* job, const char* event, const char* fields) {
+    if (job->client < 0 || d->clients[job->client].gen != job->gen) return;
+    daemon_send(d, job->client, "{\"id\":%s,\"event\":\"%s\",\"port\":\"%s\"%s%s}", job->id, event,
+                job->count == 1 ? modem_name(&d->modems[job->first]) : "*", fields[0] ? "," : "", fields);
+}
 
-bool modem_test_at(EC800KModem* modem) {
-    char response[BUFFER_SIZE];
-    return modem_send_at_command(modem, "AT", response, sizeof(response), AT_TIMEOUT_MS);
+// 按端口短名或完整路径查找，"*"表示全部模组
+int daemon_find_modem(const Daemon* d, const char* port) {
+    for (int i = 0; i < d->count; i++) {
+        if (strcmp(port, modem_name(&d->modems[i])) == 0 || strcmp(port, d->modems[i].port_path) == 0) return i;
+    }
+    return -1;
 }
 
-// 获取固件版本 (使用AT+QGMR)
-void modem_get_firmware_version(EC800KModem* modem, char* version, size_t size) {
-    char response[BUFFER_SIZE];
-    version[0] = '\0';
+THREAD_RETURN daemon_job_thread(void* arg) {
+    DaemonJob* job = (DaemonJob*)arg;
+    Daemon* d = job->daemon;
+    EC800KModem* modem = &d->modems[job->first];
+    char text[256];
     
-    if (modem_send_at_command(modem, "AT+QGMR", response, sizeof(response), AT_TIMEOUT_MS)) {
-        // 解析版本，跳过回显和OK
-        char* line = strtok(response, "\r\n");
-        while (line != NULL) {
-            // 跳过AT命令回显和OK
-            if (strncmp(line, "AT", 2) != 0 && strcmp(line, "OK") != 0 && strlen(line) > 0) {
-                strncpy(version, line, size - 1);
-                version[size - 1] = '\0';
+    switch (job->op) {
+        case DAEMON_OP_TEST: {
+            char net_reg[64];
+            job->ok = modem_test_at(modem) && modem_load_static_info(modem);
+            bool registered = modem_check_network_status(modem, net_reg, sizeof(net_reg));
+            int rssi = modem_get_rssi(modem);
+            char version[128], imei[64], iccid[64];
+            json_escape(modem->fw_version, version, sizeof(version));
+            json_escape(modem->imei, imei, sizeof(imei));
+            json_escape(modem->iccid, iccid, sizeof(iccid));
+            snprintf(job->result, sizeof(job->result),
+                     "\"version\":\"%s\",\"imei\":\"%s\",\"iccid\":\"%s\",\"registered\":%s,\"rssi\":%d",
+                     version, imei, iccid, registered ? "true" : "false", rssi);
+            break;
+        }
+        case DAEMON_OP_VERSION: {
+            char version[128];
+            modem_get_firmware_version(modem, text, sizeof(text));
+            json_escape(text, version, sizeof(version));
+            job->ok = text[0] != '\0';
+            snprintf(job->result, sizeof(job->result), "\"version\":\"%s\"", version);
+            break;
+        }
+        case DAEMON_OP_FOTA:
+        case DAEMON_OP_FOTA_FILE:
+            job->ok = job->op == DAEMON_OP_FOTA
+                      ? modem_fota_upgrade(modem, job->url, job->mode, job->limit)
+                      : modem_fota_upgrade_file(modem, job->url, job->mode, job->limit,
+                                                job->key[0] != '\0' ? job->key : NULL);
+            snprintf(job->result, sizeof(job->result), "\"result\":%d,\"download_result\":%d",
+                     modem->fota_result, modem->download_result);
+            break;
+        case DAEMON_OP_UPLOAD: {
+            CosCredentials cred;
+            if (!cos_credentials_from_env(&cred)) {
+                snprintf(job->result, sizeof(job->result), "\"error\":\"未设置COS_HOST/COS_SECRET_ID/COS_SECRET_KEY环境变量\"");
+                job->ok = false;
                 break;
             }
-            line = strtok(NULL, "\r\n");
+            job->ok = modem_cos_upload(modem, job->count, &cred, job->url, job->key, job->chunk,
+                                       d->opts->list_parts);
+            cos_credentials_destroy(&cred);
+            json_escape(job->key, text, sizeof(text));
+            snprintf(job->result, sizeof(job->result), "\"key\":\"%s\"", text);
+            break;
         }
     }
+    job->done = true;
+    return THREAD_RESULT;
 }
 
-void modem_get_module_info(EC800KModem* modem) {
-    char response[BUFFER_SIZE];
-    char version[256];
+void daemon_reply_error(Daemon* d, int client, const char* id, const char* error) {
+    daemon_send(d, client, "{\"id\":%s,\"event\":\"error\",\"error\":\"%s\"}", id, error);
+}
+
+// list与shutdown在主循环中直接回复，其余请求交给工作线程
+void daemon_handle_request(Daemon* d, int client, const char* line) {
+    char id[32] = "null";
+    char op[32];
+    char port[PORT_PATH_MAX];
+    
+    // id原样带回：纯数字按数字，其余按字符串
+    char raw[24];
+    if (json_field(line, "id", raw, sizeof(raw))) {
+        char* end;
+        strtol(raw, &end, 10);
+        if (end != raw && *end == '\0') {
+            snprintf(id, sizeof(id), "%s", raw);
+        } else {
+            char escaped[28];
+            json_escape(raw, escaped, sizeof(escaped) - 2);
+            snprintf(id, sizeof(id), "\"%s\"", escaped);
+        }
+    }
+    if (!json_field(line, "op", op, sizeof(op))) {
+        daemon_reply_error(d, client, id, "缺少op");
+        return;
+    }
     
-    printf("\n模块信息:\n");
+    if (strcmp(op, "list") == 0) {
+        char ports[DAEMON_EVENT_MAX - 128];
+        size_t len = 0;
+        for (int i = 0; i < d->count && len + 256 < sizeof(ports); i++) {
+            const EC800KModem* modem = &d->modems[i];
+            char version[128];
+            json_escape(d->busy[i] == NULL ? modem->fw_version : "", version, sizeof(version));
+            len += (size_t)snprintf(ports + len, sizeof(ports) - len,
+                                    "%s{\"port\":\"%s\",\"link\":%s,\"busy\":%s,\"version\":\"%s\"}",
+                                    i > 0 ? "," : "", modem_name(modem), modem->link_down ? "false" : "true",
+                                    d->busy[i] != NULL ? "true" : "false", version);
+        }
+        ports[len] = '\0';
+        daemon_send(d, client, "{\"id\":%s,\"event\":\"done\",\"ok\":true,\"ports\":[%s]}", id, ports);
+        return;
+    }
+    if (strcmp(op, "shutdown") == 0) {
+        d->stopping = true;
+        daemon_send(d, client, "{\"id\":%s,\"event\":\"done\",\"ok\":true}", id);
+        return;
+    }
     
-    // 固件版本 (使用AT+QGMR)
-    modem_get_firmware_version(modem, version, sizeof(version));
-    if (strlen(version) > 0) {
-        printf("  firmware_version: %s\n", version);
+    DaemonOp kind;
+    if (strcmp(op, "test") == 0) kind = DAEMON_OP_TEST;
+    else if (strcmp(op, "version") == 0) kind = DAEMON_OP_VERSION;
+    else if (strcmp(op, "fota") == 0) kind = DAEMON_OP_FOTA;
+    else if (strcmp(op, "fota-file") == 0) kind = DAEMON_OP_FOTA_FILE;
+    else if (strcmp(op, "upload") == 0) kind = DAEMON_OP_UPLOAD;
+    else {
+        daemon_reply_error(d, client, id, "未知op");
+        return;
+    }
+    if (d->stopping) {
+        daemon_reply_error(d, client, id, "正在退出");
+        return;
     }
     
-    // IMEI
-    if (modem_send_at_command(modem, "AT+GSN", response, sizeof(response), AT_TIMEOUT_MS)) {
-        printf("  IMEI响应: %s\n", response);
+    // upload可用"*"在全部模组上并发上传分片，其余操作针对单个模组
+    int first = 0, count = d->count;
+    if (!json_field(line, "port", port, sizeof(port))) {
+        if (d->count != 1) {
+            daemon_reply_error(d, client, id, "缺少port");
+            return;
+        }
+    } else if (!(kind == DAEMON_OP_UPLOAD && strcmp(port, "*") == 0)) {
+        first = daemon_find_modem(d, port);
+        count = 1;
+        if (first < 0) {
+            daemon_reply_error(d, client, id, "未知port");
+            return;
+        }
+    }
+    for (int i = first; i < first + count; i++) {
+        if (d->busy[i] != NULL) {
+            daemon_reply_error(d, client, id, "busy");
+            return;
+        }
+        if (d->modems[i].link_down) {
+            daemon_reply_error(d, client, id, "link down");
+            return;
+        }
     }
     
-    // SIM状态
-    if (modem_send_at_command(modem, "AT+CPIN?", response, sizeof(response), AT_TIMEOUT_MS)) {
-        if (strstr(response, "READY")) {
-            printf("  sim_status: 已就绪\n");
-        } else {
-            printf("  sim_status: %s\n", response);
+    DaemonJob* job = &d->jobs[first];
+    memset(job, 0, sizeof(*job));
+    job->daemon = d;
+    job->op = kind;
+    snprintf(job->id, sizeof(job->id), "%s", id);
+    job->client = client;
+    job->gen = d->clients[client].gen;
+    job->first = first;
+    job->count = count;
+    job->stage = FOTA_STAGE_IDLE;
+    if (kind == DAEMON_OP_FOTA || kind == DAEMON_OP_FOTA_FILE || kind == DAEMON_OP_UPLOAD) {
+        const char* field = kind == DAEMON_OP_FOTA ? "url" : "path";
+        if (!json_field(line, field, job->url, sizeof(job->url))) {
+            daemon_reply_error(d, client, id, kind == DAEMON_OP_FOTA ? "缺少url" : "缺少path");
+            return;
         }
     }
+    job->mode = json_field_int(line, "mode", 0);
+    job->limit = json_field_int(line, kind == DAEMON_OP_FOTA ? "timeout" : "urc_max", 50);
+    job->chunk = (size_t)json_field_int(line, "chunk_kb", 0) * 1024;
+    if (kind == DAEMON_OP_FOTA_FILE) {
+        json_field(line, "md5", job->key, sizeof(job->key));
+    } else if (kind == DAEMON_OP_UPLOAD && !json_field(line, "key", job->key, sizeof(job->key))) {
+        const char* base = job->url;
+        for (const char* p = job->url; *p != '\0'; p++) {
+            if (*p == '/' || *p == '\\') base = p + 1;
+        }
+        int n = snprintf(job->key, sizeof(job->key), "%s%s", COS_DEFAULT_PREFIX, base);
+        if (n < 0 || (size_t)n >= sizeof(job->key)) {
+            daemon_reply_error(d, client, id, "key过长");
+            return;
+        }
+    }
+    
+    // 清掉上一次升级留下的阶段，进度从本次的第一个上报开始推送
+    if (kind == DAEMON_OP_FOTA || kind == DAEMON_OP_FOTA_FILE) modem_fota_reset(&d->modems[first]);
+    if (!thread_create(&job->thread, daemon_job_thread, job)) {
+        daemon_reply_error(d, client, id, "线程创建失败");
+        return;
+    }
+    job->active = true;
+    for (int i = first; i < first + count; i++) d->busy[i] = job;
+    daemon_job_send(d, job, "accepted", "");
 }
 
-bool modem_check_network_status(EC800KModem* modem, char* net_reg, size_t size) {
-    char response[BUFFER_SIZE];
-    net_reg[0] = '\0';
+// 推送FOTA进度，回收已结束的任务；空闲模组的监听线程在FOTA结束时被停止，这里恢复
+void daemon_poll_jobs(Daemon* d) {
+    char fields[640];
     
-    printf("\n网络状态:\n");
-    
-    // 网络注册
-    if (modem_send_at_command(modem, "AT+CREG?", response, sizeof(response), AT_TIMEOUT_MS)) {
-        // 解析 +CREG: x,y
-        char* p = strstr(response, "+CREG:");
-        if (p) {
-            int n, stat;
-            if (sscanf(p, "+CREG: %d,%d", &n, &stat) >= 2) {
-                const char* status_str;
-                switch (stat) {
-                    case 0: status_str = "未注册"; break;
-                    case 1: status_str = "已注册(本地)"; break;
-                    case 2: status_str = "搜索中..."; break;
-                    case 3: status_str = "注册被拒绝"; break;
-                    case 5: status_str = "已注册(漫游)"; break;
-                    default: status_str = "未知"; break;
-                }
-                strncpy(net_reg, status_str, size - 1);
-                printf("  network_reg: %s\n", status_str);
+    for (int i = 0; i < d->count; i++) {
+        DaemonJob* job = &d->jobs[i];
+        if (!job->active) continue;
+        
+        if (job->op == DAEMON_OP_FOTA || job->op == DAEMON_OP_FOTA_FILE) {
+            EC800KModem* modem = &d->modems[job->first];
+            mutex_lock(&modem->state_lock);
+            FotaStage stage = modem->fota_stage;
+            int progress = modem->fota_progress;
+            mutex_unlock(&modem->state_lock);
+            if (stage != FOTA_STAGE_IDLE && (stage != job->stage || progress != job->progress)) {
+                job->stage = stage;
+                job->progress = progress;
+                snprintf(fields, sizeof(fields), "\"stage\":\"%s\",\"progress\":%d", fota_stage_name(stage), progress);
+                daemon_job_send(d, job, "progress", fields);
             }
         }
+        if (!job->done) continue;
+        
+        thread_join(job->thread);
+        job->active = false;
+        snprintf(fields, sizeof(fields), "\"ok\":%s%s%s", job->ok ? "true" : "false", job->result[0] ? "," : "",
+                 job->result);
+        daemon_job_send(d, job, "done", fields);
+        for (int k = job->first; k < job->first + job->count; k++) d->busy[k] = NULL;
     }
     
-    // 信号强度
-    if (modem_send_at_command(modem, "AT+CSQ", response, sizeof(response), AT_TIMEOUT_MS)) {
-        char* p = strstr(response, "+CSQ:");
-        if (p) {
-            int rssi, ber;
-            if (sscanf(p, "+CSQ: %d,%d", &rssi, &ber) >= 1) {
-                if (rssi == 99) {
-                    printf("  signal: 未知或不可检测\n");
-                } else {
-                    int dbm = -113 + 2 * rssi;
-                    printf("  signal: RSSI=%d (%ddBm)\n", rssi, dbm);
-                }
+    for (int i = 0; i < d->count; i++) {
+        EC800KModem* modem = &d->modems[i];
+        if (d->busy[i] == NULL && !modem->monitor_running) {
+            modem_link_check(modem);
+            if (!modem->link_down) modem_monitor_start(modem);
+        }
+        bool up = !modem->link_down;
+        if (up != d->link_up[i]) {
+            d->link_up[i] = up;
+            for (int c = 0; c < DAEMON_MAX_CLIENTS; c++) {
+                daemon_send(d, c, "{\"event\":\"link\",\"port\":\"%s\",\"up\":%s}", modem_name(modem),
+                            up ? "true" : "false");
             }
         }
     }
-    
-    return (strcmp(net_reg, "已注册(本地)") == 0 || strcmp(net_reg, "已注册(漫游)") == 0);
 }
 
-bool modem_fota_upgrade(EC800KModem* modem, const char* url, int auto_reset, int timeout) {
-    char response[BUFFER_SIZE];
-    char version[256];
-    char net_reg[64];
-    
-    if (strlen(url) > 700) {
-        log_msg("❌ URL长度超过700字符限制");
-        return false;
+// 读取客户端数据，按行处理请求，超长的行丢弃
+void daemon_read_client(Daemon* d, int client) {
+    DaemonClient* c = &d->clients[client];
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+    if (n <= 0) {
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        daemon_drop_client(d, client);
+        return;
     }
+    c->len += (size_t)n;
+    c->buf[c->len] = '\0';
     
-    modem->fota_complete = false;
-    modem->fota_result = -1;
-    
-    printf("\n==================================================\n");
-    log_msg("🔄 开始FOTA升级");
-    printf("==================================================\n");
-    
-    // 1. 查询当前版本
-    log_msg("\n[步骤1] 查询当前固件版本...");
-    modem_get_firmware_version(modem, version, sizeof(version));
-    if (strlen(version) > 0) {
-        log_msg("📌 当前版本: %s", version);
+    char* line = c->buf;
+    char* nl;
+    while (c->fd >= 0 && (nl = strchr(line, '\n')) != NULL) {
+        *nl = '\0';
+        if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+        if (*line != '\0') daemon_handle_request(d, client, line);
+        line = nl + 1;
     }
-    
-    // 2. 检查网络状态
-    log_msg("\n[步骤2] 检查网络状态...");
-    if (!modem_check_network_status(modem, net_reg, sizeof(net_reg))) {
-        log_msg("❌ 网络未注册: %s", net_reg);
-        return false;
+    if (c->fd < 0) return;
+    c->len -= (size_t)(line - c->buf);
+    memmove(c->buf, line, c->len);
+    if (c->len >= sizeof(c->buf) - 1) {
+        daemon_reply_error(d, client, "null", "请求过长");
+        c->len = 0;
     }
-    log_msg("✅ 网络已连接: %s", net_reg);
-    
-    // 3. 发送FOTA升级指令
-    log_msg("\n[步骤3] 发送FOTA升级指令...");
-    log_msg("📎 URL: %s", url);
-    log_msg("📎 升级模式: %s", auto_reset == 1 ? "自动重启" : "手动重启");
-    log_msg("📎 超时时间: %d秒", timeout);
+}
+
+int daemon_listen(const char* path) {
+    struct sockaddr_un addr;
     
-    // AT+QFOTADL="URL",升级模式,超时时间
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd), "AT+QFOTADL=\"%s\",%d,%d", url, auto_reset, timeout);
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_msg("❌ 套接字路径过长: %s", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, DAEMON_MAX_CLIENTS) != 0) {
+        log_msg("❌ 无法监听%s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    chmod(path, 0660);
+    return fd;
+}
+
+// 连接全部模组并进入请求循环，SIGINT/SIGTERM或shutdown请求后等待进行中的任务结束再退出
+int run_daemon(const char* ports_arg, const char* socket_path, const ToolOptions* opts) {
+    static char ports[MAX_SERIAL_PORTS][64];
+    static Daemon d;
     
-    if (!modem_send_at_command(modem, cmd, response, sizeof(response), 5000)) {
-        log_msg("❌ 指令发送失败: %s", response);
-        return false;
+    int count = parse_port_list(ports_arg, ports, MAX_SERIAL_PORTS);
+    d.modems = count > 0 ? (EC800KModem*)calloc((size_t)count, sizeof(EC800KModem)) : NULL;
+    if (d.modems == NULL) {
+        log_msg(count == 0 ? "❌ 没有可用的串口" : "❌ 内存不足");
+        return 1;
+    }
+    d.opts = opts;
+    for (int i = 0; i < count; i++) {
+        EC800KModem* modem = &d.modems[d.count];
+        modem_init(modem, ports[i], opts->baud_rate);
+        modem_apply_options(modem, opts);
+        modem->log_tag = count > 1;
+        if (!modem_connect(modem)) {
+            modem_destroy(modem);
+            continue;
+        }
+        modem_monitor_start(modem);
+        d.link_up[d.count++] = true;
     }
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) d.clients[i].fd = -1;
+    d.listen_fd = d.count > 0 ? daemon_listen(socket_path) : -1;
     
-    log_msg("✅ 指令发送成功，模组开始下载固件包...");
-    log_msg("\n[步骤4] 等待升级进度上报...");
-    log_msg("(请通过串口监视器观察 +QIND: \"FOTA\",\"UPDATING\",进度 上报)");
+    if (d.listen_fd >= 0) {
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, daemon_on_signal);
+        signal(SIGTERM, daemon_on_signal);
+        log_msg("🛰️ 守护进程已就绪: %s (%d个模组)", socket_path, d.count);
+    }
     
-    return true;
-}
-
-// ================== 工具函数 ==================
-
-void list_serial_ports(void) {
-    printf("\n📋 可用串口列表:\n");
-    printf("--------------------------------------------------\n");
-
-#ifdef _WIN32
-    printf("  Windows平台请使用设备管理器查看COM端口\n");
-    printf("  常见格式: COM1, COM2, COM3...\n");
-#elif defined(__APPLE__)
-    DIR* dir = opendir("/dev");
-    if (dir) {
-        struct dirent* entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strstr(entry->d_name, "tty.usb") || strstr(entry->d_name, "cu.usb")) {
-                printf("  /dev/%s\n", entry->d_name);
+    while (d.listen_fd >= 0) {
+        if (g_daemon_stop) d.stopping = true;
+        if (d.stopping) {
+            bool idle = true;
+            for (int i = 0; i < d.count; i++) idle = idle && d.busy[i] == NULL;
+            if (idle) break;
+        }
+        
+        struct pollfd pfds[1 + DAEMON_MAX_CLIENTS];
+        pfds[0].fd = d.stopping ? -1 : d.listen_fd;
+        pfds[0].events = POLLIN;
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+            pfds[1 + i].fd = d.clients[i].fd;
+            pfds[1 + i].events = (short)(POLLIN | (d.clients[i].out_len > 0 ? POLLOUT : 0));
+        }
+        int ret = poll(pfds, 1 + DAEMON_MAX_CLIENTS, DAEMON_POLL_MS);
+        if (ret > 0 && (pfds[0].revents & POLLIN)) {
+            int fd = accept(d.listen_fd, NULL, NULL);
+            int slot = -1;
+            for (int i = 0; i < DAEMON_MAX_CLIENTS && slot < 0; i++) {
+                if (d.clients[i].fd < 0) slot = i;
+            }
+            if (fd >= 0 && slot < 0) {
+                close(fd);
+            } else if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                d.clients[slot].fd = fd;
+                d.clients[slot].gen++;
+                d.clients[slot].len = 0;
+                d.clients[slot].out_len = 0;
             }
         }
-        closedir(dir);
-    }
-#else
-    DIR* dir = opendir("/dev");
-    if (dir) {
-        struct dirent* entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strstr(entry->d_name, "ttyUSB") || strstr(entry->d_name, "ttyACM")) {
-                printf("  /dev/%s\n", entry->d_name);
+        for (int i = 0; ret > 0 && i < DAEMON_MAX_CLIENTS; i++) {
+            if (pfds[1 + i].fd >= 0 && d.clients[i].fd == pfds[1 + i].fd && (pfds[1 + i].revents & POLLOUT)) {
+                daemon_flush_client(&d, i);
+            }
+            if (pfds[1 + i].fd >= 0 && d.clients[i].fd == pfds[1 + i].fd &&
+                (pfds[1 + i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))) {
+                daemon_read_client(&d, i);
             }
         }
-        closedir(dir);
+        daemon_poll_jobs(&d);
     }
-#endif
-    printf("\n");
-}
-
-void run_basic_test(EC800KModem* modem) {
-    printf("\n==================================================\n");
-    printf("📡 EC800K/EG800K 基本测试\n");
-    printf("==================================================\n");
     
-    printf("\n[1/3] AT通信测试...\n");
-    if (modem_test_at(modem)) {
-        printf("✅ AT通信正常\n");
-    } else {
-        printf("❌ AT通信失败\n");
-        return;
+    if (d.listen_fd >= 0) {
+        log_msg("🛑 守护进程退出");
+        close(d.listen_fd);
+        unlink(socket_path);
     }
-    
-    printf("\n[2/3] 获取模块信息...\n");
-    modem_get_module_info(modem);
-    
-    printf("\n[3/3] 检查网络状态...\n");
-    char net_reg[64];
-    modem_check_network_status(modem, net_reg, sizeof(net_reg));
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (d.clients[i].fd >= 0) close(d.clients[i].fd);
+    }
+    for (int i = 0; i < d.count; i++) {
+        modem_state_cache_flush(&d.modems[i]);
+        modem_disconnect(&d.modems[i]);
+        modem_destroy(&d.modems[i]);
+    }
+    free(d.modems);
+    if (d.count == 0) log_printf("\n💡 提示: 请检查串口连接和权限\n");
+    return d.count > 0 && d.listen_fd >= 0 ? 0 : 1;
+}
+#else
+int run_daemon(const char* ports_arg, const char* socket_path, const ToolOptions* opts) {
+    (void)ports_arg;
+    (void)socket_path;
+    (void)opts;
+    log_msg("❌ daemon仅支持Linux/macOS");
+    return 1;
 }
+#endif
 
-void print_error_codes(void) {
-    printf("\n==================================================\n");
-    printf("📖 FOTA 错误码说明\n");
-    printf("==================================================\n");
-    
-    printf("\n【FOTA升级错误码】(+QIND: \"FOTA\",\"END\",<err>)\n");
-    printf("  0:   升级成功\n");
-    printf("  504: 升级失败\n");
-    printf("  505: 包校验出错\n");
-    printf("  506: 固件MD5检查错误\n");
-    printf("  507: 包版本不匹配\n");
-    printf("  552: 包项目名不匹配\n");
-    printf("  553: 包基线名不匹配\n");
-    
-    printf("\n【+QIND URC上报说明】\n");
-    printf("  +QIND: \"FOTA\",\"HTTPSTART\"     - 开始HTTP下载\n");
-    printf("  +QIND: \"FOTA\",\"HTTPEND\",<err> - HTTP下载结束\n");
-    printf("  +QIND: \"FOTA\",\"UPDATING\",<%%>  - 升级进度(7%%-96%%)\n");
-    printf("  +QIND: \"FOTA\",\"END\",<err>     - 升级结束(0=成功)\n");
+// ================== 主函数 ==================
+
+// 命令行选项默认值
+void tool_options_init(ToolOptions* opts) {
+    opts->baud_rate = DEFAULT_BAUDRATE;
+    opts->hw_flow = false;
+    opts->md5 = NULL;
+    opts->stats = STATS_OFF;
+    opts->serve = NULL;
+    opts->cache_dir = CACHE_DEFAULT_DIR;
+    opts->net_wait_s = NET_READY_TIMEOUT_MS / 1000;
+    opts->apn = NULL;
+    opts->list_parts = false;
+    opts->state_cache = false;
+    opts->force = false;
+    opts->max_downloads = FLEET_DEFAULT_DOWNLOADS;
+    opts->cmux = false;
+    opts->telemetry = NULL;
+    opts->sample_interval_s = TELEMETRY_DEFAULT_INTERVAL_S;
+    opts->capture = NULL;
+    opts->ca_cert = NULL;
+    opts->insecure = false;
 }
 
-void print_usage(const char* prog_name) {
-    printf("\n使用方法:\n");
-    printf("  %s <串口> [命令] [参数...]\n", prog_name);
-    printf("\n命令:\n");
-    printf("  test                   - 基本测试（默认）\n");
-    printf("  info                   - 显示错误码说明\n");
-    printf("  version                - 仅查询固件版本\n");
-    printf("  fota URL [mode] [timeout]\n");
-    printf("                         - FOTA升级\n");
-    printf("                           mode: 0=手动重启, 1=自动重启\n");
-    printf("\n示例:\n");
+// 解析并移除"--"开头的选项，其余位置参数保持原有顺序
+bool parse_options(int* argc, char* argv[], ToolOptions* opts) {
+    int out = 1;
+    
+    tool_options_init(opts);
+    for (int i = 1; i < *argc; i++) {
+        if (strcmp(argv[i], "--baud") == 0 && i + 1 < *argc) {
+            opts->baud_rate = atoi(argv[++i]);
+            if (opts->baud_rate <= 0) {
+                log_printf("❌ 无效波特率: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--rtscts") == 0) {
+            opts->hw_flow = true;
+        } else if (strcmp(argv[i], "--md5") == 0 && i + 1 < *argc) {
+            opts->md5 = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < *argc) {
+            i++;
+            if (strcmp(argv[i], "json") == 0) {
+                opts->stats = STATS_JSON;
+            } else if (strcmp(argv[i], "table") == 0) {
+                opts->stats = STATS_TABLE;
+            } else {
+                log_printf("❌ 无效统计格式: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < *argc) {
+            opts->serve = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < *argc) {
+            opts->cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--net-wait") == 0 && i + 1 < *argc) {
+            opts->net_wait_s = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--apn") == 0 && i + 1 < *argc) {
+            opts->apn = argv[++i];
+        } else if (strcmp(argv[i], "--list-parts") == 0) {
+            opts->list_parts = true;
+        } else if (strcmp(argv[i], "--state-cache") == 0) {
+            opts->state_cache = true;
+        } else if (strcmp(argv[i], "--force") == 0) {
+            opts->force = true;
+        } else if (strcmp(argv[i], "--max-downloads") == 0 && i + 1 < *argc) {
+            opts->max_downloads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cmux") == 0) {
 #ifdef _WIN32
-    printf("  %s COM3 test\n", prog_name);
-    printf("  %s COM3 fota \"http://server/fota.bin\" 0 50\n", prog_name);
+            log_printf("❌ --cmux仅支持Linux/macOS\n");
+            return false;
 #else
-    printf("  %s /dev/ttyUSB0 test\n", prog_name);
-    printf("  %s /dev/ttyUSB0 fota \"http://server/fota.bin\" 0 50\n", prog_name);
+            opts->cmux = true;
 #endif
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < *argc) {
+            opts->telemetry = argv[++i];
+        } else if (strcmp(argv[i], "--sample-interval") == 0 && i + 1 < *argc) {
+            opts->sample_interval_s = atoi(argv[++i]);
+            if (opts->sample_interval_s <= 0) {
+                log_printf("❌ 无效采样周期: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < *argc) {
+            opts->capture = argv[++i];
+        } else if (strcmp(argv[i], "--cacert") == 0 && i + 1 < *argc) {
+            opts->ca_cert = argv[++i];
+        } else if (strcmp(argv[i], "--insecure") == 0) {
+            opts->insecure = true;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            log_printf("❌ 未知选项: %s\n", argv[i]);
+            return false;
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    *argc = out;
+    return true;
 }
 
-// ================== 主函数 ==================
-
+// 基准测试等程序直接包含本文件时定义EC800K_NO_MAIN
+#ifndef EC800K_NO_MAIN
 int main(int argc, char* argv[]) {
-    printf("==================================================\n");
-    printf("🚀 EC800K/EG800K FOTA 测试工具 (C)\n");
-    printf("   基于 Quectel DFOTA升级指导 V1.4\n");
-    printf("==================================================\n");
+    log_init();
+    log_printf("==================================================\n");
+    log_printf("🚀 EC800K/EG800K FOTA 测试工具 (C)\n");
+    log_printf("   基于 Quectel DFOTA升级指导 V1.4\n");
+    log_printf("==================================================\n");
+    
+    ToolOptions opts;
+    if (!parse_options(&argc, argv, &opts)) {
+        print_usage(argv[0]);
+        return 1;
+    }
     
+    stats_init((StatsMode)opts.stats);
+    at_policy_init();
+    device_cache_init();
+    if (opts.state_cache) at_policy_load();
     list_serial_ports();
     
     if (argc < 2) {
@@ -560,11 +9267,122 @@ int main(int argc, char* argv[]) {
         return 0;
     }
     
+    if (strcmp(command, "footprint") == 0) {
+        print_footprint();
+        return 0;
+    }
+    
+    if (strcmp(command, "discover") == 0) {
+        return run_discover(port);
+    }
+    
+    if (strcmp(command, "telemetry") == 0) {
+        int rc = run_telemetry(port, argc > 3 ? atoi(argv[3]) : TELEMETRY_DEFAULT_RUN_S, &opts);
+        if (opts.state_cache) at_policy_save();
+        return rc;
+    }
+    
+    if (strcmp(command, "replay") == 0) {
+        if (argc < 4) {
+            log_printf("❌ 请提供收发记录文件\n");
+            log_printf("   用法: %s <通道|all> replay <TRACE> [rounds]\n", argv[0]);
+            return 1;
+        }
+        return run_replay(port, argv[3], argc > 4 ? atoi(argv[4]) : TRACE_DEFAULT_ROUNDS);
+    }
+    
+    if (opts.telemetry != NULL && !telemetry_open(opts.telemetry, opts.sample_interval_s)) {
+        return 1;
+    }
+    if (opts.capture != NULL && !trace_open(opts.capture)) {
+        telemetry_close();
+        return 1;
+    }
+    
+    if (strcmp(command, "daemon") == 0) {
+        int rc = run_daemon(port, argc > 3 ? argv[3] : DAEMON_DEFAULT_SOCKET, &opts);
+        telemetry_close();
+        trace_close();
+        if (opts.state_cache) at_policy_save();
+        stats_print_summary();
+        return rc;
+    }
+    
+    if (strcmp(command, "fleet") == 0) {
+        if (argc < 4) {
+            log_printf("❌ 请提供FOTA包URL\n");
+            log_printf("   用法: %s <串口列表|auto> fleet <URL[,URL...]> [mode] [timeout] [workers]\n", argv[0]);
+            return 1;
+        }
+        int auto_reset = argc > 4 ? atoi(argv[4]) : 0;
+        int timeout = argc > 5 ? atoi(argv[5]) : 50;
+        int workers = argc > 6 ? atoi(argv[6]) : FLEET_DEFAULT_WORKERS;
+        // 逗号分隔的多个差分包（各方向/各源版本）共用一个本地分发服务
+        FotaServer server = {0};
+        FotaPackageSet packages;
+        packages.count = 0;
+        const char* p = argv[3];
+        while (*p) {
+            char url[512];
+            char local_url[512];
+            size_t len = strcspn(p, ",");
+            if (len > 0 && len < sizeof(url)) {
+                memcpy(url, p, len);
+                url[len] = '\0';
+                fota_package_set_add(&packages, fota_resolve_url(&server, url, &opts, local_url, sizeof(local_url)));
+            }
+            p += len;
+            if (*p == ',') p++;
+        }
+        if (packages.count == 0) {
+            log_printf("❌ 请提供FOTA包URL\n");
+            fota_server_stop(&server);
+            return 1;
+        }
+        int failures = run_fleet(port, &packages, auto_reset, timeout, workers, &opts);
+        fota_server_stop(&server);
+        telemetry_close();
+        trace_close();
+        if (opts.state_cache) at_policy_save();
+        stats_print_summary();
+        log_printf("\n✨ 完成\n");
+        return failures == 0 ? 0 : 1;
+    }
+    
+    if (strcmp(command, "upload") == 0) {
+        if (argc < 4) {
+            log_printf("❌ 请提供上传文件路径\n");
+            log_printf("   用法: %s <串口列表> upload <FILE> [key] [chunk_kb]\n", argv[0]);
+            return 1;
+        }
+        char object_key[256];
+        const char* base = argv[3];
+        for (const char* p = argv[3]; *p != '\0'; p++) {
+            if (*p == '/' || *p == '\\') base = p + 1;
+        }
+        int key_len = argc > 4 ? snprintf(object_key, sizeof(object_key), "%s", argv[4])
+                               : snprintf(object_key, sizeof(object_key), "%s%s", COS_DEFAULT_PREFIX, base);
+        if (key_len < 0 || (size_t)key_len >= sizeof(object_key)) {
+            log_printf("❌ 对象键过长（不超过%zu字节）\n", sizeof(object_key) - 1);
+            return 1;
+        }
+        // 指定chunk_kb时使用固定分片，否则按信号与吞吐自适应
+        size_t chunk_size = argc > 5 && atoi(argv[5]) > 0 ? (size_t)atoi(argv[5]) * 1024 : 0;
+        bool ok = run_upload(port, argv[3], object_key, chunk_size, &opts);
+        telemetry_close();
+        trace_close();
+        if (opts.state_cache) at_policy_save();
+        stats_print_summary();
+        log_printf("\n✨ 完成\n");
+        return ok ? 0 : 1;
+    }
+    
     EC800KModem modem;
-    modem_init(&modem, port, DEFAULT_BAUDRATE);
+    modem_init(&modem, port, opts.baud_rate);
+    modem_apply_options(&modem, &opts);
     
     if (!modem_connect(&modem)) {
-        printf("\n💡 提示: 请检查串口连接和权限\n");
+        log_printf("\n💡 提示: 请检查串口连接和权限\n");
         return 1;
     }
     
@@ -574,26 +9392,59 @@ int main(int argc, char* argv[]) {
         char version[256];
         modem_get_firmware_version(&modem, version, sizeof(version));
         if (strlen(version) > 0) {
-            printf("\n📌 固件版本: %s\n", version);
+            log_printf("\n📌 固件版本: %s\n", version);
         } else {
-            printf("\n❌ 无法获取版本\n");
+            log_printf("\n❌ 无法获取版本\n");
         }
     } else if (strcmp(command, "fota") == 0) {
         if (argc < 4) {
-            printf("❌ 请提供FOTA包URL\n");
-            printf("   用法: %s <串口> fota <URL> [mode] [timeout]\n", argv[0]);
+            log_printf("❌ 请提供FOTA包URL\n");
+            log_printf("   用法: %s <串口> fota <URL> [mode] [timeout]\n", argv[0]);
         } else {
-            const char* url = argv[3];
+            FotaServer server = {0};
+            char local_url[512];
+            const char* url = fota_resolve_url(&server, argv[3], &opts, local_url, sizeof(local_url));
             int auto_reset = argc > 4 ? atoi(argv[4]) : 0;
             int timeout = argc > 5 ? atoi(argv[5]) : 50;
             modem_fota_upgrade(&modem, url, auto_reset, timeout);
+            fota_server_stop(&server);
+        }
+    } else if (strcmp(command, "fota-file") == 0) {
+        if (argc < 4) {
+            log_printf("❌ 请提供差分包文件路径\n");
+            log_printf("   用法: %s <串口> fota-file <PATH> [mode] [urc_max]\n", argv[0]);
+        } else {
+            int auto_reset = argc > 4 ? atoi(argv[4]) : 0;
+            int urc_max = argc > 5 ? atoi(argv[5]) : 50;
+            modem_fota_upgrade_file(&modem, argv[3], auto_reset, urc_max, opts.md5);
+        }
+    } else if (strcmp(command, "fetch") == 0) {
+        if (argc < 5) {
+            log_printf("❌ 请提供URL与输出文件\n");
+            log_printf("   用法: %s <串口> fetch <URL> <OUT>\n", argv[0]);
+        } else {
+            modem_http_fetch(&modem, argv[3], argv[4]);
+        }
+    } else if (strcmp(command, "ufs-get") == 0) {
+        if (argc < 5) {
+            log_printf("❌ 请提供模组文件名与输出文件\n");
+            log_printf("   用法: %s <串口> ufs-get <NAME> <OUT>\n", argv[0]);
+        } else {
+            modem_ufs_download(&modem, argv[3], argv[4]);
         }
     } else {
-        printf("❌ 未知命令: %s\n", command);
+        log_printf("❌ 未知命令: %s\n", command);
     }
     
+    modem_state_cache_flush(&modem);
     modem_disconnect(&modem);
-    printf("\n✨ 完成\n");
+    modem_destroy(&modem);
+    telemetry_close();
+    trace_close();
+    if (opts.state_cache) at_policy_save();
+    stats_print_summary();
+    log_printf("\n✨ 完成\n");
     
     return 0;
 }
+#endif